@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# Runs the stages of compile.sh in a compile server, with warm CC1PSX
+# processes and a persistent wineserver; then set
+# compile_server = "/tmp/mgs_permut.sock" in settings.toml. The context of
+# the candidates (everything before the function) is only preprocessed once.
+# Build it first: g++ tools/CompileServer.cpp -pthread -otools/CompileServer.elf -O2
+
+# config
+# --------------------------
+
+G=8
+# G=0
+
+PSYQ=4.4
+# PSYQ=4.3
+
+SOCKET=/tmp/mgs_permut.sock
+
+# --------------------------
+
+if [ -z "$PSYQ_SDK" ]; then
+    echo "PSYQ_SDK not set"
+    exit 1
+fi
+
+CPPPSX="cpp -nostdinc -undef -D__GNUC__=2 -D__OPTIMIZE__ -lang-c -Dmips  \
+    -D__mips__ -D__mips -Dpsx -D__psx__ -D__psx -D_PSYQ -D__EXTENSIONS__ \
+    -D_MIPSEL -D__CHAR_UNSIGNED__ -D_LANGUAGE_C -DLANGUAGE_C {in}"
+CC1PSX="wine ${PSYQ_SDK}/psyq_${PSYQ}/bin/CC1PSX.EXE -quiet -O2 -G${G} -g0 -o {out}"
+ASPSX="wibo ${PSYQ_SDK}/psyq_${PSYQ}/bin/aspsx.exe -q -G${G} -g0 {in} -o {out}"
+
+exec "$(dirname "$0")/../tools/CompileServer.elf" --socket "$SOCKET" --wineserver \
+    --cache-context --stage "$CPPPSX" --stage "$CC1PSX" --stage "$ASPSX" "$@"
@@ -1,10 +1,22 @@
 from base64 import b64decode
 from collections import defaultdict
 import copy
-from dataclasses import dataclass
+from dataclasses import dataclass, field
 from random import Random
 import re
-from typing import Any, Callable, Dict, List, Optional, Set, Tuple, TYPE_CHECKING, Union
+import typing
+from typing import (
+    Any,
+    Callable,
+    Dict,
+    List,
+    Optional,
+    Set,
+    Tuple,
+    TYPE_CHECKING,
+    TypeVar,
+    Union,
+)
 
 from pycparser import CParser, c_ast as ca, c_generator
 from pycparser.plyparser import ParseError
@@ -15,8 +27,17 @@ from .ast_types import SimpleType, set_decl_name
 
 @dataclass
 class Indices:
+    """Pre-order indices of the nodes of a function at the start of a
+    randomization step. Those nodes may be shared with the original function
+    and other candidates, so they are never mutated: own() copies them, and
+    the copies are recorded here."""
+
     starts: Dict[ca.Node, int]
     ends: Dict[ca.Node, int]
+    copies: Dict[ca.Node, ca.Node] = field(default_factory=dict)
+
+
+N = TypeVar("N", bound=ca.Node)
 
 
 Block = Union[ca.Compound, ca.Case, ca.Default]
@@ -34,18 +55,37 @@ def to_c_raw(node: ca.Node) -> str:
     return source
 
 
-def to_c(node: ca.Node, *, from_import: bool = False) -> str:
+def to_c(
+    node: ca.Node,
+    *,
+    from_import: bool = False,
+    cache: Optional["SourceCache"] = None,
+) -> str:
+    if cache is not None and isinstance(node, ca.FileAST):
+        return cache.to_c(node)
     source = to_c_raw(node) if from_import else PatchedCGenerator().visit(node)
     return process_pragmas(source)
 
 
+# Nesting of sameline and latedefine pragmas, and whether the last output line
+# is to be continued
+PragmaState = Tuple[int, int, bool]
+
+
 def process_pragmas(source: str) -> str:
     if "#pragma" not in source:
         return source
-    lines = source.split("\n")
     out: List[str] = []
-    same_line = 0
-    ignore = 0
+    same_line, ignore, _ = process_pragma_lines(source.split("\n"), (0, 0, False), out)
+    assert same_line == 0
+    assert ignore == 0, "unbalanced ignore pragmas"
+    return "".join(out).rstrip() + "\n"
+
+
+def process_pragma_lines(
+    lines: List[str], state: PragmaState, out: List[str]
+) -> PragmaState:
+    same_line, ignore, joined = state
     for line in lines:
         stripped = line.strip()
         if stripped.startswith("#pragma _permuter "):
@@ -75,12 +115,11 @@ def process_pragmas(source: str) -> str:
 
         if not same_line:
             line += "\n"
-        elif line and out and not out[-1].endswith("\n"):
+        elif line and joined:
             line = " " + line.lstrip()
         out.append(line)
-    assert same_line == 0
-    assert ignore == 0, "unbalanced ignore pragmas"
-    return "".join(out).rstrip() + "\n"
+        joined = not line.endswith("\n")
+    return same_line, ignore, joined
 
 
 class PatchedCGenerator(c_generator.CGenerator):
@@ -100,6 +139,91 @@ class PatchedCGenerator(c_generator.CGenerator):
         return super().visit_If(n2)  # type: ignore
 
 
+class SourceCache:
+    """The generated C of the nodes of an AST shared between candidates, which
+    (as for all shared nodes) must never be mutated in place: the text of each
+    statement at a given indentation, and of each top-level node along with
+    its text after process_pragmas, given the pragma state before it. to_c
+    with the cache then only generates the nodes that aren't shared, and the
+    output is the same as without it."""
+
+    def __init__(self, ast: ca.FileAST) -> None:
+        # Ids of the shared nodes, which stay alive with the AST
+        self.shared: Set[int] = set()
+        self.stmts: Dict[Tuple[int, int, bool], str] = {}
+        self.exts: Dict[int, Tuple[str, bool]] = {}
+        self.processed: Dict[Tuple[int, PragmaState], Tuple[str, PragmaState]] = {}
+        shared = self.shared
+
+        class Visitor(ca.NodeVisitor):
+            def generic_visit(self, node: ca.Node) -> None:
+                shared.add(id(node))
+                super().generic_visit(node)
+
+        Visitor().visit(ast)
+
+    def _ext_text(self, gen: "CachingCGenerator", ext: ca.Node) -> Tuple[str, bool]:
+        """The text of a top-level node as visit_FileAST makes it, and whether
+        it contains pragmas."""
+        ret = self.exts.get(id(ext))
+        if ret is not None:
+            return ret
+        if isinstance(ext, ca.FuncDef):
+            text = gen.visit(ext)
+        elif isinstance(ext, ca.Pragma):
+            text = gen.visit(ext) + "\n"
+        else:
+            text = gen.visit(ext) + ";\n"
+        ret = (text, "#pragma" in text)
+        if id(ext) in self.shared:
+            self.exts[id(ext)] = ret
+        return ret
+
+    def to_c(self, ast: ca.FileAST) -> str:
+        gen = CachingCGenerator(self)
+        texts = [self._ext_text(gen, ext) for ext in ast.ext]
+        if not any(has_pragma for _, has_pragma in texts):
+            return "".join(text for text, _ in texts)
+
+        # Each text ends with a newline, so process_pragmas would see the
+        # lines of each in turn, and then an empty one that rstrip drops
+        state: PragmaState = (0, 0, False)
+        out: List[str] = []
+        for ext, (text, _) in zip(ast.ext, texts):
+            key = (id(ext), state)
+            cached = self.processed.get(key)
+            if cached is None:
+                ext_out: List[str] = []
+                end_state = process_pragma_lines(text[:-1].split("\n"), state, ext_out)
+                cached = ("".join(ext_out), end_state)
+                if id(ext) in self.shared:
+                    self.processed[key] = cached
+            out.append(cached[0])
+            state = cached[1]
+        assert state[0] == 0
+        assert state[1] == 0, "unbalanced ignore pragmas"
+        return "".join(out).rstrip() + "\n"
+
+
+class CachingCGenerator(PatchedCGenerator):
+    """A PatchedCGenerator that takes the text of shared statements from a
+    SourceCache, or adds it there."""
+
+    def __init__(self, cache: SourceCache) -> None:
+        super().__init__()
+        self.cache = cache
+
+    def _generate_stmt(self, n: ca.Node, add_indent: bool = False) -> str:
+        if id(n) not in self.cache.shared:
+            return super()._generate_stmt(n, add_indent)
+        key = (id(n), self.indent_level, add_indent)
+        text = self.cache.stmts.get(key)
+        if text is None:
+            text = super()._generate_stmt(n, add_indent)
+            self.cache.stmts[key] = text
+        return text
+
+
 def extract_fn(ast: ca.FileAST, fn_name: str) -> Tuple[ca.FuncDef, int]:
     ret = []
     for i, node in enumerate(ast.ext):
@@ -307,6 +431,68 @@ def insert_decl(
     fn.body.block_items[index:index] = [decl]
 
 
+def clone_node(node: N) -> N:
+    """A shallow copy of a node, with copies of its lists."""
+    new = copy.copy(node)
+    for name in node.__slots__[:-2]:  # type: ignore
+        value = getattr(node, name)
+        if isinstance(value, list):
+            setattr(new, name, list(value))
+    return new
+
+
+def replace_child(parent: ca.Node, old: ca.Node, new: ca.Node) -> None:
+    for name in parent.__slots__[:-2]:  # type: ignore
+        value = getattr(parent, name)
+        if value is old:
+            setattr(parent, name, new)
+            return
+        if isinstance(value, list):
+            for i, item in enumerate(value):
+                if item is old:
+                    value[i] = new
+                    return
+    assert False, "child not found"
+
+
+def own(fn: ca.FuncDef, indices: Indices, node: N) -> N:
+    """Get a version of a node within the function that may be mutated in
+    place. Nodes from the start of the randomization step are replaced by
+    copies, along with the path to them from the function (the function
+    itself belongs to the candidate), while nodes made during the step are
+    returned as they are."""
+    if node is fn or node not in indices.starts:
+        return node
+    copied = indices.copies.get(node)
+    if copied is not None:
+        return typing.cast(N, copied)
+
+    parents: Dict[ca.Node, ca.Node] = {}
+    stack: List[ca.Node] = [fn]
+    while stack:
+        cur = stack.pop()
+        if cur is node:
+            break
+        for _, child in typing.cast(Any, cur.children()):
+            parents[child] = cur
+            stack.append(child)
+    else:
+        assert False, "node not in function"
+
+    path: List[ca.Node] = [node]
+    while path[-1] is not fn:
+        path.append(parents[path[-1]])
+    parent: ca.Node = fn
+    for cur in reversed(path[:-1]):
+        if cur in indices.starts:
+            new = clone_node(cur)
+            indices.copies[cur] = new
+            replace_child(parent, cur, new)
+            cur = new
+        parent = cur
+    return typing.cast(N, parent)
+
+
 def insert_statement(block: Block, index: int, stmt: Statement) -> None:
     stmts = get_block_stmts(block, True)
     stmts[index:index] = [stmt]
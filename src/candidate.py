@@ -5,12 +5,12 @@ from typing import Mapping, Optional, Tuple
 
 from pycparser import c_ast as ca
 
-from .compiler import Compiler
+from .compiler import Compiler, SourceContext
 from .randomizer import Randomizer
 from .scorer import Scorer
 from .perm.perm import EvalState
 from .perm.ast import apply_ast_perms
-from .helpers import try_remove
+from .helpers import release_file
 from .profiler import Profiler
 from . import ast_util
 
@@ -38,6 +38,8 @@ class Candidate:
     fn_name: str
     rng_seed: int
     randomizer: Randomizer
+    context: Optional[SourceContext] = None
+    source_cache: Optional[ast_util.SourceCache] = None
     score_value: Optional[int] = field(init=False, default=None)
     score_hash: Optional[str] = field(init=False, default=None)
     _cache_source: Optional[str] = field(init=False, default=None)
@@ -46,11 +48,19 @@ class Candidate:
     @functools.lru_cache(maxsize=16)
     def _cached_shared_ast(
         source: str, fn_name: str
-    ) -> Tuple[ca.FuncDef, int, ca.FileAST]:
+    ) -> Tuple[
+        ca.FuncDef, int, ca.FileAST, Optional[SourceContext], ast_util.SourceCache
+    ]:
         ast = ast_util.parse_c(source)
         orig_fn, fn_index = ast_util.extract_fn(ast, fn_name)
         ast_util.normalize_ast(orig_fn, ast)
-        return orig_fn, fn_index, ast
+        try:
+            context_ast = ca.FileAST(ast.ext[:fn_index])
+            context = SourceContext.from_text(ast_util.to_c(context_ast))
+        except AssertionError:
+            # Pragmas that span the target function
+            context = None
+        return orig_fn, fn_index, ast, context, ast_util.SourceCache(ast)
 
     @staticmethod
     def from_source(
@@ -60,21 +70,29 @@ class Candidate:
         randomization_weights: Mapping[str, float],
         rng_seed: int,
     ) -> "Candidate":
-        # Use the same AST for all instances of the same original source, but
-        # with the target function deeply copied. Since we never change the
-        # AST outside of the target function, this is fine, and it saves us
-        # performance (deepcopy is really slow).
-        orig_fn, fn_index, ast = Candidate._cached_shared_ast(source, fn_name)
+        # Use the same AST for all instances of the same original source,
+        # the target function included: the randomizer copies the nodes it
+        # changes, and the paths to them, instead of changing them in place
+        # (see ast_util.own). Only the function's own node is copied here, or
+        # all of it for AST perms, which do change it in place (deepcopy is
+        # really slow, but those are rare).
+        shared = Candidate._cached_shared_ast(source, fn_name)
+        orig_fn, fn_index, ast, context, source_cache = shared
         ast = copy.copy(ast)
         ast.ext = copy.copy(ast.ext)
-        fn_copy = copy.deepcopy(orig_fn)
+        if eval_state.ast_perms:
+            fn_copy = copy.deepcopy(orig_fn)
+            apply_ast_perms(fn_copy, eval_state)
+        else:
+            fn_copy = ast_util.clone_node(orig_fn)
         ast.ext[fn_index] = fn_copy
-        apply_ast_perms(fn_copy, eval_state)
         return Candidate(
             ast=ast,
             fn_name=fn_name,
             rng_seed=rng_seed,
             randomizer=Randomizer(randomization_weights, rng_seed),
+            context=context,
+            source_cache=source_cache,
         )
 
     def randomize_ast(self) -> None:
@@ -83,21 +101,39 @@ class Candidate:
 
     def get_source(self) -> str:
         if self._cache_source is None:
-            self._cache_source = ast_util.to_c(self.ast)
+            self._cache_source = ast_util.to_c(self.ast, cache=self.source_cache)
         return self._cache_source
 
     def compile(self, compiler: Compiler, show_errors: bool = False) -> Optional[str]:
         source: str = self.get_source()
-        return compiler.compile(source, show_errors=show_errors)
+        return compiler.compile(
+            source, show_errors=show_errors, context=self.source_context(source)
+        )
+
+    def source_context(self, source: str) -> Optional[SourceContext]:
+        """The context, if this source of the candidate still starts with it."""
+        if self.context is not None and source.startswith(self.context.text):
+            return self.context
+        return None
 
-    def score(self, scorer: Scorer, o_file: Optional[str]) -> CandidateResult:
+    def score(
+        self,
+        scorer: Scorer,
+        o_file: Optional[str],
+        bound: Optional[int] = None,
+        source: Optional[str] = None,
+    ) -> CandidateResult:
+        """Score the object compiled from the candidate's source, or from an
+        earlier source of it that is given."""
         self.score_value = None
         self.score_hash = None
         try:
-            self.score_value, self.score_hash = scorer.score(o_file)
+            self.score_value, self.score_hash = scorer.score(o_file, bound)
         finally:
             if o_file:
-                try_remove(o_file)
+                release_file(o_file)
         return CandidateResult(
-            score=self.score_value, hash=self.score_hash, source=self.get_source()
+            score=self.score_value,
+            hash=self.score_hash,
+            source=self.get_source() if source is None else source,
         )
@@ -1,23 +1,180 @@
-from typing import Optional
+from dataclasses import dataclass
+import hashlib
+import os
+import socket
+import struct
+import sys
+import threading
+from typing import Dict, Optional, Set, Tuple
 import tempfile
 import subprocess
 import shutil
 
-from .helpers import try_remove
+from .helpers import MEMORY_FILE_PREFIX, release_file, try_remove
+
+
+class CompileServerError(Exception):
+    pass
+
+
+@dataclass(frozen=True)
+class SourceContext:
+    """The part of a source before the target function, which is the same for
+    all candidates made from it (unless the randomizer changes a declaration
+    there; a candidate's source only goes with its context if it starts with
+    it). The compile server preprocesses it once under its checksum."""
+
+    text: str
+    checksum: int
+
+    @staticmethod
+    def from_text(text: str) -> "SourceContext":
+        digest = hashlib.blake2b(text.encode("utf-8"), digest_size=8).digest()
+        return SourceContext(text, int.from_bytes(digest, "little"))
+
+
+class CompileServerClient:
+    """A connection to tools/CompileServer, which runs the stages of the
+    compile script with warm processes. Requests and responses are
+    length-prefixed like MDasm2's server; a response starts with a status byte
+    (0 = ok, 2 = unknown context)."""
+
+    def __init__(self, path: str) -> None:
+        self.path = path
+        # One connection per thread (pipelined evaluation compiles on several)
+        self.socks: Dict[int, socket.socket] = {}
+        self.pid = 0
+        # Checksums of the contexts the server refused (no --cache-context)
+        self.refused: Set[int] = set()
+
+    def _receive(self, sock: socket.socket, size: int) -> bytes:
+        data = b""
+        while len(data) < size:
+            chunk = sock.recv(size - len(data))
+            if not chunk:
+                raise CompileServerError("the compile server closed the connection")
+            data += chunk
+        return data
+
+    def request(self, payload: bytes) -> Tuple[int, bytes]:
+        # Forked workers connect on their own rather than share the socket
+        if self.pid != os.getpid():
+            self.socks = {}
+            self.pid = os.getpid()
+        sock = self.socks.get(threading.get_ident())
+        if sock is None:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(self.path)
+            self.socks[threading.get_ident()] = sock
+        sock.sendall(struct.pack("<I", len(payload)) + payload)
+        (size,) = struct.unpack("<I", self._receive(sock, 4))
+        response = self._receive(sock, size)
+        return response[0], response[1:]
+
+    def compile(
+        self, source: str, context: Optional[SourceContext] = None
+    ) -> Tuple[bool, bytes]:
+        """The object compiled from source, or the compiler's errors. With a
+        context, which source starts with, only the rest is preprocessed."""
+        status = 2
+        if context is not None and context.checksum not in self.refused:
+            head = struct.pack("<Q", context.checksum)
+            rest = source[len(context.text) :].encode("utf-8")
+            status, data = self.request(b"F" + head + rest)
+            if status == 2:
+                status, _ = self.request(b"X" + head + context.text.encode("utf-8"))
+                if status == 0:
+                    status, data = self.request(b"F" + head + rest)
+                else:
+                    self.refused.add(context.checksum)
+                    status = 2
+        if status == 2:
+            status, data = self.request(b"C" + source.encode("utf-8"))
+        if status != 0:
+            return False, data
+        # Skip the times queued and spent in each stage (see --stats)
+        (stages,) = struct.unpack_from("<I", data)
+        return True, data[4 + 8 * (stages + 1) :]
+
+    def stats(self) -> str:
+        """Queue depth and latency of every stage, as CompileServer --stats
+        prints them."""
+        return self.request(b"Q")[1].decode("utf-8")
 
 
 class Compiler:
     def __init__(
-        self, compile_cmd: str, *, show_errors: bool, debug_mode: bool
+        self,
+        compile_cmd: str,
+        *,
+        show_errors: bool,
+        debug_mode: bool,
+        in_memory: bool = False,
+        compile_server: Optional[str] = None,
     ) -> None:
         self.compile_cmd = compile_cmd
         self.show_errors = show_errors
         self.debug_mode = debug_mode
+        # Have the compile script write the .o to an inherited memfd rather
+        # than to /tmp. The returned name is then only valid in this process.
+        # The .c (and whatever the script makes of it) still goes to /tmp.
+        self.in_memory = in_memory and hasattr(os, "memfd_create") and not debug_mode
+        # Compile through a running tools/CompileServer (its socket path)
+        # instead of running the compile script for every candidate
+        self.server = (
+            CompileServerClient(compile_server)
+            if compile_server and not debug_mode
+            else None
+        )
+
+    def _new_output(self) -> Tuple[str, Tuple[int, ...]]:
+        """A name for the .o, and the file descriptors to pass for it."""
+        if self.in_memory:
+            o_fd = os.memfd_create("permuter.o")
+            return MEMORY_FILE_PREFIX + str(o_fd), (o_fd,)
+        with tempfile.NamedTemporaryFile(
+            prefix="permuter", suffix=".o", delete=False
+        ) as f:
+            return f.name, ()
 
-    def compile(self, source: str, *, show_errors: bool = False) -> Optional[str]:
+    def _compile_on_server(
+        self, source: str, show_errors: bool, context: Optional[SourceContext]
+    ) -> Optional[str]:
+        assert self.server is not None
+        ok, data = self.server.compile(source, context)
+        if not ok:
+            if show_errors:
+                print(data.decode("utf-8", "replace"), end="", file=sys.stderr)
+            return None
+        o_name, _ = self._new_output()
+        if self.in_memory:
+            os.pwrite(int(o_name[len(MEMORY_FILE_PREFIX) :]), data, 0)
+        else:
+            with open(o_name, "wb") as f:
+                f.write(data)
+        return o_name
+
+    def compile(
+        self,
+        source: str,
+        *,
+        show_errors: bool = False,
+        context: Optional[SourceContext] = None,
+    ) -> Optional[str]:
         """Try to compile a piece of C code. Returns the filename of the resulting .o
-        temp file if it succeeds."""
+        temp file if it succeeds; release it with release_file(). The compile
+        server preprocesses context, which source must start with, only once."""
         show_errors = show_errors or self.show_errors or self.debug_mode
+        if self.server is not None:
+            try:
+                return self._compile_on_server(source, show_errors, context)
+            except (OSError, CompileServerError) as e:
+                print(
+                    f"Compile server unavailable ({e}), running {self.compile_cmd}",
+                    file=sys.stderr,
+                )
+                self.server = None
+
         with tempfile.NamedTemporaryFile(
             prefix="permuter", suffix=".c", mode="w", delete=False
         ) as f:
@@ -33,10 +190,7 @@ class Compiler:
             with open(debug_filepath, "w") as f_copy:
                 f_copy.write(source)
 
-        with tempfile.NamedTemporaryFile(
-            prefix="permuter", suffix=".o", delete=False
-        ) as f2:
-            o_name = f2.name
+        o_name, pass_fds = self._new_output()
 
         try:
             stderr = 2 if show_errors else subprocess.DEVNULL
@@ -44,17 +198,18 @@ class Compiler:
                 [self.compile_cmd, c_name, "-o", o_name],
                 stdout=stderr,
                 stderr=stderr,
+                pass_fds=pass_fds,
             )
         except subprocess.CalledProcessError:
             if not show_errors:
                 try_remove(c_name)
-            try_remove(o_name)
+            release_file(o_name)
             return None
         except KeyboardInterrupt:
             # If Ctrl+C happens during this call, make a best effort in
             # removing the .c and .o files. This is totally racy, but oh well...
             try_remove(c_name)
-            try_remove(o_name)
+            release_file(o_name)
             raise
 
         if self.debug_mode:
@@ -28,6 +28,28 @@ def try_remove(path: str) -> None:
         pass
 
 
+# Objects compiled into memory (Compiler with in_memory=True) are memfds,
+# named by the path that the compile script can write to.
+MEMORY_FILE_PREFIX = "/dev/fd/"
+
+
+def is_memory_file(path: str) -> bool:
+    return path.startswith(MEMORY_FILE_PREFIX)
+
+
+def read_memory_file(path: str) -> bytes:
+    fd = int(path[len(MEMORY_FILE_PREFIX) :])
+    return os.pread(fd, os.fstat(fd).st_size, 0)
+
+
+def release_file(path: str) -> None:
+    """Close an in-memory object, or delete a temporary file."""
+    if is_memory_file(path):
+        os.close(int(path[len(MEMORY_FILE_PREFIX) :]))
+    else:
+        try_remove(path)
+
+
 def trim_source(source: str, fn_name: str) -> str:
     fn_index = source.find(fn_name)
     if fn_index != -1:
@@ -30,7 +30,9 @@ from .helpers import (
 MIN_PRIO = 0.01
 MAX_PRIO = 2.0
 
+from .objdump import get_arch
 from .permuter import (
+    BatchTask,
     EvalError,
     EvalResult,
     Feedback,
@@ -40,17 +42,25 @@ from .permuter import (
     Permuter,
     Task,
     WorkDone,
+    WorkSummary,
 )
 from .preprocess import preprocess
 from .printer import Printer
 from .profiler import Profiler
 from .randomizer import RANDOMIZATION_PASSES
+from .ring import SummaryRing
 from .scorer import Scorer
+from .seen import SEEN_DEFAULT_MB, SeenFilter, seen_key
 
 # The probability that the randomizer continues transforming the output it
 # generated last time.
 DEFAULT_RAND_KEEP_PROB = 0.6
 
+# The number of seeds a local worker is given at a time. Their results are
+# sent back one by one only when they need to be output, and otherwise as a
+# WorkSummary per batch.
+SEED_BATCH_SIZE = 16
+
 
 @dataclass
 class Options:
@@ -130,6 +140,47 @@ def write_candidate(
     print(f"wrote to {output_dir}")
 
 
+def count_results(
+    context: EvalContext,
+    permuter: Permuter,
+    count: int,
+    errors: int,
+    score_value: int,
+    profiler: Optional[Profiler],
+) -> str:
+    """Add results to the totals, returning the status line."""
+    if profiler is not None:
+        for stattype in profiler.time_stats:
+            context.overall_profiler.add_stat(stattype, profiler.time_stats[stattype])
+
+    context.iteration += count
+    context.errors += errors
+    if score_value == permuter.scorer.PENALTY_INF:
+        disp_score = "inf"
+    else:
+        disp_score = str(score_value)
+    timings = ""
+    if context.options.show_timings:
+        timings = "  \t" + context.overall_profiler.get_str_stats()
+    elapsed = time.time() - context.start_time
+    iters_per_sec = context.iteration / elapsed
+    return f"iteration {context.iteration} {iters_per_sec:.2f}/sec, {context.errors} errors, score = {disp_score}{timings}"
+
+
+def post_summary(context: EvalContext, summary: WorkSummary) -> None:
+    permuter = context.permuters[summary.perm_index]
+    status_line = count_results(
+        context,
+        permuter,
+        summary.count,
+        summary.errors,
+        summary.best_score,
+        summary.profiler,
+    )
+    if not context.options.quiet:
+        context.printer.progress(status_line)
+
+
 def post_score(
     context: EvalContext, permuter: Permuter, result: EvalResult, who: Optional[str]
 ) -> bool:
@@ -155,25 +206,11 @@ def post_score(
         print(permuter.diff(result.source))
         input("Press any key to continue...")
 
-    profiler = result.profiler
     score_value = result.score
-
-    if profiler is not None:
-        for stattype in profiler.time_stats:
-            context.overall_profiler.add_stat(stattype, profiler.time_stats[stattype])
-
-    context.iteration += 1
-    if score_value == permuter.scorer.PENALTY_INF:
-        disp_score = "inf"
-        context.errors += 1
-    else:
-        disp_score = str(score_value)
-    timings = ""
-    if context.options.show_timings:
-        timings = "  \t" + context.overall_profiler.get_str_stats()
-    elapsed = time.time() - context.start_time
-    iters_per_sec = context.iteration / elapsed
-    status_line = f"iteration {context.iteration} {iters_per_sec:.2f}/sec, {context.errors} errors, score = {disp_score}{timings}"
+    errors = int(score_value == permuter.scorer.PENALTY_INF)
+    status_line = count_results(
+        context, permuter, 1, errors, score_value, result.profiler
+    )
 
     if permuter.should_output(result):
         former_best = permuter.best_score
@@ -219,33 +256,109 @@ def cycle_seeds(permuters: List[Permuter]) -> Iterable[Tuple[int, int]]:
             i += 1
 
 
+class ResultBatcher:
+    """Sends a worker's results to the main process: the ones that need to be
+    output (or that failed) one by one through the queue, and the others as
+    one WorkSummary per permuter and batch, through the worker's ring when it
+    has room."""
+
+    def __init__(
+        self,
+        permuters: List[Permuter],
+        output_queue: "Queue[Feedback]",
+        ring: Optional[SummaryRing],
+    ) -> None:
+        self.permuters = permuters
+        self.output_queue = output_queue
+        self.ring = ring
+        self.summaries: Dict[int, WorkSummary] = {}
+
+    def send(self, permuter_index: int, result: EvalResult) -> None:
+        permuter = self.permuters[permuter_index]
+        if isinstance(result, CandidateResult) and permuter.should_output(result):
+            permuter.record_result(result)
+        # Sources are only kept for results to output (or with --print-diffs)
+        if (
+            not isinstance(result, CandidateResult)
+            or result.source is not None
+            or result.score == 0
+        ):
+            self.output_queue.put((WorkDone(permuter_index, result), -1, None))
+            return
+
+        summary = self.summaries.get(permuter_index)
+        if summary is None:
+            summary = WorkSummary(permuter_index, 0, 0, result.score, None)
+            self.summaries[permuter_index] = summary
+        summary.count += 1
+        summary.errors += result.score == permuter.scorer.PENALTY_INF
+        summary.best_score = min(summary.best_score, result.score)
+        if result.profiler is not None:
+            if summary.profiler is None:
+                summary.profiler = Profiler()
+            for stat, time_taken in result.profiler.time_stats.items():
+                summary.profiler.add_stat(stat, time_taken)
+
+    def flush(self) -> None:
+        for summary in self.summaries.values():
+            if self.ring is None or not self.ring.put(summary):
+                self.output_queue.put((summary, -1, None))
+        self.summaries.clear()
+
+
 def multiprocess_worker(
     permuters: List[Permuter],
-    input_queue: "Queue[Task]",
+    input_queue: "Queue[BatchTask]",
     output_queue: "Queue[Feedback]",
+    ring: Optional[SummaryRing] = None,
 ) -> None:
+    batcher = ResultBatcher(permuters, output_queue, ring)
+
+    def finish_in_flight(skip: int = -1) -> None:
+        for i, permuter in enumerate(permuters):
+            if i != skip:
+                while permuter.in_flight():
+                    batcher.send(i, permuter.finish_candidate())
+
     try:
         while True:
             # Read a work item from the queue. If none is immediately available,
             # tell the main thread to fill the queues more, and then block on
-            # the queue.
-            queue_item: Task
+            # the queue. (With candidates in flight, it already has been.)
+            queue_item: BatchTask
             try:
                 queue_item = input_queue.get(block=False)
             except queue.Empty:
-                output_queue.put((NeedMoreWork(), -1, None))
+                if not any(permuter.in_flight() for permuter in permuters):
+                    output_queue.put((NeedMoreWork(), -1, None))
                 queue_item = input_queue.get()
             if isinstance(queue_item, Finished):
+                finish_in_flight()
+                batcher.flush()
                 output_queue.put((queue_item, -1, None))
                 output_queue.close()
                 break
-            permuter_index, seed = queue_item
+            permuter_index, seeds = queue_item
             permuter = permuters[permuter_index]
-            result = permuter.try_eval_candidate(seed)
-            if isinstance(result, CandidateResult) and permuter.should_output(result):
-                permuter.record_result(result)
-            output_queue.put((WorkDone(permuter_index, result), -1, None))
-            output_queue.put((NeedMoreWork(), -1, None))
+            # Candidates of another permuter would otherwise stay in flight
+            # until its next batch, which may go to another worker
+            finish_in_flight(skip=permuter_index)
+            if permuter.pipeline_depth == 1:
+                for seed in seeds:
+                    batcher.send(permuter_index, permuter.try_eval_candidate(seed))
+                batcher.flush()
+                output_queue.put((NeedMoreWork(), -1, None))
+                continue
+
+            # Pipelined: only wait for a result once the pipeline is full. The
+            # last candidates of a batch stay in flight into the next one.
+            for i, seed in enumerate(seeds):
+                permuter.start_candidate(seed)
+                if i == len(seeds) - 1:
+                    output_queue.put((NeedMoreWork(), -1, None))
+                if permuter.in_flight() >= permuter.pipeline_depth:
+                    batcher.send(permuter_index, permuter.finish_candidate())
+            batcher.flush()
     except KeyboardInterrupt:
         # Don't clutter the output with stack traces; Ctrl+C is the expected
         # way to quit and sends KeyboardInterrupt to all processes.
@@ -331,12 +444,42 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
             print(base_c)
 
         compiler = Compiler(
-            compile_cmd, show_errors=options.show_errors, debug_mode=options.debug_mode
+            compile_cmd,
+            show_errors=options.show_errors,
+            debug_mode=options.debug_mode,
+            in_memory=json_prop(settings, "in_memory_objects", bool, False)
+            and get_arch(target_o).name == "mips",
+            compile_server=json_prop(settings, "compile_server", str, "") or None,
         )
         scorer = Scorer(
             target_o,
             stack_differences=options.stack_differences,
             debug_mode=options.debug_mode,
+            function=fn_name
+            if json_prop(settings, "score_function_only", bool, False)
+            else None,
+            cache=os.path.join(d, "score_cache.bin")
+            if json_prop(settings, "score_cache", bool, False)
+            else None,
+            block_diff=json_prop(settings, "block_diff", bool, False),
+            index=os.path.join(d, "target.idx")
+            if json_prop(settings, "target_index", bool, False)
+            else None,
+        )
+        pipeline_depth = json_prop(settings, "pipeline_depth", int, 1)
+        # What a source's score depends on, besides the source
+        score_settings = {
+            "func_name": fn_name,
+            "stack_differences": options.stack_differences,
+            "score_function_only": settings.get("score_function_only"),
+            "block_diff": settings.get("block_diff"),
+        }
+        seen_filter = SeenFilter(
+            os.path.join(d, "seen_sources.bin")
+            if json_prop(settings, "seen_filter", bool, True)
+            else None,
+            json_prop(settings, "seen_filter_mb", float, SEEN_DEFAULT_MB),
+            seen_key([target_o, compile_cmd], score_settings),
         )
         c_source = preprocess(base_c)
 
@@ -359,6 +502,8 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
                 better_only=options.better_only,
                 score_threshold=options.score_threshold,
                 debug_mode=options.debug_mode,
+                pipeline_depth=1 if options.debug_mode else pipeline_depth,
+                seen_filter=seen_filter,
             )
         except CandidateConstructionFailure as e:
             print(e.message, file=sys.stderr)
@@ -388,11 +533,22 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
         for permuter_index, seed in cycle_seeds(context.permuters):
             heartbeat()
             permuter = context.permuters[permuter_index]
-            result = permuter.try_eval_candidate(seed)
+            if permuter.pipeline_depth == 1:
+                result = permuter.try_eval_candidate(seed)
+            else:
+                permuter.start_candidate(seed)
+                if permuter.in_flight() < permuter.pipeline_depth:
+                    continue
+                result = permuter.finish_candidate()
             if post_score(context, permuter, result, None):
                 found_zero = True
                 if options.stop_on_zero:
                     break
+        for permuter in context.permuters:
+            while permuter.in_flight() and not (found_zero and options.stop_on_zero):
+                heartbeat()
+                if post_score(context, permuter, permuter.finish_candidate(), None):
+                    found_zero = True
     else:
         seed_iterators: List[Optional[Iterator[int]]] = [
             permuter.seed_iterator()
@@ -402,7 +558,7 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
         next_iterator_index = 0
 
         # Create queues.
-        worker_task_queue: "Queue[Task]" = Queue()
+        worker_task_queue: "Queue[BatchTask]" = Queue()
         feedback_queue: "Queue[Feedback]" = Queue()
 
         # Connect to network and create client threads and queues.
@@ -422,14 +578,14 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
                 except (EOFError, ServerError) as e:
                     print("Error:", e)
                     sys.exit(1)
-                thread, queue, stats = start_client(
+                thread, conn_queue, stats = start_client(
                     port,
                     context.permuters[perm_index],
                     perm_index,
                     feedback_queue,
                     options.network_priority,
                 )
-                net_conns.append((thread, queue))
+                net_conns.append((thread, conn_queue))
                 if first_stats is None:
                     first_stats = stats
             assert first_stats is not None, "has at least one permuter"
@@ -438,16 +594,29 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
             cores_str = plural(int(first_stats[2]), "core")
             print(f"Connected! {servers_str} online ({cores_str}, {clients_str})")
 
-        # Start local worker threads
+        # Start local worker threads, each with a ring for its summaries
         processes: List[multiprocessing.Process] = []
+        rings: List[SummaryRing] = []
         for i in range(options.threads):
+            rings.append(SummaryRing())
             p = multiprocessing.Process(
                 target=multiprocess_worker,
-                args=(context.permuters, worker_task_queue, feedback_queue),
+                args=(context.permuters, worker_task_queue, feedback_queue, rings[-1]),
             )
             p.start()
             processes.append(p)
 
+        def next_feedback() -> Optional[Feedback]:
+            """The next message of the queue, after the summaries in the rings;
+            None when there is no message for a while."""
+            for ring in rings:
+                for summary in ring.get_all():
+                    post_summary(context, summary)
+            try:
+                return feedback_queue.get(timeout=0.5)
+            except queue.Empty:
+                return None
+
         active_workers = len(processes)
 
         if not active_workers and not net_conns:
@@ -490,6 +659,19 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
                         return (perm_index, seed)
             return None
 
+        def get_batch() -> Optional[Tuple[int, List[int]]]:
+            task = get_task(-1)
+            if task is None:
+                return None
+            perm_index, seed = task
+            seeds = [seed]
+            while len(seeds) < SEED_BATCH_SIZE:
+                task = get_task(perm_index)
+                if task is None:
+                    break
+                seeds.append(task[1])
+            return perm_index, seeds
+
         # Feed the task queue with work and read from results queue.
         # We generally match these up one-by-one to avoid overfilling queues,
         # but workers can ask us to add more tasks into the system if they run
@@ -497,7 +679,10 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
         # queues are empty.)
         while seed_iterators_remaining > 0:
             heartbeat()
-            feedback, source, who = feedback_queue.get()
+            item = next_feedback()
+            if item is None:
+                continue
+            feedback, source, who = item
             if isinstance(feedback, Finished):
                 process_finish(feedback, source)
             elif isinstance(feedback, Message):
@@ -508,12 +693,16 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
                     found_zero = True
                     if options.stop_on_zero:
                         break
+            elif isinstance(feedback, WorkSummary):
+                post_summary(context, feedback)
             elif isinstance(feedback, NeedMoreWork):
-                task = get_task(source)
-                if task is not None:
-                    if source == -1:
-                        worker_task_queue.put(task)
-                    else:
+                if source == -1:
+                    batch = get_batch()
+                    if batch is not None:
+                        worker_task_queue.put(batch)
+                else:
+                    task = get_task(source)
+                    if task is not None:
                         net_conns[source][1].put(task)
             else:
                 static_assert_unreachable(feedback)
@@ -528,7 +717,10 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
         # Await final results.
         while active_workers > 0 or net_conns:
             heartbeat()
-            feedback, source, who = feedback_queue.get()
+            item = next_feedback()
+            if item is None:
+                continue
+            feedback, source, who = item
             if isinstance(feedback, Finished):
                 process_finish(feedback, source)
             elif isinstance(feedback, Message):
@@ -537,6 +729,9 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
                 if not (options.stop_on_zero and found_zero):
                     if process_result(feedback, who):
                         found_zero = True
+            elif isinstance(feedback, WorkSummary):
+                if not (options.stop_on_zero and found_zero):
+                    post_summary(context, feedback)
             elif isinstance(feedback, NeedMoreWork):
                 pass
             else:
@@ -545,6 +740,11 @@ def run_inner(options: Options, heartbeat: Callable[[], None]) -> List[int]:
         # Wait for workers to finish.
         for p in processes:
             p.join()
+        for ring in rings:
+            if not (options.stop_on_zero and found_zero):
+                for summary in ring.get_all():
+                    post_summary(context, summary)
+            ring.unlink()
 
         # Wait for network connections to close (currently does not happen).
         for conn in net_conns:
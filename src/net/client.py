@@ -94,6 +94,8 @@ def make_portable_permuter(permuter: Permuter) -> PermuterData:
         keep_prob=permuter.keep_prob,
         need_profiler=permuter.need_profiler,
         stack_differences=permuter.scorer.stack_differences,
+        block_diff=permuter.scorer.block_diff,
+        score_function=permuter.scorer.function,
         randomization_weights=permuter.randomization_weights,
         compile_script=compile_script,
         source=permuter.source,
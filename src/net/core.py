@@ -53,6 +53,9 @@ class PermuterData:
     keep_prob: float
     need_profiler: bool
     stack_differences: bool
+    block_diff: bool
+    # The function to score alone (score_function_only), if any
+    score_function: Optional[str]
     randomization_weights: Mapping[str, float]
     compile_script: str
     source: str
@@ -70,6 +73,8 @@ def permuter_data_from_json(
         keep_prob=json_prop(obj, "keep_prob", float),
         need_profiler=json_prop(obj, "need_profiler", bool),
         stack_differences=json_prop(obj, "stack_differences", bool),
+        block_diff=json_prop(obj, "block_diff", bool, False),
+        score_function=json_prop(obj, "score_function", str, "") or None,
         compile_script=json_prop(obj, "compile_script", str),
         randomization_weights=json_dict(
             json_prop(obj, "randomization_weights", dict, {}), float
@@ -88,6 +93,8 @@ def permuter_data_to_json(perm: PermuterData) -> dict:
         "keep_prob": perm.keep_prob,
         "need_profiler": perm.need_profiler,
         "stack_differences": perm.stack_differences,
+        "block_diff": perm.block_diff,
+        "score_function": perm.score_function or "",
         "randomization_weights": perm.randomization_weights,
         "compile_script": perm.compile_script,
     }
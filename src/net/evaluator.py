@@ -68,15 +68,23 @@ def _setup_port(secret: bytes) -> Port:
 
 
 def _create_permuter(data: PermuterData) -> Permuter:
-    fd, path = mkstemp(suffix=".o", prefix="permuter", text=False)
+    # The target stays on disk, next to its index, for as long as the permuter:
+    # workers load it from there when they first score.
+    fd, target_o = mkstemp(suffix=".o", prefix="permuter", text=False)
     try:
         with os.fdopen(fd, "wb") as f:
             f.write(data.target_o_bin)
         scorer = Scorer(
-            target_o=path, stack_differences=data.stack_differences, debug_mode=False
+            target_o=target_o,
+            stack_differences=data.stack_differences,
+            debug_mode=False,
+            function=data.score_function,
+            block_diff=data.block_diff,
+            index=target_o + ".idx",
         )
-    finally:
-        os.unlink(path)
+    except:
+        _remove_target(target_o)
+        raise
 
     fd, path = mkstemp(suffix=".sh", prefix="permuter", text=True)
     try:
@@ -106,6 +114,7 @@ def _create_permuter(data: PermuterData) -> Permuter:
         )
     except:
         os.unlink(path)
+        _remove_target(target_o)
         raise
 
 
@@ -146,8 +155,15 @@ GlobalWork = Tuple[Work, int]
 Task = Union[AddPermuter, RemovePermuter, Work, WorkDone]
 
 
+def _remove_target(target_o: str) -> None:
+    for path in (target_o, target_o + ".idx"):
+        if os.path.exists(path):
+            os.unlink(path)
+
+
 def _remove_permuter(perm: Permuter) -> None:
     os.unlink(perm.compiler.compile_cmd)
+    _remove_target(perm.scorer.target_o)
 
 
 def _send_result(item: WorkDone, port: Port) -> None:
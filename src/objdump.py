@@ -1,11 +1,16 @@
 #!/usr/bin/env python3
 from dataclasses import dataclass, field
+import ctypes
 import os
 import re
 import string
+import struct
 import subprocess
 import sys
-from typing import List, Match, Pattern, Set, Tuple, Optional
+import time
+from typing import Dict, List, Match, Pattern, Set, Tuple, Optional, Union
+
+from .helpers import is_memory_file, read_memory_file
 
 
 # Ignore registers, for cleaner output. (We don't do this right now, but it can
@@ -20,6 +25,22 @@ ign_branch_targets = True
 # Skip branch-likely delay slots. (They aren't interesting on IDO.)
 skip_bl_delay_slots = True
 
+# Keep one long-lived MDasm2 process per worker and send it the .o files over a
+# pipe, instead of spawning a new process for every candidate.
+use_server = True
+
+# Call MDasm2 in-process through its shared library (libmdasm.so next to the
+# MDasm2 binary) when it has been built. Takes precedence over use_server.
+use_library = True
+
+# Let MDasm2 do the simplify_objdump() normalization itself (--normalized),
+# so that we only have to split its output into lines.
+use_native_normalize = True
+
+# MDasm2 assembles CC1PSX's assembly (a .s given instead of an obj) like
+# aspsx -G gp_size: keep this the same as the compile script's G.
+gp_size = 8
+
 skip_lines = 1
 re_int = re.compile(r"[0-9]+")
 re_int_full = re.compile(r"\b[0-9]+\b")
@@ -419,23 +440,748 @@ def simplify_objdump(
     return output_lines
 
 
+class MDasmError(Exception):
+    pass
+
+
+class MDasmUnsupported(MDasmError):
+    """An obj with rows that MDasm2 can't normalize (e.g. relocation rows),
+    which the Python normalization handles."""
+
+
+def warn_no_cache(message: str) -> None:
+    """Scores are still right without the cache, just slower."""
+    print(f"Not caching scores: {message.strip()}", file=sys.stderr)
+
+
+def obj_request(o_filename: str) -> bytes:
+    """The obj part of a server request: in-memory objects are sent as bytes,
+    since the server can't open our file descriptors."""
+    if is_memory_file(o_filename):
+        return b"B" + read_memory_file(o_filename)
+    return b"P" + os.fsencode(o_filename)
+
+
+def load_indexed_target(
+    mdasm: Union["MDasmLibrary", "MDasmServer"],
+    target_o: str,
+    normalize: int,
+    index: str,
+) -> Optional[int]:
+    """Load a scoring target from its index file (tools/TargetIndex.h), first
+    writing it if it is missing, older than the target or was made by another
+    version or with other options. None if the target can't be indexed, e.g.
+    an in-memory object."""
+    if is_memory_file(target_o):
+        return None
+    if os.path.exists(index) and os.path.getmtime(index) >= os.path.getmtime(target_o):
+        try:
+            return mdasm.load_target(index, normalize)
+        except MDasmError:
+            pass
+    # Other processes may be loading the old index: replace it as a whole
+    temp = f"{index}.{os.getpid()}"
+    with open(temp, "wb") as f:
+        f.write(mdasm.target_index(target_o, normalize))
+    os.replace(temp, index)
+    return mdasm.load_target(index, normalize)
+
+
+class MDasmServer:
+    """An MDasm2 process running in --server mode. Requests and responses are
+    length-prefixed; a response starts with a status byte (0 = ok)."""
+
+    def __init__(self, cmd: List[str]) -> None:
+        self.proc = subprocess.Popen(
+            cmd + ["--server", "-G", str(gp_size)],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+        )
+        self.targets: Dict[Tuple[str, int, Optional[str]], int] = {}
+        self.function: Optional[str] = None
+
+    def request(self, payload: bytes) -> bytes:
+        stdin = self.proc.stdin
+        stdout = self.proc.stdout
+        assert stdin is not None and stdout is not None
+        stdin.write(struct.pack("<I", len(payload)) + payload)
+        stdin.flush()
+        header = stdout.read(4)
+        if len(header) != 4:
+            raise Exception("MDasm2 server exited unexpectedly")
+        (size,) = struct.unpack("<I", header)
+        response = stdout.read(size)
+        if len(response) != size or size == 0:
+            raise Exception("MDasm2 server exited unexpectedly")
+        if response[0] == 2:
+            raise MDasmUnsupported(response[1:].decode("utf-8").strip())
+        if response[0] != 0:
+            raise MDasmError(response[1:].decode("utf-8").strip())
+        return response[1:]
+
+    def set_function(self, function: Optional[str]) -> None:
+        if function != self.function:
+            self.request(b"F" + os.fsencode(function or ""))
+            self.function = function
+
+    def disassemble(
+        self,
+        o_filename: str,
+        normalize: Optional[int] = None,
+        binary: bool = False,
+        function: Optional[str] = None,
+    ) -> bytes:
+        prefix = b"" if normalize is None else b"N" + bytes([normalize])
+        if binary:
+            prefix = b"X"
+        self.set_function(function)
+        return self.request(prefix + obj_request(o_filename))
+
+    def target_index(self, target_o: str, normalize: int) -> bytes:
+        return self.request(b"Y" + bytes([normalize]) + obj_request(target_o))
+
+    def load_target(self, index: str, normalize: int) -> int:
+        return int(self.request(b"I" + bytes([normalize]) + os.fsencode(index)))
+
+    def target(
+        self,
+        target_o: str,
+        normalize: int,
+        function: Optional[str] = None,
+        cache: Optional[str] = None,
+        index: Optional[str] = None,
+    ) -> int:
+        """Id of a scoring target, loaded on first use, from its index file if
+        there is one."""
+        self.set_function(function)
+        key = (target_o, normalize, function)
+        target_id = self.targets.get(key)
+        if target_id is None:
+            if index:
+                target_id = load_indexed_target(self, target_o, normalize, index)
+            if target_id is None:
+                request = b"T" + bytes([normalize]) + obj_request(target_o)
+                target_id = int(self.request(request))
+            self.targets[key] = target_id
+            if cache:
+                request = struct.pack("<II", target_id, SCORE_CACHE_ENTRIES)
+                try:
+                    self.request(b"C" + request + os.fsencode(cache))
+                except MDasmError as e:
+                    warn_no_cache(str(e))
+        return target_id
+
+    def score(
+        self,
+        target_o: str,
+        cand_o: str,
+        normalize: int,
+        function: Optional[str] = None,
+        cache: Optional[str] = None,
+        bound: Optional[int] = None,
+        index: Optional[str] = None,
+    ) -> Tuple[int, Optional[str]]:
+        """Score a candidate natively, loading the target on first use. With a
+        bound, candidates that can't score that or better get a lower bound of
+        their score and no hash."""
+        target_id = self.target(target_o, normalize, function, cache, index)
+        if bound is None:
+            request = b"S" + struct.pack("<I", target_id)
+        else:
+            request = b"L" + struct.pack("<Iq", target_id, bound)
+        fields = self.request(request + obj_request(cand_o)).decode("utf-8").split()
+        return int(fields[0]), fields[1] if len(fields) > 1 else None
+
+    def close(self) -> None:
+        if self.proc.poll() is None:
+            self.proc.kill()
+            self.proc.wait()
+
+
+# Servers are per process: forked workers must not share the parent's pipes.
+_servers: Dict[Tuple[int, Tuple[str, ...]], MDasmServer] = {}
+
+
+def get_server(arch: ArchSettings) -> MDasmServer:
+    key = (os.getpid(), tuple(arch.objdump))
+    server = _servers.get(key)
+    if server is None or server.proc.poll() is not None:
+        server = MDasmServer(arch.objdump)
+        _servers[key] = server
+    return server
+
+
+# Constants from tools/mdasm.h
+MDASM_VERSION = 11
+MDASM_UNSUPPORTED = -2
+MDASM_TEXT = 0
+MDASM_NORMALIZED = 1
+MDASM_BINARY = 2
+MDASM_OFFSETS = 0x10
+MDASM_BYTES = 0x20
+MDASM_BLOCK_DIFF = 0x08
+
+# Entries of a score cache file (48 bytes each, allocated as they are used)
+SCORE_CACHE_ENTRIES = 1 << 18
+
+
+class MdasmLine(ctypes.Structure):
+    _fields_ = [
+        ("mnemonic", ctypes.c_char_p),
+        ("row", ctypes.c_char_p),
+        ("has_symbol", ctypes.c_int),
+    ]
+
+
+def read_obj(o_filename: str) -> bytes:
+    if is_memory_file(o_filename):
+        return read_memory_file(o_filename)
+    with open(o_filename, "rb") as f:
+        return f.read()
+
+
+class MDasmLibrary:
+    """libmdasm loaded with ctypes: the same requests as MDasmServer, without
+    the pipe round trips. See tools/mdasm.h."""
+
+    def __init__(self, path: str) -> None:
+        lib = ctypes.CDLL(path)
+        size_p = ctypes.POINTER(ctypes.c_size_t)
+        lib.mdasm_version.restype = ctypes.c_int
+        lib.mdasm_error.restype = ctypes.c_char_p
+        lib.mdasm_disassemble.argtypes = [
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_void_p),
+            size_p,
+        ]
+        lib.mdasm_normalize.argtypes = [
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.POINTER(MdasmLine)),
+            size_p,
+        ]
+        lib.mdasm_add_target.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int]
+        lib.mdasm_target_index.argtypes = [
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_void_p),
+            size_p,
+        ]
+        lib.mdasm_load_target.argtypes = [ctypes.c_char_p, ctypes.c_int]
+        lib.mdasm_set_function.argtypes = [ctypes.c_char_p]
+        lib.mdasm_score.argtypes = [
+            ctypes.c_int,
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+            ctypes.POINTER(ctypes.c_longlong),
+            ctypes.c_char_p,
+        ]
+        lib.mdasm_score_bounded.argtypes = [
+            ctypes.c_int,
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+            ctypes.c_longlong,
+            ctypes.POINTER(ctypes.c_longlong),
+            ctypes.c_char_p,
+        ]
+        lib.mdasm_target_cache.argtypes = [
+            ctypes.c_int,
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+        ]
+        lib.mdasm_code_hash.argtypes = [
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+            ctypes.POINTER(ctypes.c_uint64),
+        ]
+        self.lib = lib
+        self.targets: Dict[Tuple[str, int, Optional[str]], int] = {}
+        self.function: Optional[str] = None
+
+    def check(self, result: int) -> int:
+        if result == MDASM_UNSUPPORTED:
+            raise MDasmUnsupported(self.lib.mdasm_error().decode("utf-8").strip())
+        if result < 0:
+            raise MDasmError(self.lib.mdasm_error().decode("utf-8").strip())
+        return result
+
+    def set_function(self, function: Optional[str]) -> None:
+        if function != self.function:
+            self.lib.mdasm_set_function(os.fsencode(function) if function else None)
+            self.function = function
+
+    def disassemble(
+        self,
+        o_filename: str,
+        normalize: Optional[int] = None,
+        binary: bool = False,
+        function: Optional[str] = None,
+    ) -> bytes:
+        self.set_function(function)
+        mode, options = MDASM_TEXT, MDASM_OFFSETS | MDASM_BYTES
+        if binary:
+            mode = MDASM_BINARY
+        elif normalize is not None:
+            mode, options = MDASM_NORMALIZED, options | normalize
+        data = read_obj(o_filename)
+        out = ctypes.c_void_p()
+        size = ctypes.c_size_t()
+        self.check(
+            self.lib.mdasm_disassemble(
+                data, len(data), mode, options, ctypes.byref(out), ctypes.byref(size)
+            )
+        )
+        return ctypes.string_at(out, size.value) if size.value else b""
+
+    def normalize(
+        self, o_filename: str, normalize: int, function: Optional[str] = None
+    ) -> List["Line"]:
+        self.set_function(function)
+        data = read_obj(o_filename)
+        lines = ctypes.POINTER(MdasmLine)()
+        count = ctypes.c_size_t()
+        self.check(
+            self.lib.mdasm_normalize(
+                data, len(data), normalize, ctypes.byref(lines), ctypes.byref(count)
+            )
+        )
+        return [
+            Line(
+                row=line.row.decode("utf-8"),
+                mnemonic=line.mnemonic.decode("utf-8"),
+                has_symbol=line.has_symbol != 0,
+            )
+            for line in lines[: count.value]
+        ]
+
+    def code_hash(self, o_filename: str, function: Optional[str] = None) -> int:
+        self.set_function(function)
+        data = read_obj(o_filename)
+        hash = ctypes.c_uint64()
+        self.check(self.lib.mdasm_code_hash(data, len(data), ctypes.byref(hash)))
+        return hash.value
+
+    def target_index(self, target_o: str, normalize: int) -> bytes:
+        data = read_obj(target_o)
+        out = ctypes.c_void_p()
+        size = ctypes.c_size_t()
+        self.check(
+            self.lib.mdasm_target_index(
+                data, len(data), normalize, ctypes.byref(out), ctypes.byref(size)
+            )
+        )
+        return ctypes.string_at(out, size.value)
+
+    def load_target(self, index: str, normalize: int) -> int:
+        return self.check(self.lib.mdasm_load_target(os.fsencode(index), normalize))
+
+    def target(
+        self,
+        target_o: str,
+        normalize: int,
+        function: Optional[str] = None,
+        cache: Optional[str] = None,
+        index: Optional[str] = None,
+    ) -> int:
+        self.set_function(function)
+        key = (target_o, normalize, function)
+        target_id = self.targets.get(key)
+        if target_id is None:
+            if index:
+                target_id = load_indexed_target(self, target_o, normalize, index)
+            if target_id is None:
+                data = read_obj(target_o)
+                target_id = self.check(
+                    self.lib.mdasm_add_target(data, len(data), normalize)
+                )
+            self.targets[key] = target_id
+            if cache and (
+                self.lib.mdasm_target_cache(
+                    target_id, os.fsencode(cache), SCORE_CACHE_ENTRIES
+                )
+                < 0
+            ):
+                warn_no_cache(self.lib.mdasm_error().decode("utf-8"))
+        return target_id
+
+    def score(
+        self,
+        target_o: str,
+        cand_o: str,
+        normalize: int,
+        function: Optional[str] = None,
+        cache: Optional[str] = None,
+        bound: Optional[int] = None,
+        index: Optional[str] = None,
+    ) -> Tuple[int, Optional[str]]:
+        target_id = self.target(target_o, normalize, function, cache, index)
+        data = read_obj(cand_o)
+        score = ctypes.c_longlong()
+        hash = ctypes.create_string_buffer(65)
+        if bound is None:
+            self.check(
+                self.lib.mdasm_score(
+                    target_id, data, len(data), ctypes.byref(score), hash
+                )
+            )
+        elif self.check(
+            self.lib.mdasm_score_bounded(
+                target_id, data, len(data), bound, ctypes.byref(score), hash
+            )
+        ):
+            return score.value, None
+        return score.value, hash.value.decode("ascii")
+
+
+# The library's state is copied into forked workers along with the rest of the
+# process, so unlike servers one instance per path is enough.
+_libraries: Dict[str, Optional[MDasmLibrary]] = {}
+
+
+def get_library(arch: ArchSettings) -> Optional[MDasmLibrary]:
+    if not use_library or arch.name != "mips":
+        return None
+    name = "mdasm.dll" if sys.platform == "win32" else "libmdasm.so"
+    path = os.path.join(os.path.dirname(os.path.abspath(arch.objdump[0])), name)
+    if path not in _libraries:
+        library = None
+        if os.path.isfile(path):
+            library = MDasmLibrary(path)
+            if library.lib.mdasm_version() != MDASM_VERSION:
+                library = None
+            else:
+                library.lib.mdasm_set_gp_size(gp_size)
+        _libraries[path] = library
+    return _libraries[path]
+
+
+def get_mdasm(arch: ArchSettings) -> Union[MDasmLibrary, MDasmServer]:
+    """The library if it has been built, otherwise the server."""
+    library = get_library(arch)
+    if library is not None:
+        return library
+    return get_server(arch)
+
+
+def run_objdump(
+    o_filename: str,
+    arch: ArchSettings,
+    normalize: Optional[int] = None,
+    binary: bool = False,
+    function: Optional[str] = None,
+) -> bytes:
+    library = get_library(arch)
+    if library is not None:
+        return library.disassemble(o_filename, normalize, binary, function)
+    if use_server and arch.name == "mips":
+        return get_server(arch).disassemble(o_filename, normalize, binary, function)
+    args = [o_filename]
+    input = None
+    if is_memory_file(o_filename):
+        args = ["-"]
+        input = read_memory_file(o_filename)
+    if function:
+        args += ["--function", function]
+    args += ["-G", str(gp_size)]
+    if binary:
+        args.append("--binary")
+    elif normalize is not None:
+        args.append("--normalized")
+        for flag, name in NORMALIZE_FLAGS:
+            if normalize & flag:
+                args.append(name)
+    proc = subprocess.run(arch.objdump + args, input=input, stdout=subprocess.PIPE)
+    if proc.returncode == 2:
+        raise MDasmUnsupported(proc.stdout.decode("utf-8").strip())
+    if proc.returncode != 0:
+        raise MDasmError(proc.stdout.decode("utf-8").strip())
+    return proc.stdout
+
+
+NORMALIZE_FLAGS = [
+    (1, "--stack-diffs"),
+    (2, "--branch-targets"),
+    (4, "--bl-delay-slots"),
+]
+
+
+def native_normalize_flags(stack_differences: bool) -> int:
+    return (
+        (1 if stack_differences else 0)
+        | (0 if ign_branch_targets else 2)
+        | (0 if skip_bl_delay_slots else 4)
+    )
+
+
+def parse_normalized(output: bytes) -> List[Line]:
+    """Parse --normalized output: one "mnemonic\thas_symbol\trow" per line."""
+    lines: List[Line] = []
+    for line in output.decode("utf-8").split("\n")[:-1]:
+        mnemonic, has_symbol, row = line.split("\t", 2)
+        lines.append(Line(row=row, mnemonic=mnemonic, has_symbol=has_symbol == "1"))
+    return lines
+
+
+# MDasm2 --binary output, see BinaryHeader in tools/MDasm2.cpp.
+BINARY_MAGIC = b"MDB\x1a"
+BINARY_VERSION = 2
+BINARY_NONE = 0xFFFF
+BINARY_CHUNK_DATA = 1
+BINARY_HEADER = struct.Struct("<4sHHIIIIII")
+BINARY_OP = struct.Struct("<IBBH")
+BINARY_CHUNK = struct.Struct("<III")
+BINARY_RELOC = struct.Struct("<III")
+BINARY_RECORD = struct.Struct("<IBBBBBBHi")
+
+# fmt: off
+MIPS_REGS = [
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+]
+# fmt: on
+
+
+@dataclass
+class BinaryOp:
+    name: str
+    format: int
+    flags: int
+
+
+@dataclass
+class BinaryReloc:
+    expr: str
+    type: str
+    name: str
+
+
+@dataclass
+class BinaryDisassembly:
+    ops: List[BinaryOp]
+    # (first record, record count, flags) per code or data chunk
+    chunks: List[Tuple[int, int, int]]
+    relocs: List[BinaryReloc]
+    function_names: List[str]
+    # (word, op, rs, rt, rd, sa, pad, reloc, imm) per instruction
+    records: List[Tuple[int, ...]]
+
+
+def parse_binary(data: bytes) -> BinaryDisassembly:
+    """Parse MDasm2 --binary output."""
+    view = memoryview(data)
+    (
+        magic,
+        version,
+        record_size,
+        op_count,
+        chunk_count,
+        reloc_count,
+        name_count,
+        record_count,
+        strings_size,
+    ) = BINARY_HEADER.unpack_from(view)
+    if magic != BINARY_MAGIC or version != BINARY_VERSION:
+        raise MDasmError(f"unsupported MDasm2 binary output {magic!r} v{version}")
+    assert record_size == BINARY_RECORD.size
+
+    pos = BINARY_HEADER.size
+
+    def table(st: struct.Struct, count: int) -> List[Tuple[int, ...]]:
+        nonlocal pos
+        end = pos + st.size * count
+        rows = list(st.iter_unpack(view[pos:end]))
+        pos = end
+        return rows
+
+    ops = table(BINARY_OP, op_count)
+    chunks = table(BINARY_CHUNK, chunk_count)
+    relocs = table(BINARY_RELOC, reloc_count)
+    names = table(struct.Struct("<I"), name_count)
+    records = table(BINARY_RECORD, record_count)
+    strings = bytes(view[pos : pos + strings_size])
+
+    def string(offset: int) -> str:
+        return strings[offset : strings.index(b"\0", offset)].decode("utf-8")
+
+    return BinaryDisassembly(
+        ops=[BinaryOp(string(name), fmt, flags) for name, fmt, flags, _ in ops],
+        chunks=[(first, count, flags) for first, count, flags in chunks],
+        relocs=[BinaryReloc(*(string(s) for s in reloc)) for reloc in relocs],
+        function_names=[string(name) for (name,) in names],
+        records=records,
+    )
+
+
+def _format_int(value: int) -> str:
+    if value >= 0:
+        return hex(value) if value > 9 else str(value)
+    return "-" + hex(-value) if value < -9 else str(value)
+
+
+def _format_operands(op: BinaryOp, record: Tuple[int, ...], address: int) -> str:
+    """Python side of r3000Format() in tools/R3000.h."""
+    word, op_id, rs_id, rt_id, rd_id, sa, _, _, imm = record
+    rs, rt, rd = MIPS_REGS[rs_id], MIPS_REGS[rt_id], MIPS_REGS[rd_id]
+    fmt = op.format
+    branch = ((address + 4 + imm * 4 + 0x80000000) & 0xFFFFFFFF) - 0x80000000
+    if fmt == 0:
+        return f"0x{word:08x}" if op_id == 0 else ""
+    if fmt == 1:
+        return f"{rd}, {rs}, {rt}"
+    if fmt == 2:
+        return f"{rd}, {rt}, {_format_int(sa)}"
+    if fmt == 3:
+        return f"{rd}, {rt}, {rs}"
+    if fmt == 4:
+        return f"{rd}, {rs}"
+    if fmt == 5:
+        return f"{rd}, {rt}"
+    if fmt == 6:
+        return rd
+    if fmt == 7:
+        return rs
+    if fmt == 8:
+        return f"{rs}, {rt}"
+    if fmt == 9:
+        return f"zero, {rs}, {rt}"
+    if fmt == 10:
+        return rs if rd_id == 31 else f"{rd}, {rs}"
+    if fmt == 11:
+        return _format_int(imm) if imm else ""
+    if fmt == 12:
+        if imm == 0:
+            return ""
+        code1, code2 = imm >> 10, imm & 0x3FF
+        return _format_int(code1) + (f", {_format_int(code2)}" if code2 else "")
+    if fmt in (13, 14):
+        return f"{rt}, {rs}, {_format_int(imm)}"
+    if fmt == 15:
+        return f"{rt}, {_format_int(imm)}"
+    if fmt == 16:
+        return f"{rs}, {rt}, {_format_int(branch)}"
+    if fmt == 17:
+        return f"{rs}, {_format_int(branch)}"
+    if fmt == 18:
+        return _format_int(branch)
+    if fmt == 19:
+        return _format_int(((address + 4) & 0xF0000000) | (imm << 2))
+    if fmt in (20, 21):
+        offset = _format_int(imm) if imm else ""
+        reg = str(rt_id) if fmt == 21 else rt
+        return f"{reg}, {offset}({rs})"
+    if fmt == 22:
+        return f"{rt}, {rd_id}, 0"
+    if fmt == 23:
+        return f"{rt}, {rd_id}"
+    if fmt == 24:
+        return _format_int(imm)
+    raise MDasmError(f"unknown operand format {fmt}")
+
+
+def format_binary(dis: BinaryDisassembly) -> List[str]:
+    """Render --binary output as the lines MDasm2 prints in text mode."""
+    lines = [f"function name: {name}" for name in dis.function_names]
+    for first, count, flags in dis.chunks:
+        lines.append("-" * 30)
+        for index in range(first, first + count):
+            record = dis.records[index]
+            address = 4 * (index - first)
+            op = dis.ops[record[1]]
+            operands = _format_operands(op, record, address)
+            reloc = record[7]
+            if reloc != BINARY_NONE:
+                expr = dis.relocs[reloc].expr
+                if flags & BINARY_CHUNK_DATA:
+                    operands = expr
+                elif operands.endswith("0"):
+                    operands = operands[:-1] + expr
+                else:
+                    operands += f" <{expr}>"
+            lines.append(f"{address:4x}:\t{record[0]:08X}\t{op.name}\t{operands}")
+        if count == 0 and not flags & BINARY_CHUNK_DATA:
+            lines.append("ERROR: Failed to disassemble given code!")
+    return lines
+
+
 def objdump(
-    o_filename: str, arch: ArchSettings, *, stack_differences: bool = False
+    o_filename: str,
+    arch: ArchSettings,
+    *,
+    stack_differences: bool = False,
+    function: Optional[str] = None,
 ) -> List[Line]:
-    output = subprocess.check_output(arch.objdump + [o_filename])
+    """Normalized lines of an object. With function, only that function's
+    instructions (MDasm2 only)."""
+    if use_native_normalize and arch.name == "mips" and not ign_regs:
+        flags = native_normalize_flags(stack_differences)
+        library = get_library(arch)
+        try:
+            if library is not None:
+                return library.normalize(o_filename, flags, function)
+            return parse_normalized(
+                run_objdump(o_filename, arch, flags, False, function)
+            )
+        except MDasmUnsupported:
+            # Rows that MDasm2 can't normalize (e.g. relocation rows) take
+            # the slow path below.
+            pass
+    output = run_objdump(o_filename, arch, function=function)
     lines = output.decode("utf-8").splitlines()
     return simplify_objdump(lines, arch, stack_differences=stack_differences)
 
 
+def benchmark(o_filename: str, arch: ArchSettings, iterations: int) -> None:
+    """Compare spawning MDasm2 per call against the persistent server and
+    the library."""
+    spawned = subprocess.check_output(arch.objdump + [o_filename])
+    served = get_server(arch).disassemble(o_filename)
+    assert spawned == served, "server output differs from the command line"
+
+    start = time.monotonic()
+    for _ in range(iterations):
+        subprocess.check_output(arch.objdump + [o_filename])
+    spawn_time = time.monotonic() - start
+
+    server = get_server(arch)
+    start = time.monotonic()
+    for _ in range(iterations):
+        server.disassemble(o_filename)
+    server_time = time.monotonic() - start
+
+    print(f"spawn:   {1000 * spawn_time / iterations:.3f} ms/call")
+    print(f"server:  {1000 * server_time / iterations:.3f} ms/call")
+
+    library = get_library(arch)
+    if library is None:
+        return
+    assert library.disassemble(o_filename) == served, "library output differs"
+    start = time.monotonic()
+    for _ in range(iterations):
+        library.disassemble(o_filename)
+    library_time = time.monotonic() - start
+    print(f"library: {1000 * library_time / iterations:.3f} ms/call")
+
+
 if __name__ == "__main__":
     if len(sys.argv) < 2:
-        print(f"Usage: {sys.argv[0]} file.o", file=sys.stderr)
+        print(f"Usage: {sys.argv[0]} file.o [--bench N]", file=sys.stderr)
         sys.exit(1)
 
     if not os.path.isfile(sys.argv[1]):
         print(f"Source file {sys.argv[1]} is not readable.", file=sys.stderr)
         sys.exit(1)
 
+    if len(sys.argv) == 4 and sys.argv[2] == "--bench":
+        benchmark(sys.argv[1], MIPS_SETTINGS, int(sys.argv[3]))
+        sys.exit(0)
+
     lines = objdump(sys.argv[1], MIPS_SETTINGS)
     for line in lines:
         print(line.row)
@@ -1,3 +1,5 @@
+from collections import deque
+from concurrent.futures import Future, ThreadPoolExecutor
 from dataclasses import dataclass
 import difflib
 import hashlib
@@ -7,13 +9,13 @@ import re
 import time
 import traceback
 from typing import (
+    Deque,
     List,
     Iterator,
     Mapping,
     Optional,
     Tuple,
     Union,
-    Set,
 )
 
 from .candidate import Candidate, CandidateResult
@@ -24,7 +26,8 @@ from .perm.eval import perm_evaluate_one, perm_gen_all_seeds
 from .perm.parse import perm_parse
 from .profiler import Profiler, Timer
 from .scorer import Scorer
-from .helpers import trim_source
+from .seen import SEEN_DEFAULT_MB, SeenFilter
+from .helpers import release_file, trim_source
 
 
 @dataclass
@@ -54,14 +57,46 @@ class _CompileFailure(Exception):
     pass
 
 
+@dataclass
+class _InFlight:
+    """A candidate of pipelined evaluation, compiling in the background."""
+
+    cand: Candidate
+    seed: Tuple[int, int]
+    source: str
+    profiler: Profiler
+    o_file: "Future[Optional[str]]"
+
+
+def _release_compiled(o_file: "Future[Optional[str]]") -> None:
+    o_name = None if o_file.exception() else o_file.result()
+    if o_name:
+        release_file(o_name)
+
+
 @dataclass
 class WorkDone:
     perm_index: int
     result: EvalResult
 
 
+@dataclass
+class WorkSummary:
+    """The results of a batch of seeds that don't need to be output, reduced
+    to their number, the number of compile failures, the best score, and the
+    sum of their timings."""
+
+    perm_index: int
+    count: int
+    errors: int
+    best_score: int
+    profiler: Optional[Profiler]
+
+
 Task = Union[Finished, Tuple[int, int]]
-FeedbackItem = Union[Finished, Message, NeedMoreWork, WorkDone]
+# A permuter index and a batch of its seeds, for a local worker
+BatchTask = Union[Finished, Tuple[int, List[int]]]
+FeedbackItem = Union[Finished, Message, NeedMoreWork, WorkDone, WorkSummary]
 Feedback = Tuple[FeedbackItem, int, Optional[str]]
 
 
@@ -91,6 +126,8 @@ class Permuter:
         better_only: bool,
         score_threshold: Optional[int],
         debug_mode: bool,
+        pipeline_depth: int = 1,
+        seen_filter: Optional[SeenFilter] = None,
     ) -> None:
         self.dir = dir
         self.compiler = compiler
@@ -127,6 +164,10 @@ class Permuter:
         self._better_only = better_only
         self._score_threshold = score_threshold
         self._debug_mode = debug_mode
+        # Candidates compiled at a time by start_candidate()
+        self.pipeline_depth = max(pipeline_depth, 1)
+        self._executor: Optional[ThreadPoolExecutor] = None
+        self._in_flight: Deque[Union[_InFlight, EvalError]] = deque()
         (
             self.base_score,
             self.base_hash,
@@ -136,7 +177,7 @@ class Permuter:
         self.hashes = {self.base_hash}
         self._cur_cand: Optional[Candidate] = None
         self._last_score: Optional[int] = None
-        self._seen_sources: Set[bytes] = set()
+        self._seen_sources = seen_filter or SeenFilter(None, SEEN_DEFAULT_MB)
 
     def _create_and_score_base(self) -> Tuple[int, str, str]:
         base_source, eval_state = perm_evaluate_one(self._permutations)
@@ -161,9 +202,9 @@ class Permuter:
     def _need_to_send_source(self, result: CandidateResult) -> bool:
         return self._need_all_sources or self.should_output(result)
 
-    def _eval_candidate(self, seed: int) -> CandidateResult:
-        profiler = Profiler()
-        timer = Timer()
+    def _next_candidate(self, seed: int, profiler: Profiler, timer: Timer) -> Candidate:
+        """Pick the candidate to evaluate for seed, the last one randomized
+        further or a new one, and stringify it."""
 
         # Determine if we should keep the last candidate.
         # Don't keep 0-score candidates; we'll only create new, worse, zeroes.
@@ -201,24 +242,34 @@ class Permuter:
                 cand_source = self._cur_cand.get_source()
                 hash = hashlib.sha256(cand_source.encode()).digest()
                 profiler.add_stat(Profiler.StatType.stringify, timer.tick())
-                if hash not in self._seen_sources:
+                if self._seen_sources.add(hash):
                     break
-
-            if len(self._seen_sources) < 100000:  # prevent massive memory usage
-                self._seen_sources.add(hash)
         else:
             profiler.add_stat(Profiler.StatType.perm, timer.tick())
             self._cur_cand.get_source()
             profiler.add_stat(Profiler.StatType.stringify, timer.tick())
 
-        o_file = self._cur_cand.compile(self.compiler)
+        return self._cur_cand
+
+    def _eval_candidate(self, seed: int) -> CandidateResult:
+        profiler = Profiler()
+        timer = Timer()
+
+        cand = self._next_candidate(seed, profiler, timer)
+        o_file = cand.compile(self.compiler)
         if not o_file and self._show_errors:
             raise _CompileFailure()
         profiler.add_stat(Profiler.StatType.compile, timer.tick())
 
-        result = self._cur_cand.score(self.scorer, o_file)
+        # Candidates worse than the base are never output, so they only need
+        # a lower bound of their score (and no hash)
+        result = cand.score(self.scorer, o_file, self.base_score)
         profiler.add_stat(Profiler.StatType.score, timer.tick())
+        return self._finish_result(result, profiler)
 
+    def _finish_result(
+        self, result: CandidateResult, profiler: Profiler
+    ) -> CandidateResult:
         if self.need_profiler:
             result.profiler = profiler
 
@@ -230,6 +281,75 @@ class Permuter:
 
         return result
 
+    def start_candidate(self, seed: int) -> None:
+        """Pipelined evaluation: pick the candidate for seed and start compiling
+        it in the background, while the next ones are picked and the last ones
+        scored; finish_candidate() returns the results in order.
+
+        A candidate is kept and randomized further before the score of the
+        last one is known. If that turns out to be 0 or a compile failure,
+        which would have stopped the serial path from keeping it, the
+        candidates built on it are thrown away and evaluated again from new
+        ones."""
+        if self._executor is None:
+            self._executor = ThreadPoolExecutor(max_workers=self.pipeline_depth)
+        profiler = Profiler()
+        timer = Timer()
+        try:
+            cand = self._next_candidate(seed, profiler, timer)
+        except Exception:
+            error = EvalError(exc_str=traceback.format_exc(), seed=self._cur_seed)
+            self._in_flight.append(error)
+            return
+        assert self._cur_seed is not None
+        # The candidate may be randomized further before this is compiled
+        source = cand.get_source()
+        o_file = self._executor.submit(
+            self.compiler.compile, source, context=cand.source_context(source)
+        )
+        self._in_flight.append(
+            _InFlight(cand, self._cur_seed, source, profiler, o_file)
+        )
+
+    def in_flight(self) -> int:
+        """Candidates started and not finished yet."""
+        return len(self._in_flight)
+
+    def finish_candidate(self) -> EvalResult:
+        """Wait for the oldest candidate started by start_candidate() and score it."""
+        entry = self._in_flight.popleft()
+        if isinstance(entry, EvalError):
+            return entry
+        timer = Timer()
+        try:
+            o_file = entry.o_file.result()
+            if not o_file and self._show_errors:
+                return EvalError(exc_str=None, seed=entry.seed)
+            # Only the time waited for the compile, the rest overlapped
+            entry.profiler.add_stat(Profiler.StatType.compile, timer.tick())
+            result = entry.cand.score(
+                self.scorer, o_file, self.base_score, entry.source
+            )
+            entry.profiler.add_stat(Profiler.StatType.score, timer.tick())
+        except Exception:
+            return EvalError(exc_str=traceback.format_exc(), seed=entry.seed)
+
+        if result.score in (0, self.scorer.PENALTY_INF) and not self._force_rng_seed:
+            self._restart_built_on(entry.cand)
+        return self._finish_result(result, entry.profiler)
+
+    def _restart_built_on(self, cand: Candidate) -> None:
+        redo = []
+        for entry in list(self._in_flight):
+            if isinstance(entry, _InFlight) and entry.cand is cand:
+                self._in_flight.remove(entry)
+                entry.o_file.add_done_callback(_release_compiled)
+                redo.append(entry.seed[0])
+        if self._cur_cand is cand:
+            self._cur_cand = None
+        for seed in redo:
+            self.start_candidate(seed)
+
     def should_output(self, result: CandidateResult) -> bool:
         """Check whether a result should be outputted. This must be more liberal
         in child processes than in parent ones, or else sources will be missing."""
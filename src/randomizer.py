@@ -21,7 +21,7 @@ from typing import (
 from pycparser import c_ast as ca
 
 from . import ast_util
-from .ast_util import Block, Indices, Statement, Expression
+from .ast_util import Block, Indices, N, Statement, Expression, own
 from .ast_types import (
     SimpleType,
     Type,
@@ -263,90 +263,113 @@ def find_var_reads(top_node: ca.Node) -> List[ca.ID]:
     return ret
 
 
-def visit_replace(top_node: ca.Node, callback: Callable[[ca.Node, bool], Any]) -> None:
+def visit_replace(
+    top_node: N,
+    callback: Callable[[ca.Node, bool], Any],
+    indices: Optional[Indices] = None,
+) -> N:
+    """Replace the nodes for which the callback returns a new node, below
+    top_node. Given the indices of a randomization step, the nodes from its
+    start are left as they are, and copied when their children change (see
+    ast_util.own); the top node to use is returned."""
+
     def empty_statement_to_none(node: Any) -> Any:
         if isinstance(node, ca.EmptyStatement):
             return None
         return node
 
     def rec(orig_node: ca.Node, toplevel: bool = False, *, lvalue: bool = False) -> Any:
-        node: "ca.AnyNode" = typing.cast("ca.AnyNode", orig_node)
-        repl = callback(node, not toplevel and not lvalue)
+        repl = callback(orig_node, not toplevel and not lvalue)
         if repl:
             return repl
+        node: "ca.AnyNode" = typing.cast("ca.AnyNode", orig_node)
+
+        def set_child(name: str, value: Any, index: Optional[int] = None) -> None:
+            nonlocal node
+            old = getattr(node, name)
+            if (old if index is None else old[index]) is value:
+                return
+            if node is orig_node and indices is not None and node in indices.starts:
+                node = ast_util.clone_node(node)
+                indices.copies[orig_node] = node
+            if index is None:
+                setattr(node, name, value)
+            else:
+                getattr(node, name)[index] = value
+
         if isinstance(node, ca.Assignment):
-            node.lvalue = rec(node.lvalue, lvalue=True)
-            node.rvalue = rec(node.rvalue)
+            set_child("lvalue", rec(node.lvalue, lvalue=True))
+            set_child("rvalue", rec(node.rvalue))
         elif isinstance(node, ca.StructRef):
-            node.name = rec(node.name, lvalue=(lvalue and node.type == "."))
+            set_child("name", rec(node.name, lvalue=(lvalue and node.type == ".")))
         elif isinstance(node, ca.Cast):
             if node.expr:
-                node.expr = rec(node.expr)
+                set_child("expr", rec(node.expr))
         elif isinstance(node, (ca.Constant, ca.ID)):
             pass
         elif isinstance(node, ca.UnaryOp):
             if node.op in ["p++", "p--", "++", "--", "&"]:
-                node.expr = rec(node.expr, lvalue=True)
+                set_child("expr", rec(node.expr, lvalue=True))
             elif node.op != "sizeof":
-                node.expr = rec(node.expr)
+                set_child("expr", rec(node.expr))
         elif isinstance(node, ca.BinaryOp):
-            node.left = rec(node.left)
-            node.right = rec(node.right)
+            set_child("left", rec(node.left))
+            set_child("right", rec(node.right))
         elif isinstance(node, ca.FuncCall):
             # not worth replacing .name if it's a normal function call
             if not isinstance(node.name, ca.ID):
-                node.name = rec(node.name)
+                set_child("name", rec(node.name))
             if node.args:
-                rec(node.args, True)
+                set_child("args", rec_unreplaced(node.args))
         elif isinstance(node, ca.ExprList):
             for i in range(len(node.exprs)):
                 if not isinstance(node.exprs[i], ca.Typename):
-                    node.exprs[i] = rec(node.exprs[i])
+                    set_child("exprs", rec(node.exprs[i]), i)
         elif isinstance(node, ca.ArrayRef):
-            node.name = rec(node.name, lvalue=lvalue)
-            node.subscript = rec(node.subscript)
+            set_child("name", rec(node.name, lvalue=lvalue))
+            set_child("subscript", rec(node.subscript))
         elif isinstance(node, ca.TernaryOp):
-            node.cond = rec(node.cond)
-            node.iftrue = rec(node.iftrue, True)
-            node.iffalse = rec(node.iffalse, True)
+            set_child("cond", rec(node.cond))
+            set_child("iftrue", rec(node.iftrue, True))
+            set_child("iffalse", rec(node.iffalse, True))
         elif isinstance(node, ca.Return):
             if node.expr:
-                node.expr = rec(node.expr)
+                set_child("expr", rec(node.expr))
         elif isinstance(node, ca.Decl):
             if node.init:
-                node.init = rec(node.init, isinstance(node.init, ca.InitList))
+                set_child("init", rec(node.init, isinstance(node.init, ca.InitList)))
         elif isinstance(node, ca.For):
             if node.init:
-                node.init = empty_statement_to_none(rec(node.init, True))
+                set_child("init", empty_statement_to_none(rec(node.init, True)))
             if node.cond:
-                node.cond = rec(node.cond)
+                set_child("cond", rec(node.cond))
             if node.next:
-                node.next = empty_statement_to_none(rec(node.next, True))
-            node.stmt = rec(node.stmt, True)
+                set_child("next", empty_statement_to_none(rec(node.next, True)))
+            set_child("stmt", rec(node.stmt, True))
         elif isinstance(node, ca.Compound):
             if node.block_items:
                 for i, sub in enumerate(node.block_items):
-                    node.block_items[i] = rec(sub, True)
+                    set_child("block_items", rec(sub, True), i)
         elif isinstance(node, (ca.Case, ca.Default)):
             if node.stmts:
                 for i, sub in enumerate(node.stmts):
-                    node.stmts[i] = rec(sub, True)
+                    set_child("stmts", rec(sub, True), i)
         elif isinstance(node, ca.While):
-            node.cond = rec(node.cond)
-            node.stmt = rec(node.stmt, True)
+            set_child("cond", rec(node.cond))
+            set_child("stmt", rec(node.stmt, True))
         elif isinstance(node, ca.DoWhile):
-            node.stmt = rec(node.stmt, True)
-            node.cond = rec(node.cond)
+            set_child("stmt", rec(node.stmt, True))
+            set_child("cond", rec(node.cond))
         elif isinstance(node, ca.Switch):
-            node.cond = rec(node.cond)
-            node.stmt = rec(node.stmt, True)
+            set_child("cond", rec(node.cond))
+            set_child("stmt", rec(node.stmt, True))
         elif isinstance(node, ca.Label):
-            node.stmt = rec(node.stmt, True)
+            set_child("stmt", rec(node.stmt, True))
         elif isinstance(node, ca.If):
-            node.cond = rec(node.cond)
-            node.iftrue = rec(node.iftrue, True)
+            set_child("cond", rec(node.cond))
+            set_child("iftrue", rec(node.iftrue, True))
             if node.iffalse:
-                node.iffalse = rec(node.iffalse, True)
+                set_child("iffalse", rec(node.iffalse, True))
         elif isinstance(
             node,
             (
@@ -382,20 +405,35 @@ def visit_replace(top_node: ca.Node, callback: Callable[[ca.Node, bool], Any]) -
             assert False, f"Node with unknown type: {node}"
         return node
 
-    rec(top_node, True)
+    def rec_unreplaced(node: ca.Node) -> Any:
+        """rec, except that the node itself is not replaced (but may have been
+        copied)."""
+        ret = rec(node, True)
+        if indices is not None and indices.copies.get(node) is ret:
+            return ret
+        return node
 
+    return typing.cast(N, rec_unreplaced(top_node))
 
-def replace_subexprs(top_node: ca.Node, callback: Callable[[Expression], Any]) -> None:
+
+def replace_subexprs(
+    top_node: N,
+    callback: Callable[[Expression], Any],
+    indices: Optional[Indices] = None,
+) -> N:
     def expr_filter(node: ca.Node, is_expr: bool) -> Any:
         if not is_expr:
             return None
         return callback(typing.cast(Expression, node))
 
-    visit_replace(top_node, expr_filter)
+    return visit_replace(top_node, expr_filter, indices)
 
 
-def replace_node(top_node: ca.Node, old: ca.Node, new: ca.Node) -> None:
-    visit_replace(top_node, lambda node, _: new if node is old else None)
+def replace_node(fn: ca.FuncDef, indices: Indices, old: ca.Node, new: ca.Node) -> None:
+    """Replace a node within the body of the function."""
+    fn.body = visit_replace(
+        fn.body, lambda node, _: new if node is old else None, indices
+    )
 
 
 def random_bool(random: Random, prob: float) -> bool:
@@ -774,16 +812,17 @@ def perm_temp_for_expr(
             return ret
         return None
 
-    replace_subexprs(fn.body, replacer)
+    fn.body = replace_subexprs(fn.body, replacer, indices)
 
     # Step 6: insert the assignment and any new variable declaration
     if place is not None:
         block, index, _ = place
         assignment = ca.Assignment("=", ca.ID(var), expr)
-        ast_util.insert_statement(block, index, assignment)
+        ast_util.insert_statement(own(fn, indices, block), index, assignment)
     if not reused:
         if random_bool(random, PROB_RANDOMIZE_TYPE):
             type = randomize_type(type, typemap, random)
+        own(fn, indices, fn.body)
         ast_util.insert_decl(fn, var, type, random)
 
 
@@ -860,9 +899,9 @@ def perm_expand_expr(
                 return ca.EmptyStatement()
         return None
 
-    visit_replace(fn.body, callback)
+    fn.body = visit_replace(fn.body, callback, indices)
     if not keep_var and isinstance(write, ca.Decl):
-        write.init = None
+        own(fn, indices, write).init = None
 
 
 def perm_randomize_internal_type(
@@ -897,7 +936,9 @@ def perm_randomize_internal_type(
     ensure(decls)
     decl = random.choice(decls)
     assert isinstance(decl.type, ca.TypeDecl), "checked above"
-    decl.type = randomize_type(decl.type, typemap, random, ensure_changed=True)
+    new_type = randomize_type(decl.type, typemap, random, ensure_changed=True)
+    decl = own(fn, indices, decl)
+    decl.type = new_type
     set_decl_name(decl)
 
 
@@ -1073,7 +1114,7 @@ def perm_refer_to_var(
 
     stmt = ca.If(cond=cond, iftrue=ca.Compound(block_items=[]), iffalse=None)
     tob, toi, _, _ = random.choice(ins_cands)
-    ast_util.insert_statement(tob, toi, stmt)
+    ast_util.insert_statement(own(fn, indices, tob), toi, stmt)
 
 
 def perm_ins_block(
@@ -1090,7 +1131,7 @@ def perm_ins_block(
             ast_util.for_nested_blocks(stmt, rec)
 
     rec(fn.body)
-    block = random.choice(cands)
+    block = own(fn, indices, random.choice(cands))
     stmts = ast_util.get_block_stmts(block, True)
     decl_count = 0
     for stmt in stmts:
@@ -1157,6 +1198,7 @@ def perm_empty_stmt(
         stmts = [ca.EmptyStatement()]
 
     tob, toi, _, _ = random.choice(cands)
+    tob = own(fn, indices, tob)
     stmts.insert(0, ca.Pragma("_permuter sameline start"))
     stmts.append(ca.Pragma("_permuter sameline end"))
     for stmt in stmts[::-1]:
@@ -1180,10 +1222,12 @@ def perm_sameline(
     # Insert the second statement first, since inserting a statement may cause
     # later indices to move.
     ast_util.insert_statement(
-        cands[j][0], cands[j][1], ca.Pragma("_permuter sameline end")
+        own(fn, indices, cands[j][0]), cands[j][1], ca.Pragma("_permuter sameline end")
     )
     ast_util.insert_statement(
-        cands[i][0], cands[i][1], ca.Pragma("_permuter sameline start")
+        own(fn, indices, cands[i][0]),
+        cands[i][1],
+        ca.Pragma("_permuter sameline start"),
     )
 
 
@@ -1202,7 +1246,7 @@ def perm_commutative(
 
     Visitor().visit(fn.body)
     ensure(cands)
-    node = random.choice(cands)
+    node = own(fn, indices, random.choice(cands))
     node.left, node.right = node.right, node.left
     if node.op[0] == "<":
         node.op = ">" + node.op[1:]
@@ -1224,12 +1268,14 @@ def perm_add_sub(
 
     Visitor().visit(fn.body)
     ensure(cands)
-    node = random.choice(cands)
+    node = own(fn, indices, random.choice(cands))
     node.left, node.right = node.right, node.left
     node.op = "+" if node.op == "-" else "-"
     if isinstance(node.right, ca.Constant):
         val = node.right.value
-        node.right.value = val[1:] if val.startswith("-") else "-" + val
+        own(fn, indices, node.right).value = (
+            val[1:] if val.startswith("-") else "-" + val
+        )
     elif isinstance(node.right, ca.UnaryOp) and node.right.op == "-":
         assert not isinstance(node.right.expr, ca.Typename)
         node.right = node.right.expr
@@ -1277,9 +1323,9 @@ def perm_condition(
             and node.cond.right.value in ["0", "0U", "0.0", "0.0f"]
         )
         if node.cond.op == "==":
-            node.cond = ca.UnaryOp("!", node.cond.left)
+            own(fn, indices, node).cond = ca.UnaryOp("!", node.cond.left)
         else:
-            node.cond = node.cond.left
+            own(fn, indices, node).cond = node.cond.left
     else:
         expr = node.cond
         op = "!="
@@ -1295,7 +1341,7 @@ def perm_condition(
                 (ca.Constant("float", "0.0f"), 0.05),
             ],
         )
-        node.cond = ca.BinaryOp(op, expr, zero)
+        own(fn, indices, node).cond = ca.BinaryOp(op, expr, zero)
 
 
 def perm_add_self_assignment(
@@ -1320,7 +1366,7 @@ def perm_add_self_assignment(
         assignment = ca.Assignment("=", ca.ID(var), ca.ID(var))
     else:
         assignment = ca.Assignment("+=", ca.ID(var), ca.Constant("int", "0"))
-    ast_util.insert_statement(where[0], where[1], assignment)
+    ast_util.insert_statement(own(fn, indices, where[0]), where[1], assignment)
 
 
 def perm_dummy_comma_expr(
@@ -1331,7 +1377,7 @@ def perm_dummy_comma_expr(
     ensure(cands)
     expr = random.choice(cands)
     new_expr = ca.ExprList([ca.Constant("int", "0"), expr])
-    replace_node(fn.body, expr, new_expr)
+    replace_node(fn, indices, expr, new_expr)
 
 
 def perm_reorder_stmts(
@@ -1403,13 +1449,14 @@ def perm_reorder_stmts(
         assert from_stmt.init is not None
         assert not isinstance(from_stmt.init, ca.InitList)
         assignment = ca.Assignment("=", ca.ID(from_stmt.name), from_stmt.init)
-        ast_util.insert_statement(tob, toi, assignment)
-        from_stmt.init = None
+        ast_util.insert_statement(own(fn, indices, tob), toi, assignment)
+        own(fn, indices, from_stmt).init = None
     else:
         if fromb == tob and fromi < toi:
             toi -= 1
+        fromb = own(fn, indices, fromb)
         stmt = ast_util.get_block_stmts(fromb, True).pop(fromi)
-        ast_util.insert_statement(tob, toi, stmt)
+        ast_util.insert_statement(own(fn, indices, tob), toi, stmt)
 
 
 def perm_reorder_decls(
@@ -1477,8 +1524,9 @@ def perm_reorder_decls(
     if fromb == tob and fromi < toi:
         toi -= 1
 
+    fromb = own(fn, indices, fromb)
     stmt = ast_util.get_block_stmts(fromb, True).pop(fromi)
-    ast_util.insert_statement(tob, toi, stmt)
+    ast_util.insert_statement(own(fn, indices, tob), toi, stmt)
 
 
 def perm_compound_assignment(
@@ -1501,7 +1549,7 @@ def perm_compound_assignment(
 
     Visitor().visit(fn.body)
     ensure(cands)
-    node = random.choice(cands)
+    node = own(fn, indices, random.choice(cands))
 
     if node.op == "=":
         assert isinstance(node.rvalue, ca.BinaryOp)
@@ -1530,7 +1578,7 @@ def perm_inequalities(
     Visitor().visit(fn.body)
     ensure(cands)
 
-    node = random.choice(cands)
+    node = own(fn, indices, random.choice(cands))
 
     # Does not simplify, 'a <= (b + 1)' becomes 'a < ((b + 1) + 1)'
 
@@ -1593,7 +1641,7 @@ def perm_add_mask(
         for _ in range(random.randrange(12)):
             new_expr = ca.BinaryOp("&", new_expr, ca.Constant("int", mask))
 
-    replace_node(fn.body, expr, new_expr)
+    replace_node(fn, indices, expr, new_expr)
 
 
 def perm_xor_zero(
@@ -1619,7 +1667,7 @@ def perm_xor_zero(
     else:
         raise RandomizationFailure
 
-    replace_node(fn.body, expr, new_expr)
+    replace_node(fn, indices, expr, new_expr)
 
 
 def perm_mult_zero(
@@ -1648,7 +1696,7 @@ def perm_mult_zero(
 
     new_expr = ca.BinaryOp("*", copy.deepcopy(expr), zero)
 
-    replace_node(fn.body, zero, new_expr)
+    replace_node(fn, indices, zero, new_expr)
 
 
 def perm_float_literal(
@@ -1691,7 +1739,7 @@ def perm_float_literal(
     else:
         type = "int"
 
-    replace_node(fn.body, node, ca.Constant(type, value))
+    replace_node(fn, indices, node, ca.Constant(type, value))
 
 
 def perm_cast_simple(
@@ -1721,7 +1769,7 @@ def perm_cast_simple(
     # Surround the original expression with a cast to the chosen type
     typedecl = ca.TypeDecl(None, [], [], ca.IdentifierType(new_type))
     new_expr = ca.Cast(ca.Typename(None, [], [], typedecl), expr)
-    replace_node(fn.body, expr, new_expr)
+    replace_node(fn, indices, expr, new_expr)
 
 
 # struct_ref          # type of a         # easiest conversion
@@ -1788,7 +1836,7 @@ def perm_struct_ref(
         # TODO: Permute binops like to_binop() does
         if node.op == "-":
             # Convert to a[-b]
-            node.right = ca.UnaryOp("-", node.right)
+            return ca.ArrayRef(node.left, ca.UnaryOp("-", node.right))
         return ca.ArrayRef(node.left, node.right)
 
     def to_binop(node: ca.ArrayRef) -> ca.BinaryOp:
@@ -1838,11 +1886,11 @@ def perm_struct_ref(
         elif isinstance(parent, ca.UnaryOp):
             return parent.expr
 
-    struct_ref = random.choice(cands)
+    struct_ref = own(fn, indices, random.choice(cands))
     parent: Union[ca.StructRef, ca.UnaryOp]
 
     # Step 1: Find the parent of the leaf node
-    parent = rec(struct_ref)
+    parent = own(fn, indices, rec(struct_ref))
 
     changed = False
 
@@ -1945,16 +1993,16 @@ def perm_split_assignment(
         side = split.left
         sidetype = decayed_expr_type(side, typemap)
         ensure(same_type(vartype, sidetype, typemap, allow_similar=True))
-        split.left = copy.deepcopy(var)
+        own(fn, indices, split).left = copy.deepcopy(var)
     else:
         side = split.right
         sidetype = decayed_expr_type(side, typemap)
         ensure(same_type(vartype, sidetype, typemap, allow_similar=True))
-        split.right = copy.deepcopy(var)
+        own(fn, indices, split).right = copy.deepcopy(var)
 
     # The assignment is always inserted before the original
     new_assign = ca.Assignment("=", copy.deepcopy(var), side)
-    ast_util.insert_statement(ins_block, ins_index, new_assign)
+    ast_util.insert_statement(own(fn, indices, ins_block), ins_index, new_assign)
 
 
 def perm_remove_ast(
@@ -1999,7 +2047,7 @@ def perm_remove_ast(
     ensure(cands)
 
     cand, expr = random.choice(cands)
-    replace_node(fn.body, cand, expr)
+    replace_node(fn, indices, cand, expr)
 
 
 def perm_duplicate_assignment(
@@ -2023,7 +2071,7 @@ def perm_duplicate_assignment(
 
     dup = copy.deepcopy(cand)
     tob, toi, _, _ = random.choice(ins_cands)
-    ast_util.insert_statement(tob, toi, dup)
+    ast_util.insert_statement(own(fn, indices, tob), toi, dup)
 
 
 def perm_chain_assignment(
@@ -2058,7 +2106,7 @@ def perm_chain_assignment(
     ensure(cands)
     chosen_assignment_idx, next_stmt_idx, block = random.choice(cands)
 
-    statements = ast_util.get_block_stmts(block, True)
+    statements = ast_util.get_block_stmts(own(fn, indices, block), True)
     stmt = statements[chosen_assignment_idx]
     next_stmt = statements[next_stmt_idx]
 
@@ -2125,10 +2173,10 @@ def perm_long_chain_assignment(
     if a + 3 <= b:
         start_idx, end_idx = a, b
 
-    statements = ast_util.get_block_stmts(block, True)
+    statements = ast_util.get_block_stmts(own(fn, indices, block), True)
 
     # Merge all statements into long chain assignment at start_idx
-    stmt = statements[start_idx]
+    stmt = own(fn, indices, statements[start_idx])
     assert isinstance(stmt, ca.Assignment)
     for i in range(start_idx + 1, end_idx):
         additional_stmt = statements[i]
@@ -2162,6 +2210,7 @@ def perm_pad_var_decl(
         var = f"pad{counter}"
 
     type = random_type(random)
+    own(fn, indices, fn.body)
     ast_util.insert_decl(fn, var, type, random)
 
 
@@ -2273,7 +2322,7 @@ def perm_inline(
             # cut any longer.
             continue
         fn_call = ca.FuncCall(ca.ID(new_fn_name), ca.ExprList(list(args)))
-        replace_node(fn.body, expr, fn_call)
+        replace_node(fn, indices, expr, fn_call)
 
     params = []
     for i, (cut, tp) in enumerate(cut_types.items()):
@@ -2365,10 +2414,17 @@ class Randomizer:
         fn = ast_util.extract_fn(ast, fn_name)[0]
         indices = ast_util.compute_node_indices(fn)
         region = get_randomization_region(fn, indices, self.random)
+        start = ast_util.clone_node(fn)
         while True:
             method = random_weighted(self.random, self.methods)
             try:
                 method(fn, ast, indices, region, self.random)
                 break
             except RandomizationFailure:
-                pass
+                # Passes don't fail after changing the function, but may have
+                # copied nodes to change (indices don't cover those): go back
+                # to the nodes from the start, which are all unchanged
+                if indices.copies:
+                    for name in fn.__slots__[:-2]:  # type: ignore
+                        setattr(fn, name, getattr(start, name))
+                    indices.copies.clear()
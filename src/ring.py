@@ -0,0 +1,100 @@
+import atexit
+from multiprocessing.shared_memory import SharedMemory
+import struct
+import sys
+from typing import List, Tuple
+
+from .permuter import WorkSummary
+from .profiler import Profiler
+
+
+class SummaryRing:
+    """A single-producer, single-consumer ring buffer of WorkSummary records
+    in shared memory, from one worker process to the main one, so that the
+    summaries of batches don't go through the pickling and feeder thread of
+    a multiprocessing.Queue.
+
+    The header holds the number of records written (by the worker) and read
+    (by the main process); each record starts with its own number + 1, which
+    the reader checks, so a half-written record is left for the next read.
+
+    The main process creates and unlinks the ring; a worker is given only its
+    name, and attaches to it (forked or spawned)."""
+
+    HEADER = struct.Struct("<QQ")
+    RECORD = struct.Struct("<QiIIq?4d")
+
+    def __init__(self, slots: int = 64) -> None:
+        self.slots = slots
+        size = self.HEADER.size + slots * self.RECORD.size
+        self.shm = SharedMemory(create=True, size=size)
+        assert self.shm.buf is not None
+        self.buf = self.shm.buf
+        self.HEADER.pack_into(self.buf, 0, 0, 0)
+        self.unlinked = False
+        # Also on Ctrl+C (workers don't run this)
+        atexit.register(self.unlink)
+
+    def __getstate__(self) -> Tuple[str, int]:
+        return (self.shm.name, self.slots)
+
+    def __setstate__(self, state: Tuple[str, int]) -> None:
+        name, self.slots = state
+        # (Before 3.13 this registers it again with the main process's
+        # resource tracker, which keeps a set, so the unlink still matches.)
+        if sys.version_info >= (3, 13):
+            self.shm = SharedMemory(name, track=False)
+        else:
+            self.shm = SharedMemory(name)
+        assert self.shm.buf is not None
+        self.buf = self.shm.buf
+        self.unlinked = True
+
+    def _offset(self, index: int) -> int:
+        return self.HEADER.size + (index % self.slots) * self.RECORD.size
+
+    def put(self, summary: WorkSummary) -> bool:
+        """Append a summary; False when the ring is full."""
+        written, read = self.HEADER.unpack_from(self.buf, 0)
+        if written - read >= self.slots:
+            return False
+        profiler = summary.profiler or Profiler()
+        times = [profiler.time_stats[e] for e in Profiler.StatType]
+        self.RECORD.pack_into(
+            self.buf,
+            self._offset(written),
+            0,
+            summary.perm_index,
+            summary.count,
+            summary.errors,
+            summary.best_score,
+            summary.profiler is not None,
+            *times,
+        )
+        struct.pack_into("<Q", self.buf, self._offset(written), written + 1)
+        struct.pack_into("<Q", self.buf, 0, written + 1)
+        return True
+
+    def get_all(self) -> List[WorkSummary]:
+        """Take the summaries written since the last call."""
+        written, read = self.HEADER.unpack_from(self.buf, 0)
+        out: List[WorkSummary] = []
+        while read < written:
+            fields = self.RECORD.unpack_from(self.buf, self._offset(read))
+            if fields[0] != read + 1:
+                break
+            profiler = None
+            if fields[5]:
+                profiler = Profiler()
+                for stat, time_taken in zip(Profiler.StatType, fields[6:]):
+                    profiler.add_stat(stat, time_taken)
+            perm_index, count, errors, best_score = fields[1:5]
+            out.append(WorkSummary(perm_index, count, errors, best_score, profiler))
+            read += 1
+        struct.pack_into("<Q", self.buf, 8, read)
+        return out
+
+    def unlink(self) -> None:
+        if not self.unlinked:
+            self.unlinked = True
+            self.shm.unlink()
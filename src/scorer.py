@@ -4,7 +4,27 @@ import re
 from typing import Tuple, List, Optional
 from collections import Counter
 
-from .objdump import ArchSettings, Line, objdump, get_arch
+from . import objdump as objdump_module
+from .objdump import (
+    MDASM_BLOCK_DIFF,
+    ArchSettings,
+    Line,
+    MDasmUnsupported,
+    get_arch,
+    get_library,
+    get_mdasm,
+    native_normalize_flags,
+    objdump,
+)
+
+# Score through MDasm2's port of score() (the library or the server) instead of
+# difflib, when possible. The result is identical, except for functions of 256+
+# lines with block_diff, which are diffed block by block.
+use_native_scorer = True
+
+# Let the native scorer skip candidates that can't score as well as a bound
+# (the permuter's base score), reporting a lower bound of their score instead.
+use_score_bound = True
 
 
 class Scorer:
@@ -16,25 +36,89 @@ class Scorer:
     PENALTY_INSERTION = 100
     PENALTY_DELETION = 100
 
-    def __init__(self, target_o: str, *, stack_differences: bool, debug_mode: bool):
+    def __init__(
+        self,
+        target_o: str,
+        *,
+        stack_differences: bool,
+        debug_mode: bool,
+        function: Optional[str] = None,
+        cache: Optional[str] = None,
+        block_diff: bool = False,
+        index: Optional[str] = None,
+    ):
         self.target_o = target_o
         self.arch = get_arch(target_o)
         self.stack_differences = stack_differences
         self.debug_mode = debug_mode
-        _, self.target_seq = self._objdump(target_o)
-        self.differ: difflib.SequenceMatcher[str] = difflib.SequenceMatcher(
-            autojunk=False
+        self.function = function
+        self.cache = cache
+        self.block_diff = block_diff
+        self.index = index
+        self._target_seq: Optional[List[Line]] = None
+        self._differ: Optional["difflib.SequenceMatcher[str]"] = None
+        self.native = (
+            use_native_scorer
+            and (objdump_module.use_server or get_library(self.arch) is not None)
+            and not objdump_module.ign_regs
+            and self.arch.name == "mips"
+            and not debug_mode
+        )
+        if self.native:
+            # Load the target now, so that forked workers inherit it (or its
+            # index file, for servers) instead of each normalizing it again
+            get_mdasm(self.arch).target(
+                target_o, self._native_flags(), function, cache, index
+            )
+
+    @property
+    def target_seq(self) -> List[Line]:
+        """The target's lines for the Python scorer, normalized on first use."""
+        if self._target_seq is None:
+            _, self._target_seq = self._objdump(self.target_o)
+        return self._target_seq
+
+    @property
+    def differ(self) -> "difflib.SequenceMatcher[str]":
+        if self._differ is None:
+            self._differ = difflib.SequenceMatcher(autojunk=False)
+            self._differ.set_seq2([line.mnemonic for line in self.target_seq])
+        return self._differ
+
+    def _native_flags(self) -> int:
+        return native_normalize_flags(self.stack_differences) | (
+            MDASM_BLOCK_DIFF if self.block_diff else 0
         )
-        self.differ.set_seq2([line.mnemonic for line in self.target_seq])
 
     def _objdump(self, o_file: str) -> Tuple[str, List[Line]]:
-        lines = objdump(o_file, self.arch, stack_differences=self.stack_differences)
+        lines = objdump(
+            o_file,
+            self.arch,
+            stack_differences=self.stack_differences,
+            function=self.function,
+        )
         return "\n".join([line.row for line in lines]), lines
 
-    def score(self, cand_o: Optional[str]) -> Tuple[int, str]:
+    def score(
+        self, cand_o: Optional[str], bound: Optional[int] = None
+    ) -> Tuple[int, Optional[str]]:
         if not cand_o:
             return Scorer.PENALTY_INF, ""
 
+        if self.native:
+            try:
+                return get_mdasm(self.arch).score(
+                    self.target_o,
+                    cand_o,
+                    self._native_flags(),
+                    self.function,
+                    self.cache,
+                    bound if use_score_bound else None,
+                    self.index,
+                )
+            except MDasmUnsupported:
+                pass
+
         objdump_output, cand_seq = self._objdump(cand_o)
 
         num_stack_penalties = 0
@@ -201,3 +285,34 @@ class Scorer:
         )
 
         return (final_score, hashlib.sha256(objdump_output.encode()).hexdigest())
+
+
+if __name__ == "__main__":
+    # Check the native scorer against difflib on a corpus of objects, and time
+    # both: python3 -m src.scorer target.o cand1.o cand2.o...
+    import sys
+    import time
+
+    if len(sys.argv) < 3:
+        print(f"Usage: {sys.argv[0]} target.o cand.o...", file=sys.stderr)
+        sys.exit(1)
+
+    target_o, cands = sys.argv[1], sys.argv[2:]
+    scorer = Scorer(target_o, stack_differences=False, debug_mode=False)
+    timings = {}
+    results = {}
+    for native in [False, True]:
+        scorer.native = native
+        start = time.monotonic()
+        results[native] = [scorer.score(cand) for cand in cands]
+        timings[native] = time.monotonic() - start
+
+    mismatches = 0
+    for cand, python_result, native_result in zip(cands, results[False], results[True]):
+        if python_result != native_result:
+            mismatches += 1
+            print(f"{cand}: difflib {python_result} != native {native_result}")
+    print(f"{len(cands) - mismatches}/{len(cands)} identical")
+    for native in [False, True]:
+        name = "native" if native else "difflib"
+        print(f"{name}: {len(cands) / timings[native]:.1f} candidates/sec")
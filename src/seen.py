@@ -0,0 +1,162 @@
+import hashlib
+import json
+import math
+import mmap
+import os
+import struct
+from typing import List, Mapping, Optional, Tuple
+
+# Bits set per source, and the false positive rate the capacity is sized for
+SEEN_HASHES = 8
+SEEN_FALSE_POSITIVES = 0.01
+# Memory for the filter by default (about 835000 sources per MiB)
+SEEN_DEFAULT_MB = 16
+SEEN_BLOCK_BITS = 512
+
+
+def seen_false_positives(load: float) -> float:
+    """The false positive rate of the filter with an average of load sources
+    per block. Sources pick their block at random, so the number in a block
+    is Poisson distributed, and the rate is that of a 512-bit bloom filter
+    averaged over it; fuller blocks make it higher than for an unblocked
+    filter of the same size (1.18% instead of 1% at the load the classic
+    formula gives)."""
+    rate = 0.0
+    p = math.exp(-load)
+    i = 0
+    while i < load + 10 * math.sqrt(load) + 20:
+        set_bit = 1 - (1 - 1 / SEEN_BLOCK_BITS) ** (SEEN_HASHES * i)
+        rate += p * set_bit**SEEN_HASHES
+        i += 1
+        p *= load / i
+    return rate
+
+
+def _max_block_load() -> float:
+    """The average number of sources per block at which the false positive
+    rate reaches SEEN_FALSE_POSITIVES (about 51)."""
+    low, high = 0.0, float(SEEN_BLOCK_BITS)
+    for _ in range(50):
+        mid = (low + high) / 2
+        if seen_false_positives(mid) <= SEEN_FALSE_POSITIVES:
+            low = mid
+        else:
+            high = mid
+    return low
+
+
+SEEN_BLOCK_LOAD = _max_block_load()
+
+
+def seen_key(paths: List[str], settings: Mapping[str, object]) -> bytes:
+    """The key of a filter: a digest of the given files and settings."""
+    h = hashlib.sha256()
+    for path in paths:
+        with open(path, "rb") as f:
+            h.update(hashlib.sha256(f.read()).digest())
+    h.update(json.dumps(settings, sort_keys=True).encode())
+    return h.digest()
+
+
+class SeenFilter:
+    """The digests of the candidate sources already tried, in a blocked bloom
+    filter of fixed size: each digest sets SEEN_HASHES bits within one 64-byte
+    block, chosen by its first 8 bytes, with the positions taken from the next
+    ones. The capacity is the number of sources for which a new one is wrongly
+    taken for seen with a probability of SEEN_FALSE_POSITIVES, from the
+    blocked filter's rate (seen_false_positives()); it is lower before, and
+    when that many sources have been added, the filter starts over.
+
+    With a path, the filter is that file (seen_sources.bin in the function
+    directory), which a restarted run reuses as long as it was made for the
+    same key: a digest of what decides how a source scores (target.o, the
+    compile script and the settings), so that sources aren't skipped after
+    any of those changed. Workers map the file on their own, whether forked
+    or spawned. Without a path the filter is anonymous memory, shared with
+    forked workers only; a spawned worker starts an empty one of its own.
+    Workers may race on a block and lose a bit, which only costs a compile."""
+
+    MAGIC = b"SEEN"
+    VERSION = 2
+    BLOCK = 64
+    # magic, version, hashes, key, blocks, added
+    HEADER = struct.Struct("<4sII32sQQ")
+
+    def __init__(self, path: Optional[str], memory_mb: float, key: bytes = b"") -> None:
+        self.path = path
+        self.key = key
+        self.blocks = max(int(memory_mb * (1 << 20)) // self.BLOCK, 1)
+        self.capacity = int(self.blocks * SEEN_BLOCK_LOAD)
+        self._open(check_header=True)
+
+    def _open(self, check_header: bool) -> None:
+        size = self.HEADER.size + self.blocks * self.BLOCK
+        header = self.HEADER.pack(
+            self.MAGIC, self.VERSION, SEEN_HASHES, self.key, self.blocks, 0
+        )
+
+        if self.path is None:
+            self.map = mmap.mmap(-1, size)
+            self.map[: self.HEADER.size] = header
+            return
+
+        fd = os.open(self.path, os.O_RDWR | os.O_CREAT, 0o644)
+        try:
+            existing = os.read(fd, self.HEADER.size)
+            # Made for another target or settings: start over
+            same = self.HEADER.size - 8
+            if check_header and (
+                len(existing) < self.HEADER.size or existing[:same] != header[:same]
+            ):
+                os.ftruncate(fd, 0)
+                os.ftruncate(fd, size)
+                os.pwrite(fd, header, 0)
+            self.map = mmap.mmap(fd, size)
+        finally:
+            os.close(fd)
+
+    def __getstate__(self) -> Tuple[Optional[str], bytes, int, int]:
+        return (self.path, self.key, self.blocks, self.capacity)
+
+    def __setstate__(self, state: Tuple[Optional[str], bytes, int, int]) -> None:
+        self.path, self.key, self.blocks, self.capacity = state
+        self._open(check_header=False)
+
+    def added(self) -> int:
+        """Sources added since the filter was created or started over
+        (approximately, as concurrent workers may miss each other's)."""
+        return int(self.HEADER.unpack_from(self.map, 0)[-1])
+
+    def _bits(self, digest: bytes) -> Tuple[int, int, int]:
+        """The offset of a digest's block, the block, and the digest's bits."""
+        block = int.from_bytes(digest[:8], "little") % self.blocks
+        offset = self.HEADER.size + block * self.BLOCK
+        positions = int.from_bytes(digest[8:24], "little")
+        mask = 0
+        for _ in range(SEEN_HASHES):
+            mask |= 1 << (positions % SEEN_BLOCK_BITS)
+            positions >>= 9
+        bits = int.from_bytes(self.map[offset : offset + self.BLOCK], "little")
+        return offset, bits, mask
+
+    def __contains__(self, digest: bytes) -> bool:
+        """Whether a digest was (probably) recorded, without recording it."""
+        _, bits, mask = self._bits(digest)
+        return bits & mask == mask
+
+    def add(self, digest: bytes) -> bool:
+        """Record the sha256 digest of a source; False if it was (probably)
+        recorded before."""
+        offset, bits, mask = self._bits(digest)
+        if bits & mask == mask:
+            return False
+        added = self.added() + 1
+        if added > self.capacity:
+            self.map[self.HEADER.size :] = bytes(self.blocks * self.BLOCK)
+            added = 1
+            bits = 0
+        self.map[offset : offset + self.BLOCK] = (bits | mask).to_bytes(
+            self.BLOCK, "little"
+        )
+        struct.pack_into("<Q", self.map, self.HEADER.size - 8, added)
+        return True
@@ -9,5 +9,7 @@
 from . import c_ast
 
 class CGenerator:
+    indent_level: int
     def __init__(self) -> None: ...
     def visit(self, node: c_ast.Node) -> str: ...
+    def _generate_stmt(self, n: c_ast.Node, add_indent: bool = ...) -> str: ...
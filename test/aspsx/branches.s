@@ -0,0 +1,98 @@
+	.file	1 "branches.c"
+gcc2_compiled.:
+__gnu_compiled_c:
+	.text
+	.align	2
+	.globl	cmp
+	.ent	cmp
+cmp:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	move	$2,$0
+	beq	$4,$5,$L2
+	addu	$2,$2,1
+$L2:
+	bne	$4,$0,$L3
+	addu	$2,$2,2
+$L3:
+	blt	$4,$5,$L4
+	addu	$2,$2,4
+$L4:
+	bge	$4,10,$L5
+	addu	$2,$2,8
+$L5:
+	bgtu	$4,$5,$L6
+	addu	$2,$2,16
+$L6:
+	bleu	$4,$0,$L7
+	addu	$2,$2,32
+$L7:
+	bgez	$4,$L8
+	addu	$2,$2,64
+$L8:
+	bltz	$5,$L9
+	addu	$2,$2,128
+$L9:
+	beqz	$2,$L10
+	bnez	$4,$L2
+$L10:
+	b	$L11
+	addu	$2,$2,256
+$L11:
+	j	$31
+	.end	cmp
+	.align	2
+	.globl	loop
+	.ent	loop
+loop:
+	.frame	$sp,24,$31		# vars= 0, regs= 2/0, args= 16, extra= 0
+	.mask	0x80010000,-4
+	.fmask	0x00000000,0
+	subu	$sp,$sp,24
+	sw	$16,16($sp)
+	sw	$31,20($sp)
+	move	$16,$4
+$L13:
+	jal	step
+	addu	$16,$16,-1
+	bgtz	$16,$L13
+	la	$2,cmp
+	jal	$2
+	lw	$31,20($sp)
+	lw	$16,16($sp)
+	addu	$sp,$sp,24
+	j	$31
+	.end	loop
+	.align	2
+	.globl	dispatch
+	.ent	dispatch
+dispatch:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	sltu	$2,$4,3
+	beq	$2,$0,$L20
+	sll	$2,$4,2
+	lw	$2,$L21($2)
+	j	$2
+	.rdata
+	.align	2
+$L21:
+	.word	$L17
+	.word	$L18
+	.word	$L19
+	.text
+$L17:
+	li	$2,1
+	j	$31
+$L18:
+	li	$2,2
+	j	$31
+$L19:
+	li	$2,3
+	j	$31
+$L20:
+	move	$2,$0
+	j	$31
+	.end	dispatch
@@ -0,0 +1,54 @@
+	.file	1 "gprel.c"
+gcc2_compiled.:
+__gnu_compiled_c:
+	.globl	counter
+	.sdata
+	.align	2
+counter:
+	.word	0
+	.globl	pair
+	.align	2
+pair:
+	.half	1
+	.half	2
+	.align	2
+local:
+	.word	9
+	.sbss
+	.align	2
+zeroed:
+	.space	4
+	.extern	ext_small, 4
+	.extern	ext_large, 16
+	.comm	flag,1
+	.lcomm	lbuf,8
+	.text
+	.align	2
+	.globl	tick
+	.ent	tick
+tick:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	lw	$2,counter
+	lh	$3,pair+2
+	lw	$4,local
+	lw	$5,zeroed
+	lw	$6,ext_small
+	lw	$7,ext_large
+	lbu	$8,flag
+	lw	$9,lbuf+4
+	addu	$2,$2,1
+	sw	$2,counter
+	sb	$0,flag
+	sw	$3,lbuf
+	la	$10,counter
+	la	$11,ext_large+8
+	addu	$2,$2,$4
+	addu	$2,$2,$5
+	addu	$2,$2,$6
+	addu	$2,$2,$7
+	addu	$2,$2,$8
+	addu	$2,$2,$9
+	j	$31
+	.end	tick
@@ -0,0 +1,68 @@
+	.file	1 "hazards.c"
+gcc2_compiled.:
+__gnu_compiled_c:
+	.text
+	.align	2
+	.globl	loads
+	.ent	loads
+loads:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	lw	$2,0($4)
+	addu	$2,$2,1
+	lw	$3,4($4)
+	lw	$5,8($4)
+	addu	$3,$3,$5
+	lbu	$6,12($4)
+	sb	$6,13($4)
+	lh	$7,14($4)
+	sw	$7,0($7)
+	lw	$8,16($4)
+	beq	$8,$0,$L2
+	lwl	$9,3($4)
+	lwr	$9,0($4)
+	addu	$2,$2,$9
+$L2:
+	lw	$4,20($4)
+	j	$31
+	.end	loads
+	.align	2
+	.globl	hilo
+	.ent	hilo
+hilo:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	mult	$4,$5
+	mflo	$2
+	mult	$2,$6
+	mfhi	$3
+	addu	$3,$3,1
+	multu	$3,$4
+	mflo	$2
+	mthi	$2
+	mfhi	$3
+	div	$0,$3,$4
+	mflo	$2
+	j	$31
+	.end	hilo
+	.align	2
+	.globl	manual
+	.ent	manual
+manual:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	.set	noreorder
+	lw	$2,0($4)
+	nop
+	addu	$2,$2,1
+	beq	$2,$0,$L5
+	sw	$2,0($4)
+	lw	$3,4($4)
+$L5:
+	.set	reorder
+	addu	$2,$2,$3
+	j	$31
+	.end	manual
@@ -0,0 +1,61 @@
+	.file	1 "hilo.c"
+gcc2_compiled.:
+__gnu_compiled_c:
+	.globl	table
+	.data
+	.align	2
+table:
+	.word	1
+	.word	2
+	.word	3
+	.word	4
+	.word	5
+	.word	6
+	.word	7
+	.word	8
+	.rdata
+	.align	2
+$LC0:
+	.ascii	"%d\n\000"
+	.text
+	.align	2
+	.globl	get
+	.ent	get
+get:
+	.frame	$sp,24,$31		# vars= 0, regs= 1/0, args= 16, extra= 0
+	.mask	0x80000000,-8
+	.fmask	0x00000000,0
+	subu	$sp,$sp,24
+	sw	$31,16($sp)
+	sll	$4,$4,2
+	lui	$2,%hi(table)
+	addiu	$2,$2,%lo(table)
+	addu	$4,$4,$2
+	lw	$5,0($4)
+	la	$4,$LC0
+	jal	printf
+	lw	$2,table+12
+	lw	$3,%lo(table+28)($4)
+	sw	$2,table+4
+	la	$6,table+16
+	lw	$31,16($sp)
+	addu	$sp,$sp,24
+	j	$31
+	.end	get
+	.comm	big,400
+	.align	2
+	.globl	put
+	.ent	put
+put:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	sw	$4,big
+	sh	$5,big+200
+	sb	$6,big+399
+	lbu	$2,big+1
+	lh	$3,big+2($4)
+	addu	$2,$2,$3
+	la	$4,big+40($5)
+	j	$31
+	.end	put
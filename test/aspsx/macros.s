@@ -0,0 +1,53 @@
+	.file	1 "macros.c"
+gcc2_compiled.:
+__gnu_compiled_c:
+	.text
+	.align	2
+	.globl	consts
+	.ent	consts
+consts:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	li	$2,0x00000005		# 5
+	li	$3,-1
+	li	$4,0x00008000		# 32768
+	li	$5,0x00010000		# 65536
+	li	$6,0x12345678		# 305419896
+	li	$7,-32769
+	move	$8,$4
+	neg	$9,$5
+	negu	$10,$6
+	not	$11,$7
+	addu	$2,$2,$3
+	j	$31
+	.end	consts
+	.align	2
+	.globl	arith
+	.ent	arith
+arith:
+	.frame	$sp,0,$31		# vars= 0, regs= 0/0, args= 0, extra= 0
+	.mask	0x00000000,0
+	.fmask	0x00000000,0
+	mul	$2,$4,$5
+	div	$3,$4,$5
+	divu	$6,$4,$5
+	rem	$7,$4,$5
+	remu	$8,$4,$5
+	div	$9,$4,7
+	addu	$2,$2,$3
+	addu	$2,$2,$6
+	addu	$2,$2,$7
+	addu	$2,$2,$8
+	addu	$2,$2,$9
+	subu	$2,$2,100
+	addu	$2,$2,0x12345
+	and	$2,$2,0xffff0
+	or	$2,$2,0x10000
+	xor	$2,$2,3
+	slt	$3,$2,-5
+	sltu	$4,$2,40000
+	sll	$2,$2,3
+	sra	$2,$2,$4
+	j	$31
+	.end	arith
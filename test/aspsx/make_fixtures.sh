@@ -0,0 +1,18 @@
+#!/bin/sh
+# Assembles the CC1PSX output in this directory with aspsx, at -G 8 and -G 0,
+# into the objs test/test_mdasm.py compares tools/PsyqAsm.h against. Run it
+# again after adding a file: PSYQ_SDK=... test/aspsx/make_fixtures.sh
+
+PSYQ=4.4
+
+if [ -z "$PSYQ_SDK" ]; then
+    echo "PSYQ_SDK not set"
+    exit 1
+fi
+
+cd "$(dirname "$0")" || exit 1
+for s in *.s; do
+    for G in 8 0; do
+        wibo "${PSYQ_SDK}/psyq_${PSYQ}/bin/aspsx.exe" -q -G${G} -g0 "$s" -o "${s%.s}.G${G}.o" || exit 1
+    done
+done
@@ -0,0 +1,871 @@
+import ctypes
+import os
+import random
+import struct
+import subprocess
+import tempfile
+from typing import List, Sequence, Tuple
+import unittest
+from unittest import mock
+
+from src import objdump, scorer
+from src.compiler import Compiler, SourceContext
+from src.helpers import release_file
+from src.objdump import MIPS_SETTINGS
+from src.scorer import Scorer
+
+
+def pstr(s: str) -> bytes:
+    return bytes([len(s)]) + s.encode()
+
+
+def make_chunk(
+    section: int, words: Sequence[int], relocs: Sequence[Tuple[int, int, int]]
+) -> bytes:
+    out = b"\x06" + struct.pack("<h", section)
+    code = b"".join(struct.pack("<I", w) for w in words)
+    out += b"\x02" + struct.pack("<H", len(code)) + code
+    for type, offset, number in relocs:
+        out += b"\x0a" + struct.pack("<BH", type, offset) + b"\x02"
+        out += struct.pack("<h", number)
+    return out
+
+
+def make_obj(
+    words: Sequence[int],
+    relocs: Sequence[Tuple[int, int, int]] = (),
+    imports: Sequence[Tuple[int, str]] = (),
+    function: str = "",
+    data: Sequence[int] = (),
+    data_relocs: Sequence[Tuple[int, int, int]] = (),
+    xdefs: Sequence[Tuple[str, int]] = (("func", 0),),
+) -> bytes:
+    """A minimal PsyQ LNK object: one .text chunk and optionally one .rdata
+    chunk, relocations given as (type, offset, symbol number) against imported
+    symbols, and XDEFs as (name, .text offset)."""
+    out = b"LNK\x02\x2e\x07"
+    out += b"\x10" + struct.pack("<hhB", 1, 0, 8) + pstr(".text")
+    out += b"\x10" + struct.pack("<hhB", 2, 0, 8) + pstr(".rdata")
+    for number, name in imports:
+        out += b"\x0e" + struct.pack("<h", number) + pstr(name)
+    out += make_chunk(1, words, relocs)
+    if data:
+        out += make_chunk(2, data, data_relocs)
+    for i, (name, offset) in enumerate(xdefs):
+        out += b"\x0c" + struct.pack("<hhi", 5 + i, 1, offset) + pstr(name)
+    if function:
+        out += b"\x4a" + struct.pack("<hihihihIi", 1, 0, 1, 1, 29, 24, 31, 0, 0)
+        out += pstr(function)
+    out += b"\x00"
+    return out
+
+
+def make_lib(modules: Sequence[Tuple[str, Sequence[str], bytes]]) -> bytes:
+    """A PsyQ LIB archive of (module name, exported symbols, obj) entries."""
+    out = b"LIB\x01"
+    for name, exports, obj in modules:
+        header = b"".join(pstr(symbol) for symbol in exports) + b"\x00"
+        size = 20 + len(header)
+        out += name.ljust(8).encode() + struct.pack("<III", 0, size, size + len(obj))
+        out += header + obj
+    return out
+
+
+# Words covering every operand layout, the aliases and the GTE commands.
+WORDS = [
+    0x27BDFFE8,  # addiu sp, sp, -0x18
+    0xAFBF0010,  # sw ra, 0x10(sp)
+    0x8FA40000,  # lw a0, (sp)
+    0x0C000000,  # jal
+    0x00000000,  # nop
+    0x00801021,  # move v0, a0
+    0x00041023,  # negu v0, a0
+    0x00042027,  # nor a0, zero, a0
+    0x1000FFFD,  # b
+    0x10800002,  # beqz
+    0x14A00001,  # bnez
+    0x0085001A,  # div zero, a0, a1
+    0x0007000D,  # break 7
+    0x3C028001,  # lui v0, 0x8001
+    0x34420010,  # ori v0, v0, 0x10
+    0x00021080,  # sll v0, v0, 2
+    0x00A41004,  # sllv v0, a0, a1
+    0x04110003,  # bal
+    0x0320F809,  # jalr t9
+    0x03E00008,  # jr ra
+    0x48840800,  # mtc2 a0, 1, 0
+    0x4A280030,  # rtpt
+    0x4A400012,  # mvmva
+    0xC8810004,  # lwc2 1, 4(a0)
+    0x40026000,  # mfc0 v0, 12, 0
+    0x42000010,  # rfe
+    0xFC000000,  # .word
+    0x28A2FFF6,  # slti v0, a1, -0xa
+]
+
+
+@unittest.skipUnless(
+    os.path.isfile(MIPS_SETTINGS.objdump[0]), "MDasm2 has not been built"
+)
+class TestMDasmBinary(unittest.TestCase):
+    def round_trip(self, obj: bytes) -> None:
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "func.o")
+            with open(path, "wb") as f:
+                f.write(obj)
+            cmd = MIPS_SETTINGS.objdump + [path]
+            text = subprocess.check_output(cmd).decode("utf-8")
+            binary = subprocess.check_output(cmd + ["--binary"])
+            served = objdump.get_server(MIPS_SETTINGS).disassemble(path, binary=True)
+
+        self.assertEqual(binary, served)
+        dis = objdump.parse_binary(binary)
+        self.assertEqual(objdump.format_binary(dis), text.splitlines())
+
+    def test_all_formats(self) -> None:
+        relocs = [(74, 12, 3), (82, 52, 3), (84, 56, 3), (84, 8, 3)]
+        obj = make_obj(WORDS, relocs, [(3, "D_800AB")], function="func")
+        self.round_trip(obj)
+
+    def test_random_words(self) -> None:
+        rng = random.Random(1)
+        for _ in range(50):
+            words: List[int] = [
+                rng.choice(WORDS) if rng.random() < 0.5 else rng.getrandbits(32)
+                for _ in range(rng.randint(1, 64))
+            ]
+            relocs = [
+                (rng.choice([74, 82, 84]), 4 * i, 3)
+                for i in range(len(words))
+                if rng.random() < 0.2
+            ]
+            self.round_trip(make_obj(words, relocs, [(3, "func_80012345")]))
+
+    def test_reloc_table(self) -> None:
+        obj = make_obj([0x0C000000, 0], [(74, 0, 3)], [(3, "callee")])
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "func.o")
+            with open(path, "wb") as f:
+                f.write(obj)
+            binary = subprocess.check_output(MIPS_SETTINGS.objdump + [path, "--binary"])
+        dis = objdump.parse_binary(binary)
+        self.assertEqual(dis.chunks, [(0, 2, 0)])
+        self.assertEqual([r.expr for r in dis.relocs], ["callee"])
+        self.assertEqual(dis.records[0][7], 0)
+        self.assertEqual(dis.records[1][7], objdump.BINARY_NONE)
+        self.assertEqual(dis.ops[dis.records[1][1]].name, "nop")
+
+    def test_data_section(self) -> None:
+        obj = make_obj(
+            WORDS[:4],
+            imports=[(3, "callee")],
+            data=[0x12345678, 0, 0xFC000000],
+            data_relocs=[(16, 4, 3)],
+        )
+        self.round_trip(obj)
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "func.o")
+            with open(path, "wb") as f:
+                f.write(obj)
+            text = subprocess.check_output(MIPS_SETTINGS.objdump + [path])
+        self.assertEqual(
+            text.decode("utf-8").split("-" * 30 + "\n")[2].splitlines(),
+            [
+                "   0:\t12345678\t.word\t0x12345678",
+                "   4:\t00000000\t.word\tcallee",
+                "   8:\tFC000000\t.word\t0xfc000000",
+            ],
+        )
+
+    def test_function(self) -> None:
+        first = [0x27BDFFE8, 0x03E00008, 0x27BD0018]
+        second = [0x0C000000, 0x00000000, 0x03E00008, 0x00000000]
+        obj = make_obj(
+            first + second,
+            [(74, 12, 3)],
+            [(3, "callee")],
+            xdefs=[("first", 0), ("second", 12)],
+        )
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "func.o")
+            with open(path, "wb") as f:
+                f.write(obj)
+            cmd = MIPS_SETTINGS.objdump + [path, "--function"]
+            text = subprocess.check_output(cmd + ["second"]).decode("utf-8")
+            binary = subprocess.check_output(cmd + ["second", "--binary"])
+            served = objdump.get_server(MIPS_SETTINGS).disassemble(
+                path, binary=True, function="second"
+            )
+            missing = subprocess.run(cmd + ["third"], stdout=subprocess.PIPE)
+
+        self.assertEqual(
+            text.splitlines(),
+            [
+                "function name: second",
+                "-" * 30,
+                "   0:\t0C000000\tjal\tcallee",
+                "   4:\t00000000\tnop\t",
+                "   8:\t03E00008\tjr\tra",
+                "   c:\t00000000\tnop\t",
+            ],
+        )
+        self.assertEqual(binary, served)
+        self.assertEqual(
+            objdump.format_binary(objdump.parse_binary(binary)), text.splitlines()
+        )
+        self.assertNotEqual(missing.returncode, 0)
+
+
+class TestMDasmExe(unittest.TestCase):
+    def test_ranges_and_map(self) -> None:
+        words = [0x27BDFFE8, 0x03E00008, 0x27BD0018, 0x0C004000, 0x03E00008, 0]
+        text = b"".join(struct.pack("<I", word) for word in words)
+        header = bytearray(0x800)
+        header[:8] = b"PS-X EXE"
+        struct.pack_into("<III", header, 0x18, 0x80010000, len(text), 0)
+        with tempfile.TemporaryDirectory() as tmp:
+            exe = os.path.join(tmp, "main.exe")
+            ranges = os.path.join(tmp, "ranges.txt")
+            symbols = os.path.join(tmp, "main.map")
+            with open(exe, "wb") as f:
+                f.write(bytes(header) + text)
+            with open(ranges, "w") as f:
+                f.write("# name start end\nfirst 0x80010000 0x8001000c\n")
+                f.write("second 0x8001000c 0\n")
+            with open(symbols, "w") as f:
+                f.write("8001000C second\nfirst = 0x80010000;\n")
+            cmd = MIPS_SETTINGS.objdump + ["--exe", exe, "--threads", "2"]
+            by_range = subprocess.check_output(cmd + ["--ranges", ranges])
+            by_map = subprocess.check_output(cmd + ["--map", symbols])
+            normalized = subprocess.check_output(
+                cmd + ["--ranges", ranges, "--normalized"]
+            )
+
+        self.assertEqual(by_range, by_map)
+        self.assertEqual(
+            by_range.decode("utf-8").splitlines(),
+            [
+                "function name: first",
+                "-" * 30,
+                "80010000:\t27BDFFE8\taddiu\tsp, sp, -0x18",
+                "80010004:\t03E00008\tjr\tra",
+                "80010008:\t27BD0018\taddiu\tsp, sp, 0x18",
+                "function name: second",
+                "-" * 30,
+                "8001000c:\t0C004000\tjal\t0x80010000",
+                "80010010:\t03E00008\tjr\tra",
+                "80010014:\t00000000\tnop\t",
+            ],
+        )
+        self.assertEqual(
+            normalized.decode("utf-8").splitlines()[:2],
+            ["function name: first", "addiu\t0\taddiu\tsp, sp, -0x18"],
+        )
+
+    def test_find(self) -> None:
+        words = [
+            0x27BDFFE8,  # addiu sp, sp, -0x18
+            0xAFBF0010,  # sw ra, 0x10(sp)
+            0x3C040000,  # lui a0, %hi(table)
+            0x24840000,  # addiu a0, a0, %lo(table)
+            0x0C000000,  # jal callee
+            0x8C850004,  # lw a1, 4(a0)
+            0x00A41021,  # addu v0, a1, a0
+            0x8FBF0010,  # lw ra, 0x10(sp)
+            0x03E00008,  # jr ra
+            0x27BD0018,  # addiu sp, sp, 0x18
+        ]
+        relocs = [(82, 8, 3), (84, 12, 3), (74, 16, 4)]
+        obj = make_obj(words, relocs, [(3, "table"), (4, "callee")])
+        linked = list(words)
+        linked[2] |= 0x8009
+        linked[3] |= 0x1234
+        linked[4] |= 0x0004321
+        near = list(linked)
+        near[9] = 0x27BD0020  # addiu sp, sp, 0x20
+        rng = random.Random(5)
+        padding = [rng.getrandbits(32) for _ in range(100)]
+        image = padding + linked + padding + near + padding
+        with tempfile.TemporaryDirectory() as tmp:
+            raw = os.path.join(tmp, "main.bin")
+            path = os.path.join(tmp, "func.o")
+            with open(raw, "wb") as f:
+                f.write(b"".join(struct.pack("<I", word) for word in image))
+            with open(path, "wb") as f:
+                f.write(obj)
+            index = subprocess.check_output(
+                MIPS_SETTINGS.objdump + ["--index", raw, "--base", "80020000"]
+            )
+            with open(raw + ".idx", "wb") as f:
+                f.write(index)
+            found = subprocess.check_output(
+                MIPS_SETTINGS.objdump + ["--find", raw + ".idx", path]
+            )
+
+        self.assertEqual(
+            found.decode("utf-8").splitlines(),
+            [
+                "function name: func",
+                "80020190\t100.0%\t10/10",
+                "80020348\t90.0%\t9/10",
+            ],
+        )
+
+
+@unittest.skipUnless(
+    os.path.isfile(MIPS_SETTINGS.objdump[0]), "MDasm2 has not been built"
+)
+class TestMDasmLib(unittest.TestCase):
+    def test_modules(self) -> None:
+        first = make_obj([0x03E00008, 0x24020001], xdefs=[("one", 0)])
+        second = make_obj(
+            [0x0C000000, 0x00000000], [(74, 0, 3)], [(3, "one")], xdefs=[("two", 0)]
+        )
+        lib = make_lib([("ONE", ["one"], first), ("TWO", ["two", "deux"], second)])
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "libtest.lib")
+            with open(path, "wb") as f:
+                f.write(lib)
+            cmd = MIPS_SETTINGS.objdump + ["--lib", path]
+            listed = subprocess.check_output(cmd + ["--list"])
+            extracted = subprocess.check_output(cmd + ["--extract", "deux"])
+            everything = subprocess.check_output(cmd + ["--threads", "2"])
+            selected = subprocess.check_output(cmd + ["deux"])
+            missing = subprocess.run(cmd + ["three"], stdout=subprocess.PIPE)
+
+        self.assertEqual(listed, b"ONE\tone\nTWO\ttwo\tdeux\n")
+        self.assertEqual(extracted, second)
+        self.assertEqual(
+            everything.decode("utf-8").splitlines(),
+            [
+                "module name: ONE",
+                "-" * 30,
+                "   0:\t03E00008\tjr\tra",
+                "   4:\t24020001\taddiu\tv0, zero, 1",
+                "module name: TWO",
+                "-" * 30,
+                "   0:\t0C000000\tjal\tone",
+                "   4:\t00000000\tnop\t",
+            ],
+        )
+        self.assertEqual(selected, everything[everything.index(b"module name: TWO") :])
+        self.assertNotEqual(missing.returncode, 0)
+
+
+@unittest.skipUnless(
+    objdump.get_library(MIPS_SETTINGS) is not None, "libmdasm has not been built"
+)
+class TestMDasmLibrary(unittest.TestCase):
+    def test_same_as_server(self) -> None:
+        library = objdump.get_library(MIPS_SETTINGS)
+        server = objdump.get_server(MIPS_SETTINGS)
+        assert library is not None
+        rng = random.Random(2)
+        with tempfile.TemporaryDirectory() as tmp:
+            paths = []
+            for i in range(20):
+                words = [rng.choice(WORDS) for _ in range(rng.randint(1, 32))]
+                relocs = [(74, 4 * j, 3) for j in range(len(words)) if j % 5 == 0]
+                path = os.path.join(tmp, f"func{i}.o")
+                with open(path, "wb") as f:
+                    f.write(make_obj(words, relocs, [(3, "callee")], function="func"))
+                paths.append(path)
+
+            for path in paths:
+                self.assertEqual(library.disassemble(path), server.disassemble(path))
+                self.assertEqual(
+                    library.disassemble(path, binary=True),
+                    server.disassemble(path, binary=True),
+                )
+                self.assertEqual(
+                    library.normalize(path, 0, "func"),
+                    objdump.parse_normalized(
+                        server.disassemble(path, 0, False, "func")
+                    ),
+                )
+                for flags in [0, 1, 7]:
+                    self.assertEqual(
+                        library.normalize(path, flags),
+                        objdump.parse_normalized(server.disassemble(path, flags)),
+                    )
+                    self.assertEqual(
+                        library.score(paths[0], path, flags),
+                        server.score(paths[0], path, flags),
+                    )
+
+    def test_score_cache(self) -> None:
+        library = objdump.get_library(MIPS_SETTINGS)
+        assert library is not None
+        rng = random.Random(3)
+        with tempfile.TemporaryDirectory() as tmp:
+            cache = os.path.join(tmp, "score_cache.bin")
+            paths = []
+            for i in range(10):
+                words = [rng.choice(WORDS) for _ in range(rng.randint(1, 16))]
+                path = os.path.join(tmp, f"func{i}.o")
+                with open(path, "wb") as f:
+                    f.write(make_obj(words, [(74, 0, 3)], [(3, "callee")]))
+                paths.append(path)
+            with open(os.path.join(tmp, "copy.o"), "wb") as f:
+                with open(paths[3], "rb") as g:
+                    f.write(g.read())
+
+            scores = [
+                objdump.get_server(MIPS_SETTINGS).score(paths[0], path, 7)
+                for path in paths
+            ]
+            cached = [library.score(paths[0], path, 7, None, cache) for path in paths]
+            self.assertEqual(cached, scores)
+            self.assertEqual(
+                library.code_hash(paths[3]),
+                library.code_hash(os.path.join(tmp, "copy.o")),
+            )
+
+            # Every other process scoring that target reads the same table:
+            # a score changed in the file is what a new server answers. The
+            # target itself is an exact match for the prefilter, not cached.
+            with open(cache, "r+b") as f:
+                table = f.read()
+                entries = [table[i : i + 48] for i in range(64, len(table), 48)]
+                used = [i for i, entry in enumerate(entries) if entry[:8] != bytes(8)]
+                self.assertEqual(len(used), len(paths) - 1)
+                for i in used:
+                    f.seek(64 + i * 48 + 8)
+                    f.write(struct.pack("<q", 12345))
+            server = objdump.MDasmServer(MIPS_SETTINGS.objdump)
+            try:
+                for path, (_, hash) in zip(paths[1:], scores[1:]):
+                    self.assertEqual(
+                        server.score(paths[0], path, 7, None, cache), (12345, hash)
+                    )
+                # Another target replaces the table instead of reading it
+                server.score(paths[1], paths[0], 7, None, cache)
+                with open(cache, "rb") as f:
+                    self.assertNotEqual(f.read(16), table[:16])
+            finally:
+                server.close()
+
+    def test_prefilter(self) -> None:
+        library = objdump.get_library(MIPS_SETTINGS)
+        server = objdump.get_server(MIPS_SETTINGS)
+        assert library is not None
+        words = [0x27BDFFE8, 0xAFBF0010, 0x0C000000, 0x00000000, 0x03E00008, 0]
+        cands = [
+            words,
+            words[:1] + [0x8FBF0010] + words[2:],  # sw -> lw
+            words[:2] + [0x0C000010] + words[3:],  # in the relocated field
+            words + [0, 0],
+        ]
+        with tempfile.TemporaryDirectory() as tmp:
+            paths = []
+            for i, cand in enumerate(cands):
+                path = os.path.join(tmp, f"cand{i}.o")
+                with open(path, "wb") as f:
+                    f.write(make_obj(cand, [(74, 8, 3)], [(3, "callee")]))
+                paths.append(path)
+
+            output = subprocess.run(
+                MIPS_SETTINGS.objdump + ["--prefilter"] + paths[:1] + paths,
+                check=True,
+                capture_output=True,
+            ).stdout
+            self.assertEqual(
+                output.decode().splitlines(),
+                ["1 0/6 0", "0 1/6 200", "0 0/6 0", "0 2/8 200"],
+            )
+
+            # Candidates that can't score the bound get the prefilter's bound
+            for path, lower in zip(paths, [None, 200, 0, 200]):
+                score, hash = server.score(paths[0], path, 0)
+                self.assertEqual(library.score(paths[0], path, 0), (score, hash))
+                for bound in [score, -1]:
+                    result = (
+                        (score, hash) if lower is None or bound >= 0 else (lower, None)
+                    )
+                    self.assertEqual(
+                        library.score(paths[0], path, 0, bound=bound), result
+                    )
+                    self.assertEqual(
+                        server.score(paths[0], path, 0, bound=bound), result
+                    )
+
+    def test_block_diff(self) -> None:
+        library = objdump.get_library(MIPS_SETTINGS)
+        assert library is not None
+        # beqz to the second lw, jr ra: blocks end after the delay slots and
+        # start at the branch target
+        words = [0x27BDFFE8, 0x10800002, 0, 0x8FA40000, 0x8FA40000, 0x03E00008, 0]
+        rng = random.Random(4)
+        jumps = {0x0C000000, 0x1000FFFD, 0x10800002, 0x14A00001, 0x04110003}
+        body = [w for w in WORDS if w not in jumps | {0x0320F809, 0x03E00008}]
+        large = []
+        for _ in range(100):
+            large += [rng.choice(body) for _ in range(rng.randint(1, 6))]
+            large += [0x0C000000, 0]
+        changed = list(large)
+        changed[150], changed[151] = changed[151], changed[150]
+        with tempfile.TemporaryDirectory() as tmp:
+            paths = []
+            for i, obj_words in enumerate(
+                [words, words[:4] + words[5:], large, changed]
+            ):
+                path = os.path.join(tmp, f"func{i}.o")
+                with open(path, "wb") as f:
+                    f.write(make_obj(obj_words))
+                paths.append(path)
+
+            output = subprocess.run(
+                MIPS_SETTINGS.objdump + ["--blocks", paths[0]],
+                check=True,
+                capture_output=True,
+            ).stdout
+            blocks = [line.split("\t") for line in output.decode().splitlines()]
+            self.assertEqual(
+                [b[:2] for b in blocks], [["0", "3"], ["3", "1"], ["4", "3"]]
+            )
+
+            # Small functions are always diffed line by line, and large ones
+            # with a change inside one block score the same block by block
+            self.assertGreaterEqual(len(large), 256)
+            for target, cand in [(paths[0], paths[1]), (paths[2], paths[3])]:
+                flat = library.score(target, cand, 0)
+                self.assertNotEqual(flat[0], 0)
+                self.assertEqual(
+                    library.score(target, cand, objdump.MDASM_BLOCK_DIFF), flat
+                )
+
+    def test_target_index(self) -> None:
+        library = objdump.get_library(MIPS_SETTINGS)
+        assert library is not None
+        rng = random.Random(5)
+        flags = objdump.MDASM_BLOCK_DIFF | 1
+        with tempfile.TemporaryDirectory() as tmp:
+            paths = []
+            for i in range(8):
+                words = [rng.choice(WORDS) for _ in range(rng.randint(1, 300))]
+                relocs = [(74, 4 * j, 3) for j in range(len(words)) if j % 7 == 0]
+                path = os.path.join(tmp, f"func{i}.o")
+                with open(path, "wb") as f:
+                    f.write(make_obj(words, relocs, [(3, "callee")]))
+                paths.append(path)
+            target = paths[0]
+            index = os.path.join(tmp, "target.idx")
+
+            # A server writes the index and loads it, the library maps the
+            # same file: both score like a target loaded from the obj
+            server = objdump.MDasmServer(MIPS_SETTINGS.objdump)
+            try:
+                for path in paths:
+                    self.assertEqual(
+                        server.score(target, path, flags, index=index),
+                        library.score(target, path, flags),
+                    )
+            finally:
+                server.close()
+            target_id = library.load_target(index, flags)
+            score = ctypes.c_longlong()
+            hash = ctypes.create_string_buffer(65)
+            for path in paths:
+                data = objdump.read_obj(path)
+                library.check(
+                    library.lib.mdasm_score(
+                        target_id, data, len(data), ctypes.byref(score), hash
+                    )
+                )
+                self.assertEqual(
+                    (score.value, hash.value.decode()),
+                    library.score(target, path, flags),
+                )
+
+            # Indexes made with other options or older than the target are
+            # written again
+            with self.assertRaises(objdump.MDasmError):
+                library.load_target(index, 0)
+            objdump.load_indexed_target(library, target, 0, index)
+            with open(index, "rb") as f:
+                self.assertEqual(f.read(16)[12:], struct.pack("<I", 0))
+            os.utime(index, (0, os.path.getmtime(target) - 10))
+            objdump.load_indexed_target(library, target, 0, index)
+            self.assertGreaterEqual(os.path.getmtime(index), os.path.getmtime(target))
+
+    def test_same_as_difflib(self) -> None:
+        # Random functions and mutations of them (changed registers and stack
+        # offsets, swapped, inserted and removed instructions) score the same
+        # natively as with the Python normalization and difflib.
+        rng = random.Random(6)
+        jumps = {0x1000FFFD, 0x10800002, 0x14A00001, 0x04110003}
+        body = [w for w in WORDS if w not in jumps] + [0xAFA50014, 0x8FBF0010]
+
+        def mutate(words: List[int]) -> List[int]:
+            words = list(words)
+            for _ in range(rng.randint(0, 4)):
+                i = rng.randrange(len(words))
+                kind = rng.randrange(5)
+                if kind == 0 and words[i] >> 26:
+                    words[i] ^= 1 << rng.randint(16, 25)  # rs/rt
+                elif kind == 1 and words[i] >> 21 in (0x13D, 0x47D, 0x57D):
+                    # addiu/lw/sw with sp
+                    words[i] = words[i] & ~0xFFFF | rng.randrange(-16, 16) * 4 & 0xFFFF
+                elif kind == 2 and len(words) > 1:
+                    j = rng.randrange(len(words))
+                    words[i], words[j] = words[j], words[i]
+                elif kind == 3:
+                    words.insert(i, rng.choice(body))
+                elif len(words) > 1:
+                    del words[i]
+            return words
+
+        def write(path: str, words: List[int]) -> None:
+            relocs = [(74, 4 * j, 3) for j, w in enumerate(words) if w == 0x0C000000]
+            with open(path, "wb") as f:
+                f.write(make_obj(words, relocs, [(3, "callee")]))
+
+        with tempfile.TemporaryDirectory() as tmp:
+            cand_o = os.path.join(tmp, "cand.o")
+            for i in range(90):
+                # (Native targets are loaded once per path)
+                target_o = os.path.join(tmp, f"target{i}.o")
+                target = [rng.choice(body) for _ in range(rng.randint(1, 40))]
+                write(target_o, target)
+                cands = [mutate(target) for _ in range(10)]
+                for stack_differences in [False, True]:
+                    native = Scorer(
+                        target_o, stack_differences=stack_differences, debug_mode=False
+                    )
+                    with mock.patch.object(scorer, "use_native_scorer", False):
+                        python = Scorer(
+                            target_o,
+                            stack_differences=stack_differences,
+                            debug_mode=False,
+                        )
+                    self.assertTrue(native.native)
+                    self.assertFalse(python.native)
+                    for cand in cands:
+                        write(cand_o, cand)
+                        expected = native.score(cand_o)
+                        with mock.patch.object(objdump, "use_native_normalize", False):
+                            self.assertEqual(python.score(cand_o), expected)
+
+    def test_error(self) -> None:
+        library = objdump.get_library(MIPS_SETTINGS)
+        assert library is not None
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "bad.o")
+            with open(path, "wb") as f:
+                f.write(b"LNK\x02\x2e\x07\x02\xff")
+            with self.assertRaises(objdump.MDasmError):
+                library.disassemble(path)
+
+
+# A corpus of CC1PSX output, with aspsx's objs for it
+ASPSX_DIR = os.path.join(os.path.dirname(__file__), "aspsx")
+
+# CC1PSX-style output: $gp-relative and %hi/%lo accesses, an indexed load with
+# its load delay, div's checks and a branch delay slot.
+ASSEMBLY = """\
+\t.file\t1 "f.c"
+gcc2_compiled.:
+\t.sdata
+\t.align\t2
+g:
+\t.word\t3
+\t.comm\tbig,40
+\t.rdata
+\t.align\t2
+$LC0:
+\t.ascii\t"hi\\000"
+\t.text
+\t.align\t2
+\t.globl\tfunc
+\t.ent\tfunc
+func:
+\t.frame\t$sp,24,$31
+\tlw\t$2,g
+\tla\t$4,$LC0
+\tli\t$5,0x12345
+\tlw\t$3,big+4($2)
+\taddu\t$2,$2,$3
+\tdiv\t$2,$2,$5
+\tbeq\t$2,$0,$L2
+\tsw\t$2,g
+$L2:
+\tj\t$31
+\t.end\tfunc
+"""
+
+
+@unittest.skipUnless(
+    os.path.isfile(MIPS_SETTINGS.objdump[0]), "MDasm2 has not been built"
+)
+class TestAssembler(unittest.TestCase):
+    def dump(self, name: str, contents: bytes, *args: str) -> List[str]:
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, name)
+            with open(path, "wb") as f:
+                f.write(contents)
+            out = subprocess.check_output(MIPS_SETTINGS.objdump + [path, *args])
+        return out.decode("utf-8").splitlines()
+
+    def test_macros(self) -> None:
+        lines = self.dump("f.s", ASSEMBLY.encode(), "--function", "func")
+        self.assertEqual(
+            lines[2:],
+            [
+                "   0:\t8F820000\tlw\tv0, (gp) <.sdata>",
+                "   4:\t3C040000\tlui\ta0, .rdata",
+                "   8:\t24840000\taddiu\ta0, a0, .rdata",
+                "   c:\t3C050001\tlui\ta1, 1",
+                "  10:\t34A52345\tori\ta1, a1, 0x2345",
+                "  14:\t3C010000\tlui\tat, big+4",
+                "  18:\t00220821\taddu\tat, at, v0",
+                "  1c:\t8C230000\tlw\tv1, (at) <big+4>",
+                "  20:\t00000000\tnop\t",
+                "  24:\t00431021\taddu\tv0, v0, v1",
+                "  28:\t0045001A\tdiv\tzero, v0, a1",
+                "  2c:\t14A00002\tbnez\ta1, 0x38",
+                "  30:\t00000000\tnop\t",
+                "  34:\t0007000D\tbreak\t7",
+                "  38:\t2401FFFF\taddiu\tat, zero, -1",
+                "  3c:\t14A10004\tbne\ta1, at, 0x50",
+                "  40:\t3C018000\tlui\tat, 0x8000",
+                "  44:\t14410002\tbne\tv0, at, 0x50",
+                "  48:\t00000000\tnop\t",
+                "  4c:\t0006000D\tbreak\t6",
+                "  50:\t00001012\tmflo\tv0",
+                "  54:\t10400002\tbeqz\tv0, 0x60",
+                "  58:\t00000000\tnop\t",
+                "  5c:\tAF820000\tsw\tv0, (gp) <.sdata>",
+                "  60:\t03E00008\tjr\tra",
+                "  64:\t00000000\tnop\t",
+            ],
+        )
+        # With -G 0, g is reached through %hi/%lo instead
+        lines = self.dump("f.s", ASSEMBLY.encode(), "--function", "func", "-G", "0")
+        self.assertEqual(lines[2], "   0:\t3C020000\tlui\tv0, .sdata")
+
+    def test_same_as_obj(self) -> None:
+        text = "\t.text\n\t.globl\tfunc\nfunc:\n\taddiu\t$2,$4,1\n\tj\t$31\n"
+        self.assertEqual(
+            self.dump("f.s", text.encode(), "--function", "func"),
+            self.dump(
+                "f.o", make_obj([0x24820001, 0x03E00008, 0]), "--function", "func"
+            ),
+        )
+        library = objdump.get_library(MIPS_SETTINGS)
+        if library is not None:
+            with tempfile.TemporaryDirectory() as tmp:
+                path = os.path.join(tmp, "f.s")
+                with open(path, "w") as f:
+                    f.write(text)
+                served = objdump.get_server(MIPS_SETTINGS).disassemble(path)
+                self.assertEqual(library.disassemble(path), served)
+
+    def test_errors(self) -> None:
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "f.s")
+            with open(path, "w") as f:
+                f.write("\t.text\nfunc:\n\tfrob\t$2,$3\n")
+            failed = subprocess.run(
+                MIPS_SETTINGS.objdump + [path], stdout=subprocess.PIPE
+            )
+        self.assertNotEqual(failed.returncode, 0)
+
+    def test_same_as_aspsx(self) -> None:
+        # aspsx's objs for the CC1PSX output in test/aspsx, made by its
+        # make_fixtures.sh, disassemble the same as the assembly itself
+        for name in sorted(os.listdir(ASPSX_DIR)):
+            if not name.endswith(".s"):
+                continue
+            path = os.path.join(ASPSX_DIR, name)
+            for gp_size in ["8", "0"]:
+                with self.subTest(name=name, gp_size=gp_size):
+                    o_file = f"{path[:-2]}.G{gp_size}.o"
+                    if not os.path.isfile(o_file):
+                        self.fail(f"no aspsx output for {name} (make_fixtures.sh)")
+                    cmd = MIPS_SETTINGS.objdump + ["-G", gp_size]
+                    self.assertEqual(
+                        subprocess.check_output(cmd + [path]).decode().splitlines(),
+                        subprocess.check_output(cmd + [o_file]).decode().splitlines(),
+                    )
+
+
+COMPILE_SERVER = os.path.join(
+    os.path.dirname(MIPS_SETTINGS.objdump[0]), "CompileServer.elf"
+)
+
+
+@unittest.skipUnless(os.path.isfile(COMPILE_SERVER), "CompileServer has not been built")
+class TestCompileServer(unittest.TestCase):
+    def test_stages(self) -> None:
+        with tempfile.TemporaryDirectory() as tmp:
+            sock = os.path.join(tmp, "cc.sock")
+            # A file stage, a warm stdin stage, then a file to file one
+            server = subprocess.Popen(
+                [COMPILE_SERVER, "--socket", sock, "--jobs", "2", "--staging", tmp]
+                + ["--stage", "cat {in}", "--stage", "tr a-z A-Z"]
+                + ["--stage", "cp {in} {out}"],
+                stdout=subprocess.PIPE,
+            )
+            try:
+                assert server.stdout is not None
+                server.stdout.readline()
+                compiler = Compiler(
+                    "false", show_errors=False, debug_mode=False, compile_server=sock
+                )
+                for i in range(4):
+                    o_file = compiler.compile(f"int f{i};")
+                    assert o_file is not None
+                    with open(o_file, "rb") as f:
+                        self.assertEqual(f.read(), f"INT F{i};".encode())
+                    release_file(o_file)
+                assert compiler.server is not None
+                stats = compiler.server.stats().splitlines()
+                self.assertEqual(stats[0], "queue 0 busy 0/2")
+                self.assertTrue(stats[1].startswith("jobs 4 failed 0"))
+                self.assertTrue(stats[3].startswith("stage 2: 4 runs (4 warm)"))
+            finally:
+                server.terminate()
+                server.wait()
+                server.stdout.close()
+            self.assertFalse(os.path.exists(sock))
+
+            # Without a server, the compile script is run
+            self.assertIsNone(compiler.compile("int f;"))
+            self.assertIsNone(compiler.server)
+
+    def test_context(self) -> None:
+        with tempfile.TemporaryDirectory() as tmp:
+            sock = os.path.join(tmp, "cc.sock")
+            server = subprocess.Popen(
+                [COMPILE_SERVER, "--socket", sock, "--jobs", "1", "--staging", tmp]
+                + ["--cache-context", "--stage", "cpp -P", "--stage", "cat"],
+                stdout=subprocess.PIPE,
+            )
+            try:
+                assert server.stdout is not None
+                server.stdout.readline()
+                compiler = Compiler(
+                    "false", show_errors=False, debug_mode=False, compile_server=sock
+                )
+                context = SourceContext.from_text("#define N 3\nint a = N;\n")
+                outputs = []
+                for rest in ["int f = N + __LINE__;\n", "int g = N;\n"]:
+                    o_file = compiler.compile(context.text + rest, context=context)
+                    assert o_file is not None
+                    with open(o_file, "rb") as f:
+                        outputs.append(f.read().split())
+                    release_file(o_file)
+                # A context that can't be split is compiled whole
+                included = SourceContext.from_text("#include <nothing.h>\n")
+                self.assertIsNone(compiler.compile(included.text, context=included))
+                assert compiler.server is not None
+                stats = compiler.server.stats().splitlines()
+            finally:
+                server.terminate()
+                server.wait()
+                server.stdout.close()
+
+        self.assertEqual(outputs[0], b"int a = 3; int f = 3 + 3;".split())
+        self.assertEqual(outputs[1], b"int a = 3; int g = 3;".split())
+        self.assertEqual(stats[-1], "contexts 1, 2 jobs with one")
+        self.assertEqual(stats[1].split()[:4], ["jobs", "4", "failed", "1"])
@@ -20,6 +20,7 @@ class TestPermMacros(unittest.TestCase):
         target: str,
         *,
         fn_name: Optional[str] = None,
+        settings: str = "",
         **kwargs: Any
     ) -> int:
         base = intro + "\n" + base + "\n" + outro
@@ -42,6 +43,10 @@ class TestPermMacros(unittest.TestCase):
                 with open(os.path.join(target_dir, "function.txt"), "w") as f:
                     f.write(fn_name)
 
+            if settings:
+                with open(os.path.join(target_dir, "settings.toml"), "w") as f:
+                    f.write(settings)
+
             opts = main.Options(directories=[target_dir], stop_on_zero=True, **kwargs)
             return main.run(opts)[0]
 
@@ -242,6 +247,28 @@ class TestPermMacros(unittest.TestCase):
         )
         self.assertEqual(score, 0)
 
+    def test_randomizer_pipelined(self) -> None:
+        for threads in [1, 2]:
+            score = self.go(
+                "void foo(); void bar(); void test(void) {",
+                "}",
+                "PERM_RANDOMIZE(bar(); foo();)",
+                "foo(); bar();",
+                settings="pipeline_depth = 3\n",
+                threads=threads,
+            )
+            self.assertEqual(score, 0)
+
+    def test_general_pipelined(self) -> None:
+        score = self.go(
+            "int test(int a, int b) {",
+            "}",
+            "return a / PERM_GENERAL(,(unsigned int),(float)) b;",
+            "return a / (float) b;",
+            settings="pipeline_depth = 2\n",
+        )
+        self.assertEqual(score, 0)
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,49 @@
+import hashlib
+import os
+import tempfile
+import unittest
+
+from src.seen import SEEN_FALSE_POSITIVES, SeenFilter, seen_false_positives
+
+
+def digest(i: int) -> bytes:
+    return hashlib.sha256(i.to_bytes(8, "little")).digest()
+
+
+class TestSeenFilter(unittest.TestCase):
+    def test_false_positives_at_capacity(self) -> None:
+        seen = SeenFilter(None, 1 / 16)
+        for i in range(seen.capacity):
+            seen.add(digest(i))
+        tries = 200000
+        start = seen.capacity
+        wrong = sum(digest(i) in seen for i in range(start, start + tries))
+        # Within about 5 standard deviations of the promised rate, which the
+        # classic unblocked formula (~1.18% there) is not
+        self.assertAlmostEqual(wrong / tries, SEEN_FALSE_POSITIVES, delta=0.0012)
+        self.assertAlmostEqual(
+            seen_false_positives(seen.capacity / seen.blocks),
+            SEEN_FALSE_POSITIVES,
+            delta=0.0001,
+        )
+
+    def test_starts_over(self) -> None:
+        seen = SeenFilter(None, 1 / 1024)
+        self.assertTrue(seen.add(digest(0)))
+        self.assertFalse(seen.add(digest(0)))
+        i = 1
+        while seen.added() < seen.capacity:
+            seen.add(digest(i))
+            i += 1
+        self.assertIn(digest(0), seen)
+        while not seen.add(digest(i)):
+            i += 1
+        self.assertEqual(seen.added(), 1)
+        self.assertNotIn(digest(0), seen)
+
+    def test_key(self) -> None:
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "seen_sources.bin")
+            SeenFilter(path, 1 / 1024, bytes(32)).add(digest(0))
+            self.assertIn(digest(0), SeenFilter(path, 1 / 1024, bytes(32)))
+            self.assertNotIn(digest(0), SeenFilter(path, 1 / 1024, bytes([1] * 32)))
@@ -0,0 +1,1025 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compile server: runs the stages of a compile script (e.g. cpp, wine
+// CC1PSX.EXE, wibo aspsx.exe) for candidates sent over a local socket, so
+// that the permuter's workers don't start them cold for every candidate.
+//
+// Each worker thread owns a slot: staging files in a tmpfs, and for every
+// stage that reads its input from stdin, a process of it started ahead of
+// time and blocked on that stdin. A job feeds the warm process and the next
+// one is started as soon as the job is answered, off the critical path. A
+// persistent wineserver (--wineserver) keeps wine's own startup short for the
+// stages that can't be started early.
+//
+// With --cache-context, the first stage must be the preprocessor: a source's
+// context (everything before the target function, the same for all of its
+// candidates) is preprocessed once and kept under a checksum the client
+// chooses, and a candidate then only sends, and preprocesses, the rest. The
+// context's #define and #undef lines are put in front of the rest, with a
+// #line to keep its line numbers, and the context's output in front of the
+// result. A context with any other directive (but #pragma) is refused.
+//
+// Stages are command lines split on spaces, where {in} is replaced by the
+// previous stage's output file (the candidate's source for the first one)
+// and {out} by this stage's output file (the object for the last one). A
+// stage without {in} reads its input from stdin, one without {out} writes its
+// output to stdout.
+//
+// Requests and responses are a little-endian u32 length followed by that
+// many bytes, like MDasm2 --server; a response starts with a status byte
+// (0 = ok, 1 = error):
+//   'C' source     compile, answers u32 stages, u64 queued us, u64 us of
+//                  every stage, then the object; or the errors of the stage
+//                  that failed
+//   'Q'            answers the queue depth and the latency of every stage, as
+//                  printed by --stats
+//   'X' checksum (u64) context
+//                  preprocess a context and keep it under checksum
+//   'F' checksum (u64) rest
+//                  compile the source made of that context and rest, answers
+//                  like 'C'; status 2 when the context isn't known (any more),
+//                  it must then be sent again
+//
+// linux:
+// g++ CompileServer.cpp -pthread -oCompileServer -O2
+
+extern char **environ;
+
+typedef unsigned char BYTE;
+
+#define MAX_CONTEXTS    64
+
+typedef struct  Stage
+{
+    std::string                 command;
+    std::vector<std::string>    args;       // with {in} and {out}
+    bool                        readsStdin;
+    bool                        writesStdout;
+    std::atomic<uint64_t>       runs;
+    std::atomic<uint64_t>       warmRuns;
+    std::atomic<uint64_t>       totalUs;
+    std::atomic<uint64_t>       maxUs;
+} Stage;
+
+typedef struct  Process
+{
+    pid_t       pid;        // -1 when not running
+    int         in;         // pipe to its stdin, or -1
+    int         out;        // pipe from its stdout, or -1
+} Process;
+
+//! A worker's staging files and warm processes
+typedef struct  Slot
+{
+    std::string             source;     // the candidate's source, for {in}
+    std::vector<std::string>    outputs;    // of every stage, for {out}
+    std::vector<std::string>    errors;     // stderr of every stage
+    std::vector<Process>    warm;       // of every stage
+} Slot;
+
+//! A context, as preprocessed by the first stage
+typedef struct  Context
+{
+    std::string             directives; // its #define and #undef lines
+    uint32_t                lines;
+    std::string             output;
+} Context;
+
+typedef struct  Job
+{
+    std::string             source;     // or the rest after the context
+    std::shared_ptr<const Context>  context;
+    size_t                  stages;     // run only the first ones
+    std::chrono::steady_clock::time_point   queued;
+    bool                    ok;
+    std::string             output;     // the response after its status byte
+    bool                    done;
+} Job;
+
+std::deque<Stage>       g_stages;
+std::string             g_socketPath;
+std::string             g_staging;
+int                     g_jobs = 0;
+bool                    g_cold = false;
+bool                    g_cacheContexts = false;
+
+std::mutex              g_queueMutex;
+std::condition_variable g_queueReady;
+std::condition_variable g_jobDone;
+std::deque<Job*>        g_queue;
+std::atomic<int>        g_busy(0);
+std::atomic<uint64_t>   g_jobCount(0);
+std::atomic<uint64_t>   g_failed(0);
+std::atomic<uint64_t>   g_queuedUs(0);
+
+std::mutex              g_contextMutex;
+std::map<uint64_t, std::shared_ptr<const Context>>  g_contexts;
+std::deque<uint64_t>    g_contextOrder;     // oldest first
+std::atomic<uint64_t>   g_contextJobs(0);
+
+// For the signal handler: warm processes to kill and files to remove, set up
+// before the workers start
+std::vector<std::atomic<pid_t>>     g_warmPids;
+std::vector<std::string>            g_stagingFiles;
+
+void usage(void)
+{
+    printf("usage: CompileServer --socket PATH --stage \"COMMAND\"... [--jobs N] [--staging DIR] [--cold] [--wineserver] [--cache-context]\n");
+    printf("    run the stages of a compile script for candidates sent to the socket at PATH\n");
+    printf("    {in} is the previous stage's output file, {out} this stage's; without them a stage\n");
+    printf("    reads stdin / writes stdout\n");
+    printf("    [--jobs N] compile N candidates at a time (default: one per core)\n");
+    printf("    [--staging DIR] directory of the intermediate files (default: /dev/shm, or /tmp)\n");
+    printf("    [--cold] don't start the processes of stdin stages ahead of time\n");
+    printf("    [--wineserver] start a persistent wineserver first\n");
+    printf("    [--cache-context] the first stage is the preprocessor: preprocess the context of\n");
+    printf("    the candidates once\n");
+    printf("       CompileServer --socket PATH --stats\n");
+    printf("    print the queue depth and the latency of every stage of a running server\n");
+    exit(1);
+}
+
+uint64_t elapsedUs(std::chrono::steady_clock::time_point since)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+bool readExact(int fd, void *dst, size_t size)
+{
+    BYTE *p = (BYTE*)dst;
+
+    while (size)
+    {
+        ssize_t count = read(fd, p, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        p += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool writeExact(int fd, const void *src, size_t size)
+{
+    const BYTE *p = (const BYTE*)src;
+
+    while (size)
+    {
+        ssize_t count = write(fd, p, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        p += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool readWholeFile(const std::string &path, std::string *data)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    char buffer[0x10000];
+
+    data->clear();
+    if (fd < 0)
+    {
+        return false;
+    }
+    for (;;)
+    {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            close(fd);
+            return count == 0;
+        }
+        data->append(buffer, count);
+    }
+}
+
+bool writeWholeFile(const std::string &path, const std::string &data)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = writeExact(fd, data.data(), data.size());
+    return close(fd) == 0 && ok;
+}
+
+void closeFd(int *fd)
+{
+    if (*fd >= 0)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+//! Replace every occurrence of name in s
+std::string substitute(std::string s, const char *name, const std::string &value)
+{
+    size_t length = strlen(name);
+
+    for (size_t at = s.find(name); at != std::string::npos; at = s.find(name, at + value.size()))
+    {
+        s.replace(at, length, value);
+    }
+    return s;
+}
+
+void parseStage(const char *command)
+{
+    Stage &stage = g_stages.emplace_back();
+    const char *p = command;
+
+    stage.command = command;
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        const char *start = p;
+        while (*p && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+        if (p > start)
+        {
+            stage.args.emplace_back(start, p - start);
+        }
+    }
+    if (stage.args.empty())
+    {
+        printf("Error: empty stage\n");
+        usage();
+    }
+    stage.readsStdin = stage.command.find("{in}") == std::string::npos;
+    stage.writesStdout = stage.command.find("{out}") == std::string::npos;
+}
+
+//! A stage's processes can be started before the job when its command line
+//! doesn't depend on it
+bool canWarm(size_t stage)
+{
+    return !g_cold && g_stages[stage].readsStdin;
+}
+
+//! Start a stage with its input in the file at input (ignored for stdin
+//! stages); its stderr, and stdout when not piped, go to the slot's error
+//! file. False with the reason in error.
+bool spawnStage(Slot *slot, size_t index, const std::string &input, Process *process, std::string *error)
+{
+    const Stage                 &stage = g_stages[index];
+    std::vector<std::string>    args;
+    std::vector<char*>          argv;
+    int                         inPipe[2] = { -1, -1 };
+    int                         outPipe[2] = { -1, -1 };
+    posix_spawn_file_actions_t  actions;
+
+    for (const std::string &arg : stage.args)
+    {
+        args.push_back(substitute(substitute(arg, "{in}", input), "{out}", slot->outputs[index]));
+    }
+    for (std::string &arg : args)
+    {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(NULL);
+
+    // A stage that exits 0 without writing must not find the last job's output
+    if (!stage.writesStdout)
+    {
+        unlink(slot->outputs[index].c_str());
+    }
+    if ((stage.readsStdin && pipe2(inPipe, O_CLOEXEC) != 0) || (stage.writesStdout && pipe2(outPipe, O_CLOEXEC) != 0))
+    {
+        closeFd(&inPipe[0]);
+        closeFd(&inPipe[1]);
+        *error = "Error: pipe failed\n";
+        return false;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    if (stage.readsStdin)
+    {
+        posix_spawn_file_actions_adddup2(&actions, inPipe[0], 0);
+    }
+    else
+    {
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_addopen(&actions, 2, slot->errors[index].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stage.writesStdout)
+    {
+        posix_spawn_file_actions_adddup2(&actions, outPipe[1], 1);
+    }
+    else
+    {
+        posix_spawn_file_actions_adddup2(&actions, 2, 1);
+    }
+    int result = posix_spawnp(&process->pid, argv[0], &actions, NULL, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    closeFd(&inPipe[0]);
+    closeFd(&outPipe[1]);
+    if (result != 0)
+    {
+        closeFd(&inPipe[1]);
+        closeFd(&outPipe[0]);
+        process->pid = -1;
+        *error = "Error: Unable to start " + stage.args[0] + ": " + strerror(result) + "\n";
+        return false;
+    }
+    process->in = inPipe[1];
+    process->out = outPipe[0];
+    return true;
+}
+
+//! Feed a process its stdin and collect its stdout at the same time, so
+//! that neither side blocks on a full pipe, then wait for it
+bool communicate(Process *process, const std::string &input, std::string *output)
+{
+    size_t  written = 0;
+    char    buffer[0x10000];
+    int     status;
+
+    output->clear();
+    if (process->in >= 0 && input.empty())
+    {
+        closeFd(&process->in);
+    }
+    while (process->in >= 0 || process->out >= 0)
+    {
+        struct pollfd   fds[2];
+        int             count = 0;
+
+        if (process->in >= 0)
+        {
+            fds[count++] = { process->in, POLLOUT, 0 };
+        }
+        if (process->out >= 0)
+        {
+            fds[count++] = { process->out, POLLIN, 0 };
+        }
+        if (poll(fds, count, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (!fds[i].revents)
+            {
+                continue;
+            }
+            if (fds[i].fd == process->in)
+            {
+                ssize_t n = write(process->in, input.data() + written, input.size() - written);
+                if (n > 0)
+                {
+                    written += n;
+                }
+                // EPIPE: the process exited without reading all of it
+                if ((n < 0 && errno != EINTR && errno != EAGAIN) || written == input.size())
+                {
+                    closeFd(&process->in);
+                }
+            }
+            else
+            {
+                ssize_t n = read(process->out, buffer, sizeof(buffer));
+                if (n > 0)
+                {
+                    output->append(buffer, n);
+                }
+                else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+                {
+                    closeFd(&process->out);
+                }
+            }
+        }
+    }
+    closeFd(&process->in);
+    closeFd(&process->out);
+
+    while (waitpid(process->pid, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    process->pid = -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+//! Run the stages of a job in a slot: output is the response after its
+//! status byte
+bool runJob(Slot *slot, size_t slotIndex, const Job *job, uint64_t queued, std::string *output)
+{
+    std::vector<uint64_t>   times;
+    std::string             data = job->source;     // output of the last stage in memory,
+    std::string             file;                   // or in this file
+    std::string             error;
+
+    if (job->context)
+    {
+        data = job->context->directives + "#line " + std::to_string(job->context->lines + 1) + "\n" + job->source;
+    }
+    for (size_t i = 0; i < job->stages; i++)
+    {
+        Stage   &stage = g_stages[i];
+        Process process = slot->warm[i];
+        bool    warm = process.pid >= 0;
+        auto    start = std::chrono::steady_clock::now();
+
+        slot->warm[i].pid = -1;
+        g_warmPids[slotIndex * g_stages.size() + i] = -1;
+        if (!stage.readsStdin && file.empty())
+        {
+            file = i ? slot->outputs[i - 1] : slot->source;
+            if (!writeWholeFile(file, data))
+            {
+                *output = "Error: Unable to write " + file + "\n";
+                return false;
+            }
+        }
+        if (stage.readsStdin && !file.empty() && !readWholeFile(file, &data))
+        {
+            *output = "Error: Unable to read " + file + "\n";
+            return false;
+        }
+        if (!warm && !spawnStage(slot, i, file, &process, &error))
+        {
+            *output = error;
+            return false;
+        }
+
+        std::string result;
+        bool ok = communicate(&process, stage.readsStdin ? data : std::string(), &result);
+        uint64_t us = elapsedUs(start);
+        times.push_back(us);
+        stage.runs++;
+        stage.warmRuns += warm;
+        stage.totalUs += us;
+        for (uint64_t max = stage.maxUs; us > max && !stage.maxUs.compare_exchange_weak(max, us); )
+        {
+        }
+        if (!ok)
+        {
+            readWholeFile(slot->errors[i], output);
+            *output += "Error: stage " + std::to_string(i + 1) + " failed: " + stage.command + "\n";
+            return false;
+        }
+        if (i == 0 && job->context)
+        {
+            if (!stage.writesStdout && !readWholeFile(slot->outputs[0], &result))
+            {
+                *output = "Error: Unable to read " + slot->outputs[0] + "\n";
+                return false;
+            }
+            data = job->context->output + result;
+            file.clear();
+        }
+        else if (stage.writesStdout)
+        {
+            data.swap(result);
+            file.clear();
+        }
+        else
+        {
+            file = slot->outputs[i];
+        }
+    }
+    if (!file.empty() && !readWholeFile(file, &data))
+    {
+        *output = "Error: the last stage wrote no output\n";
+        return false;
+    }
+
+    uint32_t count = (uint32_t)times.size();
+    output->assign((const char*)&count, 4);
+    output->append((const char*)&queued, 8);
+    output->append((const char*)times.data(), times.size() * 8);
+    output->append(data);
+    return true;
+}
+
+//! Start the warm processes of a slot that aren't running
+void warmSlot(Slot *slot, size_t slotIndex)
+{
+    std::string error;
+
+    for (size_t i = 0; i < g_stages.size(); i++)
+    {
+        if (canWarm(i) && slot->warm[i].pid < 0 && spawnStage(slot, i, std::string(), &slot->warm[i], &error))
+        {
+            g_warmPids[slotIndex * g_stages.size() + i] = slot->warm[i].pid;
+        }
+    }
+}
+
+//! The staging files of a slot. The source is C and the intermediate files
+//! assembly, for the tools that go by the extension.
+void initSlot(Slot *slot, size_t slotIndex)
+{
+    std::string prefix = g_staging + "/cc." + std::to_string(getpid()) + "." + std::to_string(slotIndex) + ".";
+
+    slot->source = prefix + "c";
+    for (size_t i = 0; i < g_stages.size(); i++)
+    {
+        slot->outputs.push_back(prefix + std::to_string(i) + (i + 1 < g_stages.size() ? ".s" : ".o"));
+        slot->errors.push_back(prefix + std::to_string(i) + ".err");
+        slot->warm.push_back({ -1, -1, -1 });
+    }
+}
+
+void worker(size_t slotIndex)
+{
+    Slot slot;
+
+    initSlot(&slot, slotIndex);
+    warmSlot(&slot, slotIndex);
+    for (;;)
+    {
+        Job *job;
+        {
+            std::unique_lock<std::mutex> lock(g_queueMutex);
+            g_queueReady.wait(lock, [] { return !g_queue.empty(); });
+            job = g_queue.front();
+            g_queue.pop_front();
+            g_busy++;
+        }
+
+        std::string output;
+        uint64_t    queued = elapsedUs(job->queued);
+        bool        ok = runJob(&slot, slotIndex, job, queued, &output);
+        g_queuedUs += queued;
+        g_jobCount++;
+        g_failed += !ok;
+        {
+            std::lock_guard<std::mutex> lock(g_queueMutex);
+            job->ok = ok;
+            job->output.swap(output);
+            job->done = true;
+            g_busy--;
+        }
+        g_jobDone.notify_all();
+        warmSlot(&slot, slotIndex);
+    }
+}
+
+//! What --stats prints
+std::string stats(void)
+{
+    std::string text;
+    char        line[256];
+    size_t      queue;
+    uint64_t    jobs = g_jobCount;
+
+    {
+        std::lock_guard<std::mutex> lock(g_queueMutex);
+        queue = g_queue.size();
+    }
+    snprintf(line, sizeof(line), "queue %zu busy %d/%d\n", queue, (int)g_busy, g_jobs);
+    text += line;
+    snprintf(line, sizeof(line), "jobs %" PRIu64 " failed %" PRIu64 " queued %" PRIu64 "us avg\n",
+        jobs, (uint64_t)g_failed, jobs ? (uint64_t)g_queuedUs / jobs : 0);
+    text += line;
+    for (size_t i = 0; i < g_stages.size(); i++)
+    {
+        const Stage &stage = g_stages[i];
+        uint64_t    runs = stage.runs;
+
+        snprintf(line, sizeof(line), "stage %zu: %" PRIu64 " runs (%" PRIu64 " warm) %" PRIu64 "us avg %" PRIu64 "us max: ",
+            i + 1, runs, (uint64_t)stage.warmRuns, runs ? (uint64_t)stage.totalUs / runs : 0, (uint64_t)stage.maxUs);
+        text += line + stage.command + "\n";
+    }
+    if (g_cacheContexts)
+    {
+        std::lock_guard<std::mutex> lock(g_contextMutex);
+
+        snprintf(line, sizeof(line), "contexts %zu, %" PRIu64 " jobs with one\n", g_contexts.size(), (uint64_t)g_contextJobs);
+        text += line;
+    }
+    return text;
+}
+
+//! Queue a job and wait for a worker to run it
+void runQueued(Job *job)
+{
+    job->queued = std::chrono::steady_clock::now();
+    job->done = false;
+    std::unique_lock<std::mutex> lock(g_queueMutex);
+    g_queue.push_back(job);
+    g_queueReady.notify_one();
+    g_jobDone.wait(lock, [&] { return job->done; });
+}
+
+//! 'X': preprocess a context with the first stage and keep it under
+//! checksum, forgetting the oldest one past MAX_CONTEXTS. False with the
+//! reason in error.
+bool addContext(uint64_t checksum, const char *text, size_t size, std::string *error)
+{
+    auto    context = std::make_shared<Context>();
+    Job     job;
+
+    if (!g_cacheContexts)
+    {
+        *error = "Error: context caching is off (--cache-context)\n";
+        return false;
+    }
+    context->lines = 0;
+    for (size_t at = 0; at < size; )
+    {
+        const char  *end = (const char*)memchr(text + at, '\n', size - at);
+        size_t      next = end ? end - text + 1 : size;
+        size_t      p = at;
+
+        while (p < next && (text[p] == ' ' || text[p] == '\t'))
+        {
+            p++;
+        }
+        if (p < next && text[p] == '#')
+        {
+            std::string directive(text + p + 1, next - p - 1);
+            directive.erase(0, directive.find_first_not_of(" \t"));
+            if (!directive.compare(0, 6, "define") || !directive.compare(0, 5, "undef"))
+            {
+                // With its continuation lines
+                while (next < size && next >= at + 2 && text[next - 2] == '\\')
+                {
+                    context->lines++;
+                    end = (const char*)memchr(text + next, '\n', size - next);
+                    next = end ? end - text + 1 : size;
+                }
+                context->directives.append(text + at, next - at);
+                if (context->directives.back() != '\n')
+                {
+                    context->directives += '\n';
+                }
+            }
+            else if (directive.compare(0, 6, "pragma"))
+            {
+                *error = "Error: the context has a directive other than #define, #undef and #pragma\n";
+                return false;
+            }
+        }
+        context->lines += end != NULL;
+        at = next;
+    }
+
+    job.source.assign(text, size);
+    job.stages = 1;
+    runQueued(&job);
+    if (!job.ok)
+    {
+        error->swap(job.output);
+        return false;
+    }
+    uint32_t count;
+    memcpy(&count, job.output.data(), 4);
+    context->output = job.output.substr(4 + 8 * (count + 1));
+
+    std::lock_guard<std::mutex> lock(g_contextMutex);
+    if (g_contexts.find(checksum) == g_contexts.end())
+    {
+        g_contextOrder.push_back(checksum);
+    }
+    g_contexts[checksum] = context;
+    if (g_contextOrder.size() > MAX_CONTEXTS)
+    {
+        g_contexts.erase(g_contextOrder.front());
+        g_contextOrder.pop_front();
+    }
+    return true;
+}
+
+//! Answer the requests of a connection until it is closed
+void serveClient(int fd)
+{
+    std::vector<BYTE>   request;
+    uint32_t            size;
+
+    while (readExact(fd, &size, sizeof(size)))
+    {
+        request.resize(size);
+        if (size && !readExact(fd, request.data(), size))
+        {
+            break;
+        }
+
+        BYTE        status = 1;
+        std::string output;
+        if (size && request[0] == 'C')
+        {
+            Job job;
+
+            job.source.assign((const char*)request.data() + 1, size - 1);
+            job.stages = g_stages.size();
+            runQueued(&job);
+            status = job.ok ? 0 : 1;
+            output.swap(job.output);
+        }
+        else if (size >= 9 && request[0] == 'F')
+        {
+            Job         job;
+            uint64_t    checksum;
+
+            memcpy(&checksum, request.data() + 1, 8);
+            {
+                std::lock_guard<std::mutex> lock(g_contextMutex);
+                auto found = g_contexts.find(checksum);
+                if (found != g_contexts.end())
+                {
+                    job.context = found->second;
+                }
+            }
+            if (job.context)
+            {
+                job.source.assign((const char*)request.data() + 9, size - 9);
+                job.stages = g_stages.size();
+                runQueued(&job);
+                g_contextJobs++;
+                status = job.ok ? 0 : 1;
+                output.swap(job.output);
+            }
+            else
+            {
+                status = 2;
+                output = "Error: unknown context\n";
+            }
+        }
+        else if (size >= 9 && request[0] == 'X')
+        {
+            uint64_t checksum;
+
+            memcpy(&checksum, request.data() + 1, 8);
+            status = addContext(checksum, (const char*)request.data() + 9, size - 9, &output) ? 0 : 1;
+        }
+        else if (size && request[0] == 'Q')
+        {
+            status = 0;
+            output = stats();
+        }
+        else
+        {
+            output = "Error: unknown request\n";
+        }
+
+        size = (uint32_t)output.size() + 1;
+        if (!writeExact(fd, &size, sizeof(size)) || !writeExact(fd, &status, 1) || !writeExact(fd, output.data(), output.size()))
+        {
+            break;
+        }
+    }
+    close(fd);
+}
+
+//! SIGINT / SIGTERM: only async-signal-safe calls on what was set up before
+//! the workers started
+void onSignal(int)
+{
+    for (const std::atomic<pid_t> &pid : g_warmPids)
+    {
+        pid_t p = pid;
+        if (p > 0)
+        {
+            kill(p, SIGKILL);
+        }
+    }
+    for (const std::string &path : g_stagingFiles)
+    {
+        unlink(path.c_str());
+    }
+    unlink(g_socketPath.c_str());
+    _exit(0);
+}
+
+int connectSocket(const char *path)
+{
+    struct sockaddr_un  address = {};
+    int                 fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    address.sun_family = AF_UNIX;
+    if (fd < 0 || strlen(path) >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! --stats: ask a running server
+int printStats(void)
+{
+    int         fd = connectSocket(g_socketPath.c_str());
+    uint32_t    size = 1;
+    BYTE        request = 'Q';
+
+    if (fd < 0)
+    {
+        printf("Error: no compile server at %s\n", g_socketPath.c_str());
+        return 1;
+    }
+    if (!writeExact(fd, &size, sizeof(size)) || !writeExact(fd, &request, 1) || !readExact(fd, &size, sizeof(size)) || size == 0)
+    {
+        printf("Error: the compile server closed the connection\n");
+        return 1;
+    }
+    std::string response(size, '\0');
+    if (!readExact(fd, &response[0], size))
+    {
+        printf("Error: the compile server closed the connection\n");
+        return 1;
+    }
+    fwrite(response.data() + 1, 1, response.size() - 1, stdout);
+    close(fd);
+    return response[0] == 0 ? 0 : 1;
+}
+
+//! Start `wineserver -p`, which stays up after its last client exits
+void startWineserver(void)
+{
+    char    *argv[] = { (char*)"wineserver", (char*)"-p", NULL };
+    pid_t   pid;
+    int     status;
+
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0)
+    {
+        printf("Error: Unable to start wineserver\n");
+        exit(1);
+    }
+    waitpid(pid, &status, 0);
+}
+
+int main(int argc, char** argv)
+{
+    bool    printStatsOnly = false;
+    bool    wineserver = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--socket") && i + 1 < argc)
+            g_socketPath = argv[++i];
+        else if (!strcmp(argv[i], "--stage") && i + 1 < argc)
+            parseStage(argv[++i]);
+        else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+            g_jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--staging") && i + 1 < argc)
+            g_staging = argv[++i];
+        else if (!strcmp(argv[i], "--cold"))
+            g_cold = true;
+        else if (!strcmp(argv[i], "--wineserver"))
+            wineserver = true;
+        else if (!strcmp(argv[i], "--cache-context"))
+            g_cacheContexts = true;
+        else if (!strcmp(argv[i], "--stats"))
+            printStatsOnly = true;
+        else
+        {
+            printf("Error: unknown parameter: %s\n", argv[i]);
+            usage();
+        }
+    }
+    if (g_socketPath.empty())
+    {
+        usage();
+    }
+    if (printStatsOnly)
+    {
+        return printStats();
+    }
+    if (g_stages.empty())
+    {
+        usage();
+    }
+
+    struct stat st;
+    if (g_staging.empty())
+    {
+        g_staging = stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) ? "/dev/shm" : "/tmp";
+    }
+    if (g_jobs <= 0)
+    {
+        g_jobs = (int)std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (wineserver)
+    {
+        startWineserver();
+    }
+
+    // A server that is still answering keeps its socket
+    int fd = connectSocket(g_socketPath.c_str());
+    if (fd >= 0)
+    {
+        close(fd);
+        printf("Error: a compile server is already running at %s\n", g_socketPath.c_str());
+        return 1;
+    }
+
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (g_socketPath.size() >= sizeof(address.sun_path))
+    {
+        printf("Error: socket path too long: %s\n", g_socketPath.c_str());
+        return 1;
+    }
+    strcpy(address.sun_path, g_socketPath.c_str());
+    unlink(g_socketPath.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        printf("Error: Unable to listen on %s: %s\n", g_socketPath.c_str(), strerror(errno));
+        return 1;
+    }
+
+    g_warmPids = std::vector<std::atomic<pid_t>>(g_jobs * g_stages.size());
+    for (std::atomic<pid_t> &pid : g_warmPids)
+    {
+        pid = -1;
+    }
+    for (int i = 0; i < g_jobs; i++)
+    {
+        Slot slot;
+
+        initSlot(&slot, i);
+        g_stagingFiles.push_back(slot.source);
+        g_stagingFiles.insert(g_stagingFiles.end(), slot.outputs.begin(), slot.outputs.end());
+        g_stagingFiles.insert(g_stagingFiles.end(), slot.errors.begin(), slot.errors.end());
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    for (int slot = 0; slot < g_jobs; slot++)
+    {
+        std::thread(worker, (size_t)slot).detach();
+    }
+    printf("Compile server on %s: %d jobs, %zu stages, staging in %s\n", g_socketPath.c_str(), g_jobs, g_stages.size(), g_staging.c_str());
+    fflush(stdout);
+
+    for (;;)
+    {
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            printf("Error: accept failed: %s\n", strerror(errno));
+            return 1;
+        }
+        std::thread(serveClient, client).detach();
+    }
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "PsyqObj.h"
+
+// Instruction n-gram index of an executable (MDasm2 --index / --find), for
+// finding copies of an obj's functions.
+//
+// An executable has no relocations left, so the words are hashed with every
+// field a relocation could have patched masked out: J / JAL targets (REL26),
+// LUI immediates (HI16), and the offsets of loads, stores and addiu / ori that
+// are not based on sp (LO16 / GPREL16). A rolling hash of each run of gram
+// masked words is kept, sorted, with the word it starts at. The file is:
+//
+//  ExeIndexHeader
+//  uint64_t    hashes[count]   sorted
+//  uint32_t    starts[count]   word of the n-gram in the image
+//  uint32_t    words[words]    the image itself, for comparing matches
+//
+// It is used in place, mapped; all values are little endian.
+
+#define EXE_INDEX_MAGIC     "MDIX"
+#define EXE_INDEX_VERSION   1
+#define EXE_INDEX_GRAM      8
+#define EXE_INDEX_PRIME     0x100000001b3ull
+#define EXE_INDEX_COMMON    64  // n-grams found more often are not looked up
+
+typedef struct  ExeIndexHeader
+{
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    gram;       // words per n-gram
+    uint32_t    base;       // address of words[0]
+    uint32_t    words;
+    uint32_t    count;      // n-grams
+} ExeIndexHeader;
+
+typedef struct  ExeIndex
+{
+    const ExeIndexHeader    *header;
+    const uint64_t          *hashes;
+    const uint32_t          *starts;
+    const uint32_t          *words;
+} ExeIndex;
+
+//! Mask out the fields of word that a relocation could patch
+inline uint32_t exeIndexMask(uint32_t word)
+{
+    uint32_t op = word >> 26;
+    uint32_t rs = (word >> 21) & 31;
+
+    if (op == 0x02 || op == 0x03)           // j, jal
+    {
+        return word & 0xfc000000;
+    }
+    if (op == 0x0f)                         // lui
+    {
+        return word & 0xffff0000;
+    }
+    if ((op == 0x09 || op == 0x0d || (op >= 0x20 && op <= 0x2e) || op == 0x32 || op == 0x3a) && rs != 29)
+    {
+        return word & 0xffff0000;           // addiu, ori, loads, stores, lwc2, swc2
+    }
+    return word;
+}
+
+//! Bits of a word that a relocation of type leaves as compiled
+inline uint32_t exeIndexRelocMask(uint8_t type)
+{
+    switch (type)
+    {
+    case PSYQ_REL26:
+        return 0xfc000000;
+    case PSYQ_HI16:
+    case PSYQ_LO16:
+    case PSYQ_GPREL16:
+        return 0xffff0000;
+    default:
+        return 0;
+    }
+}
+
+//! Rolling hashes of every n-gram of masked words, hashes[i] for words
+//! [i, i + gram). All-zero n-grams (padding) get 0 and are not indexed.
+inline void exeIndexHashes(const uint32_t *masked, size_t count, uint32_t gram, std::vector<uint64_t> *hashes)
+{
+    uint64_t    hash = 0;
+    uint64_t    outFactor = 1;     // EXE_INDEX_PRIME^(gram - 1)
+    uint32_t    zeros = 0;
+
+    hashes->clear();
+    if (count < gram)
+    {
+        return;
+    }
+    for (uint32_t i = 1; i < gram; i++)
+    {
+        outFactor *= EXE_INDEX_PRIME;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i >= gram)
+        {
+            hash -= masked[i - gram] * outFactor;
+            zeros -= masked[i - gram] == 0;
+        }
+        hash = hash * EXE_INDEX_PRIME + masked[i];
+        zeros += masked[i] == 0;
+        if (i + 1 >= gram)
+        {
+            hashes->push_back(zeros == gram ? 0 : hash);
+        }
+    }
+}
+
+//! Build the index file of an image loaded at base
+inline void exeIndexBuild(const uint8_t *image, size_t size, uint32_t base, uint32_t gram, std::string *out)
+{
+    ExeIndexHeader  header = { { 'M', 'D', 'I', 'X' }, EXE_INDEX_VERSION, gram, base, (uint32_t)(size / 4), 0 };
+    std::vector<uint32_t>   words(header.words);
+    std::vector<uint32_t>   masked(header.words);
+    std::vector<uint64_t>   hashes;
+    std::vector<std::pair<uint64_t, uint32_t>>  grams;
+
+    memcpy(words.data(), image, header.words * 4);
+    for (uint32_t i = 0; i < header.words; i++)
+    {
+        masked[i] = exeIndexMask(words[i]);
+    }
+    exeIndexHashes(masked.data(), masked.size(), gram, &hashes);
+    for (uint32_t i = 0; i < hashes.size(); i++)
+    {
+        if (hashes[i])
+        {
+            grams.push_back({ hashes[i], i });
+        }
+    }
+    std::sort(grams.begin(), grams.end());
+    header.count = (uint32_t)grams.size();
+
+    out->clear();
+    out->reserve(sizeof(header) + grams.size() * 12 + words.size() * 4);
+    out->append((const char*)&header, sizeof(header));
+    for (const auto &g : grams)
+    {
+        out->append((const char*)&g.first, 8);
+    }
+    for (const auto &g : grams)
+    {
+        out->append((const char*)&g.second, 4);
+    }
+    out->append((const char*)words.data(), words.size() * 4);
+}
+
+//! Check an index file and point index into it; buffer must be 8 byte aligned
+inline bool exeIndexOpen(const uint8_t *buffer, size_t size, ExeIndex *index)
+{
+    const ExeIndexHeader *header = (const ExeIndexHeader*)buffer;
+
+    if (size < sizeof(ExeIndexHeader) || memcmp(header->magic, EXE_INDEX_MAGIC, 4) || header->version != EXE_INDEX_VERSION
+        || header->gram == 0 || size != sizeof(ExeIndexHeader) + (uint64_t)header->count * 12 + (uint64_t)header->words * 4)
+    {
+        return false;
+    }
+    index->header = header;
+    index->hashes = (const uint64_t*)(buffer + sizeof(ExeIndexHeader));
+    index->starts = (const uint32_t*)(index->hashes + header->count);
+    index->words = index->starts + header->count;
+    return true;
+}
+
+//! Starts of the n-grams with a hash, [*first, *last) in index->starts
+inline void exeIndexLookup(const ExeIndex *index, uint64_t hash, uint32_t *first, uint32_t *last)
+{
+    const uint64_t *end = index->hashes + index->header->count;
+    auto range = std::equal_range(index->hashes, end, hash);
+
+    *first = (uint32_t)(range.first - index->hashes);
+    *last = (uint32_t)(range.second - index->hashes);
+}
@@ -1,19 +1,35 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <inttypes.h>
-#include <capstone/capstone.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 #include <cstring>
-#include <iostream>
+#include <deque>
 #include <string>
 #include <vector>
 
+#include "mdasm.h"
+
 // TODO: convert to C to reduce libc++ static link size
 
+// The command line and server; the disassembler itself is libmdasm.cpp.
+
 // linux:
-// g++ MDasm2.cpp -lcapstone -oMDasm2 -O3 -march=x86-64-v2 -static
+// g++ MDasm2.cpp libmdasm.cpp -pthread -oMDasm2 -O3 -march=x86-64-v2 -static
 
 // linux -> windows
-// x86_64-w64-mingw32-g++ MDasm2.cpp -lcapstone -lssp -oMDasm2.exe -O3 -march=x86-64-v2 -static
+// x86_64-w64-mingw32-g++ MDasm2.cpp libmdasm.cpp -lssp -pthread -oMDasm2.exe -O3 -march=x86-64-v2 -static
 
 #define PERMUTER
 
@@ -30,680 +46,823 @@ typedef unsigned char BYTE;
 //     return _iob;
 // }
 
-typedef struct  Params
+// MDASM_TEXT, MDASM_NORMALIZED or MDASM_BINARY, and MDASM_* options
+int             g_mode = MDASM_TEXT;
+int             g_options = 0;
+
+// Server mode (--server): obj files are requested over stdin and the output
+// of each request is collected in g_output instead of going to stdout.
+bool            g_server = false;
+std::string     g_output;
+
+//! Thrown by fatal() in server mode, the message is in g_output
+struct          RequestError
 {
-    bool        offsets;
-    bool        bytes;
-    bool        reloc;
-    bool        code;
-} Params;
-
-Params          g_params = { 0 };
-
-/*
-enum class PsyqOpcode : uint8_t {
-    END = 0,
-    BYTES = 2,
-    SWITCH = 6,
-    ZEROES = 8,
-    RELOCATION = 10,
-    EXPORTED_SYMBOL = 12,
-    IMPORTED_SYMBOL = 14,
-    SECTION = 16,
-    LOCAL_SYMBOL = 18,
-    FILENAME = 28,
-    PROGRAMTYPE = 46,
-    UNINITIALIZED = 48,
+    int         status = MDASM_ERROR;
 };
 
-enum class PsyqRelocType : uint8_t {
-    REL32 = 16,
-    REL26 = 74,
-    HI16 = 82,
-    LO16 = 84,
-    GPREL16 = 100,
-};
+// Buffers kept alive between requests so that the server does not allocate
+// per obj file.
+std::vector<BYTE>   g_fileBuffer;
+std::vector<BYTE>   g_request;
 
-enum class PsyqExprOpcode : uint8_t {
-    VALUE = 0,
-    SYMBOL = 2,
-    SECTION_BASE = 4,
-    SECTION_START = 12,
-    SECTION_END = 22,
-    ADD = 44,
-    SUB = 46,
-    DIV = 50,
-};
-*/
-/*
-typedef struct  Section
-{
-//    int         index;
-    int         groupe;
-    char        name[256];
-} Section;
-
-Section g_sections[1024] = { 0 };
-*/
-typedef struct  Reloc
-{
-    char        type[32];
-    char        name[256];
-    char        op;
-    char        expr[512];
-} Reloc;
+// Executable mode (--exe): the functions to disassemble, from --ranges or
+// --map, and where a raw image is loaded
+std::vector<MdasmRange>     g_ranges;
+std::deque<std::string>     g_rangeNames;
+uint32_t        g_base = 0x80010000;
+int             g_threads = 0;
 
-Reloc g_relocs[2048] = { 0 };
+// --index n-gram size (0 = default) and --find matches per function
+int             g_gram = 0;
+int             g_limit = 10;
 
-char g_symbols[1024][256] = { 0 };
+// --lib: print the module index (--list) or one module's object (--extract)
+bool            g_list = false;
+const char      *g_extract = NULL;
 
-typedef struct  Section
-{
-    short       index;
-    short       groupeId;
-    unsigned char      alignment;
-    unsigned char      nameLen;
-    char        name[];
-} Section;
-Section         *g_sections[1024] = { 0 };
-/*
-typedef struct  Symbol
-{
-    short       number;
-    short       section;
-    int         offset;
-    u_char      nameLen;
-    char        name[];
-} Symbol;
-Symbol          *g_symbols[1024] = { 0 };
-*/
-typedef struct  Code
-{
-    short       size;
-    char        code[];
-} Code;
-int             g_totalCodes = 0;
-Code            *g_codes[512] = { 0 };
-
-//! Byte swap short
-int16_t swap_int16(int16_t val)
+// Obj file mapped by readFile(), until the next one is read
+void            *g_mapped = NULL;
+size_t          g_mappedSize = 0;
+
+//! Raw bytes to stdout, or to the response buffer in server mode
+void outputBytes(const void *data, size_t size)
 {
-    return (val << 8) | ((val >> 8) & 0xFF);
+    if (g_server)
+    {
+        g_output.append((const char*)data, size);
+    }
+    else
+    {
+        fwrite(data, 1, size, stdout);
+    }
 }
 
+//! Print an error and exit, or fail the current request in server mode
+void fatal(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    if (g_server)
+    {
+        char    line[1024];
 
-BYTE    *readPsyqObjSymbols(BYTE *ptr, BYTE *buffer, int file_size)
+        vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+        g_output = line;
+        throw RequestError();
+    }
+    vprintf(fmt, args);
+    va_end(args);
+    exit(1);
+}
+
+//! Fail with the library's message if a call failed. An obj the library
+//! can't normalize exits with 2 instead of 1, or answers status 2 in server
+//! mode, for src/objdump.py to normalize it itself.
+int check(int result)
 {
-    int dims;
-    while (ptr - buffer < file_size)
+    if (result == MDASM_UNSUPPORTED)
     {
-        //    printf("OPCODE: 0x%-2x - %-2d at offset 0x%x\n", *ptr, *ptr, ptr - buffer);
-        switch (*ptr++)
+        if (g_server)
         {
-        case 0x30:  // 48 - XBSS symbol number %lx .. size %lx in section %lx\n
-            ptr += 2; // symbol number
-            ptr += 2; // section
-            ptr += 4; // size
-            ptr += *ptr + 1; // symbol name
-            break;
+            g_output = mdasm_error();
+            throw RequestError{ MDASM_UNSUPPORTED };
+        }
+        printf("%s", mdasm_error());
+        exit(2);
+    }
+    if (result < 0)
+    {
+        fatal("%s", mdasm_error());
+    }
+    return result;
+}
 
+void unmapFile(void)
+{
+#ifndef _WIN32
+    if (g_mapped)
+    {
+        munmap(g_mapped, g_mappedSize);
+    }
+#endif
+    g_mapped = NULL;
+    g_mappedSize = 0;
+}
 
+//! Read everything from fd (stdin, a pipe or an inherited file) into
+//! g_fileBuffer, or map it when it is a regular file
+BYTE *readFd(int fd, size_t *fileSize)
+{
+    size_t  size = 0;
 
-        case 0x10: // 16 - Section symbol number 1 '.rdata' in group 0 alignment 8
-            ptr += 2; // section index
-            ptr += 2; // groupe index
-            ptr += 1; // alignment
-            ptr += *ptr + 1; // section name
-            break;
-        case 0x1c: // 28 - file name
-            ptr += 2; // file number
-            ptr += *ptr + 1; // file name
-            break;
-        case 0x6:  // 6 - Switch
-            ptr += 2; // section index
-            break;
-        case 0x8:  // 8 - Uninitialised data
-            ptr += 4; // total bytes
-            break;
-        case 0x2:  // 2 - Code
-            ptr += *(short*)ptr + 2; // code
-            break;
-        case 0x3a: // 58 - Set SLD linenum to 5 at offset 0 in file c
-            ptr += 8;
-            break;
-        case 0x34: // 52 - Inc SLD linenum by byte 0 at offset 0
-            ptr += 3;
-            break;
-        case 0x32: // 50 - Inc SLD linenum at offset 0
-            ptr += 2;
-            break;
-        case 0x38: // 56 - Set SLD linenum to 14 at offset 1c
-            ptr += 6;
-            break;
-        case 0xa:  // 10 - Patch type 74 at offset 2c with (sectbase(2)+$38)
-            switch (*ptr)
-            {
-            case 16:  // REL32
-            case 74:  // REL26
-            case 82:  // HI16
-            case 84:  // LO16
-            case 100: // GPREL16
-                break;
-            }
-            ptr += 1; // reloc type
-            ptr += 2; // offset
-            for (int i = 0; i < 1; i++)
-            {
-                switch (*ptr++)
-                {
-                case 0:   // VALUE
-                    ptr += 4;
-                    break;
-                case 2:   // SYMBOL
-                case 4:   // SECTION_BASE
-                case 12:  // SECTION_START
-                case 22:  // SECTION_END
-                    ptr += 2;
-                    break;
-                case 44:  // ADD
-                case 46:  // SUB
-                case 50:  // DIV
-                    i -= 2;
-                    break;
-                }
-            }
-            break;
-        case 0x3c: // 60 - End SLD info at offset 0
-            ptr += 2; // offset
-            break;
-        case 0xc:  // 12 - XDEF symbol number a 'CRC32_80020BB4' at offset 0 in section 2
-            sprintf(g_symbols[*(short*)ptr], "%.*s\0", *(ptr + 8), ptr + 9);
-        //    g_symbols[*(short*)ptr] = (Symbol*)ptr;
-            ptr += 2; // symbol number
-            ptr += 2; // section index
-            ptr += 4; // offset
-            ptr += *ptr + 1; // symbol name
-            break;
-        case 0xe:  // 14 - XREF symbol number 24 'GCL_ReadVector_80020A14'
-            sprintf(g_symbols[*(short*)ptr], "%.*s\0", *(ptr + 2), ptr + 3);
-            ptr += 2; // symbol number
-            ptr += *ptr + 1; // symbol name
-            break;
-        case 0x52: // 82 - Def
-            ptr += 2; // section
-            ptr += 4; // value
-            ptr += 2; // class
-            ptr += 2; // type
-            ptr += 4; // size
-            ptr += *ptr + 1; // name
-            break;
-        case 0x54: // 84 - Def2 (arrays)
-            ptr += 2; // section
-            ptr += 4; // value
-            ptr += 2; // class
-            ptr += 2; // type
-            ptr += 4; // size
-            dims = *(short*)ptr;
-            for (int i = 0; i <= dims; i++)
-            {
-                if (i == 0)
-                {
-                    ptr += 2; // dims
-                }
-                else
-                {
-                    ptr += 4; // dims
-                }
-            }
-            if (dims && *ptr == 0)
-            {
-                ptr += 1; // padding ?
-            }
-            else
-            {
-                ptr += *ptr + 1; // tag (1st line)
-            }
-            ptr += *ptr + 1; // tag (2nd line)
-            break;
-        case 0x4a: // 74 - Function start
-            ptr += 2; // section
-            ptr += 4; // offset
-            ptr += 2; // file
-            ptr += 4; // start line
-            ptr += 2; // frame reg
-            ptr += 4; // frame size
-            ptr += 2; // return pc reg
-            ptr += 4; // mask
-            ptr += 4; // mask offset
-            ptr += *ptr + 1; // name
-            break;
-        case 0x4e: // 78 - Block start
-            ptr += 2; // section
-            ptr += 4; // offset
-            ptr += 4; // start line
-            break;
-        case 0x50: // 80 - Block end
-            ptr += 2; // section
-            ptr += 4; // offset
-            ptr += 4; // end line
-            break;
-        case 0x4c: // 76 - Function end
-            ptr += 2; // section
-            ptr += 4; // offset
-            ptr += 4; // end line
-            break;
-        case 0:  // End of file
+    unmapFile();
+#ifdef _WIN32
+    if (fd == 0)
+    {
+        _setmode(_fileno(stdin), _O_BINARY);
+    }
+#else
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            g_mapped = mapped;
+            g_mappedSize = st.st_size;
+            *fileSize = st.st_size;
+            return (BYTE*)mapped;
+        }
+    }
+#endif
+
+    for (;;)
+    {
+        if (g_fileBuffer.size() < size + 0x10000)
+        {
+            g_fileBuffer.resize(size + 0x10000);
+        }
+#ifdef _WIN32
+        int count = _read(fd, g_fileBuffer.data() + size, (unsigned int)(g_fileBuffer.size() - size));
+#else
+        ssize_t count = read(fd, g_fileBuffer.data() + size, g_fileBuffer.size() - size);
+#endif
+        if (count < 0)
+        {
+            fatal("Error: Unable to read obj file from fd %d\n", fd);
+        }
+        if (count == 0)
+        {
             break;
-        default:
-            ptr--;
-            printf("Error111: unknown opcode 0x%x in obj file at offset 0x%x.\n", *ptr, ptr - buffer);
-            exit(1);
         }
+        size += count;
     }
-    return ptr;
+
+    *fileSize = size;
+    return g_fileBuffer.data();
 }
 
-BYTE *readPsyqObj(char* objName, int *offsetStart, int *len)
+//! Read a whole file: mapped, or into g_fileBuffer (reused between calls).
+//! "-" is stdin.
+BYTE *readFile(const char *fileName, size_t *fileSize)
 {
-    FILE* file = fopen(objName, "rb");
+    if (!strcmp(fileName, "-"))
+    {
+        return readFd(0, fileSize);
+    }
+
+#ifndef _WIN32
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        fatal("Error: Unable to open obj file %s\n", fileName);
+    }
+    BYTE *buffer = readFd(fd, fileSize);
+    close(fd);
+    return buffer;
+#else
+    unmapFile();
+
+    FILE* file = fopen(fileName, "rb");
     if (!file)
     {
-        printf("Error: Unable to open obj file %s\n", objName);
-        exit(1);
+        fatal("Error: Unable to open obj file %s\n", fileName);
     }
 
-    // Get Filesize 
+    // Get Filesize
     fseek(file, 0, SEEK_END);
     size_t file_size = ftell(file);
     rewind(file);
 //    printf("size of obj is: %d\n", file_size);
 
-    // Allocate memory for buffer
-    BYTE* buffer = new BYTE[file_size];
+    if (g_fileBuffer.size() < file_size)
+    {
+        g_fileBuffer.resize(file_size);
+    }
 
     // Fill Buffer
-    fread(buffer, file_size, 1, file);
+    size_t readCount = fread(g_fileBuffer.data(), 1, file_size, file);
     fclose(file);
+    if (readCount != file_size)
+    {
+        fatal("Error: Unable to read obj file %s\n", fileName);
+    }
+
+    *fileSize = file_size;
+    return g_fileBuffer.data();
+#endif
+}
 
-    // Read obj
-    BYTE* ptr = buffer;
-    short dims;
+//! Read a file that must stay valid while other files are read: left mapped
+//! until exit, or moved into copy
+BYTE *readFileKept(const char *fileName, size_t *fileSize, std::vector<BYTE> *copy)
+{
+    BYTE *buffer = readFile(fileName, fileSize);
 
-    Reloc *reloc;
+    if (g_mapped)
+    {
+        g_mapped = NULL;
+        g_mappedSize = 0;
+        return buffer;
+    }
+    copy->swap(g_fileBuffer);
+    return copy->data();
+}
 
-    ptr += 3; // name (LNK)
-    ptr += 1; // version (2)
-    ptr += 2; // processor type (7)
+//! Disassemble an obj in memory with the given mode, and output the result
+void disassembleObj(const BYTE *obj, size_t size, int mode, int options)
+{
+    const char  *out;
+    size_t      outSize;
 
-    readPsyqObjSymbols(ptr, buffer, file_size);
+    check(mdasm_disassemble(obj, size, mode, options, &out, &outSize));
+    outputBytes(out, outSize);
+}
 
-    while (ptr - buffer < file_size)
+void usage(void)
+{
+#ifndef PERMUTER
+    printf("usage: MDasm (func.obj / mgs.exe startOffset endOffset) [-o --offsets] [-b --bytes] [-r --reloc] [-c --code]\n");
+    printf("       MDasm (- / --fd N) [options]     read the obj file from stdin / file descriptor N\n");
+    printf("       MDasm --server [options]\n");
+    printf("    [-n --normalized] print the scorer's normalized lines (mnemonic, has_symbol, row)\n");
+    printf("        [--stack-diffs] [--branch-targets] [--bl-delay-slots]\n");
+    printf("    [--binary] print fixed size instruction records instead of text\n");
+    printf("    [--function NAME] only disassemble the text of function NAME\n");
+    printf("    [-G N] assemble CC1PSX output (func.s) like aspsx -G N (default 8)\n");
+    printf("       MDasm --exe mgs.exe (--ranges FILE / --map FILE) [--base ADDR] [--threads N] [options]\n");
+    printf("    disassemble every function of an executable, from \"name start end\" lines or a symbol map\n");
+    printf("       MDasm --index mgs.exe [--base ADDR] [--gram N] > mgs.idx\n");
+    printf("       MDasm --find mgs.idx func.obj... [--function NAME] [--limit N]\n");
+    printf("    index the instruction n-grams of an executable, then find copies of an obj's functions in it\n");
+    printf("       MDasm --lib libc.lib [MODULE / SYMBOL...] [--threads N] [options]\n");
+    printf("        [--list] print every module and its symbols\n");
+    printf("        [--extract MODULE / SYMBOL] write the module's obj file to stdout\n");
+    printf("       MDasm --score target.obj cand.obj... [normalization options] [--block-diff]\n");
+    printf("    [--block-diff] diff functions of 256 lines or more block by block\n");
+    printf("       MDasm --target-index target.obj [normalization options] [--block-diff] > target.idx\n");
+    printf("    normalize a target once, --score and --prefilter take the index in place of target.obj\n");
+    printf("       MDasm --blocks obj...       print the basic blocks of the normalized lines (first line, lines, hash)\n");
+    printf("       MDasm --prefilter target.obj cand.obj... [normalization options]\n");
+    printf("    print \"exact differing/words lower_bound\" from comparing the raw words of every candidate\n");
+    printf("       MDasm --code-hash obj...    print the hash of the code and relocations that scores depend on\n");
+    printf("    (Optional parameters must be provided at the end).\n");
+#endif
+    exit(1);
+}
+
+//! --blocks obj...: print the basic blocks of every obj
+int blockFiles(int argc, char** argv)
+{
+    for (int i = 2; i < argc; i++)
     {
-    //    printf("OPCODE: 0x%-2x - %-2d at offset 0x%x\n", *ptr, *ptr, ptr - buffer);
-        switch (*ptr++)
+        const char  *out;
+        size_t      outSize;
+        size_t      size;
+        BYTE        *obj;
+
+        if (argv[i][0] == '-')
         {
-            case 0x30:  // 48 - XBSS symbol number %lx .. size %lx in section %lx\n
-                ptr += 2; // symbol number
-                ptr += 2; // section
-                ptr += 4; // size
-                ptr += *ptr + 1; // symbol name
-                break;
+            continue;
+        }
+        obj = readFile(argv[i], &size);
+        check(mdasm_blocks(obj, size, &out, &outSize));
+        outputBytes(out, outSize);
+    }
+    return 0;
+}
 
+//! --code-hash obj...: print the code hash of every obj
+int hashFiles(int argc, char** argv)
+{
+    for (int i = 2; i < argc; i++)
+    {
+        uint64_t    hash;
+        size_t      size;
+        BYTE        *obj;
 
-            case 0x10: // 16 - Section symbol number 1 '.rdata' in group 0 alignment 8
-            //    printf("section %d groupe %d align %d name %.*s\n", *(short*)ptr, *(short*)(ptr+2), *(ptr + 4), *(ptr + 5), (ptr + 6));
-                g_sections[*(short*)ptr] = (Section*)ptr;
-            //    sprintf(g_sections[*(short*)ptr].name, "%.*s\0", *(ptr + 5), ptr + 6);
-                /*
-                    short   index;
-                    short   groupeId;
-                    char    alignment;
-                    char    *name;
-                */
-                ptr += 2; // section index
-            //    g_sections[*(short*)ptr].groupe = *(short*)ptr;
-                ptr += 2; // groupe index
-                ptr += 1; // alignment
-                ptr += *ptr + 1; // section name
-                break;
-            case 0x1c: // 28 - file name
-                ptr += 2; // file number
-            //    printf("file: %.*s\n", *ptr, ptr + 1);
-                ptr += *ptr + 1; // file name
-                break;
-            case 0x6:  // 6 - Switch
-                ptr += 2; // section index
-                break;
-            case 0x8:  // 8 - Uninitialised data
-                ptr += 4; // total bytes
-                break;
-            case 0x2:  // 2 - Code
-                g_codes[g_totalCodes++] = (Code*)ptr;
-                *len = *(unsigned short*)ptr;
-                ptr += 2; // len
-                *offsetStart = ptr - buffer;
-                ptr += *len; // mips code
-                break;
-            case 0x3a: // 58 - Set SLD linenum to 5 at offset 0 in file c
-                ptr += 8;
-                break;
-            case 0x34: // 52 - Inc SLD linenum by byte 0 at offset 0
-                ptr += 3;
-                break;
-            case 0x32: // 50 - Inc SLD linenum at offset 0
-                ptr += 2;
-                break;
-            case 0x38: // 56 - Set SLD linenum to 14 at offset 1c
-                ptr += 6;
-                break;
-            case 0xa:  // 10 - Patch type 74 at offset 2c with (sectbase(2)+$38)
-                /*
-                typedef struct  reloc
-                {
-                    enum        
-                    {
-                        eR_MIPS_32 = 16,
-                        eR_MIPS_26 = 74,
-                        eR_HI16 = 82,
-                        eR_LO16 = 84,
-                        eR_GPREL16 = 100,
-                    }           type;
-                }
-                */
-              //  g_relocs[*(short*)ptr].
-                reloc = &g_relocs[*(short*)(ptr + 1) / 4];
-             //   printf("Patch \n");
-                switch (*ptr)
-                {
-                    case 16:  // REL32
-                    //    printf("type R_MIPS_32 ");
-                        sprintf(reloc->type, "R_MIPS_32\0");
-                        break;
-                    case 74:  // REL26
-                    //    printf("type R_MIPS_26 ");
-                        sprintf(reloc->type, "R_MIPS_26");
-                        break;
-                    case 82:  // HI16
-                    //    printf("type R_HI16 ");
-                        sprintf(reloc->type, "R_HI16");
-                        break;
-                    case 84:  // LO16
-                    //    printf("type R_LO16 ");
-                        sprintf(reloc->type, "R_LO16");
-                        break;
-                    case 100: // GPREL16
-                    //    printf("type GPREL16 ");
-                        sprintf(reloc->type, "GPREL16");
-                        break;
-                }
-                ptr += 1; // reloc type
-             //   printf("at offset %x ", *(short*)ptr);
-                ptr += 2; // offset
-                for (int i = 0; i < 1; i++)
-                {
-                    switch (*ptr++)
-                    {
-                        case 0:   // VALUE
-                        //    printf("value %#x ", *(int*)ptr);
-                            if (*reloc->expr)
-                            {
-                                sprintf(reloc->expr, "%s%c%x", reloc->expr, reloc->op, *(int*)ptr);
-                            }
-                            else
-                            {
-                                sprintf(reloc->expr, "%x", *(int*)ptr);
-                            }
-                            ptr += 4;
-                            break;
-                        case 2:   // SYMBOL
-                        //    printf("symbol %s ", g_symbols[*(short*)ptr]);
-                            if (*reloc->expr)
-                            {
-                                sprintf(reloc->expr, "%s%c%s", reloc->expr, reloc->op, g_symbols[*(short*)ptr]);
-                            }
-                            else
-                            {
-                                sprintf(reloc->expr, "%s", g_symbols[*(short*)ptr]);
-                            }
-                            ptr += 2;
-                            break;
-                        case 4:   // SECTION_BASE
-                        //    printf("sectbase(%d) ", *(short*)ptr);
-                        //    printf("%s ", g_sections[*(short*)ptr].name);
-                            if (*reloc->expr)
-                            {
-                                sprintf(reloc->expr, "%s%c%.*s", reloc->expr, reloc->op, g_sections[*(short*)ptr]->nameLen, g_sections[*(short*)ptr]->name);
-                            }
-                            else
-                            {
-                                sprintf(reloc->expr, "%.*s", g_sections[*(short*)ptr]->nameLen, g_sections[*(short*)ptr]->name);
-                            }
-                            ptr += 2;
-                            break;
-                        case 12:  // SECTION_START
-                        //    printf("sectstart(%d) ", *(short*)ptr);
-                            ptr += 2;
-                            break;
-                        case 22:  // SECTION_END
-                        //    printf("sectend(%d) ", *(short*)ptr);
-                            ptr += 2;
-                            break;
-                        case 44:  // ADD
-                        //    printf("ADD ");
-                            reloc->op = '+';
-                            i -= 2;
-                            break;
-                        case 46:  // SUB
-                        //    printf("SUB ");
-                            reloc->op = '-';
-                            i -= 2;
-                            break;
-                        case 50:  // DIV
-                        //    printf("DIV ");
-                            reloc->op = '/';
-                            i -= 2;
-                            break;
-                    }
-                }
-            //    printf("\n");
-                break;
-            case 0x3c: // 60 - End SLD info at offset 0
-                ptr += 2; // offset
-                break;
-            case 0xc:  // 12 - XDEF symbol number a 'CRC32_80020BB4' at offset 0 in section 2
-            //    printf("XDEF: symbol %x section %d offset %x %.*s\n", *(short*)ptr, *(short*)(ptr+2), *(int*)(ptr+4), *(ptr+8), (ptr+9));
-                ptr += 2; // symbol number
-                ptr += 2; // section index
-                ptr += 4; // offset
-            //    printf("XDEF: %.*s\n", *ptr, ptr + 1);
-                ptr += *ptr + 1; // symbol name
-                break;
-            case 0xe:  // 14 - XREF symbol number 24 'GCL_ReadVector_80020A14'
-            //    printf("_XREF: symbol %x %.*s\n", *(short*)ptr, *(ptr + 2), (ptr + 3));
-                ptr += 2; // symbol number
-                ptr += *ptr + 1; // symbol name
-                break;
-            case 0x52: // 82 - Def
-            //    printf("DEF: section %d value %d class %d type %d size %d name %.*s\n", *(short*)ptr, *(int*)(ptr + 2), *(short*)(ptr + 6), *(short*)(ptr + 8), *(short*)(ptr + 10), *(ptr+14), (ptr + 15));
-                ptr += 2; // section
-                ptr += 4; // value
-                ptr += 2; // class
-                ptr += 2; // type
-                ptr += 4; // size
-                ptr += *ptr + 1; // name
-                break;
-            case 0x54: // 84 - Def2 (arrays)
-            //    printf("DEF2: section %d value %d class %d type %d size %d name %.*s\n", *(short*)ptr, *(int*)(ptr + 2), *(short*)(ptr + 6), *(short*)(ptr + 8), *(short*)(ptr + 10), *(ptr + 14), (ptr + 15));
-                ptr += 2; // section
-                ptr += 4; // value
-                ptr += 2; // class
-                ptr += 2; // type
-                ptr += 4; // size
-                dims = *(short*)ptr;
-                for (int i = 0; i <= dims; i++)
-                {
-                    if (i == 0)
-                    {
-                        ptr += 2; // dims
-                    }
-                    else
-                    {
-                        ptr += 4; // dims
-                    }
-                }
-                if (dims && *ptr == 0)
-                {
-                    ptr += 1; // padding ?
-                }
-                else
-                {
-                    ptr += *ptr + 1; // tag (1st line)
-                }
-                ptr += *ptr + 1; // tag (2nd line)
-                break;
-            case 0x4a: // 74 - Function start
-                ptr += 2; // section
-                ptr += 4; // offset
-                ptr += 2; // file
-                ptr += 4; // start line
-                ptr += 2; // frame reg
-                ptr += 4; // frame size
-                ptr += 2; // return pc reg
-                ptr += 4; // mask
-                ptr += 4; // mask offset
-                printf("function name: %.*s\n", *ptr, ptr + 1);
-                ptr += *ptr + 1; // name
-                break;
-            case 0x4e: // 78 - Block start
-                ptr += 2; // section
-                ptr += 4; // offset
-                ptr += 4; // start line
-                break;
-            case 0x50: // 80 - Block end
-                ptr += 2; // section
-                ptr += 4; // offset
-                ptr += 4; // end line
-                break;
-            case 0x4c: // 76 - Function end
-                ptr += 2; // section
-                ptr += 4; // offset
-                ptr += 4; // end line
-                break;
-            case 0:  // End of file
-            //    printf("End of file offset: %d, file size: %d\n", ptr - buffer, file_size);
-                if (ptr - buffer != file_size)
-                {
-                    printf("Error end of file at %x when file size is %x\n", ptr - buffer, file_size);
-                    exit(1);
-                }
-                break;
-            default:
-                ptr--;
-                printf("Error: unknown opcode 0x%x in obj file at offset 0x%x.\n", *ptr, ptr - buffer);
-                exit(1);
+        if (argv[i][0] == '-')
+        {
+            continue;
         }
+        obj = readFile(argv[i], &size);
+        check(mdasm_code_hash(obj, size, &hash));
+        printf("%016" PRIx64 "  %s\n", hash, argv[i]);
     }
+    return 0;
+}
 
-    return buffer;
+//! Load the target of --score or --prefilter: an obj, or its --target-index
+int addTargetFile(const char *fileName)
+{
+    size_t  size;
+    BYTE    *obj = readFile(fileName, &size);
+
+    if (size >= 4 && !memcmp(obj, "MDTI", 4))
+    {
+        return check(mdasm_load_target(fileName, g_options));
+    }
+    return check(mdasm_add_target(obj, size, g_options));
 }
 
-void removeChar(char* s, char c)
+//! --target-index target.o: write the index of a scoring target
+int indexTarget(const char *fileName)
 {
-    int j, n = strlen(s);
+    const char  *out;
+    size_t      outSize;
+    size_t      size;
+    BYTE        *obj = readFile(fileName, &size);
 
-    for (int i = j = 0; i < n; i++)
-        if (s[i] != c)
-            s[j++] = s[i];
-    s[j] = '\0';
+    check(mdasm_target_index(obj, size, g_options, &out, &outSize));
+    outputBytes(out, outSize);
+    return 0;
 }
 
-void usage(void)
+//! --score target.o cand.o...: print "score hash" for every candidate
+int scoreFiles(int argc, char** argv)
 {
-#ifndef PERMUTER
-    printf("usage: MDasm (func.obj / mgs.exe startOffset endOffset) [-o --offsets] [-b --bytes] [-r --reloc] [-c --code]\n");
-    printf("    (Optional parameters must be provided at the end).\n");
+    int         target = -1;
+    long long   score;
+    char        hash[65];
+
+    for (int i = 2; i < argc; i++)
+    {
+        size_t  size;
+        BYTE    *obj;
+
+        if (argv[i][0] == '-')
+        {
+            continue;
+        }
+        if (target < 0)
+        {
+            target = addTargetFile(argv[i]);
+            continue;
+        }
+        obj = readFile(argv[i], &size);
+        check(mdasm_score(target, obj, size, &score, hash));
+        printf("%lld %s\n", score, hash);
+    }
+    if (target < 0)
+    {
+        usage();
+    }
+    return 0;
+}
+
+//! --prefilter target.o cand.o...: print what mdasm_prefilter() finds for
+//! every candidate
+int prefilterFiles(int argc, char** argv)
+{
+    int             target = -1;
+    MdasmPrefilter  result;
+
+    for (int i = 2; i < argc; i++)
+    {
+        size_t  size;
+        BYTE    *obj;
+
+        if (argv[i][0] == '-')
+        {
+            continue;
+        }
+        if (target < 0)
+        {
+            target = addTargetFile(argv[i]);
+            continue;
+        }
+        obj = readFile(argv[i], &size);
+        check(mdasm_prefilter(target, obj, size, &result));
+        printf("%d %u/%u %lld\n", result.exact, result.differingWords, result.words, result.lowerBound);
+    }
+    if (target < 0)
+    {
+        usage();
+    }
+    return 0;
+}
+
+//! Read exactly size bytes from stdin, false on EOF
+bool readInput(void *dst, size_t size)
+{
+    return fread(dst, 1, size, stdin) == size;
+}
+
+//! The obj given at g_request[start]: 'P' + path or 'B' + obj bytes
+BYTE *requestObj(size_t start, size_t *size)
+{
+    if (g_request.size() <= start)
+    {
+        fatal("Error: empty request\n");
+    }
+
+    switch (g_request[start])
+    {
+    case 'P':
+        g_request.push_back('\0');
+        return readFile((char*)&g_request[start + 1], size);
+    case 'B':
+        *size = g_request.size() - start - 1;
+        return &g_request[start + 1];
+    default:
+        fatal("Error: unknown obj request '%c'\n", g_request[start]);
+    }
+    return NULL;
+}
+
+//! Handle the request in g_request:
+//!   'P' path               disassemble the obj file at path
+//!   'B' bytes              disassemble the obj file contents
+//!   'N' flags obj          same, normalized (flags: 1 = --stack-diffs,
+//!                          2 = --branch-targets, 4 = --bl-delay-slots)
+//!   'X' obj                same, as --binary records
+//!   'T' flags obj          load a scoring target, answers its id
+//!   'Y' flags obj          answers the index of a scoring target
+//!   'I' flags path         load a scoring target from its index file
+//!   'S' id (u32) obj       score against target id, answers "score hash"
+//!   'L' id (u32) bound (i64) obj
+//!                          same, only "lower_bound" if it can't score bound
+//!   'C' id (u32) capacity (u32) path
+//!                          cache the scores of target id in the file at path
+//!   'F' [name]             only disassemble / score function name in the
+//!                          next requests, or the whole obj without a name
+//!   'G' size (u32)         assemble the objs that are CC1PSX's output like
+//!                          aspsx -G size
+void handleRequest(void)
+{
+    char        hash[65];
+    char        line[96];
+    long long   score, bound;
+    uint32_t    id, capacity;
+    const char  *out;
+    size_t      outSize;
+    size_t      size;
+    BYTE        *obj;
+
+    switch (g_request.empty() ? 0 : g_request[0])
+    {
+    case 'F':
+        g_request.push_back('\0');
+        mdasm_set_function((char*)&g_request[1]);
+        break;
+    case 'G':
+        if (g_request.size() < 5)
+        {
+            fatal("Error: truncated request\n");
+        }
+        memcpy(&id, &g_request[1], sizeof(id));
+        mdasm_set_gp_size((int)id);
+        break;
+    case 'X':
+        obj = requestObj(1, &size);
+        disassembleObj(obj, size, MDASM_BINARY, g_options);
+        break;
+    case 'N':
+        if (g_request.size() < 2)
+        {
+            fatal("Error: truncated request\n");
+        }
+        obj = requestObj(2, &size);
+        disassembleObj(obj, size, MDASM_NORMALIZED, (g_options & ~MDASM_NORMALIZE_MASK) | g_request[1]);
+        break;
+    case 'T':
+        if (g_request.size() < 2)
+        {
+            fatal("Error: truncated request\n");
+        }
+        obj = requestObj(2, &size);
+        snprintf(line, sizeof(line), "%d", check(mdasm_add_target(obj, size, g_request[1])));
+        g_output = line;
+        break;
+    case 'Y':
+        if (g_request.size() < 2)
+        {
+            fatal("Error: truncated request\n");
+        }
+        obj = requestObj(2, &size);
+        check(mdasm_target_index(obj, size, g_request[1], &out, &outSize));
+        outputBytes(out, outSize);
+        break;
+    case 'I':
+        if (g_request.size() < 2)
+        {
+            fatal("Error: truncated request\n");
+        }
+        g_request.push_back('\0');
+        snprintf(line, sizeof(line), "%d", check(mdasm_load_target((char*)&g_request[2], g_request[1])));
+        g_output = line;
+        break;
+    case 'C':
+        if (g_request.size() < 9)
+        {
+            fatal("Error: truncated request\n");
+        }
+        memcpy(&id, &g_request[1], sizeof(id));
+        memcpy(&capacity, &g_request[5], sizeof(capacity));
+        g_request.push_back('\0');
+        check(mdasm_target_cache(id > INT32_MAX ? -1 : (int)id, (char*)&g_request[9], capacity));
+        break;
+    case 'S':
+        if (g_request.size() < 5)
+        {
+            fatal("Error: truncated request\n");
+        }
+        memcpy(&id, &g_request[1], sizeof(id));
+        if (id > INT32_MAX)
+        {
+            fatal("Error: unknown target %u\n", id);
+        }
+        obj = requestObj(5, &size);
+        check(mdasm_score((int)id, obj, size, &score, hash));
+        snprintf(line, sizeof(line), "%lld %s", score, hash);
+        g_output = line;
+        break;
+    case 'L':
+        if (g_request.size() < 13)
+        {
+            fatal("Error: truncated request\n");
+        }
+        memcpy(&id, &g_request[1], sizeof(id));
+        memcpy(&bound, &g_request[5], sizeof(bound));
+        if (id > INT32_MAX)
+        {
+            fatal("Error: unknown target %u\n", id);
+        }
+        obj = requestObj(13, &size);
+        check(mdasm_score_bounded((int)id, obj, size, bound, &score, hash));
+        snprintf(line, sizeof(line), hash[0] ? "%lld %s" : "%lld", score, hash);
+        g_output = line;
+        break;
+    default:
+        obj = requestObj(0, &size);
+        disassembleObj(obj, size, MDASM_TEXT, g_options);
+        break;
+    }
+}
+
+//! Server mode: every request is a little-endian u32 length followed by that
+//! many bytes, every response is a u32 length followed by a status byte
+//! (0 = ok, 1 = error, 2 = unsupported, see check()) and the output that the
+//! command line would print.
+int serve(void)
+{
+    uint32_t    size;
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
 #endif
-    exit(1);
+
+    g_server = true;
+
+    while (readInput(&size, sizeof(size)))
+    {
+        g_request.resize(size);
+        if (size && !readInput(g_request.data(), size))
+        {
+            break;
+        }
+
+        g_output.clear();
+
+        BYTE status = 0;
+        try
+        {
+            handleRequest();
+        }
+        catch (const RequestError &e)
+        {
+            status = e.status == MDASM_UNSUPPORTED ? 2 : 1;
+        }
+        unmapFile();
+
+        size = g_output.size() + 1;
+        fwrite(&size, sizeof(size), 1, stdout);
+        fwrite(&status, 1, 1, stdout);
+        fwrite(g_output.data(), 1, g_output.size(), stdout);
+        fflush(stdout);
+    }
+
+    return 0;
 }
 
-int disassemble(BYTE *code, size_t code_size)
+
+//! Parse an address token of a symbol map: 0x-prefixed, or 8 hex digits
+bool parseMapAddress(const char *token, uint32_t *address)
 {
-    csh handle;
-    cs_insn* insn;
+    char    *end;
+    size_t  len = strlen(token);
 
-    if (cs_open(CS_ARCH_MIPS, CS_MODE_MIPS32, &handle) != CS_ERR_OK)
+    if (len > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+    {
+        token += 2;
+        len -= 2;
+    }
+    else if (len != 8)
     {
-        return -1;
+        return false;
     }
+    *address = (uint32_t)strtoul(token, &end, 16);
+    return *end == '\0' || *end == ';';
+}
 
-    const size_t count = cs_disasm(handle, (const uint8_t*)code, code_size, 0x0, 0, &insn);
+//! Read --ranges ("name start end" lines) or --map (an address and a name per
+//! line, in any order, e.g. "80010000 main" or "main = 0x80010000;"); map
+//! entries end at the next symbol, the last one at the end of the executable
+void readRanges(const char *fileName, bool map)
+{
+    FILE    *file = fopen(fileName, "r");
+    char    line[1024];
 
-    if (count > 0)
+    if (!file)
+    {
+        fatal("Error: Unable to open %s\n", fileName);
+    }
+    while (fgets(line, sizeof(line), file))
     {
-        for (size_t j = 0; j < count; j++)
+        const char  *tokens[3];
+        int         count = 0;
+        MdasmRange  range = { NULL, 0, 0 };
+
+        for (char *token = strtok(line, " \t\r\n="); token && count < 3; token = strtok(NULL, " \t\r\n="))
         {
-            if (g_params.offsets)
+            if (token[0] == '#')
             {
-                printf("%4llx:\t", insn[j].address);
+                break;
             }
-            if (g_params.bytes)
+            tokens[count++] = token;
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+        if (map)
+        {
+            const char  *name = NULL;
+            bool        found = false;
+
+            // the first address and the first other token, e.g. skipping a
+            // size column
+            for (int i = 0; i < count; i++)
             {
-                //    for (int i = 0; i < insn[j].size; i++)
-                //    {
-                //        printf("%X", insn[j].bytes[i]);
-                //    }
-                //    printf("\t");
-                printf("%08X\t", *(int*)insn[j].bytes);
+                uint32_t address;
+
+                if (parseMapAddress(tokens[i], &address))
+                {
+                    range.start = found ? range.start : address;
+                    found = true;
+                }
+                else if (!name)
+                {
+                    name = tokens[i];
+                }
             }
-            removeChar(insn[j].op_str, '$');
-            bool needReplace = *(int*)&g_relocs[j] /*&& insn[j].mnemonic[0] == 'j' && insn[j].op_str[0] == '0'*/;
-            if (needReplace && insn[j].op_str[strlen(insn[j].op_str) - 1] == '0')
+            if (!found || !name)
             {
-                printf("%s\t%.*s%s", insn[j].mnemonic, strlen(insn[j].op_str) - 1, insn[j].op_str, g_relocs[j].expr);
+                continue;
             }
-            else
+            g_rangeNames.push_back(name);
+        }
+        else
+        {
+            if (count < 3)
             {
-                printf("%s\t%s", insn[j].mnemonic, insn[j].op_str);
-                if (needReplace)
-                {
-                    printf(" <%s>", g_relocs[j].expr);
-                }
+                fatal("Error: expected \"name start end\" in %s: %s\n", fileName, tokens[0]);
             }
-            //    printf("0x%llx:\t%s\t\t%s\n", insn[j].address, insn[j].mnemonic, insn[j].op_str);
+            g_rangeNames.push_back(tokens[0]);
+            range.start = (uint32_t)strtoul(tokens[1], NULL, 0);
+            range.end = (uint32_t)strtoul(tokens[2], NULL, 0);
+        }
+        range.name = g_rangeNames.back().c_str();
+        g_ranges.push_back(range);
+    }
+    fclose(file);
 
-            if (*(int*)&g_relocs[j])
-            {
-                //    if (!needReplace)
-                //    {
-                //        printf(" <%s>", g_relocs[j].expr);
-                //    }
-                if (g_params.reloc)
-                {
-                    printf("\n\t\t\t%x: %s %s", j * 4, g_relocs[j].type, g_relocs[j].name);
-                }
-            }
-            printf("\n");
+    if (map)
+    {
+        std::stable_sort(g_ranges.begin(), g_ranges.end(), [](const MdasmRange &a, const MdasmRange &b) { return a.start < b.start; });
+        for (size_t i = 0; i + 1 < g_ranges.size(); i++)
+        {
+            g_ranges[i].end = g_ranges[i + 1].start;
         }
+    }
+}
+
+//! Options followed by a value, for skipping them among file names
+bool hasValue(const char *option)
+{
+    const char *options[] = { "--function", "-G", "--ranges", "--map", "--base", "--threads", "--gram", "--limit", "--extract", NULL };
 
-        cs_free(insn, count);
+    for (int i = 0; options[i]; i++)
+    {
+        if (!strcmp(option, options[i]))
+        {
+            return true;
+        }
     }
-    else
+    return false;
+}
+
+//! --index: write the n-gram index of an executable
+int indexExe(const char *fileName)
+{
+    const char  *out;
+    size_t      outSize;
+    size_t      size;
+    BYTE        *exe = readFile(fileName, &size);
+
+    check(mdasm_build_index(exe, size, g_base, g_gram, &out, &outSize));
+    outputBytes(out, outSize);
+    return 0;
+}
+
+//! --find index.idx obj...: print where the functions of every obj are in
+//! the indexed executable
+int findFiles(int argc, char** argv)
+{
+    std::vector<BYTE>   copy;
+    size_t      indexSize;
+    BYTE        *index = readFileKept(argv[2], &indexSize, &copy);
+
+    for (int i = 3; i < argc; i++)
     {
-        printf("ERROR: Failed to disassemble given code!\n");
+        const char  *out;
+        size_t      outSize;
+        size_t      size;
+        BYTE        *obj;
+
+        if (argv[i][0] == '-')
+        {
+            i += hasValue(argv[i]);
+            continue;
+        }
+        obj = readFile(argv[i], &size);
+        check(mdasm_find(index, indexSize, obj, size, g_limit, &out, &outSize));
+        outputBytes(out, outSize);
     }
+    return 0;
+}
 
-    cs_close(&handle);
+//! --lib: disassemble the modules of an archive named on the command line, or
+//! all of them, or list them, or extract one
+int disassembleLib(int argc, char** argv)
+{
+    std::vector<const char*>    names;
+    const char  *out;
+    size_t      outSize;
+    size_t      size;
+    BYTE        *lib = readFile(argv[2], &size);
+
+    if (g_list)
+    {
+        check(mdasm_lib_index(lib, size, &out, &outSize));
+        outputBytes(out, outSize);
+        return 0;
+    }
+    if (g_extract)
+    {
+        const uint8_t *obj;
 
+        check(mdasm_lib_module(lib, size, g_extract, &obj, &outSize));
+        outputBytes(obj, outSize);
+        return 0;
+    }
+
+    for (int i = 3; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            i += hasValue(argv[i]);
+            continue;
+        }
+        names.push_back(argv[i]);
+    }
+    check(mdasm_disassemble_lib(lib, size, names.data(), names.size(), g_mode, g_options, g_threads, &out, &outSize));
+    outputBytes(out, outSize);
     return 0;
 }
 
+//! --exe: disassemble every range of an executable in one run
+int disassembleExe(const char *fileName)
+{
+    const char  *out;
+    size_t      outSize;
+    size_t      size;
+    BYTE        *exe = readFile(fileName, &size);
+
+    check(mdasm_disassemble_exe(exe, size, g_base, g_ranges.data(), g_ranges.size(), g_mode, g_options, g_threads, &out, &outSize));
+    outputBytes(out, outSize);
+    return 0;
+}
 
 int main(int argc, char** argv)
 {
     BYTE    *buf, *pBuffer;
     int     offsetStart;
     int     offsetEnd;
-    int     len;
+    size_t  size;
 //    bool    paramOffsets, paramBytes, paramReloc;
 
     if (argc < 2)
@@ -714,41 +873,142 @@ int main(int argc, char** argv)
  //   paramOffsets = 0;
  //   paramBytes = 0;
  //   paramReloc = 0;
- 
-#ifndef PERMUTER
+
+#ifdef PERMUTER
+    g_options |= MDASM_OFFSETS | MDASM_BYTES;
+#endif
+
     for (int i = 1; i < argc; i++)
     {
-        if (!strcmp(argv[i], "--offsets") || !strcmp(argv[i], "-o"))
+        if (!strcmp(argv[i], "--normalized") || !strcmp(argv[i], "-n"))
+            g_mode = g_mode == MDASM_BINARY ? g_mode : MDASM_NORMALIZED;
+        else if (!strcmp(argv[i], "--binary"))
+            g_mode = MDASM_BINARY;
+        else if (!strcmp(argv[i], "--stack-diffs"))
+            g_options |= MDASM_STACK_DIFFS;
+        else if (!strcmp(argv[i], "--branch-targets"))
+            g_options |= MDASM_BRANCH_TARGETS;
+        else if (!strcmp(argv[i], "--bl-delay-slots"))
+            g_options |= MDASM_BL_DELAY_SLOTS;
+        else if (!strcmp(argv[i], "--block-diff"))
+            g_options |= MDASM_BLOCK_DIFF;
+        else if (!strcmp(argv[i], "--function") && i + 1 < argc)
+            mdasm_set_function(argv[++i]);
+        else if (!strcmp(argv[i], "-G") && i + 1 < argc)
+            mdasm_set_gp_size(atoi(argv[++i]));
+        else if ((!strcmp(argv[i], "--server") || !strcmp(argv[i], "--score") || !strcmp(argv[i], "--prefilter") || !strcmp(argv[i], "--blocks") || !strcmp(argv[i], "--code-hash") || !strcmp(argv[i], "-")) && i == 1)
+            continue;
+        else if ((!strcmp(argv[i], "--fd") || !strcmp(argv[i], "--exe") || !strcmp(argv[i], "--index") || !strcmp(argv[i], "--find") || !strcmp(argv[i], "--lib") || !strcmp(argv[i], "--target-index")) && i == 1)
+            i++;
+        else if (!strcmp(argv[i], "--list"))
+            g_list = true;
+        else if (!strcmp(argv[i], "--extract") && i + 1 < argc)
+            g_extract = argv[++i];
+        else if (!strcmp(argv[i], "--ranges") && i + 1 < argc)
+            readRanges(argv[++i], false);
+        else if (!strcmp(argv[i], "--map") && i + 1 < argc)
+            readRanges(argv[++i], true);
+        else if (!strcmp(argv[i], "--base") && i + 1 < argc)
+            g_base = (uint32_t)strtoul(argv[++i], NULL, 16);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            g_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--gram") && i + 1 < argc)
+            g_gram = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--limit") && i + 1 < argc)
+            g_limit = atoi(argv[++i]);
+#ifndef PERMUTER
+        else if (!strcmp(argv[i], "--offsets") || !strcmp(argv[i], "-o"))
         //    paramOffsets = 1;
-            g_params.offsets = true;
+            g_options |= MDASM_OFFSETS;
         else if (!strcmp(argv[i], "--bytes") || !strcmp(argv[i], "-b"))
         //    paramBytes = 1;
-            g_params.bytes = true;
+            g_options |= MDASM_BYTES;
         else if (!strcmp(argv[i], "--reloc") || !strcmp(argv[i], "-r"))
         //    paramReloc = 1;
-            g_params.reloc = true;
+            g_options |= MDASM_RELOCS;
         else if (!strcmp(argv[i], "--code") || !strcmp(argv[i], "-c"))
             //    paramReloc = 1;
-            g_params.code = true;
+            continue;
         else if (argv[i][0] == '-')
         {
             printf("Error: unknown parameter: %s\n", argv[i]);
             usage();
         }
+#endif
+    }
+
+    if (!strcmp(argv[1], "--server"))
+    {
+        return serve();
+    }
+    if (!strcmp(argv[1], "--score"))
+    {
+        return scoreFiles(argc, argv);
+    }
+    if (!strcmp(argv[1], "--prefilter"))
+    {
+        return prefilterFiles(argc, argv);
+    }
+    if (!strcmp(argv[1], "--blocks"))
+    {
+        return blockFiles(argc, argv);
+    }
+    if (!strcmp(argv[1], "--code-hash"))
+    {
+        return hashFiles(argc, argv);
+    }
+
+#ifdef _WIN32
+    if (g_mode == MDASM_BINARY || !strcmp(argv[1], "--index") || !strcmp(argv[1], "--target-index") || g_extract)
+    {
+        _setmode(_fileno(stdout), _O_BINARY);
     }
-#else
-    g_params.offsets = true;
-    g_params.bytes = true;
 #endif
 
-    if (*(strrchr(argv[1], '.') + 1) == 'o')
+    const char *extension = strrchr(argv[1], '.');
+    if (!strcmp(argv[1], "--index") && argc >= 3)
+    {
+        return indexExe(argv[2]);
+    }
+    if (!strcmp(argv[1], "--target-index") && argc >= 3)
+    {
+        return indexTarget(argv[2]);
+    }
+    if (!strcmp(argv[1], "--find") && argc >= 3)
+    {
+        return findFiles(argc, argv);
+    }
+    if (!strcmp(argv[1], "--lib") && argc >= 3)
+    {
+        return disassembleLib(argc, argv);
+    }
+    if (!strcmp(argv[1], "--exe"))
     {
-        buf = readPsyqObj(argv[1], &offsetStart, &len);
-        pBuffer = buf + offsetStart;
-        offsetEnd = len;
+        if (argc < 3 || g_ranges.empty())
+        {
+            usage();
+        }
+        return disassembleExe(argv[2]);
+    }
+    else if (!strcmp(argv[1], "--fd"))
+    {
+        if (argc < 3)
+        {
+            usage();
+        }
+        pBuffer = readFd(atoi(argv[2]), &size);
+        disassembleObj(pBuffer, size, g_mode, g_options);
+    }
+    else if (!strcmp(argv[1], "-") || (extension && (extension[1] == 'o' || extension[1] == 's')))
+    {
+        pBuffer = readFile(argv[1], &size);
+        disassembleObj(pBuffer, size, g_mode, g_options);
     }
     else
     {
+        const char  *out;
+        size_t      outSize;
+
         if (argc < 4)
         {
             printf("Error: missing parameters for executable mode.\n");
@@ -785,23 +1045,19 @@ int main(int argc, char** argv)
         const size_t readCount = fread(pBuffer, 1, len, file);
         if (readCount != len)
         {
-            printf("Attempted to read %d bytes but got %d bytes\n", len, readCount);
+            printf("Attempted to read %d bytes but got %d bytes\n", len, (int)readCount);
             fclose(file);
             return 1;
         }
 
         fclose(file);
-    }
 
-    for (int i = 0; i < g_totalCodes; i++)
-    {
-        printf("------------------------------\n");
-        disassemble((BYTE*)g_codes[i]->code, g_codes[i]->size);
+        check(mdasm_disassemble_code(pBuffer, len, g_mode, g_options, &out, &outSize));
+        outputBytes(out, outSize);
+        delete[] buf;
     }
-//    disassemble(pBuffer, offsetEnd);
-
 
-    delete buf;
+    unmapFile();
 
     return 0;
 }
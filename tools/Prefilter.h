@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PREFILTER_SSE2
+#endif
+
+// Cheap checks of a candidate's words against the target's before scoring it
+// (mdasm_prefilter()). Each word comes with a mask of the bits compared: all
+// of them, or what its relocation leaves as compiled (exeIndexRelocMask()).
+//
+// The score's lower bound comes from the mnemonics alone. Lines only match
+// lines with the same mnemonic, and reordering only pairs insertions and
+// deletions of the same row, so every line of a mnemonic that one side has
+// more of is an insertion or a deletion.
+
+//! Words that differ in their compared bits or in their masks
+inline size_t prefilterDifferingWords(const uint32_t *a, const uint32_t *aMasks, const uint32_t *b, const uint32_t *bMasks, size_t count)
+{
+    size_t  differing = 0;
+    size_t  i = 0;
+
+#ifdef PREFILTER_SSE2
+    static const uint8_t    bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    const __m128i           zero = _mm_setzero_si128();
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i am = _mm_loadu_si128((const __m128i*)(aMasks + i));
+        __m128i bm = _mm_loadu_si128((const __m128i*)(bMasks + i));
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        __m128i same = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(x, am), zero), _mm_cmpeq_epi32(am, bm));
+
+        differing += 4 - bits[_mm_movemask_ps(_mm_castsi128_ps(same))];
+    }
+#endif
+    for (; i < count; i++)
+    {
+        differing += ((a[i] ^ b[i]) & aMasks[i]) != 0 || aMasks[i] != bMasks[i];
+    }
+    return differing;
+}
+
+//! Lower bound of the score from the number of words of each mnemonic class
+inline long long prefilterBound(const uint32_t *cand, const uint32_t *target, size_t classes, long long insertion, long long deletion)
+{
+    long long bound = 0;
+
+    for (size_t i = 0; i < classes; i++)
+    {
+        bound += cand[i] > target[i] ? (long long)(cand[i] - target[i]) * insertion : (long long)(target[i] - cand[i]) * deletion;
+    }
+    return bound;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// PS-X EXE header. The text follows the 2KB header and is loaded as-is at
+// its address; everything else in the header is only needed by a loader.
+
+#define PSX_EXE_MAGIC       "PS-X EXE"
+#define PSX_EXE_HEADER_SIZE 0x800
+
+typedef struct  PsxExe
+{
+    uint32_t        pc;         // initial pc
+    uint32_t        gp;         // initial gp
+    uint32_t        address;    // load address of the text
+    uint32_t        size;       // text size, clamped to the file
+    const uint8_t   *text;
+} PsxExe;
+
+inline uint32_t psxExeU32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+//! Parse the header, false if the buffer is not a PS-X EXE
+inline bool psxExeParse(const uint8_t *buffer, size_t size, PsxExe *exe)
+{
+    if (size < PSX_EXE_HEADER_SIZE || memcmp(buffer, PSX_EXE_MAGIC, 8))
+    {
+        return false;
+    }
+
+    exe->pc = psxExeU32(buffer + 0x10);
+    exe->gp = psxExeU32(buffer + 0x14);
+    exe->address = psxExeU32(buffer + 0x18);
+    exe->size = psxExeU32(buffer + 0x1c);
+    exe->text = buffer + PSX_EXE_HEADER_SIZE;
+    if (exe->size > size - PSX_EXE_HEADER_SIZE)
+    {
+        exe->size = size - PSX_EXE_HEADER_SIZE;
+    }
+    return true;
+}
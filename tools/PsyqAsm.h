@@ -0,0 +1,1950 @@
+#pragma once
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "PsyqObj.h"
+#include "R3000.h"
+
+// CC1PSX assembly front end: assembles the .s text CC1PSX writes straight
+// into a PsyqObject, the way aspsx assembles it into an LNK file, so that a
+// candidate can be scored without running aspsx and parsing its obj.
+//
+// It follows aspsx's rules as far as they show in the instructions:
+//  - macros are expanded like the MIPS assembler does it (li, la, move, neg,
+//    not, b / beqz / bnez, blt & co., mul, div / rem with their zero and
+//    overflow checks, loads and stores from a symbol, large immediates
+//    through $at)
+//  - a symbol of at most -G bytes (defined in .sdata / .sbss, or declared by
+//    .extern / .comm / .lcomm with its size) is accessed relative to $gp,
+//    others through a %hi / %lo pair
+//  - in .set reorder, a nop fills the delay slot of branches and jumps,
+//    after a load whose register the next instruction reads, and between
+//    mfhi / mflo and a mult / div or mthi / mtlo less than two instructions
+//    after them. Instructions are never moved. In .set noreorder nothing is
+//    inserted, except the hazards of the first instruction on what comes
+//    before the .set.
+//  - relocated fields are 0 and the relocations give the whole expression:
+//    a global or undefined symbol (plus its offset), or the section base
+//    plus the offset of a local one, since local symbols have no number
+//  - sections are declared in aspsx's order, and the code chunks follow the
+//    order of the text, a new one at every section switch
+//
+// tools/ has no copy of aspsx to check this against: test/test_mdasm.py
+// compares it with aspsx's objs for the corpus of CC1PSX output in
+// test/aspsx (made by make_fixtures.sh there), which covers these rules.
+
+//! Sections of an assembled obj, numbered like aspsx declares them
+#define PSYQ_ASM_RDATA      1
+#define PSYQ_ASM_TEXT       2
+#define PSYQ_ASM_DATA       3
+#define PSYQ_ASM_SDATA      4
+#define PSYQ_ASM_SBSS       5
+#define PSYQ_ASM_BSS        6
+#define PSYQ_ASM_SECTIONS   7
+
+//! Largest code chunk, so that relocation offsets fit their 16 bits
+#define PSYQ_ASM_CHUNK      0x8000
+
+constexpr const char *g_psyqAsmSections[PSYQ_ASM_SECTIONS] = {
+    "", ".rdata", ".text", ".data", ".sdata", ".sbss", ".bss"
+};
+
+typedef struct  PsyqAsmSymbol
+{
+    uint16_t            section;    // where it is defined, 0 while undefined
+    uint32_t            offset;
+    uint32_t            size;       // .extern / .comm / .lcomm size, or 0
+    uint16_t            number;     // symbol number in the obj, 0 for none
+    bool                global;
+    bool                common;     // .comm: allocated by the linker
+    bool                small;      // accessed relative to $gp
+} PsyqAsmSymbol;
+
+//! Branch to a label, patched once every label is defined
+typedef struct  PsyqAsmFixup
+{
+    uint16_t            section;
+    uint32_t            offset;
+    std::string_view    label;
+    int                 line;
+} PsyqAsmFixup;
+
+//! Relocation, turned into an expression once every symbol is known
+typedef struct  PsyqAsmReloc
+{
+    uint8_t             type;
+    uint16_t            section;
+    uint32_t            offset;
+    std::string_view    symbol;
+    int64_t             addend;
+} PsyqAsmReloc;
+
+//! Bytes [start, end) of a section written in one go, a code chunk
+typedef struct  PsyqAsmRun
+{
+    uint16_t            section;
+    uint32_t            start;
+    uint32_t            end;
+} PsyqAsmRun;
+
+typedef struct  PsyqAsmStatement
+{
+    int                 line;
+    std::string_view    text;
+} PsyqAsmStatement;
+
+//! Operand kinds
+#define A_REG   1   // $n
+#define A_IMM   2   // number
+#define A_ADDR  3   // symbol[+-number], or %hi() / %lo() / %gp_rel() of one
+#define A_MEM   4   // [expression](register)
+
+typedef struct  PsyqAsmOperand
+{
+    uint8_t             kind;
+    uint8_t             reg;        // A_REG, or the base of A_MEM
+    uint8_t             reloc;      // PSYQ_HI16 / PSYQ_LO16 / PSYQ_GPREL16, or 0
+    std::string_view    symbol;     // empty for a plain number
+    int64_t             value;      // the number, or the symbol's offset
+} PsyqAsmOperand;
+
+typedef struct  PsyqAsm
+{
+    int                                                 gpSize;
+    std::vector<uint8_t>                                bytes[PSYQ_ASM_SECTIONS];
+    uint32_t                                            bssSize[PSYQ_ASM_SECTIONS];
+    uint16_t                                            section;
+    bool                                                reorder;
+    bool                                                flushHazards;   // first instruction after .set noreorder
+    uint8_t                                             loadReg;        // loaded by the last instruction, or 0
+    uint8_t                                             loadOp;
+    int                                                 hiloAge;        // instructions since mfhi / mflo
+    std::unordered_map<std::string_view, PsyqAsmSymbol> symbols;        // views into the text
+    std::vector<std::string_view>                       defined;        // in definition order
+    std::vector<PsyqAsmFixup>                           fixups;
+    std::vector<PsyqAsmReloc>                           relocs;
+    std::vector<PsyqAsmRun>                             runs;
+    std::vector<PsyqAsmStatement>                       statements;
+    std::vector<std::string_view>                       operands;
+    int                                                 line;
+    std::string                                         error;
+} PsyqAsm;
+
+//! Whether a compiler output is assembly text rather than an LNK obj
+inline bool psyqIsAssembly(const uint8_t *buffer, size_t size)
+{
+    return size > 0 && (size < 3 || memcmp(buffer, "LNK", 3) != 0);
+}
+
+inline bool psyqAsmFail(PsyqAsm *a, const char *fmt, std::string_view arg = std::string_view())
+{
+    char    message[256];
+    int     len = snprintf(message, sizeof(message), "Error: line %d: ", a->line);
+
+    snprintf(message + len, sizeof(message) - len, fmt, (int)arg.size(), arg.data());
+    if (a->error.empty())
+    {
+        a->error = message;
+        a->error += '\n';
+    }
+    return false;
+}
+
+inline std::string_view psyqAsmTrim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r'))
+    {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+    {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+inline bool psyqAsmNameChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '$';
+}
+
+//! Split the text into statements: lines, or parts of lines separated by
+//! ';', without their # comments
+inline void psyqAsmSplit(PsyqAsm *a, const char *text, size_t size)
+{
+    size_t  start = 0;
+    int     line = 1;
+    bool    quoted = false;
+    bool    comment = false;
+
+    a->statements.clear();
+    for (size_t i = 0; i <= size; i++)
+    {
+        char c = i < size ? text[i] : '\n';
+
+        if (quoted)
+        {
+            if (c == '\\' && i + 1 < size)
+            {
+                i++;
+            }
+            else if (c == '"' || c == '\n')
+            {
+                quoted = false;
+            }
+            if (c != '\n')
+            {
+                continue;
+            }
+        }
+        if (c == '"' && !comment)
+        {
+            quoted = true;
+        }
+        else if (c == '#')
+        {
+            if (!comment)
+            {
+                a->statements.push_back({ line, std::string_view(text + start, i - start) });
+            }
+            comment = true;
+        }
+        else if ((c == ';' && !comment) || c == '\n')
+        {
+            if (!comment)
+            {
+                a->statements.push_back({ line, std::string_view(text + start, i - start) });
+            }
+            start = i + 1;
+            if (c == '\n')
+            {
+                comment = false;
+                line++;
+            }
+        }
+    }
+}
+
+//! Take a leading "name:" off a statement
+inline bool psyqAsmLabel(std::string_view *s, std::string_view *label)
+{
+    size_t i = 0;
+
+    while (i < s->size() && psyqAsmNameChar((*s)[i]))
+    {
+        i++;
+    }
+    if (i == 0 || i >= s->size() || (*s)[i] != ':')
+    {
+        return false;
+    }
+    *label = s->substr(0, i);
+    *s = psyqAsmTrim(s->substr(i + 1));
+    return true;
+}
+
+//! Split a statement into its mnemonic or directive and its operands
+inline std::string_view psyqAsmOperands(PsyqAsm *a, std::string_view s)
+{
+    size_t              i = 0;
+    size_t              start;
+    int                 depth = 0;
+    bool                quoted = false;
+    std::string_view    name;
+
+    while (i < s.size() && s[i] != ' ' && s[i] != '\t')
+    {
+        i++;
+    }
+    name = s.substr(0, i);
+    a->operands.clear();
+    s = psyqAsmTrim(s.substr(i));
+    if (s.empty())
+    {
+        return name;
+    }
+    start = 0;
+    for (i = 0; i <= s.size(); i++)
+    {
+        char c = i < s.size() ? s[i] : ',';
+
+        if (quoted)
+        {
+            if (c == '\\')
+            {
+                i++;
+            }
+            else if (c == '"')
+            {
+                quoted = false;
+            }
+            if (i < s.size())
+            {
+                continue;
+            }
+        }
+        if (c == '"')
+        {
+            quoted = true;
+        }
+        else if (c == '(')
+        {
+            depth++;
+        }
+        else if (c == ')')
+        {
+            depth--;
+        }
+        else if (c == ',' && depth <= 0)
+        {
+            a->operands.push_back(psyqAsmTrim(s.substr(start, i - start)));
+            start = i + 1;
+        }
+    }
+    return name;
+}
+
+//! "$n" or "$name", -1 if it is not a register
+inline int psyqAsmRegister(std::string_view s)
+{
+    static const char *names[32] = {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+        "t0",   "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+        "s0",   "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+        "t8",   "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+    };
+
+    if (s.size() < 2 || s[0] != '$')
+    {
+        return -1;
+    }
+    s.remove_prefix(1);
+    if (s[0] >= '0' && s[0] <= '9')
+    {
+        int reg = 0;
+        for (char c : s)
+        {
+            if (c < '0' || c > '9')
+            {
+                return -1;
+            }
+            reg = reg * 10 + c - '0';
+        }
+        return reg < 32 ? reg : -1;
+    }
+    if (s == "s8")
+    {
+        return 30;
+    }
+    for (int i = 0; i < 32; i++)
+    {
+        if (s == names[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//! Decimal, 0x hexadecimal or 0 octal number, with its sign
+inline bool psyqAsmNumber(std::string_view s, int64_t *value)
+{
+    bool        negative = false;
+    int         base = 10;
+    uint64_t    v = 0;
+
+    s = psyqAsmTrim(s);
+    if (!s.empty() && (s[0] == '-' || s[0] == '+'))
+    {
+        negative = s[0] == '-';
+        s = psyqAsmTrim(s.substr(1));
+    }
+    if (s.empty())
+    {
+        return false;
+    }
+    if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    {
+        base = 16;
+        s.remove_prefix(2);
+    }
+    else if (s.size() > 1 && s[0] == '0')
+    {
+        base = 8;
+        s.remove_prefix(1);
+    }
+    for (char c : s)
+    {
+        int digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        if (digit >= base)
+        {
+            return false;
+        }
+        v = v * base + digit;
+    }
+    *value = negative ? -(int64_t)v : (int64_t)v;
+    return true;
+}
+
+//! "symbol", "symbol+n", "n+symbol", "symbol-n" or "n"; sums of numbers too
+inline bool psyqAsmExpr(std::string_view s, std::string_view *symbol, int64_t *value)
+{
+    size_t  start = 0;
+    bool    negative = false;
+
+    *symbol = std::string_view();
+    *value = 0;
+    s = psyqAsmTrim(s);
+    if (s.size() > 1 && s.front() == '(' && s.back() == ')')
+    {
+        s = psyqAsmTrim(s.substr(1, s.size() - 2));
+    }
+    if (s.empty())
+    {
+        return false;
+    }
+    for (size_t i = 0; i <= s.size(); i++)
+    {
+        if (i < s.size() && (i == start || (s[i] != '+' && s[i] != '-')))
+        {
+            continue;
+        }
+        std::string_view    term = psyqAsmTrim(s.substr(start, i - start));
+        int64_t             number;
+
+        if (!term.empty() && (term[0] == '+' || term[0] == '-'))
+        {
+            negative = negative != (term[0] == '-');
+            term = psyqAsmTrim(term.substr(1));
+        }
+        if (term.empty())
+        {
+            return false;
+        }
+        if (psyqAsmNumber(term, &number))
+        {
+            *value += negative ? -number : number;
+        }
+        else
+        {
+            for (char c : term)
+            {
+                if (!psyqAsmNameChar(c))
+                {
+                    return false;
+                }
+            }
+            if (!symbol->empty() || negative || (term[0] >= '0' && term[0] <= '9'))
+            {
+                return false;
+            }
+            *symbol = term;
+        }
+        negative = i < s.size() && s[i] == '-';
+        start = i + 1;
+    }
+    return true;
+}
+
+inline bool psyqAsmOperand(PsyqAsm *a, std::string_view s, PsyqAsmOperand *op)
+{
+    int reg;
+
+    op->kind = 0;
+    op->reg = 0;
+    op->reloc = 0;
+    op->symbol = std::string_view();
+    op->value = 0;
+
+    if ((reg = psyqAsmRegister(s)) >= 0)
+    {
+        op->kind = A_REG;
+        op->reg = reg;
+        return true;
+    }
+
+    // expression(base)
+    if (!s.empty() && s.back() == ')')
+    {
+        size_t open = s.rfind('(');
+        if (open != std::string_view::npos && (reg = psyqAsmRegister(psyqAsmTrim(s.substr(open + 1, s.size() - open - 2)))) >= 0)
+        {
+            op->kind = A_MEM;
+            op->reg = reg;
+            s = psyqAsmTrim(s.substr(0, open));
+            if (s.empty())
+            {
+                return true;
+            }
+        }
+    }
+
+    if (s.size() > 1 && s[0] == '%')
+    {
+        size_t open = s.find('(');
+        if (open == std::string_view::npos || s.back() != ')')
+        {
+            return psyqAsmFail(a, "bad operand %.*s", s);
+        }
+        std::string_view which = s.substr(1, open - 1);
+        if (which == "hi")
+        {
+            op->reloc = PSYQ_HI16;
+        }
+        else if (which == "lo")
+        {
+            op->reloc = PSYQ_LO16;
+        }
+        else if (which == "gp_rel")
+        {
+            op->reloc = PSYQ_GPREL16;
+        }
+        else
+        {
+            return psyqAsmFail(a, "unknown operator %%%.*s", which);
+        }
+        s = s.substr(open + 1, s.size() - open - 2);
+    }
+
+    if (!psyqAsmExpr(s, &op->symbol, &op->value) || (op->reloc && op->symbol.empty()))
+    {
+        return psyqAsmFail(a, "bad operand %.*s", s);
+    }
+    if (!op->kind)
+    {
+        op->kind = op->symbol.empty() && !op->reloc ? A_IMM : A_ADDR;
+    }
+    return true;
+}
+
+inline PsyqAsmSymbol *psyqAsmSymbol(PsyqAsm *a, std::string_view name)
+{
+    auto it = a->symbols.find(name);
+    if (it != a->symbols.end())
+    {
+        return &it->second;
+    }
+    return &a->symbols.emplace(name, PsyqAsmSymbol{ 0, 0, 0, 0, false, false, false }).first->second;
+}
+
+//! Section of a .section / section directive, 0 for none
+inline uint16_t psyqAsmSectionNumber(std::string_view name)
+{
+    for (uint16_t i = 1; i < PSYQ_ASM_SECTIONS; i++)
+    {
+        if (name == g_psyqAsmSections[i])
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+inline bool psyqAsmIsBss(uint16_t section)
+{
+    return section == PSYQ_ASM_SBSS || section == PSYQ_ASM_BSS;
+}
+
+//! Offset of the next byte of the current section
+inline uint32_t psyqAsmOffset(const PsyqAsm *a)
+{
+    return psyqAsmIsBss(a->section) ? a->bssSize[a->section] : (uint32_t)a->bytes[a->section].size();
+}
+
+inline void psyqAsmBytes(PsyqAsm *a, const void *data, size_t size)
+{
+    std::vector<uint8_t> *bytes = &a->bytes[a->section];
+
+    if (a->runs.empty() || a->runs.back().section != a->section || a->runs.back().end != bytes->size())
+    {
+        a->runs.push_back({ a->section, (uint32_t)bytes->size(), (uint32_t)bytes->size() });
+    }
+    bytes->insert(bytes->end(), (const uint8_t*)data, (const uint8_t*)data + size);
+    a->runs.back().end += size;
+}
+
+inline bool psyqAsmSpace(PsyqAsm *a, int64_t size)
+{
+    if (size < 0 || size > 0x1000000)
+    {
+        return psyqAsmFail(a, "bad size");
+    }
+    if (psyqAsmIsBss(a->section))
+    {
+        a->bssSize[a->section] += size;
+        return true;
+    }
+    static const uint8_t zeros[256] = { 0 };
+    while (size > 0)
+    {
+        size_t n = size < (int64_t)sizeof(zeros) ? (size_t)size : sizeof(zeros);
+        psyqAsmBytes(a, zeros, n);
+        size -= n;
+    }
+    return true;
+}
+
+inline bool psyqAsmAlign(PsyqAsm *a, uint32_t alignment)
+{
+    uint32_t offset = psyqAsmOffset(a);
+    return psyqAsmSpace(a, (alignment - offset % alignment) % alignment);
+}
+
+//! Whether insn reads register reg (never true for $zero)
+inline bool psyqAsmReads(const R3000Insn *insn, int reg)
+{
+    if (reg == 0)
+    {
+        return false;
+    }
+    switch (g_r3000Ops[insn->op].format)
+    {
+    case F_RD_RT_SA:
+    case F_COP:
+    case F_COP_SEL:
+        return insn->op != R3000_CFC2 && insn->op != R3000_MFC0 && insn->op != R3000_MFC2 && insn->rt == reg;
+    case F_RS:
+    case F_JALR:
+    case F_RT_RS_SIMM:
+    case F_RT_RS_UIMM:
+    case F_RS_BRANCH:
+    case F_COP_MEM:
+        return insn->rs == reg;
+    case F_MEM:
+        // stores read rt, and so do lwl / lwr, which merge into it
+        return insn->rs == reg || (insn->rt == reg && (insn->op == R3000_LWL || insn->op == R3000_LWR || (g_r3000Ops[insn->op].flags & R3000_FLAG_STORE)));
+    case F_RD:
+    case F_RT_UIMM:
+    case F_CODE:
+    case F_BREAK:
+    case F_JUMP:
+    case F_BRANCH:
+    case F_GTE:
+        return false;
+    }
+    // rd, rs, rt and the aliases, whose other register is $zero
+    return insn->rs == reg || insn->rt == reg;
+}
+
+//! Append an instruction to the current section. With hazards, it is
+//! preceded by the nops it needs after the previous instructions; in .set
+//! reorder, branches and jumps are followed by a nop in their delay slot.
+//! Returns the instruction's offset.
+inline uint32_t psyqAsmInsn(PsyqAsm *a, uint32_t word, bool hazards = true)
+{
+    R3000Insn   insn;
+    uint32_t    offset;
+
+    r3000Decode(word, &insn);
+    if (hazards && (a->reorder || a->flushHazards))
+    {
+        bool pairedLoad = (insn.op == R3000_LWL || insn.op == R3000_LWR) && (a->loadOp == R3000_LWL || a->loadOp == R3000_LWR) && insn.rt == a->loadReg;
+        bool hilo = insn.op == R3000_MULT || insn.op == R3000_MULTU || insn.op == R3000_DIV || insn.op == R3000_DIVU || insn.op == R3000_MTHI || insn.op == R3000_MTLO;
+
+        if (psyqAsmReads(&insn, a->loadReg) && !pairedLoad)
+        {
+            psyqAsmInsn(a, 0, false);
+        }
+        while (hilo && a->hiloAge < 2)
+        {
+            psyqAsmInsn(a, 0, false);
+        }
+    }
+    a->flushHazards = false;
+
+    offset = psyqAsmOffset(a);
+    psyqAsmBytes(a, &word, sizeof(word));
+
+    a->hiloAge = insn.op == R3000_MFHI || insn.op == R3000_MFLO ? 0 : a->hiloAge + 1;
+    a->loadReg = 0;
+    a->loadOp = insn.op;
+    if (((g_r3000Ops[insn.op].flags & R3000_FLAG_LOAD) && insn.op != R3000_LWC2) || insn.op == R3000_MFC0 || insn.op == R3000_MFC2 || insn.op == R3000_CFC2)
+    {
+        a->loadReg = insn.rt;
+    }
+    if (a->reorder && hazards && (g_r3000Ops[insn.op].flags & R3000_FLAG_DELAY))
+    {
+        psyqAsmInsn(a, 0, false);
+    }
+    return offset;
+}
+
+inline uint32_t psyqAsmR(int rs, int rt, int rd, int sa, int funct)
+{
+    return (uint32_t)rs << 21 | (uint32_t)rt << 16 | (uint32_t)rd << 11 | (uint32_t)sa << 6 | funct;
+}
+
+inline uint32_t psyqAsmI(uint32_t op, int rs, int rt, int64_t imm)
+{
+    return op | (uint32_t)rs << 21 | (uint32_t)rt << 16 | ((uint32_t)imm & 0xffff);
+}
+
+inline bool psyqAsmSigned16(int64_t value)
+{
+    return value >= -0x8000 && value < 0x8000;
+}
+
+inline void psyqAsmReloc(PsyqAsm *a, uint32_t offset, uint8_t type, const PsyqAsmOperand *op)
+{
+    a->relocs.push_back({ type, a->section, offset, op->symbol, op->value });
+}
+
+//! Instruction with a 16-bit immediate operand, relocated or not
+inline bool psyqAsmImmediate(PsyqAsm *a, uint32_t op, int rs, int rt, const PsyqAsmOperand *imm)
+{
+    if (imm->reloc)
+    {
+        psyqAsmReloc(a, psyqAsmInsn(a, psyqAsmI(op, rs, rt, 0)), imm->reloc, imm);
+        return true;
+    }
+    if (!imm->symbol.empty())
+    {
+        return psyqAsmFail(a, "symbol %.*s in a 16-bit immediate", imm->symbol);
+    }
+    // andi / ori / xori / lui zero extend theirs
+    if (op >= 0x30000000 && op < 0x40000000 ? imm->value < 0 || imm->value > 0xffff : !psyqAsmSigned16(imm->value))
+    {
+        return psyqAsmFail(a, "immediate out of range");
+    }
+    psyqAsmInsn(a, psyqAsmI(op, rs, rt, imm->value));
+    return true;
+}
+
+//! li: addiu, ori, lui or lui + ori
+inline void psyqAsmLoadImmediate(PsyqAsm *a, int rt, int64_t value)
+{
+    uint32_t v = (uint32_t)value;
+
+    if (psyqAsmSigned16((int32_t)v))
+    {
+        psyqAsmInsn(a, psyqAsmI(0x24000000, 0, rt, v));
+    }
+    else if (v <= 0xffff)
+    {
+        psyqAsmInsn(a, psyqAsmI(0x34000000, 0, rt, v));
+    }
+    else
+    {
+        psyqAsmInsn(a, psyqAsmI(0x3c000000, 0, rt, v >> 16));
+        if (v & 0xffff)
+        {
+            psyqAsmInsn(a, psyqAsmI(0x34000000, rt, rt, v));
+        }
+    }
+}
+
+inline bool psyqAsmIsSmall(PsyqAsm *a, std::string_view symbol)
+{
+    return a->gpSize > 0 && psyqAsmSymbol(a, symbol)->small;
+}
+
+//! la: the address of a symbol, plus a base register
+inline bool psyqAsmLoadAddress(PsyqAsm *a, int rt, const PsyqAsmOperand *addr)
+{
+    int base = addr->kind == A_MEM ? addr->reg : 0;
+
+    if (addr->symbol.empty() || addr->reloc)
+    {
+        if (addr->reloc)
+        {
+            return psyqAsmImmediate(a, 0x24000000, base, rt, addr);
+        }
+        if (psyqAsmSigned16(addr->value))
+        {
+            psyqAsmInsn(a, psyqAsmI(0x24000000, base, rt, addr->value));
+            return true;
+        }
+        int tmp = base == rt ? 1 : rt;
+        psyqAsmLoadImmediate(a, tmp, addr->value);
+        if (base)
+        {
+            psyqAsmInsn(a, psyqAsmR(tmp, base, rt, 0, 0x21));
+        }
+        return true;
+    }
+    if (psyqAsmIsSmall(a, addr->symbol))
+    {
+        int tmp = base ? 1 : rt;
+        psyqAsmReloc(a, psyqAsmInsn(a, psyqAsmI(0x24000000, 28, tmp, 0)), PSYQ_GPREL16, addr);
+        if (base)
+        {
+            psyqAsmInsn(a, psyqAsmR(tmp, base, rt, 0, 0x21));
+        }
+        return true;
+    }
+    int tmp = base == rt ? 1 : rt;
+    psyqAsmReloc(a, psyqAsmInsn(a, psyqAsmI(0x3c000000, 0, tmp, 0)), PSYQ_HI16, addr);
+    psyqAsmReloc(a, psyqAsmInsn(a, psyqAsmI(0x24000000, tmp, tmp, 0)), PSYQ_LO16, addr);
+    if (base)
+    {
+        psyqAsmInsn(a, psyqAsmR(tmp, base, rt, 0, 0x21));
+    }
+    return true;
+}
+
+//! Load or store rt at a memory operand: offset(base), %lo / %gp_rel, or
+//! a symbol or an address that doesn't fit 16 bits, through a temporary
+//! register (rt itself for a plain load, else $at)
+inline bool psyqAsmMemory(PsyqAsm *a, uint32_t op, int rt, const PsyqAsmOperand *mem)
+{
+    int     base = mem->kind == A_MEM ? mem->reg : 0;
+    bool    load = op >> 26 >= 0x20 && op >> 26 < 0x28 && op >> 26 != 0x22 && op >> 26 != 0x26;
+    int     tmp = load && rt != 0 && rt != base && base == 0 ? rt : 1;
+
+    if (mem->kind == A_REG)
+    {
+        return psyqAsmFail(a, "expected a memory operand");
+    }
+    if (mem->reloc)
+    {
+        if (mem->reloc == PSYQ_HI16)
+        {
+            return psyqAsmFail(a, "%%hi in a memory operand");
+        }
+        return psyqAsmImmediate(a, op, base, rt, mem);
+    }
+    if (mem->symbol.empty())
+    {
+        if (psyqAsmSigned16(mem->value))
+        {
+            psyqAsmInsn(a, psyqAsmI(op, base, rt, mem->value));
+            return true;
+        }
+        psyqAsmInsn(a, psyqAsmI(0x3c000000, 0, tmp, (mem->value + 0x8000) >> 16));
+        if (base)
+        {
+            psyqAsmInsn(a, psyqAsmR(tmp, base, tmp, 0, 0x21));
+        }
+        psyqAsmInsn(a, psyqAsmI(op, tmp, rt, mem->value));
+        return true;
+    }
+    if (psyqAsmIsSmall(a, mem->symbol))
+    {
+        if (base)
+        {
+            psyqAsmInsn(a, psyqAsmR(base, 28, 1, 0, 0x21));
+        }
+        psyqAsmReloc(a, psyqAsmInsn(a, psyqAsmI(op, base ? 1 : 28, rt, 0)), PSYQ_GPREL16, mem);
+        return true;
+    }
+    psyqAsmReloc(a, psyqAsmInsn(a, psyqAsmI(0x3c000000, 0, tmp, 0)), PSYQ_HI16, mem);
+    if (base)
+    {
+        psyqAsmInsn(a, psyqAsmR(tmp, base, tmp, 0, 0x21));
+    }
+    psyqAsmReloc(a, psyqAsmInsn(a, psyqAsmI(op, tmp, rt, 0)), PSYQ_LO16, mem);
+    return true;
+}
+
+//! Branch to a label of the same section, patched by psyqAsmFixups()
+inline bool psyqAsmBranch(PsyqAsm *a, uint32_t word, const PsyqAsmOperand *target)
+{
+    if (target->kind != A_ADDR || target->reloc || target->symbol.empty() || target->value)
+    {
+        return psyqAsmFail(a, "expected a label");
+    }
+    uint32_t offset = psyqAsmInsn(a, word);
+    a->fixups.push_back({ a->section, offset, target->symbol, a->line });
+    return true;
+}
+
+//! div / divu / rem / remu rd, rs, rt: the division with its checks for a
+//! zero divisor (break 7) and, signed, for overflow (break 6), then the
+//! quotient or the remainder
+inline void psyqAsmDivide(PsyqAsm *a, uint32_t funct, int rd, int rs, int rt, uint32_t move)
+{
+    bool reorder = a->reorder;
+
+    psyqAsmInsn(a, psyqAsmR(rs, rt, 0, 0, funct));
+    a->reorder = false;
+    psyqAsmInsn(a, psyqAsmI(0x14000000, rt, 0, 2), false);             // bnez rt, 1f
+    psyqAsmInsn(a, 0, false);
+    psyqAsmInsn(a, 0x0007000d, false);                                  // break 7
+    if (funct == 0x1a)
+    {
+        psyqAsmInsn(a, psyqAsmI(0x24000000, 0, 1, -1), false);          // 1: li $at, -1
+        psyqAsmInsn(a, psyqAsmI(0x14000000, rt, 1, 4), false);          // bne rt, $at, 2f
+        psyqAsmInsn(a, psyqAsmI(0x3c000000, 0, 1, 0x8000), false);      // lui $at, 0x8000
+        psyqAsmInsn(a, psyqAsmI(0x14000000, rs, 1, 2), false);          // bne rs, $at, 2f
+        psyqAsmInsn(a, 0, false);
+        psyqAsmInsn(a, 0x0006000d, false);                              // break 6
+    }
+    psyqAsmInsn(a, psyqAsmR(0, 0, rd, 0, move), false);                 // 2: mflo / mfhi rd
+    a->reorder = reorder;
+}
+
+//! Instruction templates, by kind
+#define A_ALU       1   // rd, rs, rt|imm: funct, immediate form in the table below
+#define A_IMMEDIATE 2   // rt, rs, imm
+#define A_SHIFT     3   // rd, rt, sa|rs
+#define A_SHIFTV    4   // rd, rt, rs
+#define A_MULDIV    5   // rs, rt, or the rd, rs, rt macro
+#define A_REM       6
+#define A_MUL       7
+#define A_MFHI      8   // rd
+#define A_MTHI      9   // rs
+#define A_JR        10
+#define A_JALR      11
+#define A_JUMP      12
+#define A_BRANCH2   13  // rs, rt, label
+#define A_BRANCH1   14  // rs, label
+#define A_BRANCHZ   15  // beqz / bnez rs, label
+#define A_B         16  // label
+#define A_BRANCHCMP 17  // blt & co.: bit 0 = swap operands, bit 1 = beq, bit 2 = unsigned
+#define A_LOAD      18
+#define A_STORE     19
+#define A_LUI       20
+#define A_LI        21
+#define A_LA        22
+#define A_MOVE      23
+#define A_NEG       24
+#define A_NOT       25
+#define A_NOP       26
+#define A_CODE      27  // syscall / break [code]
+#define A_COPMOVE   28  // rt, $n
+#define A_NONE      29
+#define A_COP2      30  // command
+#define A_ULW       31
+#define A_USW       32
+
+typedef struct  PsyqAsmOp
+{
+    const char  *name;
+    uint8_t     kind;
+    uint32_t    code;
+} PsyqAsmOp;
+
+constexpr PsyqAsmOp g_psyqAsmOps[] = {
+    { "add",    A_ALU,          0x20 },
+    { "addu",   A_ALU,          0x21 },
+    { "sub",    A_ALU,          0x22 },
+    { "subu",   A_ALU,          0x23 },
+    { "and",    A_ALU,          0x24 },
+    { "or",     A_ALU,          0x25 },
+    { "xor",    A_ALU,          0x26 },
+    { "nor",    A_ALU,          0x27 },
+    { "slt",    A_ALU,          0x2a },
+    { "sltu",   A_ALU,          0x2b },
+    { "addi",   A_IMMEDIATE,    0x20000000 },
+    { "addiu",  A_IMMEDIATE,    0x24000000 },
+    { "slti",   A_IMMEDIATE,    0x28000000 },
+    { "sltiu",  A_IMMEDIATE,    0x2c000000 },
+    { "andi",   A_IMMEDIATE,    0x30000000 },
+    { "ori",    A_IMMEDIATE,    0x34000000 },
+    { "xori",   A_IMMEDIATE,    0x38000000 },
+    { "sll",    A_SHIFT,        0x00 },
+    { "srl",    A_SHIFT,        0x02 },
+    { "sra",    A_SHIFT,        0x03 },
+    { "sllv",   A_SHIFTV,       0x04 },
+    { "srlv",   A_SHIFTV,       0x06 },
+    { "srav",   A_SHIFTV,       0x07 },
+    { "mult",   A_MULDIV,       0x18 },
+    { "multu",  A_MULDIV,       0x19 },
+    { "div",    A_MULDIV,       0x1a },
+    { "divu",   A_MULDIV,       0x1b },
+    { "rem",    A_REM,          0x1a },
+    { "remu",   A_REM,          0x1b },
+    { "mul",    A_MUL,          0x18 },
+    { "mfhi",   A_MFHI,         0x10 },
+    { "mflo",   A_MFHI,         0x12 },
+    { "mthi",   A_MTHI,         0x11 },
+    { "mtlo",   A_MTHI,         0x13 },
+    { "jr",     A_JR,           0x08 },
+    { "jalr",   A_JALR,         0x09 },
+    { "j",      A_JUMP,         0x08000000 },
+    { "jal",    A_JUMP,         0x0c000000 },
+    { "beq",    A_BRANCH2,      0x10000000 },
+    { "bne",    A_BRANCH2,      0x14000000 },
+    { "blez",   A_BRANCH1,      0x18000000 },
+    { "bgtz",   A_BRANCH1,      0x1c000000 },
+    { "bltz",   A_BRANCH1,      0x04000000 },
+    { "bgez",   A_BRANCH1,      0x04010000 },
+    { "bltzal", A_BRANCH1,      0x04100000 },
+    { "bgezal", A_BRANCH1,      0x04110000 },
+    { "beqz",   A_BRANCHZ,      0x10000000 },
+    { "bnez",   A_BRANCHZ,      0x14000000 },
+    { "b",      A_B,            0x10000000 },
+    { "bal",    A_B,            0x04110000 },
+    { "blt",    A_BRANCHCMP,    0 },
+    { "bgt",    A_BRANCHCMP,    1 },
+    { "bge",    A_BRANCHCMP,    2 },
+    { "ble",    A_BRANCHCMP,    3 },
+    { "bltu",   A_BRANCHCMP,    4 },
+    { "bgtu",   A_BRANCHCMP,    5 },
+    { "bgeu",   A_BRANCHCMP,    6 },
+    { "bleu",   A_BRANCHCMP,    7 },
+    { "lb",     A_LOAD,         0x80000000 },
+    { "lh",     A_LOAD,         0x84000000 },
+    { "lwl",    A_LOAD,         0x88000000 },
+    { "lw",     A_LOAD,         0x8c000000 },
+    { "lbu",    A_LOAD,         0x90000000 },
+    { "lhu",    A_LOAD,         0x94000000 },
+    { "lwr",    A_LOAD,         0x98000000 },
+    { "lwc2",   A_LOAD,         0xc8000000 },
+    { "sb",     A_STORE,        0xa0000000 },
+    { "sh",     A_STORE,        0xa4000000 },
+    { "swl",    A_STORE,        0xa8000000 },
+    { "sw",     A_STORE,        0xac000000 },
+    { "swr",    A_STORE,        0xb8000000 },
+    { "swc2",   A_STORE,        0xe8000000 },
+    { "lui",    A_LUI,          0x3c000000 },
+    { "li",     A_LI,           0 },
+    { "la",     A_LA,           0 },
+    { "move",   A_MOVE,         0 },
+    { "neg",    A_NEG,          0x22 },
+    { "negu",   A_NEG,          0x23 },
+    { "not",    A_NOT,          0 },
+    { "nop",    A_NOP,          0 },
+    { "syscall",A_CODE,         0x0c },
+    { "break",  A_CODE,         0x0d },
+    { "mfc0",   A_COPMOVE,      0x40000000 },
+    { "mtc0",   A_COPMOVE,      0x40800000 },
+    { "mfc2",   A_COPMOVE,      0x48000000 },
+    { "cfc2",   A_COPMOVE,      0x48400000 },
+    { "mtc2",   A_COPMOVE,      0x48800000 },
+    { "ctc2",   A_COPMOVE,      0x48c00000 },
+    { "rfe",    A_NONE,         0x42000010 },
+    { "cop2",   A_COP2,         0x4a000000 },
+    { "ulw",    A_ULW,          0 },
+    { "usw",    A_USW,          0 },
+};
+
+inline const PsyqAsmOp *psyqAsmFindOp(std::string_view name)
+{
+    static const std::unordered_map<std::string_view, const PsyqAsmOp*> ops = [] {
+        std::unordered_map<std::string_view, const PsyqAsmOp*> map;
+        for (const PsyqAsmOp &op : g_psyqAsmOps)
+        {
+            map.emplace(op.name, &op);
+        }
+        return map;
+    }();
+    auto it = ops.find(name);
+    return it == ops.end() ? NULL : it->second;
+}
+
+//! The register of operand i, -1 with the error set if it is not one
+inline int psyqAsmReg(PsyqAsm *a, const PsyqAsmOperand *ops, size_t count, size_t i)
+{
+    if (i >= count || ops[i].kind != A_REG)
+    {
+        psyqAsmFail(a, "expected a register as operand %.*s", std::to_string(i + 1));
+        return -1;
+    }
+    return ops[i].reg;
+}
+
+//! Register or immediate operand i into $at, for a register only instruction
+inline int psyqAsmRegOrAt(PsyqAsm *a, const PsyqAsmOperand *op)
+{
+    if (op->kind == A_REG)
+    {
+        return op->reg;
+    }
+    if (op->kind != A_IMM)
+    {
+        psyqAsmFail(a, "expected a register or a number");
+        return -1;
+    }
+    if (op->value == 0)
+    {
+        return 0;
+    }
+    psyqAsmLoadImmediate(a, 1, op->value);
+    return 1;
+}
+
+inline bool psyqAsmInstruction(PsyqAsm *a, std::string_view name)
+{
+    const PsyqAsmOp *info = psyqAsmFindOp(name);
+    PsyqAsmOperand  ops[4];
+    size_t          count = a->operands.size();
+    int             rd, rs, rt;
+
+    if (!info)
+    {
+        return psyqAsmFail(a, "unknown instruction %.*s", name);
+    }
+    if (count > 4)
+    {
+        return psyqAsmFail(a, "too many operands for %.*s", name);
+    }
+    if (a->section != PSYQ_ASM_TEXT)
+    {
+        return psyqAsmFail(a, "instruction %.*s outside of .text", name);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!psyqAsmOperand(a, a->operands[i], &ops[i]))
+        {
+            return false;
+        }
+    }
+
+    switch (info->kind)
+    {
+    case A_ALU:
+        // "op rd, rt" is "op rd, rd, rt"
+        if (count == 2)
+        {
+            ops[2] = ops[1];
+            ops[1] = ops[0];
+            count = 3;
+        }
+        if ((rd = psyqAsmReg(a, ops, count, 0)) < 0 || (rs = psyqAsmReg(a, ops, count, 1)) < 0 || count != 3)
+        {
+            return psyqAsmFail(a, "expected rd, rs, rt for %.*s", name);
+        }
+        if (ops[2].kind == A_REG)
+        {
+            psyqAsmInsn(a, psyqAsmR(rs, ops[2].reg, rd, 0, info->code));
+            return true;
+        }
+        if (ops[2].kind == A_MEM)
+        {
+            return psyqAsmFail(a, "bad operand for %.*s", name);
+        }
+        {
+            uint32_t    immediate = 0;
+            int64_t     value = ops[2].value;
+            bool        fits = psyqAsmSigned16(value);
+
+            switch (info->code)
+            {
+            case 0x20: immediate = 0x20000000; break;
+            case 0x21: immediate = 0x24000000; break;
+            case 0x22: immediate = 0x20000000; value = -value; fits = psyqAsmSigned16(value); break;
+            case 0x23: immediate = 0x24000000; value = -value; fits = psyqAsmSigned16(value); break;
+            case 0x24: immediate = 0x30000000; fits = value >= 0 && value <= 0xffff; break;
+            case 0x25: immediate = 0x34000000; fits = value >= 0 && value <= 0xffff; break;
+            case 0x26: immediate = 0x38000000; fits = value >= 0 && value <= 0xffff; break;
+            case 0x2a: immediate = 0x28000000; break;
+            case 0x2b: immediate = 0x2c000000; break;
+            }
+            if (ops[2].kind != A_IMM)
+            {
+                if (!immediate || info->code == 0x22 || info->code == 0x23)
+                {
+                    return psyqAsmFail(a, "bad operand for %.*s", name);
+                }
+                return psyqAsmImmediate(a, immediate, rs, rd, &ops[2]);
+            }
+            if (immediate && fits)
+            {
+                psyqAsmInsn(a, psyqAsmI(immediate, rs, rd, value));
+                return true;
+            }
+            psyqAsmLoadImmediate(a, 1, ops[2].value);
+            psyqAsmInsn(a, psyqAsmR(rs, 1, rd, 0, info->code));
+        }
+        return true;
+
+    case A_IMMEDIATE:
+        if (count == 2)
+        {
+            ops[2] = ops[1];
+            ops[1] = ops[0];
+            count = 3;
+        }
+        if ((rt = psyqAsmReg(a, ops, count, 0)) < 0 || (rs = psyqAsmReg(a, ops, count, 1)) < 0 || count != 3 || ops[2].kind == A_REG || ops[2].kind == A_MEM)
+        {
+            return psyqAsmFail(a, "expected rt, rs, immediate for %.*s", name);
+        }
+        return psyqAsmImmediate(a, info->code, rs, rt, &ops[2]);
+
+    case A_SHIFT:
+        if (count == 2)
+        {
+            ops[2] = ops[1];
+            ops[1] = ops[0];
+            count = 3;
+        }
+        if ((rd = psyqAsmReg(a, ops, count, 0)) < 0 || (rt = psyqAsmReg(a, ops, count, 1)) < 0 || count != 3)
+        {
+            return psyqAsmFail(a, "expected rd, rt, shift for %.*s", name);
+        }
+        if (ops[2].kind == A_REG)
+        {
+            psyqAsmInsn(a, psyqAsmR(ops[2].reg, rt, rd, 0, info->code | 4));
+            return true;
+        }
+        if (ops[2].kind != A_IMM || ops[2].value < 0 || ops[2].value > 31)
+        {
+            return psyqAsmFail(a, "bad shift amount for %.*s", name);
+        }
+        psyqAsmInsn(a, psyqAsmR(0, rt, rd, (int)ops[2].value, info->code));
+        return true;
+
+    case A_SHIFTV:
+        if ((rd = psyqAsmReg(a, ops, count, 0)) < 0 || (rt = psyqAsmReg(a, ops, count, 1)) < 0 || (rs = psyqAsmReg(a, ops, count, 2)) < 0)
+        {
+            return false;
+        }
+        psyqAsmInsn(a, psyqAsmR(rs, rt, rd, 0, info->code));
+        return true;
+
+    case A_MULDIV:
+        if (count == 2 || (count == 3 && ops[0].kind == A_REG && ops[0].reg == 0 && (info->code == 0x1a || info->code == 0x1b)))
+        {
+            if ((rs = psyqAsmReg(a, ops, count, count - 2)) < 0 || (rt = psyqAsmReg(a, ops, count, count - 1)) < 0)
+            {
+                return false;
+            }
+            psyqAsmInsn(a, psyqAsmR(rs, rt, 0, 0, info->code));
+            return true;
+        }
+        if (info->code == 0x18 || info->code == 0x19)
+        {
+            return psyqAsmFail(a, "expected rs, rt for %.*s", name);
+        }
+        // the div / divu rd, rs, rt macro
+        [[fallthrough]];
+    case A_REM:
+        if (count != 3 || (rd = psyqAsmReg(a, ops, count, 0)) < 0 || (rs = psyqAsmReg(a, ops, count, 1)) < 0)
+        {
+            return psyqAsmFail(a, "expected rd, rs, rt for %.*s", name);
+        }
+        if (ops[2].kind == A_IMM)
+        {
+            if (ops[2].value == 0)
+            {
+                return psyqAsmFail(a, "division by zero");
+            }
+            psyqAsmLoadImmediate(a, 1, ops[2].value);
+            psyqAsmInsn(a, psyqAsmR(rs, 1, 0, 0, info->code));
+            psyqAsmInsn(a, psyqAsmR(0, 0, rd, 0, info->kind == A_REM ? 0x10 : 0x12));
+            return true;
+        }
+        if ((rt = psyqAsmReg(a, ops, count, 2)) < 0)
+        {
+            return false;
+        }
+        psyqAsmDivide(a, info->code, rd, rs, rt, info->kind == A_REM ? 0x10 : 0x12);
+        return true;
+
+    case A_MUL:
+        if (count != 3 || (rd = psyqAsmReg(a, ops, count, 0)) < 0 || (rs = psyqAsmReg(a, ops, count, 1)) < 0 || (rt = psyqAsmRegOrAt(a, &ops[2])) < 0)
+        {
+            return psyqAsmFail(a, "expected rd, rs, rt for %.*s", name);
+        }
+        psyqAsmInsn(a, psyqAsmR(rs, rt, 0, 0, info->code));
+        psyqAsmInsn(a, psyqAsmR(0, 0, rd, 0, 0x12));
+        return true;
+
+    case A_MFHI:
+        if ((rd = psyqAsmReg(a, ops, count, 0)) < 0)
+        {
+            return false;
+        }
+        psyqAsmInsn(a, psyqAsmR(0, 0, rd, 0, info->code));
+        return true;
+
+    case A_MTHI:
+    case A_JR:
+        if ((rs = psyqAsmReg(a, ops, count, 0)) < 0)
+        {
+            return false;
+        }
+        psyqAsmInsn(a, psyqAsmR(rs, 0, 0, 0, info->code));
+        return true;
+
+    case A_JALR:
+        rd = 31;
+        if (count == 2 && (rd = psyqAsmReg(a, ops, count, 0)) < 0)
+        {
+            return false;
+        }
+        if ((rs = psyqAsmReg(a, ops, count, count - 1)) < 0)
+        {
+            return false;
+        }
+        psyqAsmInsn(a, psyqAsmR(rs, 0, rd, 0, info->code));
+        return true;
+
+    case A_JUMP:
+        if (count != 1)
+        {
+            return psyqAsmFail(a, "expected a target for %.*s", name);
+        }
+        if (ops[0].kind == A_REG)
+        {
+            // j $31 / jal $2 are jr / jalr
+            psyqAsmInsn(a, info->code == 0x08000000 ? psyqAsmR(ops[0].reg, 0, 0, 0, 0x08) : psyqAsmR(ops[0].reg, 0, 31, 0, 0x09));
+            return true;
+        }
+        if (ops[0].kind != A_ADDR || ops[0].reloc || ops[0].symbol.empty())
+        {
+            return psyqAsmFail(a, "expected a symbol for %.*s", name);
+        }
+        psyqAsmReloc(a, psyqAsmInsn(a, info->code), PSYQ_REL26, &ops[0]);
+        return true;
+
+    case A_BRANCH2:
+        if (count != 3 || (rs = psyqAsmReg(a, ops, count, 0)) < 0 || (rt = psyqAsmRegOrAt(a, &ops[1])) < 0)
+        {
+            return psyqAsmFail(a, "expected rs, rt, label for %.*s", name);
+        }
+        return psyqAsmBranch(a, psyqAsmI(info->code, rs, rt, 0), &ops[2]);
+
+    case A_BRANCH1:
+    case A_BRANCHZ:
+        if (count != 2 || (rs = psyqAsmReg(a, ops, count, 0)) < 0)
+        {
+            return psyqAsmFail(a, "expected rs, label for %.*s", name);
+        }
+        return psyqAsmBranch(a, psyqAsmI(info->code, rs, 0, 0), &ops[1]);
+
+    case A_B:
+        if (count != 1)
+        {
+            return psyqAsmFail(a, "expected a label for %.*s", name);
+        }
+        return psyqAsmBranch(a, info->code, &ops[0]);
+
+    case A_BRANCHCMP:
+    {
+        bool        swap = info->code & 1;
+        bool        equal = info->code & 2;     // bge / ble: branch when not less
+        bool        isUnsigned = info->code & 4;
+        uint32_t    branch = equal ? 0x10000000 : 0x14000000;
+
+        if (count != 3 || (rs = psyqAsmReg(a, ops, count, 0)) < 0)
+        {
+            return psyqAsmFail(a, "expected rs, rt, label for %.*s", name);
+        }
+        if (((ops[1].kind == A_IMM && ops[1].value == 0) || (ops[1].kind == A_REG && ops[1].reg == 0)) && !isUnsigned)
+        {
+            // against zero: bltz / bgtz / bgez / blez
+            static const uint32_t zero[4] = { 0x04000000, 0x1c000000, 0x04010000, 0x18000000 };
+            return psyqAsmBranch(a, psyqAsmI(zero[info->code & 3], rs, 0, 0), &ops[2]);
+        }
+        if (ops[1].kind == A_IMM && !swap && psyqAsmSigned16(ops[1].value))
+        {
+            psyqAsmInsn(a, psyqAsmI(isUnsigned ? 0x2c000000 : 0x28000000, rs, 1, ops[1].value));
+        }
+        else
+        {
+            if ((rt = psyqAsmRegOrAt(a, &ops[1])) < 0)
+            {
+                return false;
+            }
+            psyqAsmInsn(a, swap ? psyqAsmR(rt, rs, 1, 0, isUnsigned ? 0x2b : 0x2a) : psyqAsmR(rs, rt, 1, 0, isUnsigned ? 0x2b : 0x2a));
+        }
+        return psyqAsmBranch(a, psyqAsmI(branch, 1, 0, 0), &ops[2]);
+    }
+
+    case A_LOAD:
+    case A_STORE:
+        if (count != 2 || (rt = psyqAsmReg(a, ops, count, 0)) < 0)
+        {
+            return psyqAsmFail(a, "expected rt, address for %.*s", name);
+        }
+        return psyqAsmMemory(a, info->code, rt, &ops[1]);
+
+    case A_LUI:
+        if (count != 2 || (rt = psyqAsmReg(a, ops, count, 0)) < 0 || ops[1].kind == A_REG || ops[1].kind == A_MEM)
+        {
+            return psyqAsmFail(a, "expected rt, immediate for %.*s", name);
+        }
+        return psyqAsmImmediate(a, info->code, 0, rt, &ops[1]);
+
+    case A_LI:
+    case A_LA:
+        if (count != 2 || (rt = psyqAsmReg(a, ops, count, 0)) < 0 || ops[1].kind == A_REG)
+        {
+            return psyqAsmFail(a, "expected rt, value for %.*s", name);
+        }
+        if (ops[1].kind == A_IMM)
+        {
+            psyqAsmLoadImmediate(a, rt, ops[1].value);
+            return true;
+        }
+        return psyqAsmLoadAddress(a, rt, &ops[1]);
+
+    case A_MOVE:
+        if ((rd = psyqAsmReg(a, ops, count, 0)) < 0 || (rs = psyqAsmReg(a, ops, count, 1)) < 0)
+        {
+            return false;
+        }
+        psyqAsmInsn(a, psyqAsmR(rs, 0, rd, 0, 0x21));
+        return true;
+
+    case A_NEG:
+    case A_NOT:
+        if ((rd = psyqAsmReg(a, ops, count, 0)) < 0)
+        {
+            return false;
+        }
+        rs = count > 1 ? psyqAsmReg(a, ops, count, 1) : rd;
+        if (rs < 0)
+        {
+            return false;
+        }
+        psyqAsmInsn(a, info->kind == A_NEG ? psyqAsmR(0, rs, rd, 0, info->code) : psyqAsmR(rs, 0, rd, 0, 0x27));
+        return true;
+
+    case A_NOP:
+        psyqAsmInsn(a, 0);
+        return true;
+
+    case A_CODE:
+    {
+        uint32_t code = 0;
+        if (count >= 1)
+        {
+            if (ops[0].kind != A_IMM || (count == 2 && ops[1].kind != A_IMM))
+            {
+                return psyqAsmFail(a, "expected a code for %.*s", name);
+            }
+            // break n[, m] has the 10-bit codes n and m, syscall one 20-bit code
+            code = info->code == 0x0d ? (uint32_t)ops[0].value << 10 | (count == 2 ? (uint32_t)ops[1].value : 0) : (uint32_t)ops[0].value;
+        }
+        psyqAsmInsn(a, (code & 0xfffff) << 6 | info->code);
+        return true;
+    }
+
+    case A_COPMOVE:
+        if (count < 2 || (rt = psyqAsmReg(a, ops, count, 0)) < 0 || (rd = psyqAsmReg(a, ops, count, 1)) < 0)
+        {
+            return psyqAsmFail(a, "expected rt, rd for %.*s", name);
+        }
+        psyqAsmInsn(a, info->code | (uint32_t)rt << 16 | (uint32_t)rd << 11);
+        return true;
+
+    case A_NONE:
+        psyqAsmInsn(a, info->code);
+        return true;
+
+    case A_COP2:
+        if (count != 1 || ops[0].kind != A_IMM)
+        {
+            return psyqAsmFail(a, "expected a command for %.*s", name);
+        }
+        psyqAsmInsn(a, info->code | ((uint32_t)ops[0].value & 0x1ffffff));
+        return true;
+
+    case A_ULW:
+    case A_USW:
+    {
+        PsyqAsmOperand high;
+
+        if (count != 2 || (rt = psyqAsmReg(a, ops, count, 0)) < 0 || ops[1].kind != A_MEM || !ops[1].symbol.empty() || ops[1].reloc)
+        {
+            return psyqAsmFail(a, "expected rt, offset(base) for %.*s", name);
+        }
+        // lwl / swl on the high byte, lwr / swr on the low one
+        high = ops[1];
+        high.value += 3;
+        if (!psyqAsmMemory(a, info->kind == A_ULW ? 0x88000000 : 0xa8000000, rt, &high))
+        {
+            return false;
+        }
+        return psyqAsmMemory(a, info->kind == A_ULW ? 0x98000000 : 0xb8000000, rt, &ops[1]);
+    }
+    }
+    return psyqAsmFail(a, "unsupported instruction %.*s", name);
+}
+
+//! .ascii / .asciiz string, with its escapes
+inline bool psyqAsmString(PsyqAsm *a, std::string_view s, bool terminate)
+{
+    std::string bytes;
+
+    if (s.size() < 2 || s.front() != '"' || s.back() != '"')
+    {
+        return psyqAsmFail(a, "expected a string");
+    }
+    for (size_t i = 1; i + 1 < s.size(); i++)
+    {
+        char c = s[i];
+        if (c != '\\' || i + 2 >= s.size())
+        {
+            bytes += c;
+            continue;
+        }
+        c = s[++i];
+        switch (c)
+        {
+        case 'n': bytes += '\n'; break;
+        case 't': bytes += '\t'; break;
+        case 'r': bytes += '\r'; break;
+        case 'b': bytes += '\b'; break;
+        case 'f': bytes += '\f'; break;
+        case 'v': bytes += '\v'; break;
+        case 'x':
+        {
+            int value = 0;
+            while (i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]))
+            {
+                char h = s[++i];
+                value = value * 16 + (h <= '9' ? h - '0' : (h | 0x20) - 'a' + 10);
+            }
+            bytes += (char)value;
+            break;
+        }
+        default:
+            if (c >= '0' && c <= '7')
+            {
+                int value = c - '0';
+                for (int n = 1; n < 3 && i + 2 < s.size() && s[i + 1] >= '0' && s[i + 1] <= '7'; n++)
+                {
+                    value = value * 8 + s[++i] - '0';
+                }
+                bytes += (char)value;
+            }
+            else
+            {
+                bytes += c;
+            }
+            break;
+        }
+    }
+    if (terminate)
+    {
+        bytes += '\0';
+    }
+    psyqAsmBytes(a, bytes.data(), bytes.size());
+    return true;
+}
+
+//! .word / .half / .byte values; words can be relocated
+inline bool psyqAsmData(PsyqAsm *a, int size)
+{
+    for (std::string_view s : a->operands)
+    {
+        std::string_view    symbol;
+        int64_t             value;
+        uint32_t            word;
+
+        if (!psyqAsmExpr(s, &symbol, &value))
+        {
+            return psyqAsmFail(a, "bad value %.*s", s);
+        }
+        if (!symbol.empty() && size != 4)
+        {
+            return psyqAsmFail(a, "symbol %.*s in a value smaller than a word", symbol);
+        }
+        if (!symbol.empty())
+        {
+            a->relocs.push_back({ PSYQ_REL32, a->section, psyqAsmOffset(a), symbol, value });
+            value = 0;
+        }
+        word = (uint32_t)value;
+        psyqAsmBytes(a, &word, size);
+    }
+    return true;
+}
+
+inline bool psyqAsmDirective(PsyqAsm *a, std::string_view name)
+{
+    const std::vector<std::string_view> &args = a->operands;
+    uint16_t section = psyqAsmSectionNumber(name);
+    int64_t value = 0;
+
+    if (section)
+    {
+        a->section = section;
+        return true;
+    }
+    if (name == ".section")
+    {
+        std::string_view target = args.empty() ? std::string_view() : args[0];
+        if (!(section = psyqAsmSectionNumber(target)))
+        {
+            return psyqAsmFail(a, "unknown section %.*s", target);
+        }
+        a->section = section;
+        return true;
+    }
+    if (name == ".set")
+    {
+        std::string_view option = args.empty() ? std::string_view() : args[0];
+        if (option == "noreorder")
+        {
+            a->flushHazards = a->reorder;
+            a->reorder = false;
+        }
+        else if (option == "reorder")
+        {
+            a->reorder = true;
+        }
+        return true;
+    }
+    if (name == ".globl" || name == ".global")
+    {
+        for (std::string_view symbol : args)
+        {
+            psyqAsmSymbol(a, symbol)->global = true;
+        }
+        return true;
+    }
+    if (name == ".comm" || name == ".lcomm")
+    {
+        if (args.size() < 2 || !psyqAsmNumber(args[1], &value))
+        {
+            return psyqAsmFail(a, "expected symbol, size for %.*s", name);
+        }
+        PsyqAsmSymbol *symbol = psyqAsmSymbol(a, args[0]);
+        if (name == ".comm")
+        {
+            symbol->common = true;
+            symbol->global = true;
+            return true;
+        }
+        // local common: allocated here, in .sbss when it is small
+        uint16_t    previous = a->section;
+        uint32_t    alignment = value >= 8 ? 8 : value >= 4 ? 4 : value >= 2 ? 2 : 1;
+
+        a->section = symbol->small ? PSYQ_ASM_SBSS : PSYQ_ASM_BSS;
+        psyqAsmAlign(a, alignment);
+        if (symbol->section)
+        {
+            return psyqAsmFail(a, "%.*s is already defined", args[0]);
+        }
+        symbol->section = a->section;
+        symbol->offset = psyqAsmOffset(a);
+        a->defined.push_back(args[0]);
+        psyqAsmSpace(a, value);
+        a->section = previous;
+        return true;
+    }
+    if (name == ".align")
+    {
+        if (args.empty() || !psyqAsmNumber(args[0], &value) || value < 0 || value > 12)
+        {
+            return psyqAsmFail(a, "bad alignment");
+        }
+        return psyqAsmAlign(a, 1u << value);
+    }
+    if (name == ".space" || name == ".skip")
+    {
+        if (args.empty() || !psyqAsmNumber(args[0], &value))
+        {
+            return psyqAsmFail(a, "bad size");
+        }
+        return psyqAsmSpace(a, value);
+    }
+    if (name == ".word" || name == ".half" || name == ".short" || name == ".byte" || name == ".ascii" || name == ".asciiz" || name == ".asciz" || name == ".float")
+    {
+        if (psyqAsmIsBss(a->section))
+        {
+            return psyqAsmFail(a, "data in %.*s", g_psyqAsmSections[a->section]);
+        }
+        if (a->section == PSYQ_ASM_TEXT)
+        {
+            a->loadReg = 0;
+        }
+        if (name == ".word")
+        {
+            return psyqAsmData(a, 4);
+        }
+        if (name == ".half" || name == ".short")
+        {
+            return psyqAsmData(a, 2);
+        }
+        if (name == ".byte")
+        {
+            return psyqAsmData(a, 1);
+        }
+        if (name == ".float")
+        {
+            for (std::string_view s : args)
+            {
+                float   f = strtof(std::string(s).c_str(), NULL);
+                psyqAsmBytes(a, &f, sizeof(f));
+            }
+            return true;
+        }
+        for (std::string_view s : args)
+        {
+            if (!psyqAsmString(a, s, name != ".ascii"))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    // declarations and debugging information, which don't change the code
+    if (name == ".extern" || name == ".file" || name == ".ent" || name == ".end" || name == ".frame" || name == ".mask" || name == ".fmask" || name == ".loc" || name == ".type" || name == ".size" || name == ".ident" || name == ".option" || name == ".verstamp" || name == ".aent" || name == ".gnu_attribute" || name == ".def" || name == ".endef" || name == ".bb" || name == ".eb" || name == ".scl" || name == ".val" || name == ".dim" || name == ".tag" || name == ".line")
+    {
+        return true;
+    }
+    return psyqAsmFail(a, "unknown directive %.*s", name);
+}
+
+//! Declarations that must be known before the instructions using them:
+//! which symbols are small, from .extern / .comm / .lcomm and the sections
+//! their labels are in. .comm comes after the functions in CC1PSX's output.
+inline void psyqAsmDeclarations(PsyqAsm *a)
+{
+    uint16_t section = PSYQ_ASM_TEXT;
+
+    for (const PsyqAsmStatement &statement : a->statements)
+    {
+        std::string_view    s = psyqAsmTrim(statement.text);
+        std::string_view    label;
+        int64_t             size;
+
+        while (psyqAsmLabel(&s, &label))
+        {
+            if (section == PSYQ_ASM_SDATA || section == PSYQ_ASM_SBSS)
+            {
+                psyqAsmSymbol(a, label)->small = true;
+            }
+        }
+        if (s.empty() || s[0] != '.')
+        {
+            continue;
+        }
+        std::string_view name = psyqAsmOperands(a, s);
+        if (psyqAsmSectionNumber(name))
+        {
+            section = psyqAsmSectionNumber(name);
+        }
+        else if (name == ".section" && !a->operands.empty() && psyqAsmSectionNumber(a->operands[0]))
+        {
+            section = psyqAsmSectionNumber(a->operands[0]);
+        }
+        else if ((name == ".extern" || name == ".comm" || name == ".lcomm") && a->operands.size() >= 2 && psyqAsmNumber(a->operands[1], &size))
+        {
+            PsyqAsmSymbol *symbol = psyqAsmSymbol(a, a->operands[0]);
+            symbol->size = (uint32_t)size;
+            symbol->small = size > 0 && size <= a->gpSize;
+        }
+    }
+}
+
+//! Patch the branches now that every label is defined
+inline bool psyqAsmFixups(PsyqAsm *a)
+{
+    for (const PsyqAsmFixup &fixup : a->fixups)
+    {
+        auto        it = a->symbols.find(fixup.label);
+        uint8_t     *word = &a->bytes[fixup.section][fixup.offset];
+        int64_t     delta;
+
+        a->line = fixup.line;
+        if (it == a->symbols.end() || it->second.section != fixup.section)
+        {
+            return psyqAsmFail(a, "branch to %.*s, which is not a label of the section", fixup.label);
+        }
+        delta = ((int64_t)it->second.offset - (fixup.offset + 4)) / 4;
+        if (!psyqAsmSigned16(delta))
+        {
+            return psyqAsmFail(a, "branch to %.*s out of range", fixup.label);
+        }
+        word[0] = (uint8_t)delta;
+        word[1] = (uint8_t)(delta >> 8);
+    }
+    return true;
+}
+
+//! Fill obj with the assembled sections, code chunks, definitions and
+//! relocations, as psyqParse() would from aspsx's LNK file
+inline void psyqAsmObject(PsyqAsm *a, PsyqObject *obj)
+{
+    uint16_t nextNumber = PSYQ_ASM_SECTIONS;
+
+    psyqClear(obj);
+    obj->sectionIndex.assign(PSYQ_ASM_SECTIONS, -1);
+    for (uint16_t i = 1; i < PSYQ_ASM_SECTIONS; i++)
+    {
+        obj->sectionIndex[i] = obj->sections.size();
+        obj->sections.push_back({ i, 0, 8, g_psyqAsmSections[i] });
+        psyqSectionState(obj, i)->size = psyqAsmIsBss(i) ? a->bssSize[i] : (uint32_t)a->bytes[i].size();
+    }
+
+    for (const PsyqAsmRun &run : a->runs)
+    {
+        for (uint32_t start = run.start; start < run.end; start += PSYQ_ASM_CHUNK)
+        {
+            PsyqCode code;
+            code.section = run.section;
+            code.size = std::min<uint32_t>(PSYQ_ASM_CHUNK, run.end - start);
+            code.data = a->bytes[run.section].data() + start;
+            code.offset = start;
+            code.relocBase = obj->codeWords;
+            obj->codeWords += (code.size + 3) / 4;
+            psyqSectionState(obj, run.section)->lastCode = obj->codes.size();
+            obj->codes.push_back(code);
+        }
+    }
+    obj->relocAt.assign(obj->codeWords, -1);
+
+    for (std::string_view name : a->defined)
+    {
+        PsyqAsmSymbol *symbol = &a->symbols.find(name)->second;
+        if (name[0] != '$')
+        {
+            obj->definitions.push_back({ symbol->section, symbol->offset, name });
+        }
+    }
+
+    for (const PsyqAsmReloc &pending : a->relocs)
+    {
+        PsyqAsmSymbol   *symbol = psyqAsmSymbol(a, pending.symbol);
+        PsyqExprNode    base = { PSYQ_EXPR_SYMBOL, 0, PSYQ_NO_ID, 0 };
+        int64_t         addend = pending.addend;
+        PsyqReloc       *reloc;
+
+        if (symbol->section && !symbol->global)
+        {
+            base.op = PSYQ_EXPR_SECTION_BASE;
+            base.value = symbol->section;
+            addend += symbol->offset;
+        }
+        else
+        {
+            if (!symbol->number)
+            {
+                symbol->number = nextNumber++;
+                obj->symbols.resize(symbol->number + 1);
+                obj->symbols[symbol->number] = pending.symbol;
+            }
+            base.value = symbol->number;
+        }
+
+        if (obj->relocCount == obj->relocs.size())
+        {
+            obj->relocs.emplace_back();
+        }
+        reloc = &obj->relocs[obj->relocCount];
+        reloc->type = pending.type;
+        reloc->section = pending.section;
+        reloc->code = -1;
+        reloc->offset = 0;
+        for (size_t i = 0; i < obj->codes.size(); i++)
+        {
+            const PsyqCode *code = &obj->codes[i];
+            if (code->section == pending.section && pending.offset >= code->offset && pending.offset < code->offset + code->size)
+            {
+                reloc->code = i;
+                reloc->offset = pending.offset - code->offset;
+                obj->relocAt[code->relocBase + reloc->offset / 4] = obj->relocCount;
+                break;
+            }
+        }
+        reloc->root = obj->nodes.size();
+        if (addend)
+        {
+            PsyqExprNode op = { (uint8_t)(addend > 0 ? PSYQ_EXPR_ADD : PSYQ_EXPR_SUB), 0, PSYQ_NO_ID, (uint32_t)obj->nodes.size() + 2 };
+            obj->nodes.push_back(op);
+            obj->nodes.push_back(base);
+            obj->nodes.push_back({ PSYQ_EXPR_VALUE, (uint32_t)(addend > 0 ? addend : -addend), PSYQ_NO_ID, 0 });
+        }
+        else
+        {
+            obj->nodes.push_back(base);
+        }
+        reloc->nodeCount = obj->nodes.size() - reloc->root;
+        obj->relocCount++;
+    }
+
+    obj->symbolIds.assign(obj->symbols.size(), PSYQ_NO_ID);
+    obj->sectionIds.assign(obj->sections.size(), PSYQ_NO_ID);
+    for (size_t i = 0; i < obj->relocCount; i++)
+    {
+        psyqResolveExpr(obj, &obj->relocs[i]);
+    }
+}
+
+//! Assemble CC1PSX's output into obj, for symbols of at most gpSize bytes
+//! accessed relative to $gp (aspsx -G). The object refers to the tables of a
+//! and to text, which must outlive it. On failure obj->error has the message.
+inline bool psyqAssemble(PsyqAsm *a, PsyqObject *obj, const char *text, size_t size, int gpSize)
+{
+    for (int i = 0; i < PSYQ_ASM_SECTIONS; i++)
+    {
+        a->bytes[i].clear();
+        a->bssSize[i] = 0;
+    }
+    a->gpSize = gpSize;
+    a->section = PSYQ_ASM_TEXT;
+    a->reorder = true;
+    a->flushHazards = false;
+    a->loadReg = 0;
+    a->loadOp = 0;
+    a->hiloAge = 2;
+    a->symbols.clear();
+    a->defined.clear();
+    a->fixups.clear();
+    a->relocs.clear();
+    a->runs.clear();
+    a->line = 0;
+    a->error.clear();
+
+    psyqAsmSplit(a, text, size);
+    psyqAsmDeclarations(a);
+
+    for (const PsyqAsmStatement &statement : a->statements)
+    {
+        std::string_view    s = psyqAsmTrim(statement.text);
+        std::string_view    label;
+
+        a->line = statement.line;
+        while (psyqAsmLabel(&s, &label))
+        {
+            PsyqAsmSymbol *symbol = psyqAsmSymbol(a, label);
+            if (symbol->section)
+            {
+                psyqAsmFail(a, "%.*s is already defined", label);
+                break;
+            }
+            symbol->section = a->section;
+            symbol->offset = psyqAsmOffset(a);
+            a->defined.push_back(label);
+        }
+        if (!a->error.empty())
+        {
+            break;
+        }
+        if (s.empty())
+        {
+            continue;
+        }
+        std::string_view name = psyqAsmOperands(a, s);
+        if (!(name[0] == '.' ? psyqAsmDirective(a, name) : psyqAsmInstruction(a, name)))
+        {
+            break;
+        }
+    }
+
+    if (a->error.empty())
+    {
+        psyqAsmFixups(a);
+    }
+    if (!a->error.empty())
+    {
+        psyqClear(obj);
+        obj->error = a->error;
+        return false;
+    }
+    psyqAsmObject(a, obj);
+    return true;
+}
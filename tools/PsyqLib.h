@@ -0,0 +1,149 @@
+#pragma once
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// PsyQ LIB archive (PSYLIB): "LIB", version 1, then one entry per module:
+//
+//  char        name[8]     space padded
+//  uint32_t    date
+//  uint32_t    headerSize  from the start of the entry to the LNK object
+//  uint32_t    size        of the whole entry
+//  exports                 (length, name) pairs ending with a 0 length: the
+//                          XDEFs of the module, as written by the librarian
+//  the LNK object
+//
+// Modules are views into the buffer (it must outlive the PsyqLib), and their
+// objects can be handed to psyqParse() as they are.
+
+#define PSYQ_LIB_MAGIC      "LIB"
+#define PSYQ_LIB_VERSION    1
+
+typedef struct  PsyqLibModule
+{
+    std::string_view                name;
+    uint32_t                        date;
+    const uint8_t                   *obj;
+    size_t                          size;
+    std::vector<std::string_view>   exports;
+} PsyqLibModule;
+
+typedef struct  PsyqLib
+{
+    std::vector<PsyqLibModule>                          modules;
+    std::unordered_map<std::string_view, uint32_t>      symbols;    // XDEF -> modules[], the first one
+    std::string                                         error;
+} PsyqLib;
+
+inline bool psyqIsLib(const uint8_t *buffer, size_t size)
+{
+    return size >= 4 && !memcmp(buffer, PSYQ_LIB_MAGIC, 3);
+}
+
+inline bool psyqLibFail(PsyqLib *lib, const char *what, size_t offset)
+{
+    char message[128];
+
+    snprintf(message, sizeof(message), "Error: bad LIB archive, %s at 0x%zx\n", what, offset);
+    lib->error = message;
+    return false;
+}
+
+//! Read the module table and the symbol index of an archive
+inline bool psyqLibParse(const uint8_t *buffer, size_t size, PsyqLib *lib)
+{
+    size_t  pos = 4;
+
+    lib->modules.clear();
+    lib->symbols.clear();
+    lib->error.clear();
+    if (!psyqIsLib(buffer, size) || buffer[3] != PSYQ_LIB_VERSION)
+    {
+        return psyqLibFail(lib, "no LIB version 1 header", 0);
+    }
+
+    while (pos < size)
+    {
+        PsyqLibModule   module;
+        const uint8_t   *entry = buffer + pos;
+        uint32_t        headerSize, entrySize;
+        size_t          nameSize = 8;
+        size_t          at = pos + 20;
+
+        if (size - pos < 20)
+        {
+            return psyqLibFail(lib, "truncated module header", pos);
+        }
+        while (nameSize && entry[nameSize - 1] == ' ')
+        {
+            nameSize--;
+        }
+        module.name = std::string_view((const char*)entry, nameSize);
+        module.date = entry[8] | entry[9] << 8 | entry[10] << 16 | (uint32_t)entry[11] << 24;
+        headerSize = entry[12] | entry[13] << 8 | entry[14] << 16 | (uint32_t)entry[15] << 24;
+        entrySize = entry[16] | entry[17] << 8 | entry[18] << 16 | (uint32_t)entry[19] << 24;
+        if (headerSize < 20 || entrySize < headerSize || entrySize > size - pos)
+        {
+            return psyqLibFail(lib, "bad module size", pos);
+        }
+
+        while (at < pos + headerSize && buffer[at])
+        {
+            uint8_t length = buffer[at];
+
+            if (at + 1 + length > pos + headerSize)
+            {
+                return psyqLibFail(lib, "bad export name", at);
+            }
+            module.exports.push_back(std::string_view((const char*)buffer + at + 1, length));
+            at += 1 + length;
+        }
+        module.obj = entry + headerSize;
+        module.size = entrySize - headerSize;
+        if (module.size < 6 || memcmp(module.obj, "LNK", 3))
+        {
+            return psyqLibFail(lib, "module without an LNK object", pos + headerSize);
+        }
+
+        for (std::string_view symbol : module.exports)
+        {
+            lib->symbols.emplace(symbol, (uint32_t)lib->modules.size());
+        }
+        lib->modules.push_back(std::move(module));
+        pos += entrySize;
+    }
+    return true;
+}
+
+//! Module defining a symbol, or else named name (case insensitive), or -1
+inline int psyqLibFind(const PsyqLib *lib, std::string_view name)
+{
+    auto symbol = lib->symbols.find(name);
+
+    if (symbol != lib->symbols.end())
+    {
+        return (int)symbol->second;
+    }
+    for (size_t i = 0; i < lib->modules.size(); i++)
+    {
+        std::string_view module = lib->modules[i].name;
+        size_t           j = 0;
+
+        while (j < name.size() && j < module.size() && toupper((uint8_t)module[j]) == toupper((uint8_t)name[j]))
+        {
+            j++;
+        }
+        if (j == name.size() && j == module.size())
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,760 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// PsyQ LNK object parser.
+//
+// One pass over the file: sections, symbols, code chunks (with their offsets
+// in their section), definitions and relocations go into growable tables whose names are string_views into the file buffer
+// (the buffer must outlive the object). Relocation expressions are read into
+// expression trees; they can refer to symbols and sections defined later in
+// the file, so their names are resolved to interned ids once the whole file
+// has been read, and the text is only rendered when it is printed.
+// psyqClear() keeps the tables' memory, and the interned names, for the next
+// object: ids can be compared between objects parsed into the same PsyqObject,
+// or into PsyqObjects sharing one PsyqNames table.
+
+//! LNK record opcodes
+#define PSYQ_END            0x00
+#define PSYQ_CODE           0x02
+#define PSYQ_SWITCH         0x06
+#define PSYQ_UNINITIALISED  0x08
+#define PSYQ_PATCH          0x0a
+#define PSYQ_XDEF           0x0c
+#define PSYQ_XREF           0x0e
+#define PSYQ_SECTION        0x10
+#define PSYQ_LOCAL_SYMBOL   0x12
+#define PSYQ_FILENAME       0x1c
+#define PSYQ_XBSS           0x30
+#define PSYQ_SLD_INC        0x32
+#define PSYQ_SLD_INC_BYTE   0x34
+#define PSYQ_SLD_SET        0x38
+#define PSYQ_SLD_SET_FILE   0x3a
+#define PSYQ_SLD_END        0x3c
+#define PSYQ_FUNCTION_START 0x4a
+#define PSYQ_FUNCTION_END   0x4c
+#define PSYQ_BLOCK_START    0x4e
+#define PSYQ_BLOCK_END      0x50
+#define PSYQ_DEF            0x52
+#define PSYQ_DEF2           0x54
+
+//! Relocation types
+#define PSYQ_REL32          16
+#define PSYQ_REL26          74
+#define PSYQ_HI16           82
+#define PSYQ_LO16           84
+#define PSYQ_GPREL16        100
+
+//! Relocation expression opcodes
+#define PSYQ_EXPR_VALUE         0
+#define PSYQ_EXPR_SYMBOL        2
+#define PSYQ_EXPR_SECTION_BASE  4
+#define PSYQ_EXPR_SECTION_START 12
+#define PSYQ_EXPR_SECTION_END   22
+#define PSYQ_EXPR_ADD           44
+#define PSYQ_EXPR_SUB           46
+#define PSYQ_EXPR_DIV           50
+
+//! No interned name (unknown symbol or section)
+#define PSYQ_NO_ID              0xffffffff
+
+typedef struct  PsyqSection
+{
+    uint16_t            index;
+    uint16_t            group;
+    uint8_t             alignment;
+    std::string_view    name;
+} PsyqSection;
+
+typedef struct  PsyqCode
+{
+    uint16_t            section;
+    uint32_t            size;
+    const uint8_t       *data;
+    uint32_t            offset;     // in the section
+    uint32_t            relocBase;  // first word in PsyqObject::relocAt
+} PsyqCode;
+
+//! Size and last code chunk of a section, while it is being read
+typedef struct  PsyqSectionState
+{
+    uint32_t            size;
+    int32_t             lastCode;
+} PsyqSectionState;
+
+//! Symbol defined at an offset of a section (XDEF, local symbol, function start)
+typedef struct  PsyqDefinition
+{
+    uint16_t            section;
+    uint32_t            offset;
+    std::string_view    name;
+} PsyqDefinition;
+
+//! Bytes [start, end) of a section
+typedef struct  PsyqRange
+{
+    uint16_t            section;
+    uint32_t            start;
+    uint32_t            end;
+} PsyqRange;
+
+typedef struct  PsyqFunction
+{
+    uint16_t            section;
+    uint32_t            offset;
+    std::string_view    name;
+} PsyqFunction;
+
+//! Relocation expression node. Nodes are stored in prefix order, so the left
+//! operand of ADD / SUB / DIV is the next node and a whole expression is a
+//! contiguous range.
+typedef struct  PsyqExprNode
+{
+    uint8_t             op;
+    uint32_t            value;  // VALUE, or the symbol / section number in the file
+    uint32_t            id;     // interned name of SYMBOL / SECTION_BASE, or PSYQ_NO_ID
+    uint32_t            right;  // ADD / SUB / DIV: right operand
+} PsyqExprNode;
+
+typedef struct  PsyqReloc
+{
+    uint8_t             type;
+    uint16_t            section;
+    uint16_t            offset;     // in the code chunk
+    int32_t             code;       // patched chunk: the section's last one, or -1
+    uint32_t            root;       // first node of the expression
+    uint32_t            nodeCount;
+    uint32_t            symbol;     // first named symbol of the expression, or PSYQ_NO_ID
+    mutable bool        rendered;
+    mutable std::string expr;       // see psyqRelocExpr()
+} PsyqReloc;
+
+//! Interned names; a name keeps its id for the lifetime of the table
+typedef struct  PsyqNames
+{
+    std::deque<std::string>                         names;  // id -> name
+    std::unordered_map<std::string_view, uint32_t>  ids;    // views into names
+} PsyqNames;
+
+typedef struct  PsyqObject
+{
+    std::vector<PsyqSection>        sections;
+    std::vector<int32_t>            sectionIndex;   // section number -> sections[], or -1
+    std::vector<std::string_view>   symbols;        // symbol number -> name
+    std::vector<PsyqCode>           codes;
+    std::vector<PsyqSectionState>   sectionStates;  // section number -> state
+    std::vector<PsyqFunction>       functions;
+    std::vector<PsyqDefinition>     definitions;
+    std::vector<PsyqReloc>          relocs;
+    std::vector<PsyqExprNode>       nodes;
+    std::vector<uint32_t>           symbolIds;      // symbol number -> interned name
+    std::vector<uint32_t>           sectionIds;     // sections[] -> interned name
+    std::vector<uint32_t>           pending;        // psyqReadExpr() operators
+    PsyqNames                       *names;         // shared interned names, or NULL for ownNames
+    PsyqNames                       ownNames;
+    std::vector<int32_t>            relocAt;        // code relocBase + offset / 4 -> relocs[], or -1
+    uint32_t                        codeWords;
+    size_t                          relocCount;     // relocs in use, their strings are reused
+    std::string                     error;
+} PsyqObject;
+
+inline void psyqClear(PsyqObject *obj)
+{
+    obj->sections.clear();
+    obj->sectionIndex.clear();
+    obj->symbols.clear();
+    obj->codes.clear();
+    obj->sectionStates.clear();
+    obj->functions.clear();
+    obj->definitions.clear();
+    obj->nodes.clear();
+    obj->symbolIds.clear();
+    obj->sectionIds.clear();
+    obj->relocAt.clear();
+    obj->codeWords = 0;
+    obj->relocCount = 0;
+    obj->error.clear();
+}
+
+inline const char *psyqRelocTypeName(uint8_t type)
+{
+    switch (type)
+    {
+    case PSYQ_REL32:    return "R_MIPS_32";
+    case PSYQ_REL26:    return "R_MIPS_26";
+    case PSYQ_HI16:     return "R_HI16";
+    case PSYQ_LO16:     return "R_LO16";
+    case PSYQ_GPREL16:  return "GPREL16";
+    }
+    return NULL;
+}
+
+//! Relocation patching the word at offset in a code chunk, or NULL
+inline const PsyqReloc *psyqFindReloc(const PsyqObject *obj, const PsyqCode *code, size_t offset)
+{
+    size_t i = code->relocBase + offset / 4;
+    if (offset >= code->size || i >= obj->relocAt.size() || obj->relocAt[i] < 0)
+    {
+        return NULL;
+    }
+    return &obj->relocs[obj->relocAt[i]];
+}
+
+inline const PsyqSection *psyqSection(const PsyqObject *obj, uint32_t number)
+{
+    if (number >= obj->sectionIndex.size() || obj->sectionIndex[number] < 0)
+    {
+        return NULL;
+    }
+    return &obj->sections[obj->sectionIndex[number]];
+}
+
+inline std::string_view psyqSymbol(const PsyqObject *obj, uint32_t number)
+{
+    return number < obj->symbols.size() ? obj->symbols[number] : std::string_view();
+}
+
+//! Whether a section holds instructions: .text, or a section that was never
+//! declared (which MDasm always disassembled)
+inline bool psyqIsText(const PsyqObject *obj, uint32_t number)
+{
+    const PsyqSection *section = psyqSection(obj, number);
+    return !section || section->name.substr(0, 5) == ".text";
+}
+
+inline PsyqSectionState *psyqSectionState(PsyqObject *obj, uint16_t number)
+{
+    if (number >= obj->sectionStates.size())
+    {
+        obj->sectionStates.resize(number + 1, { 0, -1 });
+    }
+    return &obj->sectionStates[number];
+}
+
+//! Bytes of a function, found by name among the function starts, XDEFs and
+//! local symbols. It ends at the next definition in its section, or at the
+//! end of the section.
+inline bool psyqFindFunction(const PsyqObject *obj, std::string_view name, PsyqRange *range)
+{
+    const PsyqDefinition *found = NULL;
+
+    for (const PsyqDefinition &definition : obj->definitions)
+    {
+        if (definition.name == name && psyqIsText(obj, definition.section))
+        {
+            found = &definition;
+            break;
+        }
+    }
+    if (!found)
+    {
+        return false;
+    }
+
+    range->section = found->section;
+    range->start = found->offset;
+    range->end = found->section < obj->sectionStates.size() ? obj->sectionStates[found->section].size : found->offset;
+    for (const PsyqDefinition &definition : obj->definitions)
+    {
+        if (definition.section == found->section && definition.offset > range->start && definition.offset < range->end)
+        {
+            range->end = definition.offset;
+        }
+    }
+    return true;
+}
+
+inline PsyqNames *psyqNames(PsyqObject *obj)
+{
+    return obj->names ? obj->names : &obj->ownNames;
+}
+
+inline const PsyqNames *psyqNames(const PsyqObject *obj)
+{
+    return obj->names ? obj->names : &obj->ownNames;
+}
+
+inline uint32_t psyqIntern(PsyqNames *names, std::string_view name)
+{
+    auto it = names->ids.find(name);
+    if (it != names->ids.end())
+    {
+        return it->second;
+    }
+    uint32_t id = names->names.size();
+    names->names.emplace_back(name);
+    names->ids.emplace(names->names.back(), id);
+    return id;
+}
+
+//! Name of an interned id, empty for PSYQ_NO_ID
+inline std::string_view psyqInterned(const PsyqObject *obj, uint32_t id)
+{
+    const PsyqNames *names = psyqNames(obj);
+    return id < names->names.size() ? std::string_view(names->names[id]) : std::string_view();
+}
+
+//! Reader over the file buffer; every read is bounds checked
+typedef struct  PsyqReader
+{
+    const uint8_t   *ptr;
+    const uint8_t   *end;
+    bool            failed;
+} PsyqReader;
+
+inline bool psyqNeed(PsyqReader *r, size_t size)
+{
+    if (r->failed || (size_t)(r->end - r->ptr) < size)
+    {
+        r->failed = true;
+        return false;
+    }
+    return true;
+}
+
+inline uint8_t psyqU8(PsyqReader *r)
+{
+    if (!psyqNeed(r, 1))
+    {
+        return 0;
+    }
+    return *r->ptr++;
+}
+
+inline uint16_t psyqU16(PsyqReader *r)
+{
+    if (!psyqNeed(r, 2))
+    {
+        return 0;
+    }
+    uint16_t value = r->ptr[0] | r->ptr[1] << 8;
+    r->ptr += 2;
+    return value;
+}
+
+inline uint32_t psyqU32(PsyqReader *r)
+{
+    if (!psyqNeed(r, 4))
+    {
+        return 0;
+    }
+    uint32_t value = r->ptr[0] | r->ptr[1] << 8 | r->ptr[2] << 16 | (uint32_t)r->ptr[3] << 24;
+    r->ptr += 4;
+    return value;
+}
+
+inline void psyqSkip(PsyqReader *r, size_t size)
+{
+    if (psyqNeed(r, size))
+    {
+        r->ptr += size;
+    }
+}
+
+//! Length-prefixed name
+inline std::string_view psyqName(PsyqReader *r)
+{
+    uint8_t len = psyqU8(r);
+    if (!psyqNeed(r, len))
+    {
+        return std::string_view();
+    }
+    std::string_view name((const char*)r->ptr, len);
+    r->ptr += len;
+    return name;
+}
+
+inline void psyqSetSymbol(PsyqObject *obj, uint16_t number, std::string_view name)
+{
+    if (number >= obj->symbols.size())
+    {
+        obj->symbols.resize(number + 1);
+    }
+    obj->symbols[number] = name;
+}
+
+inline bool psyqFail(PsyqObject *obj, const char *fmt, int a, int b)
+{
+    char    message[256];
+
+    snprintf(message, sizeof(message), fmt, a, b);
+    obj->error = message;
+    return false;
+}
+
+//! Relocation expression text, rendered on first use the way MDasm always
+//! printed it: operands left to right, joined by the last operator seen.
+inline const std::string &psyqRelocExpr(const PsyqObject *obj, const PsyqReloc *reloc)
+{
+    char    op = 0;
+    char    value[16];
+
+    if (reloc->rendered)
+    {
+        return reloc->expr;
+    }
+    reloc->rendered = true;
+    reloc->expr.clear();
+    for (uint32_t i = reloc->root; i < reloc->root + reloc->nodeCount; i++)
+    {
+        const PsyqExprNode  *node = &obj->nodes[i];
+        std::string_view    operand;
+
+        switch (node->op)
+        {
+        case PSYQ_EXPR_ADD: op = '+'; continue;
+        case PSYQ_EXPR_SUB: op = '-'; continue;
+        case PSYQ_EXPR_DIV: op = '/'; continue;
+        case PSYQ_EXPR_VALUE:
+            snprintf(value, sizeof(value), "%x", node->value);
+            operand = value;
+            break;
+        case PSYQ_EXPR_SYMBOL:
+        case PSYQ_EXPR_SECTION_BASE:
+            operand = psyqInterned(obj, node->id);
+            break;
+        default: // SECTION_START / SECTION_END are not printed
+            continue;
+        }
+        if (!reloc->expr.empty())
+        {
+            reloc->expr += op;
+        }
+        reloc->expr += operand;
+    }
+    return reloc->expr;
+}
+
+//! Compare two relocations on their types and interned ids, without
+//! rendering them. The objects must share their PsyqNames.
+inline bool psyqRelocEqual(const PsyqObject *a, const PsyqReloc *ra, const PsyqObject *b, const PsyqReloc *rb)
+{
+    if (ra->type != rb->type || ra->nodeCount != rb->nodeCount)
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < ra->nodeCount; i++)
+    {
+        const PsyqExprNode *na = &a->nodes[ra->root + i];
+        const PsyqExprNode *nb = &b->nodes[rb->root + i];
+        bool named = na->op == PSYQ_EXPR_SYMBOL || na->op == PSYQ_EXPR_SECTION_BASE;
+
+        if (na->op != nb->op || (named ? na->id != nb->id : na->value != nb->value))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Read a relocation expression (prefix notation) into obj->nodes, linking
+//! every operator to its right operand
+inline bool psyqReadExpr(PsyqObject *obj, PsyqReader *r, const uint8_t *buffer)
+{
+    obj->pending.clear();
+    while (!r->failed)
+    {
+        PsyqExprNode    node = { psyqU8(r), 0, PSYQ_NO_ID, 0 };
+
+        switch (node.op)
+        {
+        case PSYQ_EXPR_VALUE:
+            node.value = psyqU32(r);
+            break;
+        case PSYQ_EXPR_SYMBOL:
+        case PSYQ_EXPR_SECTION_BASE:
+        case PSYQ_EXPR_SECTION_START:
+        case PSYQ_EXPR_SECTION_END:
+            node.value = psyqU16(r);
+            break;
+        case PSYQ_EXPR_ADD:
+        case PSYQ_EXPR_SUB:
+        case PSYQ_EXPR_DIV:
+            obj->pending.push_back(obj->nodes.size());
+            obj->nodes.push_back(node);
+            continue;
+        default:
+            return psyqFail(obj, "Error: unknown relocation expression 0x%x in obj file at offset 0x%x.\n", node.op, (int)(r->ptr - 1 - buffer));
+        }
+        obj->nodes.push_back(node);
+
+        // A complete operand: the innermost operator that still misses its
+        // right operand gets the next node, the complete ones are done
+        while (!obj->pending.empty() && obj->nodes[obj->pending.back()].right)
+        {
+            obj->pending.pop_back();
+        }
+        if (obj->pending.empty())
+        {
+            break;
+        }
+        obj->nodes[obj->pending.back()].right = obj->nodes.size();
+    }
+    return true;
+}
+
+//! Resolve the names of a relocation's expression to interned ids
+inline void psyqResolveExpr(PsyqObject *obj, PsyqReloc *reloc)
+{
+    reloc->symbol = PSYQ_NO_ID;
+    reloc->rendered = false;
+    for (uint32_t i = reloc->root; i < reloc->root + reloc->nodeCount; i++)
+    {
+        PsyqExprNode *node = &obj->nodes[i];
+
+        if (node->op == PSYQ_EXPR_SYMBOL && node->value < obj->symbols.size())
+        {
+            uint32_t *id = &obj->symbolIds[node->value];
+            if (*id == PSYQ_NO_ID && !obj->symbols[node->value].empty())
+            {
+                *id = psyqIntern(psyqNames(obj), obj->symbols[node->value]);
+            }
+            node->id = *id;
+            if (reloc->symbol == PSYQ_NO_ID)
+            {
+                reloc->symbol = node->id;
+            }
+        }
+        else if (node->op == PSYQ_EXPR_SECTION_BASE && node->value < obj->sectionIndex.size() && obj->sectionIndex[node->value] >= 0)
+        {
+            uint32_t *id = &obj->sectionIds[obj->sectionIndex[node->value]];
+            if (*id == PSYQ_NO_ID)
+            {
+                *id = psyqIntern(psyqNames(obj), obj->sections[obj->sectionIndex[node->value]].name);
+            }
+            node->id = *id;
+        }
+    }
+}
+
+//! Parse a whole LNK file. On failure obj->error has the message.
+inline bool psyqParse(PsyqObject *obj, const uint8_t *buffer, size_t size)
+{
+    PsyqReader  reader = { buffer, buffer + size, false };
+    PsyqReader  *r = &reader;
+    uint16_t    currentSection = 0;
+
+    psyqClear(obj);
+
+    psyqSkip(r, 3); // name (LNK)
+    psyqSkip(r, 1); // version (2)
+    psyqSkip(r, 2); // processor type (7)
+
+    while (r->ptr < r->end && !r->failed)
+    {
+        const uint8_t   *record = r->ptr;
+        uint8_t         opcode = psyqU8(r);
+
+        switch (opcode)
+        {
+        case PSYQ_XBSS:             // 48 - XBSS symbol number %lx .. size %lx in section %lx
+        {
+            uint16_t number = psyqU16(r);
+            psyqSkip(r, 2); // section
+            psyqSkip(r, 4); // size
+            psyqSetSymbol(obj, number, psyqName(r));
+            break;
+        }
+        case PSYQ_SECTION:          // 16 - Section symbol number 1 '.rdata' in group 0 alignment 8
+        {
+            PsyqSection section;
+            section.index = psyqU16(r);
+            section.group = psyqU16(r);
+            section.alignment = psyqU8(r);
+            section.name = psyqName(r);
+            if (section.index >= obj->sectionIndex.size())
+            {
+                obj->sectionIndex.resize(section.index + 1, -1);
+            }
+            obj->sectionIndex[section.index] = obj->sections.size();
+            obj->sections.push_back(section);
+            break;
+        }
+        case PSYQ_FILENAME:         // 28 - file name
+            psyqSkip(r, 2); // file number
+            psyqName(r);
+            break;
+        case PSYQ_SWITCH:           // 6 - Switch
+            currentSection = psyqU16(r);
+            break;
+        case PSYQ_UNINITIALISED:    // 8 - Uninitialised data
+            psyqSectionState(obj, currentSection)->size += psyqU32(r); // total bytes
+            break;
+        case PSYQ_CODE:             // 2 - Code
+        {
+            PsyqSectionState    *state = psyqSectionState(obj, currentSection);
+            PsyqCode            code;
+            code.section = currentSection;
+            code.size = psyqU16(r);
+            code.data = r->ptr;
+            code.offset = state->size;
+            code.relocBase = obj->codeWords;
+            psyqSkip(r, code.size);
+            state->size += code.size;
+            state->lastCode = obj->codes.size();
+            obj->codeWords += (code.size + 3) / 4;
+            obj->codes.push_back(code);
+            break;
+        }
+        case PSYQ_SLD_SET_FILE:     // 58 - Set SLD linenum to 5 at offset 0 in file c
+            psyqSkip(r, 8);
+            break;
+        case PSYQ_SLD_INC_BYTE:     // 52 - Inc SLD linenum by byte 0 at offset 0
+            psyqSkip(r, 3);
+            break;
+        case PSYQ_SLD_INC:          // 50 - Inc SLD linenum at offset 0
+            psyqSkip(r, 2);
+            break;
+        case PSYQ_SLD_SET:          // 56 - Set SLD linenum to 14 at offset 1c
+            psyqSkip(r, 6);
+            break;
+        case PSYQ_PATCH:            // 10 - Patch type 74 at offset 2c with (sectbase(2)+$38)
+        {
+            PsyqReloc *reloc;
+
+            if (obj->relocCount == obj->relocs.size())
+            {
+                obj->relocs.emplace_back();
+            }
+            reloc = &obj->relocs[obj->relocCount];
+            reloc->type = psyqU8(r);
+            reloc->section = currentSection;
+            reloc->offset = psyqU16(r);
+            reloc->code = psyqSectionState(obj, currentSection)->lastCode;
+            reloc->root = obj->nodes.size();
+            if (!psyqReadExpr(obj, r, buffer))
+            {
+                return false;
+            }
+            reloc->nodeCount = obj->nodes.size() - reloc->root;
+            // unknown types were never printed
+            if (psyqRelocTypeName(reloc->type) && reloc->code >= 0 && reloc->offset < obj->codes[reloc->code].size)
+            {
+                size_t i = obj->codes[reloc->code].relocBase + reloc->offset / 4;
+                if (i >= obj->relocAt.size())
+                {
+                    obj->relocAt.resize(i + 1, -1);
+                }
+                obj->relocAt[i] = obj->relocCount;
+            }
+            obj->relocCount++;
+            break;
+        }
+        case PSYQ_SLD_END:          // 60 - End SLD info at offset 0
+            psyqSkip(r, 2); // offset
+            break;
+        case PSYQ_XDEF:             // 12 - XDEF symbol number a 'CRC32_80020BB4' at offset 0 in section 2
+        {
+            uint16_t        number = psyqU16(r);
+            PsyqDefinition  definition;
+            definition.section = psyqU16(r);
+            definition.offset = psyqU32(r);
+            definition.name = psyqName(r);
+            psyqSetSymbol(obj, number, definition.name);
+            obj->definitions.push_back(definition);
+            break;
+        }
+        case PSYQ_XREF:             // 14 - XREF symbol number 24 'GCL_ReadVector_80020A14'
+        {
+            uint16_t number = psyqU16(r);
+            psyqSetSymbol(obj, number, psyqName(r));
+            break;
+        }
+        case PSYQ_LOCAL_SYMBOL:     // 18 - Local symbol 'loc' at offset 10 in section 1
+        {
+            PsyqDefinition  definition;
+            definition.section = psyqU16(r);
+            definition.offset = psyqU32(r);
+            definition.name = psyqName(r);
+            obj->definitions.push_back(definition);
+            break;
+        }
+        case PSYQ_DEF:              // 82 - Def
+            psyqSkip(r, 2); // section
+            psyqSkip(r, 4); // value
+            psyqSkip(r, 2); // class
+            psyqSkip(r, 2); // type
+            psyqSkip(r, 4); // size
+            psyqName(r);
+            break;
+        case PSYQ_DEF2:             // 84 - Def2 (arrays)
+        {
+            psyqSkip(r, 2); // section
+            psyqSkip(r, 4); // value
+            psyqSkip(r, 2); // class
+            psyqSkip(r, 2); // type
+            psyqSkip(r, 4); // size
+            uint16_t dims = psyqU16(r);
+            psyqSkip(r, 4 * dims);
+            if (dims && psyqNeed(r, 1) && *r->ptr == 0)
+            {
+                psyqSkip(r, 1); // padding ?
+            }
+            else
+            {
+                psyqName(r); // tag (1st line)
+            }
+            psyqName(r); // tag (2nd line)
+            break;
+        }
+        case PSYQ_FUNCTION_START:   // 74 - Function start
+        {
+            PsyqFunction function;
+            function.section = psyqU16(r);
+            function.offset = psyqU32(r);
+            psyqSkip(r, 2); // file
+            psyqSkip(r, 4); // start line
+            psyqSkip(r, 2); // frame reg
+            psyqSkip(r, 4); // frame size
+            psyqSkip(r, 2); // return pc reg
+            psyqSkip(r, 4); // mask
+            psyqSkip(r, 4); // mask offset
+            function.name = psyqName(r);
+            obj->functions.push_back(function);
+            obj->definitions.push_back({ function.section, function.offset, function.name });
+            break;
+        }
+        case PSYQ_BLOCK_START:      // 78 - Block start
+            psyqSkip(r, 2); // section
+            psyqSkip(r, 4); // offset
+            psyqSkip(r, 4); // start line
+            break;
+        case PSYQ_BLOCK_END:        // 80 - Block end
+        case PSYQ_FUNCTION_END:     // 76 - Function end
+            psyqSkip(r, 2); // section
+            psyqSkip(r, 4); // offset
+            psyqSkip(r, 4); // end line
+            break;
+        case PSYQ_END:              // End of file
+            if (r->ptr != r->end)
+            {
+                return psyqFail(obj, "Error end of file at %x when file size is %x\n", (int)(r->ptr - buffer), (int)size);
+            }
+            break;
+        default:
+            return psyqFail(obj, "Error: unknown opcode 0x%x in obj file at offset 0x%x.\n", opcode, (int)(record - buffer));
+        }
+    }
+
+    if (r->failed)
+    {
+        return psyqFail(obj, "Error: truncated obj file at offset 0x%x (size 0x%x)\n", (int)(r->ptr - buffer), (int)size);
+    }
+
+    // Forward references are resolved now that every symbol has been read
+    obj->symbolIds.assign(obj->symbols.size(), PSYQ_NO_ID);
+    obj->sectionIds.assign(obj->sections.size(), PSYQ_NO_ID);
+    for (size_t i = 0; i < obj->relocCount; i++)
+    {
+        psyqResolveExpr(obj, &obj->relocs[i]);
+    }
+    return true;
+}
@@ -0,0 +1,526 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+// R3000A (MIPS I) + PSX GTE decoder, replacing capstone in MDasm2.
+//
+// Instructions decode into a small R3000Insn through compile-time opcode
+// tables, without any allocation or string handling. r3000Format() turns one
+// into text when needed, in the same syntax capstone (CS_MODE_MIPS32) prints
+// (register names without '$'), so that disassembly and scores don't change.
+
+typedef enum    R3000Op
+{
+    R3000_INVALID = 0,
+
+    // SPECIAL
+    R3000_SLL, R3000_SRL, R3000_SRA, R3000_SLLV, R3000_SRLV, R3000_SRAV,
+    R3000_JR, R3000_JALR, R3000_SYSCALL, R3000_BREAK,
+    R3000_MFHI, R3000_MTHI, R3000_MFLO, R3000_MTLO,
+    R3000_MULT, R3000_MULTU, R3000_DIV, R3000_DIVU,
+    R3000_ADD, R3000_ADDU, R3000_SUB, R3000_SUBU,
+    R3000_AND, R3000_OR, R3000_XOR, R3000_NOR, R3000_SLT, R3000_SLTU,
+
+    // REGIMM
+    R3000_BLTZ, R3000_BGEZ, R3000_BLTZAL, R3000_BGEZAL,
+
+    // primary opcodes
+    R3000_J, R3000_JAL, R3000_BEQ, R3000_BNE, R3000_BLEZ, R3000_BGTZ,
+    R3000_ADDI, R3000_ADDIU, R3000_SLTI, R3000_SLTIU,
+    R3000_ANDI, R3000_ORI, R3000_XORI, R3000_LUI,
+    R3000_LB, R3000_LH, R3000_LWL, R3000_LW, R3000_LBU, R3000_LHU, R3000_LWR,
+    R3000_SB, R3000_SH, R3000_SWL, R3000_SW, R3000_SWR,
+    R3000_LWC2, R3000_SWC2,
+
+    // COP0 / COP2
+    R3000_MFC0, R3000_MTC0, R3000_RFE,
+    R3000_MFC2, R3000_CFC2, R3000_MTC2, R3000_CTC2,
+
+    // GTE commands (COP2 with bit 25 set)
+    R3000_RTPS, R3000_NCLIP, R3000_OP, R3000_DPCS, R3000_INTPL, R3000_MVMVA,
+    R3000_NCDS, R3000_CDP, R3000_NCDT, R3000_NCCS, R3000_CC, R3000_NCS,
+    R3000_NCT, R3000_SQR, R3000_DCPL, R3000_DPCT, R3000_AVSZ3, R3000_AVSZ4,
+    R3000_RTPT, R3000_GPF, R3000_GPL, R3000_NCCT, R3000_COP2,
+
+    // aliases picked at decode time, like capstone prints them
+    R3000_NOP, R3000_MOVE, R3000_NEG, R3000_NEGU, R3000_NOT,
+    R3000_B, R3000_BEQZ, R3000_BNEZ, R3000_BAL,
+
+    R3000_OP_COUNT
+} R3000Op;
+
+//! Operand layouts, for formatting
+typedef enum    R3000Format
+{
+    F_NONE,         //
+    F_RD_RS_RT,     // rd, rs, rt
+    F_RD_RT_SA,     // rd, rt, sa
+    F_RD_RT_RS,     // rd, rt, rs
+    F_RD_RS,        // rd, rs
+    F_RD_RT,        // rd, rt
+    F_RD,           // rd
+    F_RS,           // rs
+    F_RS_RT,        // rs, rt
+    F_ZERO_RS_RT,   // zero, rs, rt
+    F_JALR,         // rs, or rd, rs
+    F_CODE,         // syscall code
+    F_BREAK,        // break code1[, code2]
+    F_RT_RS_SIMM,   // rt, rs, simm
+    F_RT_RS_UIMM,   // rt, rs, uimm
+    F_RT_UIMM,      // rt, uimm
+    F_RS_RT_BRANCH, // rs, rt, target
+    F_RS_BRANCH,    // rs, target
+    F_BRANCH,       // target
+    F_JUMP,         // target
+    F_MEM,          // rt, imm(rs)
+    F_COP_MEM,      // cop reg, imm(rs)
+    F_COP_SEL,      // rt, cop reg, 0
+    F_COP,          // rt, cop reg
+    F_GTE,          // command
+} R3000Format;
+
+//! Control flow and memory access flags
+#define R3000_FLAG_BRANCH   0x01    // conditional or unconditional branch (pc relative)
+#define R3000_FLAG_JUMP     0x02    // j / jal / jr / jalr
+#define R3000_FLAG_CALL     0x04    // links ra
+#define R3000_FLAG_LOAD     0x08
+#define R3000_FLAG_STORE    0x10
+#define R3000_FLAG_DELAY    0x20    // has a delay slot
+
+typedef struct  R3000OpInfo
+{
+    const char  *name;
+    uint8_t     format;
+    uint8_t     flags;
+} R3000OpInfo;
+
+typedef struct  R3000Insn
+{
+    uint32_t    word;
+    uint8_t     op;     // R3000Op
+    uint8_t     rs;
+    uint8_t     rt;
+    uint8_t     rd;
+    uint8_t     sa;
+    int32_t     imm;    // sign or zero extended immediate, code, jump index or GTE command
+} R3000Insn;
+
+#define BR  (R3000_FLAG_BRANCH | R3000_FLAG_DELAY)
+#define JMP (R3000_FLAG_JUMP | R3000_FLAG_DELAY)
+#define LD  R3000_FLAG_LOAD
+#define ST  R3000_FLAG_STORE
+
+constexpr R3000OpInfo g_r3000Ops[R3000_OP_COUNT] = {
+    { ".word",      F_NONE,         0 },
+
+    { "sll",        F_RD_RT_SA,     0 },
+    { "srl",        F_RD_RT_SA,     0 },
+    { "sra",        F_RD_RT_SA,     0 },
+    { "sllv",       F_RD_RT_RS,     0 },
+    { "srlv",       F_RD_RT_RS,     0 },
+    { "srav",       F_RD_RT_RS,     0 },
+    { "jr",         F_RS,           JMP },
+    { "jalr",       F_JALR,         JMP | R3000_FLAG_CALL },
+    { "syscall",    F_CODE,         0 },
+    { "break",      F_BREAK,        0 },
+    { "mfhi",       F_RD,           0 },
+    { "mthi",       F_RS,           0 },
+    { "mflo",       F_RD,           0 },
+    { "mtlo",       F_RS,           0 },
+    { "mult",       F_RS_RT,        0 },
+    { "multu",      F_RS_RT,        0 },
+    { "div",        F_ZERO_RS_RT,   0 },
+    { "divu",       F_ZERO_RS_RT,   0 },
+    { "add",        F_RD_RS_RT,     0 },
+    { "addu",       F_RD_RS_RT,     0 },
+    { "sub",        F_RD_RS_RT,     0 },
+    { "subu",       F_RD_RS_RT,     0 },
+    { "and",        F_RD_RS_RT,     0 },
+    { "or",         F_RD_RS_RT,     0 },
+    { "xor",        F_RD_RS_RT,     0 },
+    { "nor",        F_RD_RS_RT,     0 },
+    { "slt",        F_RD_RS_RT,     0 },
+    { "sltu",       F_RD_RS_RT,     0 },
+
+    { "bltz",       F_RS_BRANCH,    BR },
+    { "bgez",       F_RS_BRANCH,    BR },
+    { "bltzal",     F_RS_BRANCH,    BR | R3000_FLAG_CALL },
+    { "bgezal",     F_RS_BRANCH,    BR | R3000_FLAG_CALL },
+
+    { "j",          F_JUMP,         JMP },
+    { "jal",        F_JUMP,         JMP | R3000_FLAG_CALL },
+    { "beq",        F_RS_RT_BRANCH, BR },
+    { "bne",        F_RS_RT_BRANCH, BR },
+    { "blez",       F_RS_BRANCH,    BR },
+    { "bgtz",       F_RS_BRANCH,    BR },
+    { "addi",       F_RT_RS_SIMM,   0 },
+    { "addiu",      F_RT_RS_SIMM,   0 },
+    { "slti",       F_RT_RS_SIMM,   0 },
+    { "sltiu",      F_RT_RS_SIMM,   0 },
+    { "andi",       F_RT_RS_UIMM,   0 },
+    { "ori",        F_RT_RS_UIMM,   0 },
+    { "xori",       F_RT_RS_UIMM,   0 },
+    { "lui",        F_RT_UIMM,      0 },
+    { "lb",         F_MEM,          LD },
+    { "lh",         F_MEM,          LD },
+    { "lwl",        F_MEM,          LD },
+    { "lw",         F_MEM,          LD },
+    { "lbu",        F_MEM,          LD },
+    { "lhu",        F_MEM,          LD },
+    { "lwr",        F_MEM,          LD },
+    { "sb",         F_MEM,          ST },
+    { "sh",         F_MEM,          ST },
+    { "swl",        F_MEM,          ST },
+    { "sw",         F_MEM,          ST },
+    { "swr",        F_MEM,          ST },
+    { "lwc2",       F_COP_MEM,      LD },
+    { "swc2",       F_COP_MEM,      ST },
+
+    { "mfc0",       F_COP_SEL,      0 },
+    { "mtc0",       F_COP_SEL,      0 },
+    { "rfe",        F_NONE,         0 },
+    { "mfc2",       F_COP_SEL,      0 },
+    { "cfc2",       F_COP,          0 },
+    { "mtc2",       F_COP_SEL,      0 },
+    { "ctc2",       F_COP,          0 },
+
+    { "rtps",       F_GTE,          0 },
+    { "nclip",      F_GTE,          0 },
+    { "op",         F_GTE,          0 },
+    { "dpcs",       F_GTE,          0 },
+    { "intpl",      F_GTE,          0 },
+    { "mvmva",      F_GTE,          0 },
+    { "ncds",       F_GTE,          0 },
+    { "cdp",        F_GTE,          0 },
+    { "ncdt",       F_GTE,          0 },
+    { "nccs",       F_GTE,          0 },
+    { "cc",         F_GTE,          0 },
+    { "ncs",        F_GTE,          0 },
+    { "nct",        F_GTE,          0 },
+    { "sqr",        F_GTE,          0 },
+    { "dcpl",       F_GTE,          0 },
+    { "dpct",       F_GTE,          0 },
+    { "avsz3",      F_GTE,          0 },
+    { "avsz4",      F_GTE,          0 },
+    { "rtpt",       F_GTE,          0 },
+    { "gpf",        F_GTE,          0 },
+    { "gpl",        F_GTE,          0 },
+    { "ncct",       F_GTE,          0 },
+    { "cop2",       F_GTE,          0 },
+
+    { "nop",        F_NONE,         0 },
+    { "move",       F_RD_RS,        0 },
+    { "neg",        F_RD_RT,        0 },
+    { "negu",       F_RD_RT,        0 },
+    { "not",        F_RD_RS,        0 },
+    { "b",          F_BRANCH,       BR },
+    { "beqz",       F_RS_BRANCH,    BR },
+    { "bnez",       F_RS_BRANCH,    BR },
+    { "bal",        F_BRANCH,       BR | R3000_FLAG_CALL },
+};
+
+#undef BR
+#undef JMP
+#undef LD
+#undef ST
+
+#define X R3000_INVALID
+
+//! Primary opcode (bits 26-31); SPECIAL, REGIMM, COP0 and COP2 are decoded further
+constexpr uint8_t g_r3000Primary[64] = {
+    X,              X,              R3000_J,        R3000_JAL,      R3000_BEQ,      R3000_BNE,      R3000_BLEZ,     R3000_BGTZ,
+    R3000_ADDI,     R3000_ADDIU,    R3000_SLTI,     R3000_SLTIU,    R3000_ANDI,     R3000_ORI,      R3000_XORI,     R3000_LUI,
+    X,              X,              X,              X,              X,              X,              X,              X,
+    X,              X,              X,              X,              X,              X,              X,              X,
+    R3000_LB,       R3000_LH,       R3000_LWL,      R3000_LW,       R3000_LBU,      R3000_LHU,      R3000_LWR,      X,
+    R3000_SB,       R3000_SH,       R3000_SWL,      R3000_SW,       X,              X,              R3000_SWR,      X,
+    X,              X,              R3000_LWC2,     X,              X,              X,              X,              X,
+    X,              X,              R3000_SWC2,     X,              X,              X,              X,              X,
+};
+
+//! SPECIAL function (bits 0-5)
+constexpr uint8_t g_r3000Special[64] = {
+    R3000_SLL,      X,              R3000_SRL,      R3000_SRA,      R3000_SLLV,     X,              R3000_SRLV,     R3000_SRAV,
+    R3000_JR,       R3000_JALR,     X,              X,              R3000_SYSCALL,  R3000_BREAK,    X,              X,
+    R3000_MFHI,     R3000_MTHI,     R3000_MFLO,     R3000_MTLO,     X,              X,              X,              X,
+    R3000_MULT,     R3000_MULTU,    R3000_DIV,      R3000_DIVU,     X,              X,              X,              X,
+    R3000_ADD,      R3000_ADDU,     R3000_SUB,      R3000_SUBU,     R3000_AND,      R3000_OR,       R3000_XOR,      R3000_NOR,
+    X,              X,              R3000_SLT,      R3000_SLTU,     X,              X,              X,              X,
+    X,              X,              X,              X,              X,              X,              X,              X,
+    X,              X,              X,              X,              X,              X,              X,              X,
+};
+
+//! GTE command function (bits 0-5)
+constexpr uint8_t g_r3000Gte[64] = {
+    X,              R3000_RTPS,     X,              X,              X,              X,              R3000_NCLIP,    X,
+    X,              X,              X,              X,              R3000_OP,       X,              X,              X,
+    R3000_DPCS,     R3000_INTPL,    R3000_MVMVA,    R3000_NCDS,     R3000_CDP,      X,              R3000_NCDT,     X,
+    X,              X,              X,              R3000_NCCS,     R3000_CC,       X,              R3000_NCS,      X,
+    R3000_NCT,      X,              X,              X,              X,              X,              X,              X,
+    R3000_SQR,      R3000_DCPL,     R3000_DPCT,     X,              X,              R3000_AVSZ3,    R3000_AVSZ4,    X,
+    R3000_RTPT,     X,              X,              X,              X,              X,              X,              X,
+    X,              X,              X,              X,              X,              R3000_GPF,      R3000_GPL,      R3000_NCCT,
+};
+
+#undef X
+
+//! Decode one little-endian word
+inline void r3000Decode(uint32_t word, R3000Insn *insn)
+{
+    uint32_t    primary = word >> 26;
+    uint8_t     op = g_r3000Primary[primary];
+
+    insn->word = word;
+    insn->rs = (word >> 21) & 0x1f;
+    insn->rt = (word >> 16) & 0x1f;
+    insn->rd = (word >> 11) & 0x1f;
+    insn->sa = (word >> 6) & 0x1f;
+    insn->imm = (int16_t)(word & 0xffff);
+
+    switch (primary)
+    {
+    case 0x00:  // SPECIAL
+        op = g_r3000Special[word & 0x3f];
+        switch (op)
+        {
+        case R3000_SLL:
+            if (word == 0)
+            {
+                op = R3000_NOP;
+            }
+            break;
+        case R3000_ADDU:
+        case R3000_OR:
+            if (insn->rt == 0)
+            {
+                op = R3000_MOVE;
+            }
+            break;
+        case R3000_SUB:
+        case R3000_SUBU:
+            if (insn->rs == 0)
+            {
+                op = op == R3000_SUB ? R3000_NEG : R3000_NEGU;
+            }
+            break;
+        case R3000_NOR:
+            if (insn->rt == 0)
+            {
+                op = R3000_NOT;
+            }
+            break;
+        case R3000_SYSCALL:
+        case R3000_BREAK:
+            insn->imm = (word >> 6) & 0xfffff;
+            break;
+        }
+        break;
+    case 0x01:  // REGIMM
+        switch (insn->rt)
+        {
+        case 0x00: op = R3000_BLTZ; break;
+        case 0x01: op = R3000_BGEZ; break;
+        case 0x10: op = R3000_BLTZAL; break;
+        case 0x11: op = insn->rs == 0 ? R3000_BAL : R3000_BGEZAL; break;
+        default: op = R3000_INVALID; break;
+        }
+        break;
+    case 0x02:  // J
+    case 0x03:  // JAL
+        insn->imm = word & 0x3ffffff;
+        break;
+    case 0x04:  // BEQ
+        if (insn->rt == 0)
+        {
+            op = insn->rs == 0 ? R3000_B : R3000_BEQZ;
+        }
+        break;
+    case 0x05:  // BNE
+        if (insn->rt == 0)
+        {
+            op = R3000_BNEZ;
+        }
+        break;
+    case 0x0c:  // ANDI
+    case 0x0d:  // ORI
+    case 0x0e:  // XORI
+    case 0x0f:  // LUI
+        insn->imm = word & 0xffff;
+        break;
+    case 0x10:  // COP0
+        switch (insn->rs)
+        {
+        case 0x00: op = R3000_MFC0; break;
+        case 0x04: op = R3000_MTC0; break;
+        case 0x10: op = (word & 0x3f) == 0x10 ? R3000_RFE : R3000_INVALID; break;
+        default: op = R3000_INVALID; break;
+        }
+        break;
+    case 0x12:  // COP2
+        if (word & (1 << 25))
+        {
+            op = g_r3000Gte[word & 0x3f];
+            if (op == R3000_INVALID)
+            {
+                op = R3000_COP2;
+            }
+            insn->imm = word & 0x1ffffff;
+            break;
+        }
+        switch (insn->rs)
+        {
+        case 0x00: op = R3000_MFC2; break;
+        case 0x02: op = R3000_CFC2; break;
+        case 0x04: op = R3000_MTC2; break;
+        case 0x06: op = R3000_CTC2; break;
+        default: op = R3000_INVALID; break;
+        }
+        break;
+    }
+
+    insn->op = op;
+}
+
+inline const R3000OpInfo *r3000Info(const R3000Insn *insn)
+{
+    return &g_r3000Ops[insn->op];
+}
+
+//! Branch or jump target, for the instruction at address
+inline uint32_t r3000Target(const R3000Insn *insn, uint32_t address)
+{
+    if (g_r3000Ops[insn->op].format == F_JUMP)
+    {
+        return ((address + 4) & 0xf0000000) | ((uint32_t)insn->imm << 2);
+    }
+    return address + 4 + insn->imm * 4;
+}
+
+constexpr const char *g_r3000Regs[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0",   "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0",   "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8",   "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+};
+
+//! Signed immediate, printed like capstone's printInt64 (hex above 9)
+inline int r3000FormatInt(char *out, size_t size, int64_t value)
+{
+    if (value >= 0)
+    {
+        return snprintf(out, size, value > 9 ? "0x%llx" : "%llu", (unsigned long long)value);
+    }
+    return snprintf(out, size, value < -9 ? "-0x%llx" : "-%llu", (unsigned long long)-value);
+}
+
+//! Write the mnemonic and the operands of insn at address. Returns the
+//! length of the operand string.
+inline int r3000Format(const R3000Insn *insn, uint32_t address, const char **mnemonic, char *ops, size_t size)
+{
+    const R3000OpInfo   *info = r3000Info(insn);
+    const char          *rs = g_r3000Regs[insn->rs];
+    const char          *rt = g_r3000Regs[insn->rt];
+    const char          *rd = g_r3000Regs[insn->rd];
+    char                imm[32];
+    int                 len = 0;
+
+    *mnemonic = info->name;
+    switch (info->format)
+    {
+    case F_NONE:
+        if (insn->op == R3000_INVALID)
+        {
+            return snprintf(ops, size, "0x%08x", insn->word);
+        }
+        ops[0] = '\0';
+        return 0;
+    case F_RD_RS_RT:
+        return snprintf(ops, size, "%s, %s, %s", rd, rs, rt);
+    case F_RD_RT_SA:
+        r3000FormatInt(imm, sizeof(imm), insn->sa);
+        return snprintf(ops, size, "%s, %s, %s", rd, rt, imm);
+    case F_RD_RT_RS:
+        return snprintf(ops, size, "%s, %s, %s", rd, rt, rs);
+    case F_RD_RS:
+        return snprintf(ops, size, "%s, %s", rd, rs);
+    case F_RD_RT:
+        return snprintf(ops, size, "%s, %s", rd, rt);
+    case F_RD:
+        return snprintf(ops, size, "%s", rd);
+    case F_RS:
+        return snprintf(ops, size, "%s", rs);
+    case F_RS_RT:
+        return snprintf(ops, size, "%s, %s", rs, rt);
+    case F_ZERO_RS_RT:
+        return snprintf(ops, size, "zero, %s, %s", rs, rt);
+    case F_JALR:
+        if (insn->rd == 31)
+        {
+            return snprintf(ops, size, "%s", rs);
+        }
+        return snprintf(ops, size, "%s, %s", rd, rs);
+    case F_CODE:
+        if (insn->imm == 0)
+        {
+            ops[0] = '\0';
+            return 0;
+        }
+        return r3000FormatInt(ops, size, insn->imm);
+    case F_BREAK:
+    {
+        int code1 = insn->imm >> 10;
+        int code2 = insn->imm & 0x3ff;
+        if (insn->imm == 0)
+        {
+            ops[0] = '\0';
+            return 0;
+        }
+        len = r3000FormatInt(ops, size, code1);
+        if (code2)
+        {
+            len += snprintf(ops + len, size - len, ", ");
+            len += r3000FormatInt(ops + len, size - len, code2);
+        }
+        return len;
+    }
+    case F_RT_RS_SIMM:
+    case F_RT_RS_UIMM:
+        r3000FormatInt(imm, sizeof(imm), insn->imm);
+        return snprintf(ops, size, "%s, %s, %s", rt, rs, imm);
+    case F_RT_UIMM:
+        r3000FormatInt(imm, sizeof(imm), insn->imm);
+        return snprintf(ops, size, "%s, %s", rt, imm);
+    case F_RS_RT_BRANCH:
+        r3000FormatInt(imm, sizeof(imm), (int32_t)r3000Target(insn, address));
+        return snprintf(ops, size, "%s, %s, %s", rs, rt, imm);
+    case F_RS_BRANCH:
+        r3000FormatInt(imm, sizeof(imm), (int32_t)r3000Target(insn, address));
+        return snprintf(ops, size, "%s, %s", rs, imm);
+    case F_BRANCH:
+        return r3000FormatInt(ops, size, (int32_t)r3000Target(insn, address));
+    case F_JUMP:
+        return r3000FormatInt(ops, size, r3000Target(insn, address));
+    case F_MEM:
+    case F_COP_MEM:
+        // a zero offset is left out, "lw v0, (a0)"
+        imm[0] = '\0';
+        if (insn->imm)
+        {
+            r3000FormatInt(imm, sizeof(imm), insn->imm);
+        }
+        if (info->format == F_COP_MEM)
+        {
+            return snprintf(ops, size, "%d, %s(%s)", insn->rt, imm, rs);
+        }
+        return snprintf(ops, size, "%s, %s(%s)", rt, imm, rs);
+    case F_COP_SEL:
+        return snprintf(ops, size, "%s, %d, 0", rt, insn->rd);
+    case F_COP:
+        return snprintf(ops, size, "%s, %d", rt, insn->rd);
+    case F_GTE:
+        return snprintf(ops, size, "0x%x", insn->imm);
+    }
+    ops[0] = '\0';
+    return 0;
+}
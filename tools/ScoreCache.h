@@ -0,0 +1,200 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Score cache shared by processes and kept between runs: a file mapped by
+// every one of them, holding an open addressing table from the code hash of
+// a candidate obj to its score and objdump hash.
+//
+// Slots are claimed and published without locks: a writer claims an empty
+// slot by swapping its key from 0 to SCORE_CACHE_BUSY, fills it, then stores
+// the real key with release ordering, and readers only look at a slot after
+// seeing the key they want in it. A table made for another context (target,
+// flags) is replaced as a whole by renaming a new file over it, so that
+// processes still using the old one never see it half cleared. A process
+// dying in the middle of an insertion only loses that slot.
+
+#define SCORE_CACHE_MAGIC       "MDSC"
+#define SCORE_CACHE_VERSION     1
+#define SCORE_CACHE_BUSY        1
+#define SCORE_CACHE_PROBES      16
+
+typedef struct  ScoreCacheHeader
+{
+    char        magic[4];
+    uint32_t    version;
+    uint64_t    context;    // what the scores are for, see mdasm_target_cache()
+    uint64_t    capacity;   // entries, a power of 2
+    uint8_t     reserved[40];
+} ScoreCacheHeader;
+
+typedef struct  ScoreCacheEntry
+{
+    uint64_t    key;        // 0: empty, SCORE_CACHE_BUSY: being written
+    int64_t     score;
+    uint8_t     hash[32];   // sha256 of the normalized rows
+} ScoreCacheEntry;
+
+typedef struct  ScoreCache
+{
+    ScoreCacheHeader    *header;
+    ScoreCacheEntry     *entries;
+    uint64_t            mask;
+    size_t              size;
+} ScoreCache;
+
+//! Keys 0 and SCORE_CACHE_BUSY mark free slots
+inline uint64_t scoreCacheKey(uint64_t hash)
+{
+    return hash <= SCORE_CACHE_BUSY ? hash + 2 : hash;
+}
+
+inline void scoreCacheClose(ScoreCache *cache)
+{
+#ifndef _WIN32
+    if (cache->header)
+    {
+        munmap(cache->header, cache->size);
+    }
+#endif
+    cache->header = NULL;
+    cache->entries = NULL;
+}
+
+#ifndef _WIN32
+//! Map a cache file of the right size, or NULL
+inline ScoreCacheHeader *scoreCacheMap(int fd, size_t size)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != size)
+    {
+        return NULL;
+    }
+    void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return mapped == MAP_FAILED ? NULL : (ScoreCacheHeader*)mapped;
+}
+#endif
+
+//! Open the cache file at path for context, creating or replacing it when it
+//! does not match; capacity is rounded up to a power of 2
+inline bool scoreCacheOpen(ScoreCache *cache, const char *path, uint64_t capacity, uint64_t context, std::string *error)
+{
+    scoreCacheClose(cache);
+#ifdef _WIN32
+    *error = "Error: the score cache is not supported on Windows\n";
+    return false;
+#else
+    uint64_t            entries = 1024;
+    ScoreCacheHeader    *header = NULL;
+
+    while (entries < capacity)
+    {
+        entries *= 2;
+    }
+    size_t size = sizeof(ScoreCacheHeader) + entries * sizeof(ScoreCacheEntry);
+
+    int fd = open(path, O_RDWR);
+    if (fd >= 0)
+    {
+        header = scoreCacheMap(fd, size);
+        close(fd);
+        if (header && (memcmp(header->magic, SCORE_CACHE_MAGIC, 4) || header->version != SCORE_CACHE_VERSION
+            || header->context != context || header->capacity != entries))
+        {
+            munmap(header, size);
+            header = NULL;
+        }
+    }
+
+    if (!header)
+    {
+        std::string temp = std::string(path) + "." + std::to_string(getpid());
+
+        fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, size) != 0 || !(header = scoreCacheMap(fd, size)))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+                unlink(temp.c_str());
+            }
+            *error = std::string("Error: Unable to create score cache ") + path + "\n";
+            return false;
+        }
+        close(fd);
+        memcpy(header->magic, SCORE_CACHE_MAGIC, 4);
+        header->version = SCORE_CACHE_VERSION;
+        header->context = context;
+        header->capacity = entries;
+        if (rename(temp.c_str(), path) != 0)
+        {
+            unlink(temp.c_str());   // still usable, just not shared
+        }
+    }
+
+    cache->header = header;
+    cache->entries = (ScoreCacheEntry*)(header + 1);
+    cache->mask = entries - 1;
+    cache->size = size;
+    return true;
+#endif
+}
+
+inline bool scoreCacheFind(const ScoreCache *cache, uint64_t hash, long long *score, uint8_t *objdumpHash)
+{
+    uint64_t key = scoreCacheKey(hash);
+
+    for (uint64_t i = 0; i < SCORE_CACHE_PROBES; i++)
+    {
+        ScoreCacheEntry *entry = &cache->entries[(key + i) & cache->mask];
+        uint64_t        found = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+
+        if (found == key)
+        {
+            *score = entry->score;
+            memcpy(objdumpHash, entry->hash, 32);
+            return true;
+        }
+        if (found == 0)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+//! Add a score, unless the key is already there or its slots are all taken
+inline void scoreCacheInsert(const ScoreCache *cache, uint64_t hash, long long score, const uint8_t *objdumpHash)
+{
+    uint64_t key = scoreCacheKey(hash);
+
+    for (uint64_t i = 0; i < SCORE_CACHE_PROBES; i++)
+    {
+        ScoreCacheEntry *entry = &cache->entries[(key + i) & cache->mask];
+        uint64_t        expected = 0;
+
+        if (__atomic_compare_exchange_n(&entry->key, &expected, SCORE_CACHE_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            entry->score = score;
+            memcpy(entry->hash, objdumpHash, 32);
+            __atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+            return;
+        }
+        if (expected == key)
+        {
+            return;
+        }
+    }
+}
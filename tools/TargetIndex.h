@@ -0,0 +1,314 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Scoring target index (MDasm2 --target-index, mdasm_target_index()): a
+// target normalized once, with everything the scorer looks up in it, so that
+// workers load it by mapping the file instead of disassembling the obj and
+// rebuilding their tables. The file is:
+//
+//  TargetIndexHeader
+//  uint64_t    blockHashes[blockIds]       sorted, see blockHashIds
+//  uint32_t    lineMnemonics[lines]        index in the mnemonic names
+//  uint32_t    rowOffsets[lines + 1]       into strings
+//  uint32_t    b2jStarts[mnemonics + 1]    into b2j
+//  uint32_t    b2j[lines]                  lines of every mnemonic, in order
+//  uint32_t    mnemonicOffsets[mnemonics + 1]
+//  uint32_t    words[words]                for the prefilter, see ObjWords
+//  uint32_t    masks[words]
+//  uint32_t    chunks[chunks]
+//  uint32_t    relocated[relocs]
+//  uint32_t    relocOffsets[relocs + 1]    expressions of relocated
+//  uint32_t    classes[classes]            words of every mnemonic class
+//  uint32_t    blockStarts[blocks + 1]     first line of every block (none
+//                                          without MDASM_BLOCK_DIFF)
+//  uint32_t    blockSeq[blocks]            block id of every block
+//  uint32_t    blockB2jStarts[blockIds + 1]
+//  uint32_t    blockB2j[blocks]
+//  uint32_t    blockHashIds[blockIds]      id of blockHashes[i]
+//  uint8_t     symbols[lines]              has_symbol of every line
+//  char        strings[strings]
+//
+// It is used in place, mapped; all values are little endian.
+
+#define TARGET_INDEX_MAGIC      "MDTI"
+#define TARGET_INDEX_VERSION    1
+
+typedef struct  TargetIndexHeader
+{
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    mdasmVersion;   // of the normalization
+    uint32_t    flags;          // mdasm_add_target() options
+    uint32_t    lines;
+    uint32_t    mnemonics;
+    uint32_t    words;
+    uint32_t    chunks;
+    uint32_t    relocs;
+    uint32_t    classes;
+    uint32_t    blocks;
+    uint32_t    blockIds;
+    uint32_t    strings;
+    uint32_t    reserved;
+    uint64_t    codeHash;       // see objCodeHash()
+    uint64_t    function;       // XXH64 of the function scored, "" for all
+    char        hash[64];       // sha256 of the rows, in hex
+} TargetIndexHeader;
+
+typedef struct  TargetIndex
+{
+    const TargetIndexHeader *header;
+    const uint64_t          *blockHashes;
+    const uint32_t          *lineMnemonics;
+    const uint32_t          *rowOffsets;
+    const uint32_t          *b2jStarts;
+    const uint32_t          *b2j;
+    const uint32_t          *mnemonicOffsets;
+    const uint32_t          *words;
+    const uint32_t          *masks;
+    const uint32_t          *chunks;
+    const uint32_t          *relocated;
+    const uint32_t          *relocOffsets;
+    const uint32_t          *classes;
+    const uint32_t          *blockStarts;
+    const uint32_t          *blockSeq;
+    const uint32_t          *blockB2jStarts;
+    const uint32_t          *blockB2j;
+    const uint32_t          *blockHashIds;
+    const uint8_t           *symbols;
+    const char              *strings;
+} TargetIndex;
+
+//! What targetIndexBuild() writes, the lookup tables are made from it
+typedef struct  TargetIndexSource
+{
+    TargetIndexHeader               header;     // counts are filled in
+    std::vector<std::string_view>   mnemonics;  // names
+    std::vector<uint32_t>           lineMnemonics;
+    std::vector<std::string_view>   rows;
+    std::vector<uint8_t>            symbols;
+    std::vector<uint32_t>           words;
+    std::vector<uint32_t>           masks;
+    std::vector<uint32_t>           chunks;
+    std::vector<uint32_t>           relocated;
+    std::vector<std::string>        relocExprs;
+    std::vector<uint32_t>           classes;
+    std::vector<uint32_t>           blockStarts;
+    std::vector<uint64_t>           blockHashes;    // of every block
+} TargetIndexSource;
+
+inline void targetIndexAppend(std::string *out, const void *data, size_t size)
+{
+    out->append((const char*)data, size);
+}
+
+template<typename T>
+void targetIndexAppend(std::string *out, const std::vector<T> &values)
+{
+    out->append((const char*)values.data(), values.size() * sizeof(T));
+}
+
+//! Offsets of strings appended to a string table, then its end
+template<typename S>
+std::vector<uint32_t> targetIndexStrings(const std::vector<S> &strings, std::string *table)
+{
+    std::vector<uint32_t> offsets;
+
+    for (const S &s : strings)
+    {
+        offsets.push_back((uint32_t)table->size());
+        table->append(s.data(), s.size());
+    }
+    offsets.push_back((uint32_t)table->size());
+    return offsets;
+}
+
+//! Positions of every id in a sequence of ids below count: starts[count + 1]
+//! into positions[]
+inline void targetIndexB2j(const std::vector<uint32_t> &seq, uint32_t count, std::vector<uint32_t> *starts, std::vector<uint32_t> *positions)
+{
+    starts->assign(count + 1, 0);
+    positions->resize(seq.size());
+    for (uint32_t id : seq)
+    {
+        (*starts)[id + 1]++;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        (*starts)[i + 1] += (*starts)[i];
+    }
+    std::vector<uint32_t> next(starts->begin(), starts->end() - 1);
+    for (uint32_t j = 0; j < seq.size(); j++)
+    {
+        (*positions)[next[seq[j]]++] = j;
+    }
+}
+
+inline void targetIndexBuild(const TargetIndexSource *source, std::string *out)
+{
+    TargetIndexHeader                   header = source->header;
+    std::string                         strings;
+    std::vector<uint32_t>               b2jStarts, b2j, blockSeq, blockB2jStarts, blockB2j, blockHashIds;
+    std::vector<std::pair<uint64_t, uint32_t>>  blockIds;
+    std::unordered_map<uint64_t, uint32_t>      ids;
+
+    for (uint64_t hash : source->blockHashes)
+    {
+        auto id = ids.emplace(hash, (uint32_t)ids.size()).first;
+        if (id->second == blockIds.size())
+        {
+            blockIds.push_back({ hash, id->second });
+        }
+        blockSeq.push_back(id->second);
+    }
+    std::sort(blockIds.begin(), blockIds.end());
+
+    memcpy(header.magic, TARGET_INDEX_MAGIC, 4);
+    header.version = TARGET_INDEX_VERSION;
+    header.lines = (uint32_t)source->lineMnemonics.size();
+    header.mnemonics = (uint32_t)source->mnemonics.size();
+    header.words = (uint32_t)source->words.size();
+    header.chunks = (uint32_t)source->chunks.size();
+    header.relocs = (uint32_t)source->relocated.size();
+    header.classes = (uint32_t)source->classes.size();
+    header.blocks = (uint32_t)source->blockHashes.size();
+    header.blockIds = (uint32_t)blockIds.size();
+    header.reserved = 0;
+
+    std::vector<uint32_t> rowOffsets = targetIndexStrings(source->rows, &strings);
+    std::vector<uint32_t> mnemonicOffsets = targetIndexStrings(source->mnemonics, &strings);
+    std::vector<uint32_t> relocOffsets = targetIndexStrings(source->relocExprs, &strings);
+    header.strings = (uint32_t)strings.size();
+    targetIndexB2j(source->lineMnemonics, header.mnemonics, &b2jStarts, &b2j);
+    targetIndexB2j(blockSeq, header.blockIds, &blockB2jStarts, &blockB2j);
+
+    out->clear();
+    targetIndexAppend(out, &header, sizeof(header));
+    for (const auto &id : blockIds)
+    {
+        targetIndexAppend(out, &id.first, 8);
+    }
+    targetIndexAppend(out, source->lineMnemonics);
+    targetIndexAppend(out, rowOffsets);
+    targetIndexAppend(out, b2jStarts);
+    targetIndexAppend(out, b2j);
+    targetIndexAppend(out, mnemonicOffsets);
+    targetIndexAppend(out, source->words);
+    targetIndexAppend(out, source->masks);
+    targetIndexAppend(out, source->chunks);
+    targetIndexAppend(out, source->relocated);
+    targetIndexAppend(out, relocOffsets);
+    targetIndexAppend(out, source->classes);
+    targetIndexAppend(out, source->blockStarts);
+    targetIndexAppend(out, blockSeq);
+    targetIndexAppend(out, blockB2jStarts);
+    targetIndexAppend(out, blockB2j);
+    for (const auto &id : blockIds)
+    {
+        targetIndexAppend(out, &id.second, 4);
+    }
+    targetIndexAppend(out, source->symbols);
+    out->append(strings);
+}
+
+//! Offsets are in order and inside of the string table
+inline bool targetIndexOffsetsOk(const uint32_t *offsets, uint32_t count, uint32_t end)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (offsets[i] > offsets[i + 1])
+        {
+            return false;
+        }
+    }
+    return offsets[count] <= end;
+}
+
+inline bool targetIndexIdsOk(const uint32_t *ids, uint32_t count, uint32_t end)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (ids[i] >= end)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Check an index file and point index into it; buffer must be 8 byte aligned
+inline bool targetIndexOpen(const uint8_t *buffer, size_t size, TargetIndex *index)
+{
+    const TargetIndexHeader *h = (const TargetIndexHeader*)buffer;
+
+    if (size < sizeof(TargetIndexHeader) || memcmp(h->magic, TARGET_INDEX_MAGIC, 4) || h->version != TARGET_INDEX_VERSION)
+    {
+        return false;
+    }
+
+    uint64_t blockStarts = h->blocks ? (uint64_t)h->blocks + 1 : 0;
+    uint64_t u32s = (uint64_t)h->lines * 3 + 1 + ((uint64_t)h->mnemonics + 1) * 2 + (uint64_t)h->words * 2 + h->chunks
+        + (uint64_t)h->relocs * 2 + 1 + h->classes + blockStarts + (uint64_t)h->blocks * 2 + (uint64_t)h->blockIds * 2 + 1;
+    if (size != sizeof(TargetIndexHeader) + (uint64_t)h->blockIds * 8 + u32s * 4 + h->lines + h->strings)
+    {
+        return false;
+    }
+
+    index->header = h;
+    index->blockHashes = (const uint64_t*)(h + 1);
+    index->lineMnemonics = (const uint32_t*)(index->blockHashes + h->blockIds);
+    index->rowOffsets = index->lineMnemonics + h->lines;
+    index->b2jStarts = index->rowOffsets + h->lines + 1;
+    index->b2j = index->b2jStarts + h->mnemonics + 1;
+    index->mnemonicOffsets = index->b2j + h->lines;
+    index->words = index->mnemonicOffsets + h->mnemonics + 1;
+    index->masks = index->words + h->words;
+    index->chunks = index->masks + h->words;
+    index->relocated = index->chunks + h->chunks;
+    index->relocOffsets = index->relocated + h->relocs;
+    index->classes = index->relocOffsets + h->relocs + 1;
+    index->blockStarts = index->classes + h->classes;
+    index->blockSeq = index->blockStarts + blockStarts;
+    index->blockB2jStarts = index->blockSeq + h->blocks;
+    index->blockB2j = index->blockB2jStarts + h->blockIds + 1;
+    index->blockHashIds = index->blockB2j + h->blocks;
+    index->symbols = (const uint8_t*)(index->blockHashIds + h->blockIds);
+    index->strings = (const char*)(index->symbols + h->lines);
+
+    // Everything that is followed when scoring stays inside of the file
+    return targetIndexOffsetsOk(index->rowOffsets, h->lines, h->strings)
+        && targetIndexOffsetsOk(index->mnemonicOffsets, h->mnemonics, h->strings)
+        && targetIndexOffsetsOk(index->relocOffsets, h->relocs, h->strings)
+        && targetIndexOffsetsOk(index->b2jStarts, h->mnemonics, h->lines)
+        && targetIndexOffsetsOk(index->blockB2jStarts, h->blockIds, h->blocks)
+        && (!h->blocks || targetIndexOffsetsOk(index->blockStarts, h->blocks, h->lines))
+        && (!h->blocks || index->blockStarts[h->blocks] == h->lines)
+        && targetIndexIdsOk(index->lineMnemonics, h->lines, h->mnemonics)
+        && targetIndexIdsOk(index->b2j, h->lines, h->lines)
+        && targetIndexIdsOk(index->blockSeq, h->blocks, h->blockIds)
+        && targetIndexIdsOk(index->blockB2j, h->blocks, h->blocks)
+        && targetIndexIdsOk(index->blockHashIds, h->blockIds, h->blockIds)
+        && targetIndexIdsOk(index->relocated, h->relocs, h->words);
+}
+
+inline std::string_view targetIndexString(const TargetIndex *index, const uint32_t *offsets, uint32_t i)
+{
+    return std::string_view(index->strings + offsets[i], offsets[i + 1] - offsets[i]);
+}
+
+//! Id of a block hash, or header->blockIds when the target has no such block
+inline uint32_t targetIndexBlockId(const TargetIndex *index, uint64_t hash)
+{
+    const uint64_t *end = index->blockHashes + index->header->blockIds;
+    const uint64_t *found = std::lower_bound(index->blockHashes, end, hash);
+
+    return found != end && *found == hash ? index->blockHashIds[found - index->blockHashes] : index->header->blockIds;
+}
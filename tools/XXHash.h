@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// XXH64 (https://github.com/Cyan4973/xxHash), streaming, for hashing obj
+// contents piece by piece without copying them together first.
+
+#define XXH_PRIME64_1   0x9e3779b185ebca87ull
+#define XXH_PRIME64_2   0xc2b2ae3d27d4eb4full
+#define XXH_PRIME64_3   0x165667b19e3779f9ull
+#define XXH_PRIME64_4   0x85ebca77c2b2ae63ull
+#define XXH_PRIME64_5   0x27d4eb2f165667c5ull
+
+typedef struct  XXHash64
+{
+    uint64_t    v[4];
+    uint64_t    seed;
+    uint64_t    size;
+    uint8_t     buffer[32];
+    uint32_t    buffered;
+} XXHash64;
+
+inline uint64_t xxhRotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t xxhRead64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);   // little endian hosts only, like the rest of MDasm2
+    return v;
+}
+
+inline uint32_t xxhRead32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    return xxhRotl(acc, 31) * XXH_PRIME64_1;
+}
+
+inline uint64_t xxhMerge(uint64_t acc, uint64_t v)
+{
+    acc ^= xxhRound(0, v);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+inline void xxhInit(XXHash64 *h, uint64_t seed)
+{
+    h->v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    h->v[1] = seed + XXH_PRIME64_2;
+    h->v[2] = seed;
+    h->v[3] = seed - XXH_PRIME64_1;
+    h->seed = seed;
+    h->size = 0;
+    h->buffered = 0;
+}
+
+inline void xxhUpdate(XXHash64 *h, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    const uint8_t *end = p + size;
+
+    h->size += size;
+    if (h->buffered + size < 32)
+    {
+        memcpy(h->buffer + h->buffered, p, size);
+        h->buffered += (uint32_t)size;
+        return;
+    }
+    if (h->buffered)
+    {
+        memcpy(h->buffer + h->buffered, p, 32 - h->buffered);
+        p += 32 - h->buffered;
+        for (int i = 0; i < 4; i++)
+        {
+            h->v[i] = xxhRound(h->v[i], xxhRead64(h->buffer + i * 8));
+        }
+        h->buffered = 0;
+    }
+    for (; p + 32 <= end; p += 32)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            h->v[i] = xxhRound(h->v[i], xxhRead64(p + i * 8));
+        }
+    }
+    memcpy(h->buffer, p, end - p);
+    h->buffered = (uint32_t)(end - p);
+}
+
+inline uint64_t xxhDigest(const XXHash64 *h)
+{
+    const uint8_t   *p = h->buffer;
+    const uint8_t   *end = p + h->buffered;
+    uint64_t        hash;
+
+    if (h->size >= 32)
+    {
+        hash = xxhRotl(h->v[0], 1) + xxhRotl(h->v[1], 7) + xxhRotl(h->v[2], 12) + xxhRotl(h->v[3], 18);
+        for (int i = 0; i < 4; i++)
+        {
+            hash = xxhMerge(hash, h->v[i]);
+        }
+    }
+    else
+    {
+        hash = h->seed + XXH_PRIME64_5;
+    }
+    hash += h->size;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        hash ^= xxhRound(0, xxhRead64(p));
+        hash = xxhRotl(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end)
+    {
+        hash ^= xxhRead32(p) * XXH_PRIME64_1;
+        hash = xxhRotl(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        hash ^= *p * XXH_PRIME64_5;
+        hash = xxhRotl(hash, 11) * XXH_PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+inline uint64_t xxh64(const void *data, size_t size, uint64_t seed)
+{
+    XXHash64 h;
+
+    xxhInit(&h, seed);
+    xxhUpdate(&h, data, size);
+    return xxhDigest(&h);
+}
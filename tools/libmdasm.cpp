@@ -0,0 +1,2662 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mdasm.h"
+#include "ExeIndex.h"
+#include "Prefilter.h"
+#include "PsxExe.h"
+#include "PsyqAsm.h"
+#include "PsyqLib.h"
+#include "PsyqObj.h"
+#include "R3000.h"
+#include "ScoreCache.h"
+#include "TargetIndex.h"
+#include "XXHash.h"
+
+// The obj parser, disassembler and scorer of MDasm2, behind the C API of
+// mdasm.h. MDasm2.cpp is the command line and server on top of it.
+
+// linux:
+// g++ libmdasm.cpp -shared -fPIC -pthread -olibmdasm.so -O3 -march=x86-64-v2
+
+// linux -> windows
+// x86_64-w64-mingw32-g++ libmdasm.cpp -shared -lssp -pthread -omdasm.dll -O3 -march=x86-64-v2 -static
+
+namespace
+{
+
+typedef unsigned char BYTE;
+
+typedef struct  Params
+{
+    bool        offsets;
+    bool        bytes;
+    bool        reloc;
+    bool        normalized;
+    bool        binary;
+} Params;
+
+// The state of a disassembly is per thread, so that mdasm_disassemble_exe()
+// can run one per worker. Scoring state (targets, mnemonic ids) is shared.
+thread_local Params g_params = {};
+
+// Only disassemble this function (mdasm_set_function), or the whole obj
+std::string     g_function;
+
+// Output of the current call, kept between calls so that it is not
+// reallocated for every obj file
+thread_local std::string    g_output;
+thread_local std::string    g_error;
+
+//! Thrown by fatal() and unsupported(), the message is in g_error
+struct          RequestError
+{
+    int         status = MDASM_ERROR;
+};
+
+thread_local PsyqObject     g_obj;
+
+// Assembler of the objs that are CC1PSX's output, and its -G (mdasm_set_gp_size)
+thread_local PsyqAsm        g_asm;
+int             g_gpSize = 8;
+
+//! printf to the output of the current call
+void output(const char *fmt, ...)
+{
+    va_list args;
+    char    line[1024];
+    va_list copy;
+
+    va_start(args, fmt);
+    va_copy(copy, args);
+    int len = vsnprintf(line, sizeof(line), fmt, copy);
+    va_end(copy);
+    if (len < (int)sizeof(line))
+    {
+        g_output.append(line, len);
+    }
+    else
+    {
+        size_t start = g_output.size();
+        g_output.resize(start + len + 1);
+        vsnprintf(&g_output[start], len + 1, fmt, args);
+        g_output.resize(start + len);
+    }
+    va_end(args);
+}
+
+//! Raw bytes to the output of the current call
+void outputBytes(const void *data, size_t size)
+{
+    g_output.append((const char*)data, size);
+}
+
+//! Fail the current call
+void fatal(const char *fmt, ...)
+{
+    va_list args;
+    char    line[1024];
+
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    g_error = line;
+    throw RequestError();
+}
+
+//! Fail the current call with MDASM_UNSUPPORTED: the caller normalizes this
+//! obj in Python instead
+void unsupported(const char *fmt, ...)
+{
+    va_list args;
+    char    line[1024];
+
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    g_error = line;
+    throw RequestError{ MDASM_UNSUPPORTED };
+}
+
+//! Binary output (--binary), version 2, all little-endian:
+//!   BinaryHeader
+//!   opCount     x BinaryOp      mnemonic and R3000Format of every op id
+//!   chunkCount  x BinaryChunk   code and data chunks, records [first, first + count)
+//!   relocCount  x BinaryReloc
+//!   nameCount   x u32           "function name:" strings
+//!   recordCount x BinaryRecord  one per instruction, at address 4 * (index - chunk first)
+//!   stringsSize bytes           NUL terminated strings, referenced by offset
+#define BINARY_MAGIC    "MDB\x1a"
+#define BINARY_VERSION  2
+#define BINARY_NONE     0xffff
+
+//! BinaryChunk flags
+#define BINARY_CHUNK_DATA   1   // .word records, a relocation replaces the value
+
+typedef struct  BinaryHeader
+{
+    char        magic[4];
+    uint16_t    version;
+    uint16_t    recordSize;
+    uint32_t    opCount;
+    uint32_t    chunkCount;
+    uint32_t    relocCount;
+    uint32_t    nameCount;
+    uint32_t    recordCount;
+    uint32_t    stringsSize;
+} BinaryHeader;
+
+typedef struct  BinaryOp
+{
+    uint32_t    name;
+    uint8_t     format;
+    uint8_t     flags;
+    uint16_t    pad;
+} BinaryOp;
+
+typedef struct  BinaryChunk
+{
+    uint32_t    first;
+    uint32_t    count;
+    uint32_t    flags;
+} BinaryChunk;
+
+typedef struct  BinaryReloc
+{
+    uint32_t    expr;
+    uint32_t    type;
+    uint32_t    name;
+} BinaryReloc;
+
+typedef struct  BinaryRecord
+{
+    uint32_t    word;
+    uint8_t     op;
+    uint8_t     rs;
+    uint8_t     rt;
+    uint8_t     rd;
+    uint8_t     sa;
+    uint8_t     pad;
+    uint16_t    reloc;  // index in the reloc table, or BINARY_NONE
+    int32_t     imm;
+} BinaryRecord;
+
+static_assert(sizeof(BinaryHeader) == 32 && sizeof(BinaryOp) == 8 && sizeof(BinaryChunk) == 12 && sizeof(BinaryRecord) == 16, "binary layout");
+
+typedef struct  BinaryOutput
+{
+    std::vector<BinaryChunk>    chunks;
+    std::vector<BinaryReloc>    relocs;
+    std::vector<uint32_t>       names;
+    std::vector<BinaryRecord>   records;
+    std::string                 strings;
+} BinaryOutput;
+
+thread_local BinaryOutput   g_binary;
+
+void resetBinary(void)
+{
+    g_binary.chunks.clear();
+    g_binary.relocs.clear();
+    g_binary.names.clear();
+    g_binary.records.clear();
+    g_binary.strings.clear();
+}
+
+uint32_t binaryString(const std::string &s)
+{
+    uint32_t offset = g_binary.strings.size();
+    g_binary.strings.append(s.c_str(), s.size() + 1);
+    return offset;
+}
+
+void binaryName(const std::string &name)
+{
+    g_binary.names.push_back(binaryString(name));
+}
+
+uint16_t binaryReloc(const PsyqReloc *reloc)
+{
+    g_binary.relocs.push_back({ binaryString(psyqRelocExpr(&g_obj, reloc)), binaryString(psyqRelocTypeName(reloc->type)), binaryString(std::string(psyqInterned(&g_obj, reloc->symbol))) });
+    return g_binary.relocs.size() - 1;
+}
+
+void writeBinary(void)
+{
+    std::vector<BinaryOp>   ops(R3000_OP_COUNT);
+    BinaryHeader            header;
+
+    for (int i = 0; i < R3000_OP_COUNT; i++)
+    {
+        ops[i].name = binaryString(g_r3000Ops[i].name);
+        ops[i].format = g_r3000Ops[i].format;
+        ops[i].flags = g_r3000Ops[i].flags;
+        ops[i].pad = 0;
+    }
+
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.recordSize = sizeof(BinaryRecord);
+    header.opCount = ops.size();
+    header.chunkCount = g_binary.chunks.size();
+    header.relocCount = g_binary.relocs.size();
+    header.nameCount = g_binary.names.size();
+    header.recordCount = g_binary.records.size();
+    header.stringsSize = g_binary.strings.size();
+
+    outputBytes(&header, sizeof(header));
+    outputBytes(ops.data(), ops.size() * sizeof(BinaryOp));
+    outputBytes(g_binary.chunks.data(), g_binary.chunks.size() * sizeof(BinaryChunk));
+    outputBytes(g_binary.relocs.data(), g_binary.relocs.size() * sizeof(BinaryReloc));
+    outputBytes(g_binary.names.data(), g_binary.names.size() * sizeof(uint32_t));
+    outputBytes(g_binary.records.data(), g_binary.records.size() * sizeof(BinaryRecord));
+    outputBytes(g_binary.strings.data(), g_binary.strings.size());
+}
+
+//! Parse an LNK obj, or assemble CC1PSX's output into one
+void parsePsyqObj(const BYTE *buffer, size_t size)
+{
+    bool parsed = psyqIsAssembly(buffer, size) ? psyqAssemble(&g_asm, &g_obj, (const char*)buffer, size, g_gpSize) : psyqParse(&g_obj, buffer, size);
+
+    if (!parsed)
+    {
+        fatal("%s", g_obj.error.c_str());
+    }
+}
+
+void outputFunctionName(std::string_view name)
+{
+    if (g_params.binary)
+    {
+        binaryName(std::string(name));
+    }
+    else if (!g_params.normalized)
+    {
+        output("function name: %.*s\n", (int)name.size(), name.data());
+    }
+}
+
+//! Scorer normalization (--normalized). Reproduces simplify_objdump() from
+//! src/objdump.py for the MIPS settings on the lines printed in PERMUTER mode,
+//! so that it gives exactly the same Line(row, mnemonic, has_symbol) values.
+typedef struct  Normalizer
+{
+    bool        stackDifferences;   // stack_differences
+    bool        branchTargets;      // !ign_branch_targets
+    bool        blDelaySlots;       // !skip_bl_delay_slots
+    bool        skipNext;
+    int         nops;
+} Normalizer;
+
+thread_local Normalizer     g_normalizer = {};
+
+const char      *g_branchLikelyInstructions[] = {
+    "beql", "bnel", "beqzl", "bnezl", "bgezl", "bgtzl", "blezl", "bltzl", "bc1tl", "bc1fl", NULL
+};
+
+const char      *g_branchInstructions[] = {
+    "b", "j", "beq", "bne", "beqz", "bnez", "bgez", "bgtz", "blez", "bltz", "bc1t", "bc1f", NULL
+};
+
+bool isInList(const std::string &s, const char **list)
+{
+    for (int i = 0; list[i]; i++)
+    {
+        if (s == list[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//! str.isspace() for ASCII
+bool isPySpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r') || (c >= 0x1c && c <= 0x1f);
+}
+
+//! \w for ASCII
+bool isWordChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+std::string strip(const std::string &s, bool left, bool right)
+{
+    size_t start = 0;
+    size_t end = s.size();
+
+    while (left && start < end && isPySpace(s[start]))
+    {
+        start++;
+    }
+    while (right && end > start && isPySpace(s[end - 1]))
+    {
+        end--;
+    }
+    return s.substr(start, end - start);
+}
+
+//! re.sub(r"<.*?>", "", row)
+std::string removeComments(const std::string &row)
+{
+    std::string result;
+    size_t      i = 0;
+
+    while (i < row.size())
+    {
+        size_t close;
+        if (row[i] == '<' && (close = row.find('>', i + 1)) != std::string::npos)
+        {
+            i = close + 1;
+            continue;
+        }
+        result += row[i++];
+    }
+    return result;
+}
+
+//! re.search(r"\b(sp|s8)\b", args)
+bool includesSp(const std::string &args)
+{
+    for (size_t i = 0; i + 1 < args.size(); i++)
+    {
+        if (args[i] == 's' && (args[i + 1] == 'p' || args[i + 1] == '8') &&
+            (i == 0 || !isWordChar(args[i - 1])) &&
+            (i + 2 == args.size() || !isWordChar(args[i + 2])))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//! re.sub(r"\b[0-9]+\b", "imm", row)
+std::string replaceImmediates(const std::string &row)
+{
+    std::string result;
+    size_t      i = 0;
+
+    while (i < row.size())
+    {
+        if (isDigit(row[i]) && (i == 0 || !isWordChar(row[i - 1])))
+        {
+            size_t end = i;
+            while (end < row.size() && isDigit(row[end]))
+            {
+                end++;
+            }
+            if (end == row.size() || !isWordChar(row[end]))
+            {
+                result += "imm";
+            }
+            else
+            {
+                result.append(row, i, end - i);
+            }
+            i = end;
+            continue;
+        }
+        result += row[i++];
+    }
+    return result;
+}
+
+//! re.sub(re_int, fn, row): multi-digit decimal numbers not touching a letter
+//! or '_' are converted to hex
+std::string decimalToHex(const std::string &row)
+{
+    std::string result;
+    size_t      i = 0;
+
+    while (i < row.size())
+    {
+        if (!isDigit(row[i]))
+        {
+            result += row[i++];
+            continue;
+        }
+
+        size_t end = i;
+        while (end < row.size() && isDigit(row[end]))
+        {
+            end++;
+        }
+        if (end - i <= 1 ||
+            (i && (isalpha((unsigned char)row[i - 1]) || row[i - 1] == '_')) ||
+            (end < row.size() && (isalpha((unsigned char)row[end]) || row[end] == '_')))
+        {
+            result.append(row, i, end - i);
+        }
+        else
+        {
+            size_t  first = i;
+            char    hex[32];
+
+            while (first < end - 1 && row[first] == '0')
+            {
+                first++;
+            }
+            if (end - first > 19)
+            {
+                unsupported("Unsupported: decimal number too large in '%s'\n", row.c_str());
+            }
+            snprintf(hex, sizeof(hex), "0x%llx", strtoull(row.substr(first, end - first).c_str(), NULL, 10));
+            result += hex;
+        }
+        i = end;
+    }
+    return result;
+}
+
+//! re.sub(r"(?<=,)([0-9]+|0x[0-9a-f]+)\((sp|s8)\)", "addr(sp)", row)
+std::string replaceStackOffsets(const std::string &row)
+{
+    std::string result;
+    size_t      i = 0;
+
+    while (i < row.size())
+    {
+        if (i && row[i - 1] == ',')
+        {
+            size_t end = i;
+            if (row.compare(i, 2, "0x") == 0 && i + 2 < row.size() && isxdigit((unsigned char)row[i + 2]) && !isupper((unsigned char)row[i + 2]))
+            {
+                end = i + 2;
+                while (end < row.size() && (isDigit(row[end]) || (row[end] >= 'a' && row[end] <= 'f')))
+                {
+                    end++;
+                }
+            }
+            else
+            {
+                while (end < row.size() && isDigit(row[end]))
+                {
+                    end++;
+                }
+            }
+            if (end > i && (row.compare(end, 4, "(sp)") == 0 || row.compare(end, 4, "(s8)") == 0))
+            {
+                result += "addr(sp)";
+                i = end + 4;
+                continue;
+            }
+        }
+        result += row[i++];
+    }
+    return result;
+}
+
+//! A normalized line, kept in memory for scoring
+typedef struct  ScoreLine
+{
+    int         mnemonic;   // interned, see internMnemonic()
+    bool        hasSymbol;
+    std::string row;
+} ScoreLine;
+
+// When set, normalized lines are collected here instead of being printed
+thread_local std::vector<ScoreLine>  *g_scoreLines = NULL;
+
+std::unordered_map<std::string, int>    g_mnemonicIds;
+std::vector<std::string>                g_mnemonicNames;    // id -> mnemonic
+
+int internMnemonic(const std::string &mnemonic)
+{
+    auto it = g_mnemonicIds.find(mnemonic);
+    if (it != g_mnemonicIds.end())
+    {
+        return it->second;
+    }
+    int id = (int)g_mnemonicIds.size();
+    g_mnemonicIds.emplace(mnemonic, id);
+    g_mnemonicNames.push_back(mnemonic);
+    return id;
+}
+
+void emitNormalized(const std::string &mnemonic, const std::string &row)
+{
+    if (g_scoreLines)
+    {
+        g_scoreLines->push_back({ internMnemonic(mnemonic), false, row });
+        return;
+    }
+    output("%s\t0\t%s\n", mnemonic.c_str(), row.c_str());
+}
+
+//! Normalize one line of disassembly, as printed with offsets and bytes
+void normalizeLine(const char *line)
+{
+    Normalizer  *n = &g_normalizer;
+    std::string row = strip(line, false, true);
+
+    if (row.empty() || row.find(">:") != std::string::npos)
+    {
+        return;
+    }
+
+    row = strip(removeComments(row), false, true);
+
+    // "\t".join(row.split("\t")[2:])
+    size_t tab = row.find('\t');
+    tab = tab == std::string::npos ? tab : row.find('\t', tab + 1);
+    if (tab == std::string::npos)
+    {
+        return;
+    }
+    row.erase(0, tab + 1);
+    if (row.empty())
+    {
+        return;
+    }
+
+    std::string mnemonic;
+    std::string args;
+    size_t      sep = row.find('\t');
+    if (sep != std::string::npos)
+    {
+        mnemonic = strip(row.substr(0, sep), true, true);
+        args = strip(row.substr(sep + 1), true, true);
+    }
+    else
+    {
+        sep = row.find(' ');
+        mnemonic = strip(row.substr(0, sep), true, true);
+        args = sep == std::string::npos ? "" : strip(row.substr(sep + 1), true, true);
+    }
+
+    row = mnemonic + "\t";
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        if (args[i] == '\t')
+        {
+            row += "  ";
+        }
+        else
+        {
+            row += args[i];
+        }
+    }
+
+    if (row.find("R_MIPS_") != std::string::npos)
+    {
+        unsupported("Unsupported: relocation row '%s'\n", row.c_str());
+    }
+
+    if (n->skipNext)
+    {
+        n->skipNext = false;
+        row = "<skipped>";
+    }
+
+    if (!n->stackDifferences && mnemonic == "addiu" && includesSp(args))
+    {
+        row = replaceImmediates(row);
+    }
+    if (isInList(mnemonic, g_branchInstructions) || isInList(mnemonic, g_branchLikelyInstructions))
+    {
+        if (!n->branchTargets)
+        {
+            size_t comma = args.rfind(',');
+            row = mnemonic + "\t" + (comma == std::string::npos ? "" : args.substr(0, comma + 1)) + "<target>";
+        }
+        // The last part is in hex, so skip the dec->hex conversion
+    }
+    else
+    {
+        row = decimalToHex(row);
+    }
+    if (isInList(mnemonic, g_branchLikelyInstructions) && !n->blDelaySlots)
+    {
+        n->skipNext = true;
+    }
+    if (!n->stackDifferences)
+    {
+        row = replaceStackOffsets(row);
+    }
+
+    if (row == "nop")
+    {
+        // strip trailing nops; padding is irrelevant to us
+        n->nops++;
+    }
+    else
+    {
+        for (; n->nops; n->nops--)
+        {
+            emitNormalized("nop", "nop");
+        }
+        emitNormalized(mnemonic, row);
+    }
+}
+
+//! Disassemble the instructions in bytes [start, end) of a code chunk, at
+//! addresses offset - origin
+int disassemble(const PsyqCode *code, uint32_t start, uint32_t end, uint32_t origin)
+{
+    R3000Insn   insn;
+    uint32_t    offset;
+
+    for (offset = start; offset + 4 <= end; offset += 4)
+    {
+        uint32_t    address = offset - origin;
+        const BYTE  *bytes = code->data + offset;
+        const PsyqReloc *reloc = psyqFindReloc(&g_obj, code, offset);
+        const char  *mnemonic;
+        char        ops[64];
+        char        line[1024];
+        int         len = 0;
+
+        r3000Decode(bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24, &insn);
+        if (g_params.binary)
+        {
+            BinaryRecord record = { insn.word, insn.op, insn.rs, insn.rt, insn.rd, insn.sa, 0, BINARY_NONE, insn.imm };
+            if (reloc)
+            {
+                record.reloc = binaryReloc(reloc);
+            }
+            g_binary.records.push_back(record);
+            continue;
+        }
+
+        int opsLen = r3000Format(&insn, address, &mnemonic, ops, sizeof(ops));
+
+        if (g_params.offsets || g_params.normalized)
+        {
+            len += snprintf(line + len, sizeof(line) - len, "%4x:\t", address);
+        }
+        if (g_params.bytes || g_params.normalized)
+        {
+            len += snprintf(line + len, sizeof(line) - len, "%08X\t", insn.word);
+        }
+        bool needReplace = reloc /*&& mnemonic[0] == 'j' && ops[0] == '0'*/;
+        if (needReplace && opsLen > 0 && ops[opsLen - 1] == '0')
+        {
+            len += snprintf(line + len, sizeof(line) - len, "%s\t%.*s%s", mnemonic, opsLen - 1, ops, psyqRelocExpr(&g_obj, reloc).c_str());
+        }
+        else
+        {
+            len += snprintf(line + len, sizeof(line) - len, "%s\t%s", mnemonic, ops);
+            if (needReplace)
+            {
+                snprintf(line + len, sizeof(line) - len, " <%s>", psyqRelocExpr(&g_obj, reloc).c_str());
+            }
+        }
+
+        if (g_params.normalized)
+        {
+            normalizeLine(line);
+            continue;
+        }
+        output("%s", line);
+
+        if (reloc && g_params.reloc)
+        {
+            std::string_view name = psyqInterned(&g_obj, reloc->symbol);
+            output("\n\t\t\t%x: %s %.*s", address, psyqRelocTypeName(reloc->type), (int)name.size(), name.data());
+        }
+        output("\n");
+    }
+
+    if (start + 4 > end && !g_params.normalized && !g_params.binary)
+    {
+        output("ERROR: Failed to disassemble given code!\n");
+    }
+
+    return 0;
+}
+
+//! Data chunks are compared as raw words: one .word row per word, the last
+//! one padded with zeros, or the relocation's expression instead of the value
+void dumpData(const PsyqCode *code)
+{
+    for (uint32_t offset = 0; offset < code->size; offset += 4)
+    {
+        const PsyqReloc *reloc = psyqFindReloc(&g_obj, code, offset);
+        uint32_t        word = 0;
+        char            line[1024];
+        int             len = 0;
+
+        memcpy(&word, code->data + offset, std::min<uint32_t>(4, code->size - offset));
+        if (g_params.binary)
+        {
+            BinaryRecord record = { word, R3000_INVALID, 0, 0, 0, 0, 0, BINARY_NONE, 0 };
+            if (reloc)
+            {
+                record.reloc = binaryReloc(reloc);
+            }
+            g_binary.records.push_back(record);
+            continue;
+        }
+
+        if (g_params.offsets || g_params.normalized)
+        {
+            len += snprintf(line + len, sizeof(line) - len, "%4x:\t", offset);
+        }
+        if (g_params.bytes || g_params.normalized)
+        {
+            len += snprintf(line + len, sizeof(line) - len, "%08X\t", word);
+        }
+        if (reloc)
+        {
+            snprintf(line + len, sizeof(line) - len, ".word\t%s", psyqRelocExpr(&g_obj, reloc).c_str());
+        }
+        else
+        {
+            snprintf(line + len, sizeof(line) - len, ".word\t0x%08x", word);
+        }
+
+        if (g_params.normalized)
+        {
+            normalizeLine(line);
+            continue;
+        }
+        output("%s\n", line);
+    }
+}
+
+void beginChunk(uint32_t words, uint32_t flags)
+{
+    if (g_params.binary)
+    {
+        g_binary.chunks.push_back({ (uint32_t)g_binary.records.size(), words, flags });
+    }
+    else if (!g_params.normalized)
+    {
+        output("------------------------------\n");
+    }
+}
+
+//! Disassemble one chunk of code or dump one chunk of data, its addresses
+//! start at 0
+void disassembleChunk(const PsyqCode *code)
+{
+    if (!psyqIsText(&g_obj, code->section))
+    {
+        beginChunk((code->size + 3) / 4, BINARY_CHUNK_DATA);
+        dumpData(code);
+        return;
+    }
+    beginChunk(code->size / 4, 0);
+    disassemble(code, 0, code->size, 0);
+}
+
+//! Disassemble only the text of g_function, as one chunk starting at 0
+void disassembleFunction(void)
+{
+    PsyqRange   range;
+    uint32_t    words = 0;
+
+    if (!psyqFindFunction(&g_obj, g_function, &range))
+    {
+        fatal("Error: function %s not found\n", g_function.c_str());
+    }
+
+    outputFunctionName(g_function);
+    for (const PsyqCode &code : g_obj.codes)
+    {
+        if (code.section == range.section && code.offset < range.end && code.offset + code.size > range.start)
+        {
+            uint32_t start = std::max(range.start, code.offset) - code.offset;
+            uint32_t end = std::min(range.end, code.offset + code.size) - code.offset;
+            words += (end - start) / 4;
+        }
+    }
+    beginChunk(words, 0);
+    for (const PsyqCode &code : g_obj.codes)
+    {
+        if (code.section == range.section && code.offset < range.end && code.offset + code.size > range.start)
+        {
+            uint32_t start = std::max(range.start, code.offset) - code.offset;
+            uint32_t end = std::min(range.end, code.offset + code.size) - code.offset;
+            disassemble(&code, start, end, range.start - code.offset);
+        }
+    }
+}
+
+//! Disassemble one range of an executable image at its addresses
+void disassembleRange(const PsyqCode *image, uint32_t base, const MdasmRange *range)
+{
+    uint32_t end = range->end ? range->end : base + image->size;
+
+    if (range->start < base || end > base + image->size || end < range->start)
+    {
+        fatal("Error: %s (0x%x-0x%x) is outside of the executable (0x%x-0x%x)\n", range->name, range->start, end, base, base + image->size);
+    }
+
+    g_normalizer.skipNext = false;
+    g_normalizer.nops = 0;
+    output("function name: %s\n", range->name);
+    beginChunk((end - range->start) / 4, 0);
+    disassemble(image, range->start - base, end - base, 0 - base);
+}
+
+//! Words of the bytes of a range of g_obj, and the bits of each one that are
+//! not relocated
+void rangeWords(const PsyqRange *range, std::vector<uint32_t> *words, std::vector<uint32_t> *masks)
+{
+    words->assign((range->end - range->start) / 4, 0);
+    masks->assign(words->size(), 0xffffffff);
+    for (const PsyqCode &code : g_obj.codes)
+    {
+        if (code.section != range->section)
+        {
+            continue;
+        }
+        for (uint32_t offset = 0; offset + 4 <= code.size; offset += 4)
+        {
+            uint32_t at = code.offset + offset;
+
+            if (at >= range->start && at + 4 <= range->end)
+            {
+                const BYTE      *bytes = code.data + offset;
+                const PsyqReloc *reloc = psyqFindReloc(&g_obj, &code, offset);
+
+                (*words)[(at - range->start) / 4] = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+                (*masks)[(at - range->start) / 4] = reloc ? exeIndexRelocMask(reloc->type) : 0xffffffff;
+            }
+        }
+    }
+}
+
+//! Print where the words of a function of g_obj are in an executable: the
+//! starts of its n-grams in the index, compared word by word outside of its
+//! relocations. N-grams found more than EXE_INDEX_COMMON times (padding,
+//! runs of the same instruction) don't say where the function is; without
+//! any other one, e.g. for a function shorter than an n-gram, every start is
+//! tried instead. Only matches of at least half of the words are kept, best
+//! first.
+void findFunction(const ExeIndex *index, std::string_view name, const PsyqRange *range, int limit)
+{
+    const ExeIndexHeader    *header = index->header;
+    std::vector<uint32_t>   words, masks, masked, starts;
+    std::vector<uint64_t>   hashes;
+    std::vector<std::pair<uint32_t, uint32_t>>  matches;    // (matched words, start)
+
+    rangeWords(range, &words, &masks);
+    uint32_t count = (uint32_t)words.size();
+    output("function name: %.*s\n", (int)name.size(), name.data());
+    if (count == 0)
+    {
+        return;
+    }
+
+    for (uint32_t word : words)
+    {
+        masked.push_back(exeIndexMask(word));
+    }
+    bool informative = false;
+
+    exeIndexHashes(masked.data(), count, header->gram, &hashes);
+    for (uint32_t i = 0; i < hashes.size(); i++)
+    {
+        uint32_t first, last;
+
+        exeIndexLookup(index, hashes[i], &first, &last);
+        if (!hashes[i] || last - first > EXE_INDEX_COMMON)
+        {
+            continue;
+        }
+        informative = true;
+        for (; first < last; first++)
+        {
+            if (index->starts[first] >= i)
+            {
+                starts.push_back(index->starts[first] - i);
+            }
+        }
+    }
+    std::sort(starts.begin(), starts.end());
+    starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+    if (!informative)
+    {
+        for (uint32_t start = 0; start + count <= header->words; start++)
+        {
+            uint32_t i = 0;
+
+            while (i < count && exeIndexMask(index->words[start + i]) == masked[i])
+            {
+                i++;
+            }
+            if (i == count)
+            {
+                starts.push_back(start);
+            }
+        }
+    }
+
+    for (uint32_t start : starts)
+    {
+        uint32_t matched = 0;
+
+        for (uint32_t i = 0; i < count && start + i < header->words; i++)
+        {
+            matched += ((index->words[start + i] ^ words[i]) & masks[i]) == 0;
+        }
+        if (matched * 2 >= count)
+        {
+            matches.push_back({ matched, start });
+        }
+    }
+    std::sort(matches.begin(), matches.end(), [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b)
+    {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    for (size_t i = 0; i < matches.size() && (limit <= 0 || (int)i < limit); i++)
+    {
+        output("%08x\t%.1f%%\t%u/%u\n", header->base + matches[i].second * 4, matches[i].first * 100.0 / count, matches[i].first, count);
+    }
+}
+
+//! Find the functions of g_obj (g_function, or every text definition, or the
+//! whole text sections of an obj without any) in an executable index
+void findFunctions(const ExeIndex *index, int limit)
+{
+    std::vector<std::pair<uint16_t, uint32_t>>  found;
+    PsyqRange   range;
+
+    if (!g_function.empty())
+    {
+        if (!psyqFindFunction(&g_obj, g_function, &range))
+        {
+            fatal("Error: function %s not found\n", g_function.c_str());
+        }
+        findFunction(index, g_function, &range, limit);
+        return;
+    }
+
+    for (const PsyqDefinition &definition : g_obj.definitions)
+    {
+        std::pair<uint16_t, uint32_t> at = { definition.section, definition.offset };
+
+        if (psyqIsText(&g_obj, definition.section) && std::find(found.begin(), found.end(), at) == found.end())
+        {
+            found.push_back(at);
+            psyqFindFunction(&g_obj, definition.name, &range);
+            findFunction(index, definition.name, &range, limit);
+        }
+    }
+    if (!found.empty())
+    {
+        return;
+    }
+    for (uint16_t section = 0; section < g_obj.sectionStates.size(); section++)
+    {
+        const PsyqSection *info = psyqSection(&g_obj, section);
+
+        range = { section, 0, g_obj.sectionStates[section].size };
+        if (range.end && psyqIsText(&g_obj, section))
+        {
+            findFunction(index, info ? info->name : std::string_view(".text"), &range, limit);
+        }
+    }
+}
+
+void disassembleCodes(void)
+{
+    g_normalizer.skipNext = false;
+    g_normalizer.nops = 0;
+    if (!g_function.empty())
+    {
+        disassembleFunction();
+    }
+    else
+    {
+        for (const PsyqFunction &function : g_obj.functions)
+        {
+            outputFunctionName(function.name);
+        }
+        for (const PsyqCode &code : g_obj.codes)
+        {
+            disassembleChunk(&code);
+        }
+    }
+    if (g_params.binary)
+    {
+        writeBinary();
+    }
+}
+
+//! SHA-256, for the same hash as Scorer.score
+typedef struct  Sha256
+{
+    uint32_t    state[8];
+    uint64_t    size;
+    BYTE        block[64];
+} Sha256;
+
+const uint32_t  g_sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+uint32_t rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+void sha256Block(Sha256 *ctx, const BYTE *data)
+{
+    uint32_t w[64];
+    uint32_t v[8];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)data[i * 4] << 24 | data[i * 4 + 1] << 16 | data[i * 4 + 2] << 8 | data[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    memcpy(v, ctx->state, sizeof(v));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+        uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7] + s1 + ch + g_sha256K[i] + w[i];
+        uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+        uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + s0 + maj;
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        ctx->state[i] += v[i];
+    }
+}
+
+void sha256Init(Sha256 *ctx)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->size = 0;
+}
+
+void sha256Update(Sha256 *ctx, const void *data, size_t size)
+{
+    const BYTE *ptr = (const BYTE*)data;
+
+    while (size)
+    {
+        size_t used = ctx->size % 64;
+        size_t count = 64 - used < size ? 64 - used : size;
+
+        memcpy(ctx->block + used, ptr, count);
+        ctx->size += count;
+        ptr += count;
+        size -= count;
+        if (ctx->size % 64 == 0)
+        {
+            sha256Block(ctx, ctx->block);
+        }
+    }
+}
+
+//! Finish and write the digest as 64 hex characters + '\0'
+void sha256Final(Sha256 *ctx, char *hex)
+{
+    uint64_t    bits = ctx->size * 8;
+    BYTE        pad = 0x80;
+    BYTE        length[8];
+
+    sha256Update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->size % 64 != 56)
+    {
+        sha256Update(ctx, &pad, 1);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        length[i] = (BYTE)(bits >> (56 - i * 8));
+    }
+    sha256Update(ctx, length, 8);
+    for (int i = 0; i < 8; i++)
+    {
+        sprintf(hex + i * 8, "%08x", ctx->state[i]);
+    }
+}
+
+#define OBJ_WORDS_DATA  0x80000000
+
+//! The words of g_obj in the order they are normalized (one line each), for
+//! the prefilter
+typedef struct  ObjWords
+{
+    std::vector<uint32_t>           words;
+    std::vector<uint32_t>           masks;      // bits compared, see Prefilter.h
+    std::vector<uint32_t>           chunks;     // words of each, | OBJ_WORDS_DATA
+    std::vector<uint32_t>           relocated;  // indexes in words
+    std::vector<const PsyqReloc*>   relocs;     // of relocated, into g_obj
+    std::vector<uint32_t>           classes;    // mnemonic class -> words
+} ObjWords;
+
+typedef struct  OpClasses
+{
+    uint8_t     classes[R3000_OP_COUNT];
+    int         count;
+} OpClasses;
+
+//! Mnemonic class of every op: ops printed with the same name (like the
+//! .word of invalid instructions and data) share one
+const OpClasses &opClasses(void)
+{
+    static const OpClasses classes = []
+    {
+        OpClasses c = {};
+
+        for (int op = 0; op < R3000_OP_COUNT; op++)
+        {
+            int first = 0;
+
+            while (strcmp(g_r3000Ops[first].name, g_r3000Ops[op].name))
+            {
+                first++;
+            }
+            c.classes[op] = first == op ? (uint8_t)c.count++ : c.classes[first];
+        }
+        return c;
+    }();
+    return classes;
+}
+
+//! Add the words in bytes [start, end) of a code chunk, like disassemble() or
+//! dumpData() go through them
+void gatherWords(const PsyqCode *code, uint32_t start, uint32_t end, bool data, ObjWords *w)
+{
+    const OpClasses &classes = opClasses();
+    R3000Insn       insn;
+
+    for (uint32_t offset = start; data ? offset < end : offset + 4 <= end; offset += 4)
+    {
+        const PsyqReloc *reloc = psyqFindReloc(&g_obj, code, offset);
+        uint32_t        word = 0;
+
+        memcpy(&word, code->data + offset, std::min<uint32_t>(4, end - offset));
+        if (reloc)
+        {
+            w->relocated.push_back((uint32_t)w->words.size());
+            w->relocs.push_back(reloc);
+        }
+        w->words.push_back(word);
+        w->masks.push_back(reloc ? exeIndexRelocMask(reloc->type) : 0xffffffff);
+        if (data)
+        {
+            w->classes[classes.classes[R3000_INVALID]]++;
+            continue;
+        }
+        r3000Decode(word, &insn);
+        w->classes[classes.classes[insn.op]]++;
+    }
+}
+
+//! The words of g_obj that disassembleCodes() normalizes
+void gatherObjWords(ObjWords *w)
+{
+    w->words.clear();
+    w->masks.clear();
+    w->chunks.clear();
+    w->relocated.clear();
+    w->relocs.clear();
+    w->classes.assign(opClasses().count, 0);
+
+    if (g_function.empty())
+    {
+        for (const PsyqCode &code : g_obj.codes)
+        {
+            bool data = !psyqIsText(&g_obj, code.section);
+
+            w->chunks.push_back(data ? (code.size + 3) / 4 | OBJ_WORDS_DATA : code.size / 4);
+            gatherWords(&code, 0, code.size, data, w);
+        }
+        return;
+    }
+
+    PsyqRange range;
+    if (!psyqFindFunction(&g_obj, g_function, &range))
+    {
+        fatal("Error: function %s not found\n", g_function.c_str());
+    }
+    for (const PsyqCode &code : g_obj.codes)
+    {
+        if (code.section == range.section && code.offset < range.end && code.offset + code.size > range.start)
+        {
+            uint32_t start = std::max(range.start, code.offset) - code.offset;
+            uint32_t end = std::min(range.end, code.offset + code.size) - code.offset;
+            gatherWords(&code, start, end, false, w);
+        }
+    }
+    w->chunks.push_back((uint32_t)w->words.size());
+}
+
+//! Basic blocks of normalized lines, one line per word of an ObjWords
+typedef struct  ObjBlocks
+{
+    std::vector<int>        starts;     // first line of every block, then the line count
+    std::vector<uint64_t>   hashes;     // XXH64 of the mnemonics of every block
+} ObjBlocks;
+
+//! Split lines into basic blocks: one ends after the delay slot of every
+//! branch or jump, or at a branch target, and chunks are blocks of their own.
+//! False when the lines don't match the words.
+bool findBlocks(const ObjWords *w, const std::vector<ScoreLine> &lines, ObjBlocks *blocks)
+{
+    std::vector<uint8_t>    starts(w->words.size() + 1, 0);
+    R3000Insn               insn;
+    uint32_t                chunkStart = 0;
+
+    blocks->starts.clear();
+    blocks->hashes.clear();
+    if (lines.size() != w->words.size())
+    {
+        return false;
+    }
+    for (uint32_t chunk : w->chunks)
+    {
+        uint32_t end = chunkStart + (chunk & ~OBJ_WORDS_DATA);
+
+        starts[chunkStart] = 1;
+        for (uint32_t i = chunkStart; !(chunk & OBJ_WORDS_DATA) && i < end; i++)
+        {
+            r3000Decode(w->words[i], &insn);
+            uint8_t flags = g_r3000Ops[insn.op].flags;
+
+            if (!(flags & R3000_FLAG_DELAY))
+            {
+                continue;
+            }
+            starts[std::min(i + 2, end)] = 1;
+            if (flags & R3000_FLAG_BRANCH)
+            {
+                int64_t target = (int64_t)i + 1 + insn.imm;
+
+                if (target >= chunkStart && target < end)
+                {
+                    starts[target] = 1;
+                }
+            }
+        }
+        chunkStart = end;
+    }
+
+    XXHash64 h;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        if (starts[i])
+        {
+            if (i)
+            {
+                blocks->hashes.push_back(xxhDigest(&h));
+            }
+            blocks->starts.push_back((int)i);
+            xxhInit(&h, 0);
+        }
+        const std::string &mnemonic = g_mnemonicNames[lines[i].mnemonic];
+        xxhUpdate(&h, mnemonic.c_str(), mnemonic.size() + 1);
+    }
+    if (!lines.empty())
+    {
+        blocks->hashes.push_back(xxhDigest(&h));
+    }
+    blocks->starts.push_back((int)lines.size());
+    return true;
+}
+
+//! A target loaded once for --score and the server's 'T'/'S' requests: its
+//! index (TargetIndex.h), built by addTarget() or mapped by loadTarget()
+typedef struct  ScoreTarget
+{
+    int                     flags;      // normalization flags, see handleRequest()
+    TargetIndex             index;
+    std::vector<uint64_t>   built;      // the index when built here, aligned
+    void                    *mapped;    // or the index file, mappedSize bytes
+    size_t                  mappedSize;
+    std::vector<uint32_t>   mnemonics;  // interned mnemonic id -> index mnemonic
+    ScoreCache              cache;      // see mdasm_target_cache(), or no header
+} ScoreTarget;
+
+//! Targets of fewer lines are diffed line by line even with MDASM_BLOCK_DIFF
+#define SCORE_BLOCK_LINES   256
+
+std::vector<ScoreTarget*>   g_targets;
+
+//! Penalties, same as Scorer in src/scorer.py
+#define PENALTY_STACKDIFF   1
+#define PENALTY_REGALLOC    5
+#define PENALTY_REORDERING  60
+#define PENALTY_INSERTION   100
+#define PENALTY_DELETION    100
+
+typedef struct  Match
+{
+    int         a;
+    int         b;
+    int         size;
+} Match;
+
+//! difflib.SequenceMatcher(autojunk=False) between a candidate (a) and the
+//! target (b), on interned mnemonics, or on block ids for MDASM_BLOCK_DIFF.
+//! This has to pick the same alignment as difflib for the scores to be
+//! identical, so it is a port of difflib's longest-match recursion rather
+//! than a textbook O(ND) diff. Ids of a from ids up are in no match.
+typedef struct  Differ
+{
+    const uint32_t      *a;
+    const uint32_t      *b;
+    const uint32_t      *b2jStarts; // id -> its positions in b, in b2j
+    const uint32_t      *b2j;
+    uint32_t            ids;
+    std::vector<int>    j2len[2];
+    std::vector<uint64_t> j2gen[2];
+    uint64_t            generation; // 64 bits: never wraps in a worker's life
+} Differ;
+
+Differ          g_differ;
+
+Match findLongestMatch(Differ *d, int alo, int ahi, int blo, int bhi)
+{
+    const uint32_t  *a = d->a;
+    const uint32_t  *b = d->b;
+    Match           best = { alo, blo, 0 };
+
+    // j2len[cur][j] is only valid when j2gen[cur][j] matches the generation of
+    // the row it was written in, which avoids clearing the arrays per row.
+    // Generations start at 1, so 0 (what the arrays are filled with) and the
+    // previous row before the first never match.
+    int prev = 0;
+    uint64_t prevGeneration = 0;
+    for (int i = alo; i < ahi; i++)
+    {
+        int cur = prev ^ 1;
+        uint64_t generation = ++d->generation;
+        uint32_t id = a[i];
+
+        if (id < d->ids)
+        {
+            for (uint32_t p = d->b2jStarts[id]; p < d->b2jStarts[id + 1]; p++)
+            {
+                int j = (int)d->b2j[p];
+
+                if (j < blo)
+                {
+                    continue;
+                }
+                if (j >= bhi)
+                {
+                    break;
+                }
+                int k = (j > 0 && d->j2gen[prev][j - 1] == prevGeneration ? d->j2len[prev][j - 1] : 0) + 1;
+                d->j2len[cur][j] = k;
+                d->j2gen[cur][j] = generation;
+                if (k > best.size)
+                {
+                    best.a = i - k + 1;
+                    best.b = j - k + 1;
+                    best.size = k;
+                }
+            }
+        }
+        prev = cur;
+        prevGeneration = generation;
+    }
+
+    while (best.a > alo && best.b > blo && a[best.a - 1] == b[best.b - 1])
+    {
+        best.a--;
+        best.b--;
+        best.size++;
+    }
+    while (best.a + best.size < ahi && best.b + best.size < bhi &&
+           a[best.a + best.size] == b[best.b + best.size])
+    {
+        best.size++;
+    }
+    return best;
+}
+
+//! get_matching_blocks() of a[la0, la) and b[lb0, lb), including the final
+//! (la, lb, 0) sentinel
+void getMatchingBlocks(Differ *d, int la0, int la, int lb0, int lb, std::vector<Match> *blocks)
+{
+    std::vector<Match>          matches;
+
+    for (int i = 0; i < 2; i++)
+    {
+        if ((int)d->j2len[i].size() < lb)
+        {
+            d->j2len[i].resize(lb);
+            d->j2gen[i].resize(lb, 0);
+        }
+    }
+
+    // queue of (alo, ahi, blo, bhi) ranges still to be matched
+    std::vector<int> ranges = { la0, la, lb0, lb };
+    while (!ranges.empty())
+    {
+        int bhi = ranges.back(); ranges.pop_back();
+        int blo = ranges.back(); ranges.pop_back();
+        int ahi = ranges.back(); ranges.pop_back();
+        int alo = ranges.back(); ranges.pop_back();
+        Match x = findLongestMatch(d, alo, ahi, blo, bhi);
+        if (x.size)
+        {
+            matches.push_back(x);
+            if (alo < x.a && blo < x.b)
+            {
+                ranges.insert(ranges.end(), { alo, x.a, blo, x.b });
+            }
+            if (x.a + x.size < ahi && x.b + x.size < bhi)
+            {
+                ranges.insert(ranges.end(), { x.a + x.size, ahi, x.b + x.size, bhi });
+            }
+        }
+    }
+    std::sort(matches.begin(), matches.end(), [](const Match &l, const Match &r)
+    {
+        return l.a != r.a ? l.a < r.a : (l.b != r.b ? l.b < r.b : l.size < r.size);
+    });
+
+    Match last = { la0, lb0, 0 };
+    blocks->clear();
+    for (const Match &m : matches)
+    {
+        if (last.a + last.size == m.a && last.b + last.size == m.b)
+        {
+            last.size += m.size;
+        }
+        else
+        {
+            if (last.size)
+            {
+                blocks->push_back(last);
+            }
+            last = m;
+        }
+    }
+    if (last.size)
+    {
+        blocks->push_back(last);
+    }
+    blocks->push_back({ la, lb, 0 });
+}
+
+//! re.search(re_sprel, row).group(1)
+bool findStackOffset(const std::string &row, std::string *number)
+{
+    for (size_t i = 1; i < row.size(); i++)
+    {
+        if (row[i - 1] != ',')
+        {
+            continue;
+        }
+        size_t  end = i;
+        if (row.compare(i, 2, "0x") == 0 && i + 2 < row.size() &&
+            (isDigit(row[i + 2]) || (row[i + 2] >= 'a' && row[i + 2] <= 'f')))
+        {
+            end = i + 2;
+            while (end < row.size() && (isDigit(row[end]) || (row[end] >= 'a' && row[end] <= 'f')))
+            {
+                end++;
+            }
+        }
+        else
+        {
+            while (end < row.size() && isDigit(row[end]))
+            {
+                end++;
+            }
+        }
+        if (end > i && (row.compare(end, 4, "(sp)") == 0 || row.compare(end, 4, "(s8)") == 0))
+        {
+            *number = row.substr(i, end - i);
+            return true;
+        }
+    }
+    return false;
+}
+
+//! int(number, 0)
+long long parseStackOffset(const std::string &number)
+{
+    bool hex = number.compare(0, 2, "0x") == 0;
+
+    if (number.size() > 17)
+    {
+        unsupported("Unsupported: stack offset %s too large\n", number.c_str());
+    }
+    if (!hex && number[0] == '0' && number.find_first_not_of('0') != std::string::npos)
+    {
+        // int("012", 0) raises in Python
+        unsupported("Unsupported: invalid stack offset %s\n", number.c_str());
+    }
+    return strtoll(number.c_str() + (hex ? 2 : 0), NULL, hex ? 16 : 10);
+}
+
+std::vector<std::string> splitFields(const std::string &row, bool splitParen)
+{
+    std::vector<std::string>    fields;
+    size_t                      start = 0;
+
+    for (size_t i = 0; i <= row.size(); i++)
+    {
+        if (i == row.size() || row[i] == ',')
+        {
+            fields.push_back(row.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    if (!splitParen)
+    {
+        return fields;
+    }
+
+    // re.split(r"(?<!%hi)(?<!%lo)\(", last field)
+    std::string last = fields.back();
+    fields.pop_back();
+    start = 0;
+    for (size_t i = 0; i < last.size(); i++)
+    {
+        if (last[i] == '(' && !(i >= 3 && (last.compare(i - 3, 3, "%hi") == 0 || last.compare(i - 3, 3, "%lo") == 0)))
+        {
+            fields.push_back(last.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    fields.push_back(last.substr(start));
+    return fields;
+}
+
+typedef struct  Penalties
+{
+    long long   stack;
+    long long   regalloc;
+    long long   reordering;
+    long long   insertion;
+    long long   deletion;
+} Penalties;
+
+//! Penalties of a target row (old) and the candidate row matched with it
+void diffSameline(std::string_view oldView, bool oldHasSymbol, const std::string &newRow, int flags, Penalties *p)
+{
+    bool ignoreLastField = false;
+
+    if (oldView == newRow)
+    {
+        return;
+    }
+    std::string oldRow(oldView);
+
+    if (flags & 1)
+    {
+        std::string oldRel;
+        std::string newRel;
+        if (findStackOffset(oldRow, &oldRel) && findStackOffset(newRow, &newRel))
+        {
+            p->stack += llabs(parseStackOffset(oldRel) - parseStackOffset(newRel));
+            ignoreLastField = true;
+        }
+    }
+
+    std::vector<std::string> newFields = splitFields(newRow, !ignoreLastField);
+    std::vector<std::string> oldFields = splitFields(oldRow, !ignoreLastField);
+    if (ignoreLastField)
+    {
+        newFields.pop_back();
+        oldFields.pop_back();
+    }
+
+    for (size_t i = 0; i < newFields.size() && i < oldFields.size(); i++)
+    {
+        if (newFields[i] != oldFields[i])
+        {
+            // A symbol in place of a relocated field doesn't count
+            if (newFields[i].find('.') != std::string::npos && oldHasSymbol)
+            {
+                continue;
+            }
+            p->regalloc++;
+        }
+    }
+    p->regalloc += llabs((long long)newFields.size() - (long long)oldFields.size());
+}
+
+std::vector<uint32_t>   g_candMnemonics;
+ObjBlocks               g_candBlocks;
+std::vector<uint32_t>   g_candBlockSeq;
+
+//! The matching lines of a candidate and the target, as getMatchingBlocks()
+//! finds them. With blocks (words given and the target split into blocks),
+//! identical blocks are matched first, and lines only between them.
+void matchLines(const ScoreTarget *target, const std::vector<ScoreLine> &cand, const ObjWords *words, std::vector<Match> *matches)
+{
+    const TargetIndex       *index = &target->index;
+    const TargetIndexHeader *header = index->header;
+    Differ                  *d = &g_differ;
+    int                     la = (int)cand.size();
+    int                     lb = (int)header->lines;
+    std::vector<Match>      blockMatches, gap;
+
+    g_candMnemonics.resize(cand.size());
+    for (size_t i = 0; i < cand.size(); i++)
+    {
+        size_t id = cand[i].mnemonic;
+        g_candMnemonics[i] = id < target->mnemonics.size() ? target->mnemonics[id] : header->mnemonics;
+    }
+    d->a = g_candMnemonics.data();
+    d->b = index->lineMnemonics;
+    d->b2jStarts = index->b2jStarts;
+    d->b2j = index->b2j;
+    d->ids = header->mnemonics;
+    if (!words || !header->blocks || !findBlocks(words, cand, &g_candBlocks))
+    {
+        getMatchingBlocks(d, 0, la, 0, lb, matches);
+        return;
+    }
+
+    const std::vector<int> &ca = g_candBlocks.starts;
+    const uint32_t         *tb = index->blockStarts;
+
+    g_candBlockSeq.clear();
+    for (uint64_t hash : g_candBlocks.hashes)
+    {
+        g_candBlockSeq.push_back(targetIndexBlockId(index, hash));
+    }
+    d->a = g_candBlockSeq.data();
+    d->b = index->blockSeq;
+    d->b2jStarts = index->blockB2jStarts;
+    d->b2j = index->blockB2j;
+    d->ids = header->blockIds;
+    getMatchingBlocks(d, 0, (int)g_candBlockSeq.size(), 0, (int)header->blocks, &blockMatches);
+
+    d->a = g_candMnemonics.data();
+    d->b = index->lineMnemonics;
+    d->b2jStarts = index->b2jStarts;
+    d->b2j = index->b2j;
+    d->ids = header->mnemonics;
+    matches->clear();
+    int i = 0;
+    int j = 0;
+    for (const Match &m : blockMatches)
+    {
+        int a = ca[m.a];
+        int b = (int)tb[m.b];
+        if (i < a && j < b)
+        {
+            getMatchingBlocks(d, i, a, j, b, &gap);
+            matches->insert(matches->end(), gap.begin(), gap.end() - 1);
+        }
+        int size = std::min(ca[m.a + m.size] - a, (int)tb[m.b + m.size] - b);
+        if (size)
+        {
+            matches->push_back({ a, b, size });
+        }
+        i = a + size;
+        j = b + size;
+    }
+    matches->push_back({ la, lb, 0 });
+}
+
+//! sha256 of the rows joined by newlines, the objdump hash of src/scorer.py
+void rowsHash(const std::vector<ScoreLine> &lines, char *hash)
+{
+    Sha256 sha;
+
+    sha256Init(&sha);
+    for (size_t k = 0; k < lines.size(); k++)
+    {
+        if (k)
+        {
+            sha256Update(&sha, "\n", 1);
+        }
+        sha256Update(&sha, lines[k].row.data(), lines[k].row.size());
+    }
+    sha256Final(&sha, hash);
+}
+
+//! Scorer.score() on already normalized candidate lines, the words they come
+//! from are needed for MDASM_BLOCK_DIFF
+long long scoreLines(const ScoreTarget *target, const std::vector<ScoreLine> &cand, const ObjWords *words, char *hash)
+{
+    const TargetIndex                                           *index = &target->index;
+    Penalties                                                   p = {};
+    std::vector<Match>                                          blocks;
+    std::unordered_map<std::string_view, std::pair<int, int>>   counts; // row -> (insertions, deletions)
+
+    matchLines(target, cand, words, &blocks);
+
+    int i = 0;
+    int j = 0;
+    for (const Match &m : blocks)
+    {
+        // get_opcodes(): everything between two matching blocks is a
+        // replace, delete or insert, and all of them go to the counters
+        for (int k = i; k < m.a; k++)
+        {
+            counts[cand[k].row].first++;
+        }
+        for (int k = j; k < m.b; k++)
+        {
+            counts[targetIndexString(index, index->rowOffsets, k)].second++;
+        }
+        for (int k = 0; k < m.size; k++)
+        {
+            int t = m.b + k;
+            diffSameline(targetIndexString(index, index->rowOffsets, t), index->symbols[t], cand[m.a + k].row, target->flags, &p);
+        }
+        i = m.a + m.size;
+        j = m.b + m.size;
+    }
+
+    for (const auto &it : counts)
+    {
+        int ins = it.second.first;
+        int dels = it.second.second;
+        int common = ins < dels ? ins : dels;
+        p.insertion += ins - common;
+        p.deletion += dels - common;
+        p.reordering += common;
+    }
+
+    rowsHash(cand, hash);
+    return p.stack * PENALTY_STACKDIFF
+        + p.regalloc * PENALTY_REGALLOC
+        + p.reordering * PENALTY_REORDERING
+        + p.insertion * PENALTY_INSERTION
+        + p.deletion * PENALTY_DELETION;
+}
+
+void setNormalizeFlags(int flags)
+{
+    g_normalizer.stackDifferences = flags & 1;
+    g_normalizer.branchTargets = flags & 2;
+    g_normalizer.blDelaySlots = flags & 4;
+}
+
+//! Normalize the obj that was just parsed into lines
+void normalizeCodes(int flags, std::vector<ScoreLine> *lines)
+{
+    bool normalized = g_params.normalized;
+
+    lines->clear();
+    setNormalizeFlags(flags);
+    g_params.normalized = true;
+    g_scoreLines = lines;
+    disassembleCodes();
+    g_scoreLines = NULL;
+    g_params.normalized = normalized;
+}
+
+//! XXH64 of everything the normalized lines of g_obj depend on: its chunks
+//! with their section names, its relocations, and its definitions when only
+//! g_function is disassembled. Identical objs can skip normalizing and
+//! diffing with it.
+uint64_t objCodeHash(void)
+{
+    XXHash64    h;
+
+    xxhInit(&h, 0);
+    for (const PsyqCode &code : g_obj.codes)
+    {
+        const PsyqSection   *section = psyqSection(&g_obj, code.section);
+        std::string_view    name = section ? section->name : std::string_view();
+        uint32_t            header[4] = { code.section, code.offset, code.size, (uint32_t)name.size() };
+
+        xxhUpdate(&h, header, sizeof(header));
+        xxhUpdate(&h, name.data(), name.size());
+        xxhUpdate(&h, code.data, code.size);
+    }
+    for (size_t i = 0; i < g_obj.relocCount; i++)
+    {
+        const PsyqReloc     *reloc = &g_obj.relocs[i];
+        const std::string   &expr = psyqRelocExpr(&g_obj, reloc);
+        uint32_t            header[4] = { reloc->type, (uint32_t)reloc->code, reloc->offset, (uint32_t)expr.size() };
+
+        xxhUpdate(&h, header, sizeof(header));
+        xxhUpdate(&h, expr.data(), expr.size());
+    }
+    if (!g_function.empty())
+    {
+        for (const PsyqDefinition &definition : g_obj.definitions)
+        {
+            uint32_t header[3] = { definition.section, definition.offset, (uint32_t)definition.name.size() };
+
+            xxhUpdate(&h, header, sizeof(header));
+            xxhUpdate(&h, definition.name.data(), definition.name.size());
+        }
+    }
+    return xxhDigest(&h);
+}
+
+//! Normalize g_obj as a scoring target and write its index
+void buildTargetIndex(int flags, std::string *out)
+{
+    TargetIndexSource       source = {};
+    std::vector<ScoreLine>  lines;
+    ObjWords                words;
+    ObjBlocks               blocks;
+    char                    hash[65];
+
+    normalizeCodes(flags, &lines);
+    gatherObjWords(&words);
+    rowsHash(lines, hash);
+    source.header.mdasmVersion = MDASM_VERSION;
+    source.header.flags = flags;
+    source.header.codeHash = objCodeHash();
+    source.header.function = xxh64(g_function.data(), g_function.size(), 0);
+    memcpy(source.header.hash, hash, sizeof(source.header.hash));
+
+    // Mnemonics are numbered in the order they appear, not by interned id,
+    // which depends on what the process normalized before
+    std::vector<uint32_t> ids(g_mnemonicNames.size(), UINT32_MAX);
+    for (const ScoreLine &line : lines)
+    {
+        if (ids[line.mnemonic] == UINT32_MAX)
+        {
+            ids[line.mnemonic] = (uint32_t)source.mnemonics.size();
+            source.mnemonics.push_back(g_mnemonicNames[line.mnemonic]);
+        }
+        source.lineMnemonics.push_back(ids[line.mnemonic]);
+        source.rows.push_back(line.row);
+        source.symbols.push_back(line.hasSymbol);
+    }
+    source.words = words.words;
+    source.masks = words.masks;
+    source.chunks = words.chunks;
+    source.relocated = words.relocated;
+    source.classes = words.classes;
+    for (const PsyqReloc *reloc : words.relocs)
+    {
+        source.relocExprs.push_back(psyqRelocExpr(&g_obj, reloc));
+    }
+    if ((flags & MDASM_BLOCK_DIFF) && lines.size() >= SCORE_BLOCK_LINES && findBlocks(&words, lines, &blocks))
+    {
+        source.blockStarts.assign(blocks.starts.begin(), blocks.starts.end());
+        source.blockHashes = blocks.hashes;
+    }
+    targetIndexBuild(&source, out);
+}
+
+//! Check the index of a target and use it, or fail the call
+void openTarget(ScoreTarget *target, const uint8_t *index, size_t size)
+{
+    if (!targetIndexOpen(index, size, &target->index))
+    {
+        fatal("Error: invalid target index\n");
+    }
+
+    const TargetIndexHeader *header = target->index.header;
+    if (header->mdasmVersion != MDASM_VERSION || header->classes != (uint32_t)opClasses().count)
+    {
+        fatal("Error: the target index was made by another version\n");
+    }
+    if (header->function != xxh64(g_function.data(), g_function.size(), 0))
+    {
+        fatal("Error: the target index was made for another function\n");
+    }
+    target->flags = (int)header->flags;
+    for (uint32_t i = 0; i < header->mnemonics; i++)
+    {
+        size_t id = internMnemonic(std::string(targetIndexString(&target->index, target->index.mnemonicOffsets, i)));
+
+        if (id >= target->mnemonics.size())
+        {
+            target->mnemonics.resize(id + 1, header->mnemonics);
+        }
+        target->mnemonics[id] = i;
+    }
+}
+
+ScoreTarget *addTarget(int flags)
+{
+    std::unique_ptr<ScoreTarget>    target(new ScoreTarget());
+    std::string                     index;
+
+    buildTargetIndex(flags, &index);
+    target->built.resize((index.size() + 7) / 8);
+    memcpy(target->built.data(), index.data(), index.size());
+    openTarget(target.get(), (const uint8_t*)target->built.data(), index.size());
+    g_targets.push_back(target.get());
+    return target.release();
+}
+
+void unmapTarget(ScoreTarget *target)
+{
+#ifndef _WIN32
+    if (target->mapped)
+    {
+        munmap(target->mapped, target->mappedSize);
+    }
+#endif
+    target->mapped = NULL;
+}
+
+//! Map an index file made by buildTargetIndex() with these flags
+ScoreTarget *loadTarget(const char *path, int flags)
+{
+    std::unique_ptr<ScoreTarget>    target(new ScoreTarget());
+    const uint8_t                   *index;
+    size_t                          size;
+
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fatal("Error: Unable to open %s\n", path);
+    }
+    fseek(file, 0, SEEK_END);
+    size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    target->built.resize((size + 7) / 8);
+    bool read = fread(target->built.data(), 1, size, file) == size;
+    fclose(file);
+    if (!read)
+    {
+        fatal("Error: Unable to read %s\n", path);
+    }
+    index = (const uint8_t*)target->built.data();
+#else
+    struct stat st;
+    int         fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        fatal("Error: Unable to open %s\n", path);
+    }
+    size = (size_t)st.st_size;
+    void *mapped = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        fatal("Error: Unable to map %s\n", path);
+    }
+    target->mapped = mapped;
+    target->mappedSize = size;
+    index = (const uint8_t*)mapped;
+#endif
+
+    try
+    {
+        openTarget(target.get(), index, size);
+        if (target->flags != flags)
+        {
+            fatal("Error: %s was made with other options\n", path);
+        }
+    }
+    catch (...)
+    {
+        unmapTarget(target.get());
+        throw;
+    }
+    g_targets.push_back(target.get());
+    return target.release();
+}
+
+std::vector<ScoreLine>  g_candLines;
+ObjWords                g_candWords;
+
+//! Compare the words of g_obj with the target's, without normalizing them.
+//! Exact matches have the same words, relocations and chunks, so the same
+//! lines.
+void prefilterObj(const ScoreTarget *target, MdasmPrefilter *result)
+{
+    const TargetIndex       *t = &target->index;
+    const TargetIndexHeader *header = t->header;
+    ObjWords                *c = &g_candWords;
+    auto same = [](const std::vector<uint32_t> &values, const uint32_t *words, uint32_t count)
+    {
+        return values.size() == count && std::equal(values.begin(), values.end(), words);
+    };
+
+    gatherObjWords(c);
+    size_t common = std::min<size_t>(c->words.size(), header->words);
+    size_t extra = std::max<size_t>(c->words.size(), header->words) - common;
+
+    result->words = (uint32_t)c->words.size();
+    result->differingWords = (uint32_t)(prefilterDifferingWords(c->words.data(), c->masks.data(), t->words, t->masks, common) + extra);
+    result->exact = result->differingWords == 0 && same(c->words, t->words, header->words)
+        && same(c->chunks, t->chunks, header->chunks) && same(c->relocated, t->relocated, header->relocs);
+    for (size_t i = 0; result->exact && i < c->relocs.size(); i++)
+    {
+        result->exact = psyqRelocExpr(&g_obj, c->relocs[i]) == targetIndexString(t, t->relocOffsets, (uint32_t)i);
+    }
+    result->lowerBound = result->exact ? 0 : prefilterBound(c->classes.data(), t->classes, c->classes.size(), PENALTY_INSERTION, PENALTY_DELETION);
+}
+
+//! Score g_obj, or take its score from the prefilter or the target's cache.
+//! Candidates that can't score bound or better get the prefilter's lower
+//! bound and an empty hash.
+long long scoreObj(const ScoreTarget *target, long long bound, char *hash)
+{
+    const char      *digits = "0123456789abcdef";
+    uint64_t        code = 0;
+    uint8_t         raw[32];
+    long long       score;
+    MdasmPrefilter  filter;
+
+    prefilterObj(target, &filter);
+    if (filter.exact)
+    {
+        memcpy(hash, target->index.header->hash, 64);
+        hash[64] = '\0';
+        return 0;
+    }
+    if (filter.lowerBound > bound)
+    {
+        hash[0] = '\0';
+        return filter.lowerBound;
+    }
+
+    if (target->cache.header)
+    {
+        code = objCodeHash();
+        if (scoreCacheFind(&target->cache, code, &score, raw))
+        {
+            for (int i = 0; i < 32; i++)
+            {
+                hash[i * 2] = digits[raw[i] >> 4];
+                hash[i * 2 + 1] = digits[raw[i] & 15];
+            }
+            hash[64] = '\0';
+            return score;
+        }
+    }
+
+    normalizeCodes(target->flags, &g_candLines);
+    score = scoreLines(target, g_candLines, &g_candWords, hash);
+    if (target->cache.header)
+    {
+        for (int i = 0; i < 32; i++)
+        {
+            raw[i] = (uint8_t)((strchr(digits, hash[i * 2]) - digits) << 4 | (strchr(digits, hash[i * 2 + 1]) - digits));
+        }
+        scoreCacheInsert(&target->cache, code, score, raw);
+    }
+    return score;
+}
+
+std::vector<MdasmLine>  g_lineViews;
+
+//! Start an API call: forget the previous obj and output
+void beginCall(int mode, int options)
+{
+    g_output.clear();
+    g_error.clear();
+    psyqClear(&g_obj);
+    resetBinary();
+
+    if (mode < MDASM_TEXT || mode > MDASM_BINARY)
+    {
+        fatal("Error: unknown output mode %d\n", mode);
+    }
+    g_params.offsets = options & MDASM_OFFSETS;
+    g_params.bytes = options & MDASM_BYTES;
+    g_params.reloc = options & MDASM_RELOCS;
+    g_params.normalized = mode == MDASM_NORMALIZED;
+    g_params.binary = mode == MDASM_BINARY;
+    setNormalizeFlags(options);
+}
+
+//! Exceptions must not leave the library: failed calls return their status
+int failCall(void)
+{
+    try
+    {
+        throw;
+    }
+    catch (const RequestError &e)
+    {
+        return e.status;
+    }
+    catch (const std::exception &e)
+    {
+        g_error = e.what();
+    }
+    return MDASM_ERROR;
+}
+
+//! Run job(0) ... job(count - 1) on threads workers (0 = one per core), the
+//! calling thread being one of them. Each worker starts its own call, and the
+//! outputs are put together in order into the caller's; the first error stops
+//! the others and fails the call.
+template <typename Job>
+void runWorkers(size_t count, int mode, int options, int threads, const Job &job)
+{
+    std::vector<std::string>    results(count);
+    std::atomic<size_t>         next(0);
+    std::atomic<bool>           failed(false);
+    std::mutex                  errorMutex;
+    std::string                 error;
+    int                         status = MDASM_ERROR;
+    auto worker = [&]()
+    {
+        beginCall(mode, options);
+        for (size_t i; !failed && (i = next++) < count; )
+        {
+            try
+            {
+                job(i);
+            }
+            catch (...)
+            {
+                int jobStatus = failCall();
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!failed.exchange(true))
+                {
+                    error = g_error;
+                    status = jobStatus;
+                }
+                break;
+            }
+            results[i].swap(g_output);
+            g_output.clear();
+        }
+    };
+
+    if (threads <= 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads && (size_t)t < count; t++)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool)
+    {
+        thread.join();
+    }
+    if (failed)
+    {
+        g_error = error;
+        throw RequestError{ status };
+    }
+
+    g_output.clear();
+    for (const std::string &result : results)
+    {
+        g_output += result;
+    }
+}
+
+//! Read a LIB archive, or fail the call
+void parsePsyqLib(const BYTE *buffer, size_t size, PsyqLib *lib)
+{
+    if (!psyqLibParse(buffer, size, lib))
+    {
+        fatal("%s", lib->error.c_str());
+    }
+}
+
+} // namespace
+
+MDASM_API int mdasm_version(void)
+{
+    return MDASM_VERSION;
+}
+
+MDASM_API const char *mdasm_error(void)
+{
+    return g_error.c_str();
+}
+
+MDASM_API int mdasm_set_function(const char *name)
+{
+    g_function = name ? name : "";
+    return 0;
+}
+
+MDASM_API int mdasm_set_gp_size(int size)
+{
+    g_gpSize = size;
+    return 0;
+}
+
+MDASM_API int mdasm_disassemble(const uint8_t *obj, size_t size, int mode, int options, const char **out, size_t *outSize)
+{
+    try
+    {
+        beginCall(mode, options);
+        parsePsyqObj(obj, size);
+        disassembleCodes();
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_disassemble_code(const uint8_t *code, size_t size, int mode, int options, const char **out, size_t *outSize)
+{
+    try
+    {
+        beginCall(mode, options);
+        PsyqCode raw = { 0, (uint32_t)size, code, 0, 0 };
+
+        g_normalizer.skipNext = false;
+        g_normalizer.nops = 0;
+        disassembleChunk(&raw);
+        if (g_params.binary)
+        {
+            writeBinary();
+        }
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_disassemble_exe(const uint8_t *file, size_t size, uint32_t base, const MdasmRange *ranges, size_t count, int mode, int options, int threads, const char **out, size_t *outSize)
+{
+    try
+    {
+        PsxExe      exe;
+        PsyqCode    image = { 0, (uint32_t)size, file, 0, 0 };
+
+        beginCall(mode, options);
+        if (mode == MDASM_BINARY)
+        {
+            fatal("Error: binary output is not supported for executables\n");
+        }
+        if (psxExeParse(file, size, &exe))
+        {
+            image.data = exe.text;
+            image.size = exe.size;
+            base = exe.address;
+        }
+
+        runWorkers(count, mode, options, threads, [&](size_t i)
+        {
+            disassembleRange(&image, base, &ranges[i]);
+        });
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_disassemble_lib(const uint8_t *lib, size_t size, const char *const *names, size_t count, int mode, int options, int threads, const char **out, size_t *outSize)
+{
+    try
+    {
+        PsyqLib                 archive;
+        std::vector<uint32_t>   selected;
+
+        beginCall(mode, options);
+        if (mode == MDASM_BINARY)
+        {
+            fatal("Error: binary output is not supported for LIB archives\n");
+        }
+        parsePsyqLib(lib, size, &archive);
+        for (size_t i = 0; i < count; i++)
+        {
+            int module = psyqLibFind(&archive, names[i]);
+
+            if (module < 0)
+            {
+                fatal("Error: no module or symbol %s in the archive\n", names[i]);
+            }
+            selected.push_back(module);
+        }
+        if (!count)
+        {
+            for (uint32_t i = 0; i < archive.modules.size(); i++)
+            {
+                selected.push_back(i);
+            }
+        }
+
+        runWorkers(selected.size(), mode, options, threads, [&](size_t i)
+        {
+            const PsyqLibModule &module = archive.modules[selected[i]];
+
+            output("module name: %.*s\n", (int)module.name.size(), module.name.data());
+            parsePsyqObj(module.obj, module.size);
+            disassembleCodes();
+        });
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_lib_index(const uint8_t *lib, size_t size, const char **out, size_t *outSize)
+{
+    try
+    {
+        PsyqLib archive;
+
+        beginCall(MDASM_TEXT, 0);
+        parsePsyqLib(lib, size, &archive);
+        for (const PsyqLibModule &module : archive.modules)
+        {
+            output("%.*s", (int)module.name.size(), module.name.data());
+            for (std::string_view symbol : module.exports)
+            {
+                output("\t%.*s", (int)symbol.size(), symbol.data());
+            }
+            output("\n");
+        }
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_lib_module(const uint8_t *lib, size_t size, const char *name, const uint8_t **obj, size_t *objSize)
+{
+    try
+    {
+        PsyqLib archive;
+
+        beginCall(MDASM_TEXT, 0);
+        parsePsyqLib(lib, size, &archive);
+        int module = psyqLibFind(&archive, name);
+        if (module < 0)
+        {
+            fatal("Error: no module or symbol %s in the archive\n", name);
+        }
+        *obj = archive.modules[module].obj;
+        *objSize = archive.modules[module].size;
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    return 0;
+}
+
+MDASM_API int mdasm_build_index(const uint8_t *file, size_t size, uint32_t base, int gram, const char **out, size_t *outSize)
+{
+    try
+    {
+        PsxExe exe;
+
+        beginCall(MDASM_TEXT, 0);
+        if (gram < 0 || gram > 0x10000)
+        {
+            fatal("Error: bad n-gram size %d\n", gram);
+        }
+        if (psxExeParse(file, size, &exe))
+        {
+            file = exe.text;
+            size = exe.size;
+            base = exe.address;
+        }
+        exeIndexBuild(file, size, base, gram ? gram : EXE_INDEX_GRAM, &g_output);
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_find(const uint8_t *index, size_t indexSize, const uint8_t *obj, size_t size, int limit, const char **out, size_t *outSize)
+{
+    try
+    {
+        ExeIndex exeIndex;
+
+        beginCall(MDASM_TEXT, 0);
+        if (!exeIndexOpen(index, indexSize, &exeIndex))
+        {
+            fatal("Error: not an MDasm2 index, or of another version\n");
+        }
+        parsePsyqObj(obj, size);
+        findFunctions(&exeIndex, limit);
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_normalize(const uint8_t *obj, size_t size, int options, const MdasmLine **lines, size_t *count)
+{
+    try
+    {
+        beginCall(MDASM_NORMALIZED, options);
+        parsePsyqObj(obj, size);
+        normalizeCodes(options & MDASM_NORMALIZE_MASK, &g_candLines);
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+
+    g_lineViews.resize(g_candLines.size());
+    for (size_t i = 0; i < g_candLines.size(); i++)
+    {
+        g_lineViews[i].mnemonic = g_mnemonicNames[g_candLines[i].mnemonic].c_str();
+        g_lineViews[i].row = g_candLines[i].row.c_str();
+        g_lineViews[i].hasSymbol = g_candLines[i].hasSymbol;
+    }
+    *lines = g_lineViews.data();
+    *count = g_lineViews.size();
+    return 0;
+}
+
+MDASM_API int mdasm_blocks(const uint8_t *obj, size_t size, const char **out, size_t *outSize)
+{
+    try
+    {
+        beginCall(MDASM_NORMALIZED, 0);
+        parsePsyqObj(obj, size);
+        normalizeCodes(0, &g_candLines);
+        gatherObjWords(&g_candWords);
+        if (!findBlocks(&g_candWords, g_candLines, &g_candBlocks))
+        {
+            fatal("Error: the lines don't match the words\n");
+        }
+        for (size_t i = 0; i < g_candBlocks.hashes.size(); i++)
+        {
+            int start = g_candBlocks.starts[i];
+
+            output("%d\t%d\t%016" PRIx64 "\n", start, g_candBlocks.starts[i + 1] - start, g_candBlocks.hashes[i]);
+        }
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_add_target(const uint8_t *obj, size_t size, int options)
+{
+    try
+    {
+        beginCall(MDASM_NORMALIZED, options);
+        parsePsyqObj(obj, size);
+        addTarget(options & (MDASM_NORMALIZE_MASK | MDASM_BLOCK_DIFF));
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    return (int)g_targets.size() - 1;
+}
+
+MDASM_API int mdasm_target_index(const uint8_t *obj, size_t size, int options, const char **out, size_t *outSize)
+{
+    try
+    {
+        beginCall(MDASM_NORMALIZED, options);
+        parsePsyqObj(obj, size);
+        buildTargetIndex(options & (MDASM_NORMALIZE_MASK | MDASM_BLOCK_DIFF), &g_output);
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    *out = g_output.data();
+    *outSize = g_output.size();
+    return 0;
+}
+
+MDASM_API int mdasm_load_target(const char *path, int options)
+{
+    try
+    {
+        beginCall(MDASM_NORMALIZED, options);
+        loadTarget(path, options & (MDASM_NORMALIZE_MASK | MDASM_BLOCK_DIFF));
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    return (int)g_targets.size() - 1;
+}
+
+MDASM_API int mdasm_target_cache(int target, const char *path, size_t capacity)
+{
+    try
+    {
+        beginCall(MDASM_TEXT, 0);
+        if (target < 0 || target >= (int)g_targets.size())
+        {
+            fatal("Error: unknown target %d\n", target);
+        }
+
+        ScoreTarget *t = g_targets[target];
+        uint64_t    context[3] = { MDASM_VERSION, (uint64_t)t->flags, t->index.header->codeHash };
+        uint64_t    seed = xxh64(context, sizeof(context), 0);
+
+        if (!scoreCacheOpen(&t->cache, path, capacity, xxh64(g_function.data(), g_function.size(), seed), &g_error))
+        {
+            throw RequestError();
+        }
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    return 0;
+}
+
+MDASM_API int mdasm_code_hash(const uint8_t *obj, size_t size, uint64_t *hash)
+{
+    try
+    {
+        beginCall(MDASM_TEXT, 0);
+        parsePsyqObj(obj, size);
+        *hash = objCodeHash();
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    return 0;
+}
+
+MDASM_API int mdasm_score(int target, const uint8_t *obj, size_t size, long long *score, char *hash)
+{
+    return mdasm_score_bounded(target, obj, size, LLONG_MAX, score, hash);
+}
+
+MDASM_API int mdasm_score_bounded(int target, const uint8_t *obj, size_t size, long long bound, long long *score, char *hash)
+{
+    try
+    {
+        beginCall(MDASM_NORMALIZED, 0);
+        if (target < 0 || target >= (int)g_targets.size())
+        {
+            fatal("Error: unknown target %d\n", target);
+        }
+        parsePsyqObj(obj, size);
+        *score = scoreObj(g_targets[target], bound, hash);
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    return hash[0] ? 0 : 1;
+}
+
+MDASM_API int mdasm_prefilter(int target, const uint8_t *obj, size_t size, MdasmPrefilter *result)
+{
+    try
+    {
+        beginCall(MDASM_NORMALIZED, 0);
+        if (target < 0 || target >= (int)g_targets.size())
+        {
+            fatal("Error: unknown target %d\n", target);
+        }
+        parsePsyqObj(obj, size);
+        prefilterObj(g_targets[target], result);
+    }
+    catch (...)
+    {
+        return failCall();
+    }
+    return 0;
+}
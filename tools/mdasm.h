@@ -0,0 +1,177 @@
+#ifndef MDASM_H
+#define MDASM_H
+
+// C API of libmdasm: the PsyQ obj parser, disassembler and scorer of MDasm2,
+// for calling them in-process (e.g. from Python with ctypes).
+//
+// The library keeps its state in globals, per thread for disassembly: the
+// buffers it returns are valid until the next call from the same thread, and
+// scoring (targets and normalized lines) must stay on one thread at a time.
+// Every function returns -1 on error, with the message in mdasm_error().
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#define MDASM_EXTERN extern "C"
+#else
+#define MDASM_EXTERN
+#endif
+
+#ifdef _WIN32
+#define MDASM_API   MDASM_EXTERN __declspec(dllexport)
+#else
+#define MDASM_API   MDASM_EXTERN __attribute__((visibility("default")))
+#endif
+
+// Bumped when the API or the output formats change
+#define MDASM_VERSION   11
+
+// Calls return a negative status when they fail, with the message in
+// mdasm_error(): MDASM_UNSUPPORTED for an obj that has rows only the Python
+// normalization in src/objdump.py handles (relocation rows, numbers too large),
+// which callers fall back to, and MDASM_ERROR for anything else.
+#define MDASM_ERROR         -1
+#define MDASM_UNSUPPORTED   -2
+
+// Output modes
+#define MDASM_TEXT          0   // lines as printed by MDasm2
+#define MDASM_NORMALIZED    1   // "mnemonic\thas_symbol\trow" lines (--normalized)
+#define MDASM_BINARY        2   // instruction records (--binary)
+
+// Options. The low bits are the scorer normalization flags, the same as in
+// the server's 'N' and 'T' requests.
+#define MDASM_STACK_DIFFS       0x01
+#define MDASM_BRANCH_TARGETS    0x02
+#define MDASM_BL_DELAY_SLOTS    0x04
+#define MDASM_NORMALIZE_MASK    0x07
+#define MDASM_BLOCK_DIFF        0x08    // mdasm_add_target(): diff large functions
+                                        // block by block, see mdasm_blocks()
+#define MDASM_OFFSETS           0x10
+#define MDASM_BYTES             0x20
+#define MDASM_RELOCS            0x40
+
+//! A function of an executable, [start, end) at its load addresses; end 0 is
+//! the end of the executable
+typedef struct  MdasmRange
+{
+    const char  *name;
+    uint32_t    start;
+    uint32_t    end;
+} MdasmRange;
+
+//! A candidate compared word by word with a target, see mdasm_prefilter()
+typedef struct  MdasmPrefilter
+{
+    int         exact;          // same lines as the target: scores 0
+    uint32_t    words;          // of the candidate
+    uint32_t    differingWords; // at the same index, outside of relocated
+                                // fields, plus the difference in length
+    long long   lowerBound;     // the score is at least this
+} MdasmPrefilter;
+
+//! A normalized line, the same as Line in src/objdump.py
+typedef struct  MdasmLine
+{
+    const char  *mnemonic;
+    const char  *row;
+    int         hasSymbol;
+} MdasmLine;
+
+MDASM_API int mdasm_version(void);
+
+//! Message of the last error
+MDASM_API const char *mdasm_error(void);
+
+//! Restrict the following calls on obj files to the text of one function, or
+//! to the whole obj for NULL / "". Data sections are otherwise output as raw
+//! .word rows.
+MDASM_API int mdasm_set_function(const char *name);
+
+//! Every function taking an obj also takes CC1PSX's assembly output instead
+//! (anything not starting with "LNK"): it is assembled in memory the way
+//! aspsx -G size would, see PsyqAsm.h. The size is 8 until this is called.
+MDASM_API int mdasm_set_gp_size(int size);
+
+//! Disassemble an obj file in memory, the output is what MDasm2 prints
+MDASM_API int mdasm_disassemble(const uint8_t *obj, size_t size, int mode, int options, const char **out, size_t *outSize);
+
+//! Disassemble raw code, without relocations
+MDASM_API int mdasm_disassemble_code(const uint8_t *code, size_t size, int mode, int options, const char **out, size_t *outSize);
+
+//! Disassemble ranges of an executable on threads worker threads (0 = one per
+//! core), in order, each one as "function name:" followed by its text or
+//! normalized lines. A PS-X EXE is mapped at its header's address, anything
+//! else is a raw image loaded at base.
+MDASM_API int mdasm_disassemble_exe(const uint8_t *file, size_t size, uint32_t base, const MdasmRange *ranges, size_t count, int mode, int options, int threads, const char **out, size_t *outSize);
+
+//! Disassemble modules of a PsyQ LIB archive on threads worker threads (0 =
+//! one per core), selected by module or symbol name (every module for count
+//! 0), in order, each one as "module name:" followed by what
+//! mdasm_disassemble() prints for its object
+MDASM_API int mdasm_disassemble_lib(const uint8_t *lib, size_t size, const char *const *names, size_t count, int mode, int options, int threads, const char **out, size_t *outSize);
+
+//! Modules of a LIB archive, "module\tsymbol\tsymbol...\n" for each one
+MDASM_API int mdasm_lib_index(const uint8_t *lib, size_t size, const char **out, size_t *outSize);
+
+//! Object of the module of a LIB archive defining a symbol, or with that
+//! name; it points into lib (e.g. for mdasm_add_target())
+MDASM_API int mdasm_lib_module(const uint8_t *lib, size_t size, const char *name, const uint8_t **obj, size_t *objSize);
+
+//! Build the n-gram index of an executable (see ExeIndex.h) for mdasm_find(),
+//! with n-grams of gram words (0 = 8). The output is the index file.
+MDASM_API int mdasm_build_index(const uint8_t *file, size_t size, uint32_t base, int gram, const char **out, size_t *outSize);
+
+//! Find copies of the functions of an obj in an indexed executable (only the
+//! function set by mdasm_set_function(), if any). Each function is printed as
+//! "function name:" followed by "address\tsimilarity%\tmatched/words" lines,
+//! best first, at most limit of them (0 = all). index must be 8 byte aligned.
+MDASM_API int mdasm_find(const uint8_t *index, size_t indexSize, const uint8_t *obj, size_t size, int limit, const char **out, size_t *outSize);
+
+//! Disassemble and normalize an obj file in one call
+MDASM_API int mdasm_normalize(const uint8_t *obj, size_t size, int options, const MdasmLine **lines, size_t *count);
+
+//! Basic blocks of the normalized lines of an obj, "first\tlines\thash" for
+//! each one. Blocks end after the delay slot of branches and jumps and at
+//! branch targets; the hash is of their mnemonics. With MDASM_BLOCK_DIFF,
+//! targets of 256 lines or more are diffed with candidates by matching
+//! identical blocks first, and lines only between them: the same scores as
+//! a diff of the whole lines when the blocks line up, much faster on large
+//! functions.
+MDASM_API int mdasm_blocks(const uint8_t *obj, size_t size, const char **out, size_t *outSize);
+
+//! Load a scoring target, returns its id
+MDASM_API int mdasm_add_target(const uint8_t *obj, size_t size, int options);
+
+//! Normalize a scoring target once for all the processes scoring against it:
+//! the output is its index file (see TargetIndex.h), for mdasm_load_target()
+MDASM_API int mdasm_target_index(const uint8_t *obj, size_t size, int options, const char **out, size_t *outSize);
+
+//! Load a scoring target from its index file, mapped rather than read, returns
+//! its id. Fails when the file was made by another version, with other
+//! options or for another function than mdasm_set_function()'s.
+MDASM_API int mdasm_load_target(const char *path, int options);
+
+//! Keep the scores of a target in a cache file shared with other processes and
+//! later runs, by the code hash of the candidates: scoring an obj seen before
+//! only parses and hashes it. The file is replaced when it was made for
+//! another target, other normalization flags or another function.
+MDASM_API int mdasm_target_cache(int target, const char *path, size_t capacity);
+
+//! XXH64 of the code, relocations and section names of an obj (and of its
+//! definitions with mdasm_set_function()): equal for objs that score the same
+MDASM_API int mdasm_code_hash(const uint8_t *obj, size_t size, uint64_t *hash);
+
+//! Score a candidate obj against a target, hash receives 64 hex characters + '\0'
+MDASM_API int mdasm_score(int target, const uint8_t *obj, size_t size, long long *score, char *hash);
+
+//! Same, but candidates that can't score bound or better are not scored:
+//! returns 1 with the prefilter's lower bound as score and an empty hash
+MDASM_API int mdasm_score_bounded(int target, const uint8_t *obj, size_t size, long long bound, long long *score, char *hash);
+
+//! Compare the raw words of a candidate obj with a target's, without
+//! disassembling it. mdasm_score() does this first and skips scoring exact
+//! matches.
+MDASM_API int mdasm_prefilter(int target, const uint8_t *obj, size_t size, MdasmPrefilter *result);
+
+#endif // MDASM_H